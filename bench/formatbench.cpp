@@ -0,0 +1,98 @@
+/*
+  Packet log formatting benchmark. Compares looking up type mnemonics in
+  the compile-time tables with the hashed map copied per call they
+  replaced, and the one-line packet summary with the table dump of
+  operator<<.
+
+    make bench && ./bin/formatbench [packets]
+*/
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "dns.hpp"
+
+static std::vector<uint8_t> makeQuery(const std::string &name, uint16_t type, uint16_t id) {
+  std::vector<uint8_t> packet = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+  size_t               start  = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos)
+      end = name.size();
+    packet.push_back(end - start);
+    packet.insert(packet.end(), name.begin() + start, name.begin() + end);
+    start = end + 1;
+  }
+  packet.insert(packet.end(), {0, (uint8_t)(type >> 8), (uint8_t)type, 0, 1});
+  return packet;
+}
+
+/* The lookup the tables replaced: a map taken by value */
+static std::string copiedLookup(int value, std::unordered_map<int, std::string> values) {
+  auto it = values.find(value);
+  return it != values.end() ? it->second : "UNKNOWN";
+}
+
+template<typename Function>
+static double nanoseconds(size_t count, Function function) {
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    function(i);
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / count;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  static const uint16_t types[] = {T_A, T_AAAA, T_MX, T_TXT, T_NS, T_SOA, T_HTTPS, T_ANY, T_DLV, 65534};
+
+  std::unordered_map<int, std::string> map;
+  for (const auto &[value, name] : dns_type_vals) {
+    map.emplace(value, name);
+  }
+
+  size_t sink  = 0;
+  double table = nanoseconds(count, [&](size_t i) { sink += dns_type_vals.name(types[i % 10]).size(); });
+  double old   = nanoseconds(count / 100, [&](size_t i) { sink += copiedLookup(types[i % 10], map).size(); });
+  std::printf("type mnemonic: %.1f ns table, %.0f ns copied map\n", table, old);
+
+  std::vector<std::vector<uint8_t>> packets;
+  for (size_t i = 0; i < 1000; ++i) {
+    packets.push_back(makeQuery("host" + std::to_string(i) + ".example.com", types[i % 10], i));
+  }
+
+  Arena              arena;
+  std::ostringstream stream;
+  char               line[DNS_SUMMARY_SIZE];
+  size_t             length = 0;
+
+  double summary = nanoseconds(count, [&](size_t i) {
+    const auto &packet = packets[i % packets.size()];
+    DNS         dns(arena, packet.data(), packet.size());
+    length = dns.summarize(line, sizeof(line), htonl(0xC0000201), htons(53000 + i % 1000));
+    sink += length;
+    if (i % 32 == 31)
+      arena.reset();
+  });
+  arena.reset();
+  double dump = nanoseconds(count / 10, [&](size_t i) {
+    const auto &packet = packets[i % packets.size()];
+    DNS         dns(arena, packet.data(), packet.size());
+    stream.str("");
+    stream << dns << std::endl;
+    sink += stream.tellp();
+    if (i % 32 == 31)
+      arena.reset();
+  });
+  std::printf("packet log line: %.0f ns summary, %.0f ns table dump (parsing included)\n", summary, dump);
+  std::printf("e.g. %.*s\n", (int)length, line);
+  return sink > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+/*
+  Microbenchmark of the heavy hitter sketches. Feeds a Zipf distributed
+  stream of query names from random clients through one worker's sketches,
+  reports the cost per query and checks the top names against exact counts.
+
+    make bench && ./bin/hitterbench [names] [queries]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hitters.hpp"
+#include "name.hpp"
+
+int main(int argc, char **argv) {
+  size_t count   = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  size_t queries = argc > 2 ? std::atoi(argv[2]) : 20000000;
+
+  std::vector<std::string> names(count);
+  std::vector<uint64_t>    hashes(count);
+  for (size_t i = 0; i < count; ++i) {
+    names[i]  = "host" + std::to_string(i) + ".example.com";
+    hashes[i] = hashName(names[i]);
+  }
+
+  /* Zipf with exponent 1 by inverting the cumulative weights */
+  std::vector<double> cumulative(count);
+  double              total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    total += 1.0 / (i + 1);
+    cumulative[i] = total;
+  }
+
+  std::mt19937                           rng(42);
+  std::uniform_real_distribution<double> uniform(0, total);
+  std::uniform_int_distribution<int>     clients(0, 1 << 20);
+  std::vector<uint32_t>                  stream(queries), sources(queries);
+  for (size_t i = 0; i < queries; ++i) {
+    stream[i]  = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin();
+    sources[i] = clients(rng);
+  }
+
+  /* the server has the hash and the name of a query at hand, resolve them before timing */
+  std::vector<NameKey> keys(queries);
+  for (size_t i = 0; i < queries; ++i) {
+    keys[i] = {names[stream[i]], hashes[stream[i]]};
+  }
+
+  auto worker = std::make_unique<HitterWorker>();
+  auto begin  = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries; ++i) {
+    worker->add(keys[i].hash, keys[i].name, sources[i]);
+  }
+  auto   end = std::chrono::steady_clock::now();
+  double ns  = std::chrono::duration<double, std::nano>(end - begin).count() / queries;
+  std::printf("%zu queries over %zu names: %.1f ns/query (name and client sketch)\n", queries, count, ns);
+
+  std::unordered_map<uint32_t, uint32_t> exact;
+  for (uint32_t name : stream) {
+    exact[name]++;
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> truth(exact.begin(), exact.end());
+  std::sort(truth.begin(), truth.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+
+  std::vector<Hitter> top   = worker->names.top();
+  size_t              check = std::min<size_t>(10, top.size());
+  size_t              found = 0;
+  double              error = 0;
+  for (size_t i = 0; i < check; ++i) {
+    for (size_t k = 0; k < check; ++k) {
+      found += top[k].key == names[truth[i].first];
+    }
+    uint32_t real = exact[std::stoul(top[i].key.substr(4))];
+    error         = std::max(error, std::fabs((double)top[i].count - real) / real);
+  }
+  std::printf("top %zu recall %zu/%zu, largest overestimate %.2f%%\n", check, found, check, 100 * error);
+  return found == check ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,60 @@
+/*
+  Zone loading benchmark. Writes a zone of generated A, AAAA, MX and TXT
+  records to a temporary file and loads it with one thread and with one
+  thread per CPU.
+
+    make bench && ./bin/loadbench [records] [file]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "zoneloader.hpp"
+
+static void writeZone(const char *path, size_t records) {
+  FILE *file = std::fopen(path, "w");
+  if (file == nullptr) {
+    std::perror(path);
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::fprintf(file, "example.com 3600 IN SOA ns1.example.com hostmaster.example.com 1 7200 3600 1209600 300\n");
+  std::fprintf(file, "example.com 3600 IN NS ns1.example.com\n");
+  for (size_t i = 0; i < records; ++i) {
+    switch (i % 4) {
+      case 0:
+        std::fprintf(file, "host%zu.example.com 300 IN A 10.%zu.%zu.%zu\n", i / 4, i >> 16 & 255, i >> 8 & 255, i & 255);
+        break;
+      case 1:
+        std::fprintf(file, "host%zu.example.com 300 IN AAAA 2001:db8::%zx\n", i / 4, i & 0xFFFF);
+        break;
+      case 2:
+        std::fprintf(file, "host%zu.example.com 300 IN MX 10 mail%zu.example.com\n", i / 4, i % 16);
+        break;
+      default:
+        std::fprintf(file, "host%zu.example.com 300 IN TXT v=spf1-include:_spf.example.com ; generated\n", i / 4);
+        break;
+    }
+  }
+  std::fclose(file);
+}
+
+int main(int argc, char **argv) {
+  size_t      records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+  const char *path    = argc > 2 ? argv[2] : "/tmp/loadbench.zone";
+
+  writeZone(path, records);
+
+  for (size_t threads : {1u, std::thread::hardware_concurrency()}) {
+    auto start = std::chrono::steady_clock::now();
+    auto zone  = loadZoneFile(path, threads);
+    auto ms    = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%2zu threads: %zu names in %lld ms\n", threads, zone ? zone->size() : 0, (long long)ms);
+  }
+
+  std::remove(path);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/*
+  Microbenchmark of the wire-format name parser. Compares the scalar and the
+  vector implementations on a generated set of query names whose shape
+  follows what a public authoritative server sees: mostly two to four short
+  labels, a tail of long CDN and service-discovery style names.
+
+    make bench && ./bin/namebench [names] [rounds]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "name.hpp"
+
+static const char *tlds[]   = {"com", "net", "org", "nl", "de", "io", "co.uk", "ir"};
+static const char *prefix[] = {"www", "mail", "api", "cdn", "ns1", "_dmarc", "_sip._udp", "static"};
+
+static std::string randomLabel(std::mt19937 &rng, int minLength, int maxLength) {
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+  std::uniform_int_distribution<int> length(minLength, maxLength);
+  std::uniform_int_distribution<int> letter(0, sizeof(alphabet) - 2);
+
+  std::string label(length(rng), 'a');
+  for (auto &c : label) {
+    c = alphabet[letter(rng)];
+  }
+  return label;
+}
+
+static std::string randomName(std::mt19937 &rng) {
+  std::uniform_int_distribution<int> shape(0, 99);
+  std::uniform_int_distribution<int> pick(0, 7);
+
+  int         s    = shape(rng);
+  std::string name = randomLabel(rng, 3, 14) + "." + tlds[pick(rng)];
+  if (s < 55) {
+    name = std::string(prefix[pick(rng)]) + "." + name;
+  } else if (s < 85) {
+    name = randomLabel(rng, 2, 10) + "." + std::string(prefix[pick(rng)]) + "." + name;
+  } else if (s >= 95) {
+    /* long tail: hashed CDN hosts and deep service names */
+    name = randomLabel(rng, 20, 40) + "." + randomLabel(rng, 8, 30) + "." + randomLabel(rng, 4, 12) + "." + name;
+  }
+  return name;
+}
+
+static void appendWire(std::vector<uint8_t> &out, const std::string &name) {
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos)
+      end = name.size();
+    out.push_back(end - start);
+    out.insert(out.end(), name.begin() + start, name.begin() + end);
+    start = end + 1;
+  }
+  out.push_back(0);
+}
+
+int main(int argc, char **argv) {
+  size_t count  = argc > 1 ? std::atoi(argv[1]) : 100000;
+  int    rounds = argc > 2 ? std::atoi(argv[2]) : 50;
+
+  std::mt19937         rng(42);
+  std::vector<uint8_t> wire;
+  std::vector<size_t>  offsets;
+  size_t               totalLength = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    std::string name = randomName(rng);
+    offsets.push_back(wire.size());
+    appendWire(wire, name);
+    totalLength += name.size();
+  }
+
+  std::printf("%zu names, mean length %.1f bytes, %d rounds\n", count, (double)totalLength / count, rounds);
+
+  uint64_t reference = 0;
+  for (NameParser parser : {NameParser::SCALAR, NameParser::SSE2, NameParser::AVX2}) {
+    if (!setNameParser(parser)) {
+      std::printf("%-8s unsupported on this CPU\n", nameParserName(parser));
+      continue;
+    }
+
+    char       text[NAME_BUFFER_SIZE];
+    char       key[NAME_BUFFER_SIZE];
+    ParsedName parsed;
+    uint64_t   checksum = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+      for (size_t offset : offsets) {
+        if (!parseWireName(wire.data(), wire.size(), offset, text, key, parsed)) {
+          std::fprintf(stderr, "%s: parse failed\n", nameParserName(parser));
+          return EXIT_FAILURE;
+        }
+        checksum += parsed.hash;
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (reference == 0) {
+      reference = checksum;
+    } else if (checksum != reference) {
+      std::fprintf(stderr, "%s: hash mismatch against scalar\n", nameParserName(parser));
+      return EXIT_FAILURE;
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / ((double)count * rounds);
+    std::printf("%-8s %7.2f ns/name %8.1f MB/s\n", nameParserName(parser), ns, totalLength / (ns * count) * 1e3);
+  }
+
+  return EXIT_SUCCESS;
+}
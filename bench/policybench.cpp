@@ -0,0 +1,126 @@
+/*
+  Microbenchmark of the blocklist name set. Compiles a generated list the
+  size of the large public ones, checks every lookup against a hash set
+  walking the same ancestors and reports the image size per name and the
+  lookup cost for a mix of blocked names, names below them and clean ones.
+
+    make bench && ./bin/policybench [names] [queries]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "policy.hpp"
+
+static const char *tlds[] = {"com", "net", "org", "nl", "de", "io", "co.uk", "ir"};
+
+static std::string randomLabel(std::mt19937 &rng, int minLength, int maxLength) {
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+  std::uniform_int_distribution<int> length(minLength, maxLength);
+  std::uniform_int_distribution<int> letter(0, sizeof(alphabet) - 2);
+
+  std::string label(length(rng), 'a');
+  for (auto &c : label) {
+    c = alphabet[letter(rng)];
+  }
+  return label;
+}
+
+/* ad and tracker hosts: a few labels under a registered domain */
+static std::string randomName(std::mt19937 &rng) {
+  std::uniform_int_distribution<int> shape(0, 99);
+  std::uniform_int_distribution<int> pick(0, 7);
+
+  int         s    = shape(rng);
+  std::string name = randomLabel(rng, 4, 16) + "." + tlds[pick(rng)];
+  if (s < 60)
+    name = randomLabel(rng, 2, 12) + "." + name;
+  if (s < 20)
+    name = randomLabel(rng, 2, 12) + "." + name;
+  return name;
+}
+
+static bool reference(const std::unordered_map<std::string, uint8_t> &names, std::string name) {
+  for (bool self = true;; self = false) {
+    auto found = names.find(name);
+    if (found != names.end() && (found->second & (self ? POLICY_SELF : POLICY_BELOW)))
+      return true;
+    size_t dot = name.find('.');
+    if (dot == std::string::npos)
+      return false;
+    name = name.substr(dot + 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t count   = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  size_t queries = argc > 2 ? std::atoi(argv[2]) : 2000000;
+
+  std::mt19937                                 rng(42);
+  std::uniform_int_distribution<int>           percent(0, 99);
+  std::vector<std::pair<std::string, uint8_t>> entries;
+  std::unordered_map<std::string, uint8_t>     names;
+  size_t                                       textSize = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    std::string name  = randomName(rng);
+    uint8_t     flags = percent(rng) < 10 ? POLICY_BELOW : POLICY_SELF | POLICY_BELOW;
+    textSize += name.size() + (flags == POLICY_BELOW ? 3 : 1);
+    names[name] |= flags;
+    entries.emplace_back(name, flags);
+  }
+
+  std::vector<std::string> mix;
+  std::vector<std::string> blocked;
+  for (const auto &[name, flags] : entries) {
+    blocked.push_back(name);
+  }
+  std::uniform_int_distribution<size_t> any(0, blocked.size() - 1);
+  for (size_t i = 0; i < queries; ++i) {
+    int s = percent(rng);
+    if (s < 10)
+      mix.push_back(blocked[any(rng)]);
+    else if (s < 20)
+      mix.push_back(randomLabel(rng, 1, 8) + "." + blocked[any(rng)]);
+    else
+      mix.push_back(randomName(rng));
+  }
+
+  auto                 begin = std::chrono::steady_clock::now();
+  std::vector<uint8_t> image = NameSet::compile(std::move(entries));
+  auto                 end   = std::chrono::steady_clock::now();
+
+  NameSet set;
+  if (!set.open(image.data(), image.size())) {
+    std::fprintf(stderr, "compiled image does not open\n");
+    return EXIT_FAILURE;
+  }
+  std::printf(
+      "%zu names (%zu distinct) compiled in %.0f ms: %zu kB image, %.1f bytes/name, list text %.1f bytes/name\n", count, set.size(),
+      std::chrono::duration<double, std::milli>(end - begin).count(), image.size() >> 10, (double)image.size() / set.size(),
+      (double)textSize / count
+  );
+
+  size_t hits = 0;
+  for (const auto &name : mix) {
+    if (set.contains(name) != reference(names, name)) {
+      std::fprintf(stderr, "%s: answer differs from the reference\n", name.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+
+  begin = std::chrono::steady_clock::now();
+  for (const auto &name : mix) {
+    hits += set.contains(name);
+  }
+  end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - begin).count() / queries;
+  std::printf("%zu lookups, %zu blocked: %.1f ns/lookup, %.2f M lookups/s\n", queries, hits, ns, 1e3 / ns);
+  return EXIT_SUCCESS;
+}
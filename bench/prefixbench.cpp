@@ -0,0 +1,136 @@
+/*
+  Microbenchmark of the view prefix matcher. Compiles tens of thousands of
+  IPv4 prefixes with the length mix of a routing table plus a few thousand
+  IPv6 ones, checks lookups against a map probed at every prefix
+  length and reports the lookup cost for random client addresses.
+
+    make bench && ./bin/prefixbench [prefixes] [lookups]
+*/
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "prefix.hpp"
+
+static std::vector<uint8_t> masked(const uint8_t *address, int bytes, int length) {
+  std::vector<uint8_t> out(address, address + bytes);
+  for (int i = 0; i < bytes; ++i) {
+    int kept = std::min(std::max(length - i * 8, 0), 8);
+    out[i] &= (uint8_t)(0xff00 >> kept);
+  }
+  out.push_back(length);
+  return out;
+}
+
+static uint16_t reference(const std::map<std::vector<uint8_t>, uint16_t> &prefixes, const uint8_t *address, int bytes) {
+  for (int length = bytes * 8; length >= 0; --length) {
+    auto found = prefixes.find(masked(address, bytes, length));
+    if (found != prefixes.end())
+      return found->second;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t count   = argc > 1 ? std::atoi(argv[1]) : 50000;
+  size_t lookups = argc > 2 ? std::atoi(argv[2]) : 10000000;
+
+  std::mt19937                             rng(42);
+  std::uniform_int_distribution<int>       percent(0, 99);
+  std::uniform_int_distribution<uint32_t>  any;
+  std::uniform_int_distribution<int>       views(1, 64);
+  std::map<std::vector<uint8_t>, uint16_t> prefixes4, prefixes6;
+  std::vector<uint32_t>                    starts4;
+  PrefixMatcher                            matcher;
+
+  for (size_t i = 0; i < count; ++i) {
+    int s      = percent(rng);
+    int length = s < 60 ? 24 : s < 80 ? 16 + s % 8 : s < 95 ? 8 + s % 8 : 25 + s % 8;
+
+    uint32_t address = htonl(any(rng));
+    uint16_t value   = views(rng);
+    char     text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address, text, sizeof(text));
+    matcher.add(std::string(text) + "/" + std::to_string(length), value);
+    prefixes4[masked((const uint8_t *)&address, 4, length)] = value;
+    starts4.push_back(address);
+  }
+
+  std::vector<struct in6_addr> starts6;
+  for (size_t i = 0; i < count / 10; ++i) {
+    struct in6_addr address;
+    for (int k = 0; k < 4; ++k) {
+      uint32_t word = any(rng);
+      std::memcpy(address.s6_addr + 4 * k, &word, 4);
+    }
+    address.s6_addr[0] = 0x20;
+    int      length    = 32 + percent(rng) % 33;
+    uint16_t value     = views(rng);
+    char     text[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &address, text, sizeof(text));
+    matcher.add(std::string(text) + "/" + std::to_string(length), value);
+    prefixes6[masked(address.s6_addr, 16, length)] = value;
+    starts6.push_back(address);
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  if (!matcher.compile()) {
+    std::fprintf(stderr, "too many long prefixes\n");
+    return EXIT_FAILURE;
+  }
+  auto end = std::chrono::steady_clock::now();
+  std::printf(
+      "%zu IPv4 and %zu IPv6 prefixes compiled in %.0f ms\n", count, count / 10, std::chrono::duration<double, std::milli>(end - begin).count()
+  );
+
+  /* half the clients inside a listed prefix, half anywhere */
+  std::vector<uint32_t> clients4(lookups);
+  for (auto &client : clients4) {
+    client = percent(rng) < 50 ? htonl(ntohl(starts4[any(rng) % starts4.size()]) ^ (any(rng) & 0xff)) : htonl(any(rng));
+  }
+  std::vector<struct in6_addr> clients6(lookups / 10);
+  for (auto &client : clients6) {
+    client = starts6[any(rng) % starts6.size()];
+    client.s6_addr[15] ^= any(rng);
+    if (percent(rng) < 50)
+      client.s6_addr[3] ^= any(rng);
+  }
+
+  for (size_t i = 0; i < 100000 && i < lookups; ++i) {
+    if (matcher.lookup(clients4[i]) != reference(prefixes4, (const uint8_t *)&clients4[i], 4)) {
+      std::fprintf(stderr, "IPv4 lookup %zu differs from the reference\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  for (size_t i = 0; i < 10000 && i < clients6.size(); ++i) {
+    if (matcher.lookup(clients6[i]) != reference(prefixes6, clients6[i].s6_addr, 16)) {
+      std::fprintf(stderr, "IPv6 lookup %zu differs from the reference\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t checksum = 0;
+  begin             = std::chrono::steady_clock::now();
+  for (uint32_t client : clients4) {
+    checksum += matcher.lookup(client);
+  }
+  end       = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - begin).count() / clients4.size();
+  std::printf("IPv4 %6.1f ns/lookup\n", ns);
+
+  begin = std::chrono::steady_clock::now();
+  for (const auto &client : clients6) {
+    checksum += matcher.lookup(client);
+  }
+  end = std::chrono::steady_clock::now();
+  ns  = std::chrono::duration<double, std::nano>(end - begin).count() / clients6.size();
+  std::printf("IPv6 %6.1f ns/lookup (checksum %llu)\n", ns, (unsigned long long)checksum);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+/*
+  Synthesized records benchmark. Indexes one $GENERATE line per /24 of
+  10.0.0.0/12, the way a zone file lists host-10-1-2-$ names a block at a
+  time, and a $SYNTHESIZE line for all of 10.0.0.0/8, then times
+  RangeIndex::lookup() for a generated name, a synthesized forward name, a
+  PTR under in-addr.arpa and a name nothing covers.
+
+    make bench && ./bin/rangebench [lookups]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "dns.hpp"
+#include "synth.hpp"
+
+template<typename Function>
+static double nanoseconds(size_t count, Function function) {
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    function(i);
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / count;
+}
+
+static RangeOwner owner(const std::string &prefix, const std::string &parent) {
+  return RangeOwner{parent, prefix, ""};
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  std::vector<GeneratedRange> generated;
+  std::string                 error;
+  for (int block = 0; block < 4096; ++block) {
+    std::string   address = "10." + std::to_string(block >> 8) + "." + std::to_string(block & 255) + ".$";
+    RangeTemplate rdata;
+    RangeTemplate::parse(address, rdata, error);
+
+    std::string prefix = "gen-10-" + std::to_string(block >> 8) + "-" + std::to_string(block & 255) + "-";
+    generated.push_back(GeneratedRange{owner(prefix, "example.net"), {0, 0, 'd'}, 0, 255, 1, T_A, C_IN, 300, {rdata}});
+  }
+
+  std::vector<SynthesizedNetwork> networks(1);
+  networks[0].owner = owner("host-", "example.net");
+  networks[0].v4    = true;
+  networks[0].ttl   = 300;
+  uint8_t first[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 0, 0, 0};
+  uint8_t last[16]  = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 255, 255, 255};
+  std::copy(first, first + 16, networks[0].first);
+  std::copy(last, last + 16, networks[0].last);
+
+  auto index = RangeIndex::build(std::move(generated), std::move(networks));
+
+  Arena                       arena;
+  std::pmr::vector<DNSAnswer> answers(&arena);
+  size_t                      sink = 0;
+  auto                        time = [&](const char *label, const std::vector<std::string> &names, uint16_t type) {
+    std::vector<DNSQuery> queries;
+    for (const auto &name : names) {
+      queries.push_back(DNSQuery{name, name, hashName(name), type, C_IN});
+    }
+    double ns = nanoseconds(count, [&](size_t i) {
+      answers.clear();
+      sink += index->lookup(queries[i % queries.size()], arena, answers) + answers.size();
+      if (i % 64 == 63)
+        arena.reset();
+    });
+    std::printf("%-10s %6.0f ns\n", label, ns);
+  };
+
+  std::vector<std::string> generatedNames, forwardNames, reverseNames, missingNames;
+  for (int i = 0; i < 1024; ++i) {
+    int a = i % 16, b = i * 7 % 256, c = i * 13 % 256;
+    generatedNames.push_back("gen-10-" + std::to_string(a) + "-" + std::to_string(b) + "-" + std::to_string(c) + ".example.net");
+    forwardNames.push_back("host-10-" + std::to_string(a) + "-" + std::to_string(b) + "-" + std::to_string(c) + ".example.net");
+    reverseNames.push_back(std::to_string(c) + "." + std::to_string(b) + "." + std::to_string(a) + ".10.in-addr.arpa");
+    missingNames.push_back("www-" + std::to_string(i) + ".example.net");
+  }
+
+  std::printf("4096 $GENERATE lines and a /8 $SYNTHESIZE, %zu lookups each:\n", count);
+  time("generated", generatedNames, T_A);
+  time("forward", forwardNames, T_A);
+  time("reverse", reverseNames, T_PTR);
+  time("missing", missingNames, T_A);
+  return sink > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
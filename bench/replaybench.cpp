@@ -0,0 +1,444 @@
+/*
+  Offline replay of a packet capture. Reads the UDP DNS queries of a pcap
+  file and answers them with the query processing of the UDP server on
+  several threads, without sockets, to measure the cost of the engine
+  alone: queries per second over all passes and the latency of single
+  queries. With -d the answers are compared with the responses in the
+  capture, ignoring record order, name compression and EDNS options, and
+  the differences are printed.
+
+    make bench && ./bin/replaybench -r capture.pcap [-f db.conf] [-j threads] [-n passes] [-d]
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "argparser.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "udpserver.hpp"
+
+#define REPLAY_BATCH 32 // queries between pinQueryState() and arena resets, as the UDP server
+#define REPLAY_DIFFS 10 // differences printed in full
+
+/* A datagram of the capture, its bytes at `offset` of Capture::bytes */
+struct Datagram {
+  size_t   offset;
+  uint16_t length;
+  uint32_t address;  /* client, network byte order */
+  uint16_t port;     /* client, host byte order */
+  int64_t  response; /* index of the captured response, -1 for none */
+};
+
+struct Capture {
+  std::vector<uint8_t>  bytes;
+  std::vector<Datagram> queries;
+  std::vector<Datagram> responses;
+  size_t                packets = 0;
+  size_t                skipped = 0; /* not IPv4 UDP to or from the DNS port, fragments, updates */
+};
+
+static uint16_t read16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t read32(const uint8_t *p) {
+  return ((uint32_t)read16(p) << 16) | read16(p + 2);
+}
+
+/* Field of a pcap header, written in the byte order of the capturing host */
+static uint32_t pcap32(const uint8_t *p, bool swapped) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return swapped ? __builtin_bswap32(value) : value;
+}
+
+/* Offset of the IPv4 header in a frame of `linktype`, -1 when it carries something else */
+static long networkOffset(const uint8_t *frame, size_t size, uint32_t linktype) {
+  switch (linktype) {
+    case 0: /* BSD loopback, address family in host byte order */
+      return size >= 4 && (frame[0] == 2 || frame[3] == 2) ? 4 : -1;
+    case 108: /* OpenBSD loopback, in network byte order */
+      return size >= 4 && frame[3] == 2 ? 4 : -1;
+    case 1: { /* Ethernet, possibly with VLAN tags */
+      size_t offset = 12;
+      while (offset + 2 <= size && (read16(frame + offset) == 0x8100 || read16(frame + offset) == 0x88a8)) {
+        offset += 4;
+      }
+      return offset + 2 <= size && read16(frame + offset) == 0x0800 ? offset + 2 : -1;
+    }
+    case 113: /* Linux cooked capture */
+      return size >= 16 && read16(frame + 14) == 0x0800 ? 16 : -1;
+    case 276: /* Linux cooked capture v2 */
+      return size >= 20 && read16(frame) == 0x0800 ? 20 : -1;
+    case 12:
+    case 14:
+    case 101:
+    case 228: /* raw IP */
+      return size >= 1 && frame[0] >> 4 == 4 ? 0 : -1;
+    default:
+      return -1;
+  }
+}
+
+static void addPacket(Capture &capture, std::unordered_map<uint64_t, size_t> &pending, const uint8_t *frame, size_t size, uint32_t linktype, uint16_t dnsPort) {
+  capture.packets++;
+
+  long offset = networkOffset(frame, size, linktype);
+  if (offset < 0 || size < (size_t)offset + 20) {
+    capture.skipped++;
+    return;
+  }
+  const uint8_t *ip     = frame + offset;
+  size_t         header = (ip[0] & 0x0F) * 4;
+  size_t         total  = std::min<size_t>(read16(ip + 2), size - offset);
+  /* fragments are rare for queries and need reassembly */
+  if (ip[9] != 17 || (read16(ip + 6) & 0x3FFF) != 0 || total < header + 8 + sizeof(DNSHeader)) {
+    capture.skipped++;
+    return;
+  }
+
+  const uint8_t *udp        = ip + header;
+  uint16_t       source     = read16(udp);
+  uint16_t       target     = read16(udp + 2);
+  const uint8_t *dns        = udp + 8;
+  size_t         length     = std::min<size_t>(std::max<size_t>(read16(udp + 4), 8), total - header) - 8;
+  if (length < sizeof(DNSHeader)) {
+    capture.skipped++;
+    return;
+  }
+  bool    isResponse = dns[2] & 0x80;
+  uint8_t opcode     = (dns[2] >> 3) & 0x0F;
+
+  Datagram datagram = {capture.bytes.size(), (uint16_t)length, 0, 0, -1};
+  if (!isResponse && target == dnsPort && opcode == OPCODE_QUERY) {
+    std::memcpy(&datagram.address, ip + 12, 4);
+    datagram.port = source;
+  } else if (isResponse && source == dnsPort) {
+    std::memcpy(&datagram.address, ip + 16, 4);
+    datagram.port = target;
+  } else {
+    capture.skipped++;
+    return;
+  }
+  capture.bytes.insert(capture.bytes.end(), dns, dns + length);
+
+  uint64_t key = ((uint64_t)datagram.address << 32) | ((uint64_t)datagram.port << 16) | read16(dns);
+  if (!isResponse) {
+    pending[key] = capture.queries.size();
+    capture.queries.push_back(datagram);
+    return;
+  }
+  auto query = pending.find(key);
+  if (query != pending.end()) {
+    capture.queries[query->second].response = capture.responses.size();
+    pending.erase(query);
+  }
+  capture.responses.push_back(datagram);
+}
+
+static bool readCapture(const char *path, uint16_t dnsPort, Capture &capture) {
+  FILE *file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    std::perror(path);
+    return false;
+  }
+
+  uint8_t header[24];
+  if (std::fread(header, 1, sizeof(header), file) != sizeof(header)) {
+    std::fprintf(stderr, "%s: not a pcap file\n", path);
+    std::fclose(file);
+    return false;
+  }
+
+  uint32_t magic   = pcap32(header, false);
+  bool     swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+  if (!swapped && magic != 0xA1B2C3D4 && magic != 0xA1B23C4D) {
+    std::fprintf(stderr, "%s: not a pcap file%s\n", path, magic == 0x0A0D0D0A ? ", convert pcapng with editcap -F pcap" : "");
+    std::fclose(file);
+    return false;
+  }
+  uint32_t linktype = pcap32(header + 20, swapped) & 0x0FFFFFFF;
+
+  std::unordered_map<uint64_t, size_t> pending;
+  std::vector<uint8_t>                 frame(65536);
+  uint8_t                              record[16];
+  while (std::fread(record, 1, sizeof(record), file) == sizeof(record)) {
+    uint32_t captured = pcap32(record + 8, swapped);
+    if (captured > frame.size())
+      frame.resize(captured);
+    if (std::fread(frame.data(), 1, captured, file) != captured)
+      break;
+    addPacket(capture, pending, frame.data(), captured, linktype, dnsPort);
+  }
+
+  std::fclose(file);
+  return true;
+}
+
+/* Answer the queries of `first` to `last` once, timing each query when `latencies` is given */
+static void replay(const Capture &capture, size_t first, size_t last, std::vector<uint32_t> *latencies) {
+  Arena         arena;
+  NotifyHandler notify;
+  uint8_t       reply[EDNS_PAYLOAD_SIZE];
+  uint64_t      ticket;
+
+  for (size_t i = first; i < last; ++i) {
+    if ((i - first) % REPLAY_BATCH == 0) {
+      arena.reset();
+      pinQueryState();
+    }
+
+    const Datagram &query = capture.queries[i];
+    const uint8_t  *data  = capture.bytes.data() + query.offset;
+    auto            begin = std::chrono::steady_clock::now();
+
+    DNS  packet(arena);
+    bool shed = false;
+    if (packet.parseDNS(data, query.length))
+      answerDatagram(packet, data, query.length, query.address, reply, shed, notify, ticket);
+
+    if (latencies)
+      latencies->push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+  }
+}
+
+/* Lowercased presentation form of the possibly compressed name at `offset`, which is moved past it */
+static bool readName(const uint8_t *message, size_t size, size_t &offset, std::string &name) {
+  size_t position = offset;
+  bool   jumped   = false;
+  for (int hops = 0; hops < 64; ++hops) {
+    if (position >= size)
+      return false;
+    uint8_t length = message[position];
+    if ((length & 0xC0) == 0xC0) {
+      if (position + 1 >= size)
+        return false;
+      if (!jumped)
+        offset = position + 2;
+      jumped   = true;
+      position = ((length & 0x3F) << 8) | message[position + 1];
+      continue;
+    }
+    if (length == 0) {
+      if (!jumped)
+        offset = position + 1;
+      if (name.empty())
+        name = ".";
+      return true;
+    }
+    if (position + 1 + length > size)
+      return false;
+    for (size_t k = 0; k < length; ++k) {
+      name += (char)std::tolower(message[position + 1 + k]);
+    }
+    name += '.';
+    position += 1 + length;
+  }
+  return false;
+}
+
+static void appendHex(std::string &out, const uint8_t *data, size_t size) {
+  char digits[3];
+  for (size_t i = 0; i < size; ++i) {
+    std::snprintf(digits, sizeof(digits), "%02x", data[i]);
+    out += digits;
+  }
+}
+
+/* RDATA with the names expanded; types whose RDATA may hold compressed names per RFC 3597 */
+static bool readRdata(const uint8_t *message, size_t size, size_t offset, size_t length, uint16_t type, std::string &out) {
+  size_t end   = offset + length;
+  size_t fixed = 0;
+  int    names = 0;
+  switch (type) {
+    case T_NS:
+    case T_CNAME:
+    case T_PTR:
+      names = 1;
+      break;
+    case T_MX:
+      fixed = 2;
+      names = 1;
+      break;
+    case T_SOA:
+      names = 2;
+      break;
+    default:
+      appendHex(out, message + offset, length);
+      return true;
+  }
+
+  appendHex(out, message + offset, fixed);
+  offset += fixed;
+  for (int i = 0; i < names; ++i) {
+    out += ' ';
+    if (!readName(message, size, offset, out))
+      return false;
+  }
+  out += ' ';
+  appendHex(out, message + offset, end - std::min(offset, end));
+  return true;
+}
+
+/*
+  Comparable form of a response: RCODE, AA and TC, then the records of
+  each section sorted, without the OPT record. Empty when malformed.
+*/
+static std::string normalize(const uint8_t *message, size_t size) {
+  if (size < sizeof(DNSHeader))
+    return "";
+
+  char flags[64];
+  std::snprintf(flags, sizeof(flags), "rcode %d aa %d tc %d\n", message[3] & 0x0F, (message[2] >> 2) & 1, (message[2] >> 1) & 1);
+  std::string out = flags;
+
+  size_t offset = sizeof(DNSHeader);
+  for (int i = 0; i < read16(message + 4); ++i) {
+    std::string name;
+    if (!readName(message, size, offset, name) || offset + 4 > size)
+      return "";
+    offset += 4;
+  }
+
+  static const char *sections[] = {"answer", "authority", "additional"};
+  for (int section = 0; section < 3; ++section) {
+    std::vector<std::string> records;
+    for (int i = 0; i < read16(message + 6 + 2 * section); ++i) {
+      std::string record = std::string(sections[section]) + " ";
+      if (!readName(message, size, offset, record) || offset + 10 > size)
+        return "";
+      uint16_t type   = read16(message + offset);
+      uint16_t length = read16(message + offset + 8);
+      if (offset + 10 + length > size)
+        return "";
+      record += " " + std::to_string(read32(message + offset + 4)) + " " + std::to_string(read16(message + offset + 2)) + " " + std::to_string(type) + " ";
+      if (!readRdata(message, size, offset + 10, length, type, record))
+        return "";
+      offset += 10 + length;
+      if (type != T_OPT)
+        records.push_back(record);
+    }
+    std::sort(records.begin(), records.end());
+    for (const auto &record : records) {
+      out += record + "\n";
+    }
+  }
+  return out;
+}
+
+static void diff(const Capture &capture) {
+  Arena         arena;
+  NotifyHandler notify;
+  uint8_t       reply[EDNS_PAYLOAD_SIZE];
+  uint64_t      ticket;
+  size_t        compared = 0, differing = 0;
+
+  pinQueryState();
+  for (const auto &query : capture.queries) {
+    if (query.response < 0)
+      continue;
+    const uint8_t  *data     = capture.bytes.data() + query.offset;
+    const Datagram &response = capture.responses[query.response];
+
+    DNS    packet(arena);
+    bool   shed   = false;
+    size_t length = packet.parseDNS(data, query.length) ? answerDatagram(packet, data, query.length, query.address, reply, shed, notify, ticket) : 0;
+    arena.reset();
+
+    std::string expected = normalize(capture.bytes.data() + response.offset, response.length);
+    std::string actual   = normalize(reply, length);
+    compared++;
+    if (expected == actual)
+      continue;
+
+    if (++differing <= REPLAY_DIFFS) {
+      std::string question;
+      size_t      offset = sizeof(DNSHeader);
+      readName(data, query.length, offset, question);
+      std::printf("--- %s type %d, captured:\n%s+++ replayed:\n%s", question.c_str(), offset + 2 <= query.length ? read16(data + offset) : 0, expected.c_str(),
+                  actual.c_str());
+    }
+  }
+  std::printf("%zu of %zu answers differ from the capture (%zu queries without a captured response)\n", differing, compared,
+              capture.queries.size() - compared);
+}
+
+int main(int argc, char **argv) {
+  ArgParser parser("replaybench", "Replay the DNS queries of a pcap file without sockets.");
+  parser.add_option<std::string>("r", "read", "pcap file to replay", "");
+  parser.add_option<std::string>("f", "file", "Dns records file name", "db.conf");
+  parser.add_option<int>("j", "threads", "Threads answering queries", std::thread::hardware_concurrency());
+  parser.add_option<int>("n", "passes", "Times every query is answered", 5);
+  parser.add_option<int>("p", "port", "DNS port in the capture", 53);
+  parser.add_option<bool>("d", "diff", "Compare the answers with the responses in the capture", false);
+  parser.add_option<bool>("h", "help", "Show help message", false);
+
+  std::string pcap, dbFile;
+  int         threads, passes, port;
+  bool        compare;
+  try {
+    parser.parse(argc, argv);
+    pcap    = parser.get_value<std::string>("r");
+    dbFile  = parser.get_value<std::string>("f");
+    threads = std::max(1, parser.get_value<int>("j"));
+    passes  = std::max(1, parser.get_value<int>("n"));
+    port    = parser.get_value<int>("p");
+    compare = parser.get_value<bool>("d");
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  if (parser.get_value<bool>("h") || pcap.empty()) {
+    parser.print_help();
+    return pcap.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  Capture capture;
+  if (!readCapture(pcap.c_str(), port, capture))
+    return EXIT_FAILURE;
+  std::printf("%zu packets: %zu queries, %zu responses, %zu skipped\n", capture.packets, capture.queries.size(), capture.responses.size(), capture.skipped);
+  if (capture.queries.empty())
+    return EXIT_FAILURE;
+
+  DB::getInstance(dbFile);
+
+  /* throughput, each thread answering its share of the capture */
+  size_t                   count = capture.queries.size();
+  std::vector<std::thread> workers;
+  auto                     begin = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      for (int pass = 0; pass < passes; ++pass) {
+        replay(capture, count * t / threads, count * (t + 1) / threads, nullptr);
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  std::printf("%d threads, %d passes: %.0f queries/s\n", threads, passes, count * passes / seconds);
+
+  /* latency of single queries, one thread so they do not compete */
+  std::vector<uint32_t> latencies;
+  latencies.reserve(count);
+  replay(capture, 0, count, &latencies);
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) { return latencies[std::min(count - 1, (size_t)(p * count))]; };
+  std::printf("latency: p50 %u ns, p90 %u ns, p99 %u ns, p99.9 %u ns, max %u ns\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+              latencies.back());
+
+  if (compare)
+    diff(capture);
+  return EXIT_SUCCESS;
+}
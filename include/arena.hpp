@@ -0,0 +1,46 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <cstddef>
+#include <memory_resource>
+
+#define ARENA_BLOCK_SIZE (64 * 1024) // 64 kB
+
+/*
+  Bump allocator owned by one worker. Everything a request needs is carved
+  out of it and released at once with reset(), blocks are kept for the next
+  packet so steady-state request handling never reaches the global
+  allocator. Usable as a memory resource for std::pmr containers.
+*/
+class Arena: public std::pmr::memory_resource {
+public:
+  explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+  ~Arena();
+
+  Arena(const Arena &)            = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void reset();
+
+  size_t capacity() const;
+
+private:
+  struct Block {
+    Block *next;
+    size_t size;
+  };
+
+  size_t blockSize;
+  Block *head;
+  Block *current;
+  char  *cursor;
+  char  *end;
+
+  Block *grow(size_t bytes, size_t alignment);
+
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  void  do_deallocate(void *ptr, size_t bytes, size_t alignment) override;
+  bool  do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+};
+
+#endif /* __ARENA_HPP__ */
@@ -0,0 +1,32 @@
+#ifndef __BUFFERPOOL_HPP__
+#define __BUFFERPOOL_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+  Fixed-size packet buffers carved out of a single allocation made up front.
+  Owned by one worker, acquire() and release() never allocate.
+*/
+class BufferPool {
+public:
+  BufferPool(size_t count, size_t bufferSize);
+
+  BufferPool(const BufferPool &)            = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  /* nullptr once every buffer is in use */
+  uint8_t *acquire();
+  void     release(uint8_t *buffer);
+
+  size_t bufferSize() const;
+  size_t available() const;
+
+private:
+  size_t                size;
+  std::vector<uint8_t>  storage;
+  std::vector<uint8_t *> freeList;
+};
+
+#endif /* __BUFFERPOOL_HPP__ */
@@ -0,0 +1,57 @@
+#ifndef __COOKIE_HPP__
+#define __COOKIE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define COOKIE_CLIENT_SIZE 8    // client cookie bytes (RFC 7873)
+#define COOKIE_SERVER_SIZE 16   // server cookies we issue (RFC 9018)
+#define COOKIE_SERVER_MAX  32   // longest server cookie a client may send
+#define COOKIE_VERSION     1
+#define COOKIE_LIFETIME    3600 // seconds a server cookie is accepted
+#define COOKIE_SKEW        300  // seconds its timestamp may lie in the future
+#define COOKIE_REFRESH     1800 // older ones are replaced in replies
+#define COOKIE_ROTATE      3600 // seconds each derived secret signs new cookies
+
+/* SipHash-2-4 of `length` bytes under the 128 bit `key` */
+uint64_t siphash24(const uint8_t *key, const uint8_t *data, size_t length);
+
+/*
+  Stateless DNS Cookies in the interoperable format of RFC 9018: version,
+  reserved bytes, a timestamp and SipHash-2-4 over the client cookie, those
+  fields and the client address. A valid server cookie proves the client
+  received an earlier reply at its address, so the address is not spoofed.
+
+  Each COOKIE_ROTATE period signs with a secret of its own, derived from
+  the master secret and the period number. A cookie is checked with the
+  secret of the period its timestamp falls into, so rotation needs no
+  coordination and servers sharing the master secret accept each other's
+  cookies. Derived secrets are cached per thread, a check is one SipHash.
+*/
+class Cookies {
+public:
+  static Cookies &getInstance();
+
+  /* Use the hex encoded master secret in `path`, written there with a random one if the file does not exist */
+  bool loadSecret(const std::string &path);
+
+  /* Write the server cookie for `clientCookie` from `address` (network byte order) at `now` to `serverCookie` */
+  void generate(const uint8_t *clientCookie, uint32_t address, uint32_t now, uint8_t *serverCookie) const;
+
+  /* Whether `serverCookie` of `length` bytes was issued for `clientCookie` from `address` and is still valid at `now` */
+  bool verify(const uint8_t *clientCookie, const uint8_t *serverCookie, size_t length, uint32_t address, uint32_t now) const;
+
+private:
+  uint8_t  master[16];
+  uint32_t generation; /* bumped with the master secret, invalidates the cached secrets */
+
+  Cookies();
+  Cookies(const Cookies &)            = delete;
+  Cookies &operator=(const Cookies &) = delete;
+
+  const uint8_t *secret(uint32_t period) const;
+  uint64_t       hash(const uint8_t *clientCookie, const uint8_t *serverCookie, uint32_t address, const uint8_t *key) const;
+};
+
+#endif /* __COOKIE_HPP__ */
@@ -1,30 +1,237 @@
 #ifndef __DB_HPP__
 #define __DB_HPP__
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
-#include <map>
-#include <optional>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "name.hpp"
+
+#define JOURNAL_MAX_RECORDS 100000 // changed records kept for IXFR
+#define MIN_ZONE_SHARDS     64
+#define NAMES_PER_SHARD     512 // shard size an incremental change has to copy
+#define INDEX_CHUNK_SIZE    256 // sorted names per chunk of the name index
+
 struct DNSRecord {
-  std::optional<uint32_t> ttl;
-  std::string             recordclass;
-  std::string             type;
-  std::string             value;
+  uint16_t             type;
+  uint16_t             rclass;
+  uint32_t             ttl;
+  std::vector<uint8_t> rdata; /* wire form, names uncompressed */
+
+  bool operator==(const DNSRecord &other) const = default;
+};
+
+typedef std::unordered_map<std::string, std::vector<DNSRecord>, NameHash, NameEqual> RecordMap;
+
+/* Whether the records of a name, nullptr for none, include one of `type` */
+bool hasType(const std::vector<DNSRecord> *records, uint16_t type);
+
+/* A record together with its owner name, the unit of zone changes */
+struct ResourceRecord {
+  std::string name;
+  DNSRecord   record;
 };
 
+/* Difference between two consecutive versions of the zone */
+struct ZoneChange {
+  uint32_t                    fromSerial;
+  uint32_t                    toSerial;
+  std::vector<ResourceRecord> removed;
+  std::vector<ResourceRecord> added;
+};
+
+/*
+  Owner names in DNSSEC canonical order, held as sort keys (see orderKey())
+  in sorted chunks. A change copies the chunks holding the names it adds or
+  removes and shares the others, like the shards of the zone. Answers NSEC
+  lookups and tells empty non-terminals from names that do not exist.
+*/
+class NameIndex {
+public:
+  static std::shared_ptr<const NameIndex> build(std::vector<std::string> &&keys);
+
+  std::shared_ptr<const NameIndex> update(std::vector<std::string> &&added, std::vector<std::string> &&removed) const;
+
+  /* Greatest key below `key` and smallest key above it, nullptr if there is none */
+  const std::string *before(std::string_view key) const;
+  const std::string *after(std::string_view key) const;
+
+  size_t size() const;
+
+private:
+  typedef std::vector<std::string> Chunk;
+
+  std::vector<std::shared_ptr<const Chunk>> chunks;
+  size_t                                    count = 0;
+
+  size_t chunkFor(std::string_view key) const;
+};
+
+class RangeIndex;
+struct ZoneData;
+
+/* A zone of the store, with the authority section of its negative answers in wire form ready to be copied */
+struct ZoneEntry {
+  std::string          apex;
+  std::vector<uint8_t> negative[2];      /* the SOA with its TTL capped at the minimum (RFC 2308), [1] followed by its RRSIGs */
+  uint16_t             negativeCount[2]; /* records in each */
+};
+
+/*
+  Zones held in the store, one per SOA record owner. The closest zone
+  enclosing a name is found by probing its suffixes from the longest one.
+  Suffixes with a label count no apex has are skipped without hashing, so
+  a lookup walks the labels once and usually probes a single time however
+  many zones there are.
+*/
+class ZoneRegistry {
+public:
+  static std::shared_ptr<const ZoneRegistry> build(const ZoneData &zone, const std::vector<std::string> &apexes);
+
+  /* Registry after the SOA records or their signatures changed at `names`, zones may come, go or get new templates */
+  std::shared_ptr<const ZoneRegistry> update(const ZoneData &zone, const std::vector<std::string> &names) const;
+
+  /* Closest zone enclosing the canonical `name`, nullptr if none does */
+  const ZoneEntry *find(const NameKey &name) const;
+
+  bool   contains(const std::string &apex) const;
+  bool   empty() const;
+  size_t size() const;
+
+private:
+  std::unordered_map<std::string, std::shared_ptr<const ZoneEntry>, NameHash, NameEqual> entries;
+  uint64_t depths = 0; /* bit n set when an apex has n labels, the last bit also stands for more */
+
+  void countDepths();
+};
+
+/*
+  One version of the zone data, never modified once published. Names are
+  spread over shards by hash so a change copies only the shards it touches
+  and shares the others with the previous version.
+*/
+struct ZoneData {
+  std::vector<std::shared_ptr<const RecordMap>> shards;
+  std::shared_ptr<const NameIndex>              index;
+  std::shared_ptr<const ZoneRegistry>           zones;
+  std::shared_ptr<const RangeIndex>             ranges; /* records synthesized at query time, nullptr for none */
+  std::string                                   apex; /* owner of the first SOA record, the zone transferred, updated and signed */
+  uint32_t                                      serial;
+
+  /* Split freshly loaded records into shards, nodes are moved rather than copied */
+  static std::shared_ptr<ZoneData> build(RecordMap &&records);
+
+  /* Next version with `change` applied, copying only the shards and index chunks it touches */
+  std::shared_ptr<ZoneData> withChange(const ZoneChange &change) const;
+
+  /* Add the SOA replacement moving the serial one step forward to `change` */
+  void bumpSerial(ZoneChange &change) const;
+
+  size_t                        shardIndex(uint64_t hash) const;
+  const std::vector<DNSRecord> *find(const NameKey &key) const;
+  const std::vector<DNSRecord> *find(std::string_view name) const;
+  size_t                        size() const;
+};
+
+/* Fills `change` from the live zone, returns an RCODE; see DB::update() */
+typedef std::function<uint16_t(const ZoneData &zone, ZoneChange &change)> ChangeBuilder;
+
+class WriteAheadLog;
+
 class DB {
 public:
-  static DB                            &getInstance(std::string filename);
-  std::optional<std::vector<DNSRecord>> get(std::string name);
+  static DB &getInstance(std::string filename);
+
+  /*
+    Move the calling thread to the latest version of the zone. Records
+    returned by get() belong to the pinned version and stay valid until the
+    thread pins again, so workers pin once per packet or batch.
+  */
+  void pin();
+
+  /* Records of a canonical (lowercased) name, nullptr if the name is unknown */
+  const std::vector<DNSRecord> *get(const NameKey &key) const;
+  const std::vector<DNSRecord> *get(std::string_view name) const;
+
+  /* The version pinned by the calling thread */
+  const ZoneData &zone() const;
+
+  std::shared_ptr<const ZoneData> snapshot() const;
+
+  /* Reread the zone file and apply the difference to the live zone */
+  bool reload();
+
+  /*
+    Apply a change on top of the live zone, copying only the shards it
+    touches. Readers keep using the version they pinned meanwhile.
+  */
+  void apply(const ZoneChange &change);
+
+  /* Swap in a whole new version, e.g. after a full zone transfer */
+  void replace(std::shared_ptr<ZoneData> data);
+
+  /*
+    Dynamic update. The change is built against the live zone and applied
+    under the same writer lock, so concurrent updates see each other, then
+    queued to the write-ahead log. Nothing may be acknowledged before
+    waitDurable(ticket) returns true. Returns the RCODE of the builder, or
+    REFUSED when the zone is not backed by a db file. settled(ticket) tells
+    whether that wait would return right away, for workers that must not
+    block on the disk.
+  */
+  uint16_t update(const ChangeBuilder &build, uint64_t &ticket);
+  bool     waitDurable(uint64_t ticket);
+  bool     settled(uint64_t ticket) const;
+
+  /* Journaled changes from `serial` onwards, false if the journal does not reach that far back */
+  bool changesSince(uint32_t serial, std::vector<std::shared_ptr<const ZoneChange>> &changes) const;
 
 private:
-  std::map<std::string, std::vector<DNSRecord>> records;
+  std::string                                   filename;
+  std::atomic<std::shared_ptr<const ZoneData>>  current;
+  std::mutex                                    writerMutex;
+  mutable std::mutex                            journalMutex;
+  std::deque<std::shared_ptr<const ZoneChange>> journal;
+  size_t                                        journalRecords;
+
+  /* write-ahead log of dynamic updates, compacted into a snapshot in the background */
+  std::unique_ptr<WriteAheadLog> wal;
+  std::thread                    compactor;
+  std::mutex                     compactMutex;
+  std::condition_variable        compactWakeup;
+  bool                           compactRequested;
+  bool                           stopping;
+
+  /* replaces DNSSEC signatures before they expire */
+  std::thread             resigner;
+  std::condition_variable resignWakeup;
 
   DB(std::string filename);
+  ~DB();
   DB(const DB &)            = delete;
   DB &operator=(const DB &) = delete;
+
+  void commit(const ZoneData &old, std::shared_ptr<ZoneData> next, const ZoneChange &change);
+  void publish(std::shared_ptr<ZoneData> data);
+  void record(std::shared_ptr<const ZoneChange> change);
+  void clearJournal();
+
+  void openJournal(std::shared_ptr<ZoneData> &zone);
+  void requestCompaction();
+  void runCompactor();
+  bool compact();
+
+  void runResigner();
+  void resign();
 };
 
 #endif /* __DB_HPP__ */
@@ -1,11 +1,80 @@
 #ifndef __DNS_HPP__
 #define __DNS_HPP__
 
+#include <array>
 #include <cinttypes>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "arena.hpp"
+#include "cookie.hpp"
+#include "name.hpp"
+
+struct DNSRecord;
+struct ZoneData;
+struct ZoneEntry;
+
+/* A protocol value and its mnemonic */
+struct ValueName {
+  int              value;
+  std::string_view name;
+};
+
+/*
+  Mnemonics of protocol values, built at compile time. Values below
+  `Dense` are found with one load from an index of entry numbers, the few
+  above it with a scan; no hashing and no allocation.
+*/
+template<size_t N, size_t Dense>
+class ValueTable {
+  static_assert(N < 256, "entry numbers are stored in a byte");
+
+public:
+  constexpr ValueTable(const ValueName (&list)[N]): entries(), index() {
+    for (size_t i = 0; i < N; ++i) {
+      entries[i] = list[i];
+      if (list[i].value >= 0 && list[i].value < (int)Dense)
+        index[list[i].value] = i + 1;
+    }
+  }
+
+  /* Mnemonic of `value`, empty when it has none */
+  constexpr std::string_view find(int value) const {
+    if (value >= 0 && value < (int)Dense)
+      return index[value] ? entries[index[value] - 1].name : std::string_view();
+    for (const auto &entry : entries) {
+      if (entry.value == value)
+        return entry.name;
+    }
+    return std::string_view();
+  }
+
+  /* Mnemonic of `value`, "UNKNOWN" when it has none */
+  constexpr std::string_view name(int value) const {
+    std::string_view found = find(value);
+    return found.empty() ? "UNKNOWN" : found;
+  }
+
+  constexpr const ValueName *begin() const {
+    return entries.data();
+  }
+  constexpr const ValueName *end() const {
+    return entries.data() + N;
+  }
+
+private:
+  std::array<ValueName, N>   entries;
+  std::array<uint8_t, Dense> index; /* entry + 1 by value, 0 for none */
+};
+
+template<size_t Dense, size_t N>
+constexpr ValueTable<N, Dense> valueTable(const ValueName (&list)[N]) {
+  return ValueTable<N, Dense>(list);
+}
+
 /* type values  */
 #define T_A          1     /* host address */
 #define T_NS         2     /* authoritative name server */
@@ -101,7 +170,7 @@
 #define T_WINS_R     65282 /* Microsoft's WINS-R RR */
 #define T_XPF        65422 /* XPF draft-bellis-dnsop-xpf */
 
-const std::unordered_map<int, std::string> dns_type_vals = {
+inline constexpr auto dns_type_vals = valueTable<512>({
     {0,            "Unused"    },
     {T_A,          "A"         },
     {T_NS,         "NS"        },
@@ -196,7 +265,7 @@ const std::unordered_map<int, std::string> dns_type_vals = {
     {T_WINS,       "WINS"      },
     {T_WINS_R,     "WINS-R"    },
     {T_XPF,        "XPF"       },
-};
+});
 
 /* Class values */
 #define C_IN   1   /* the Internet */
@@ -206,14 +275,14 @@ const std::unordered_map<int, std::string> dns_type_vals = {
 #define C_NONE 254 /* none */
 #define C_ANY  255 /* any */
 
-const std::unordered_map<int, std::string> dns_class_vals = {
+inline constexpr auto dns_class_vals = valueTable<256>({
     {C_IN,   "IN"  },
     {C_CS,   "CS"  },
     {C_CH,   "CH"  },
     {C_HS,   "HS"  },
     {C_NONE, "NONE"},
     {C_ANY,  "ANY" }
-};
+});
 
 /* Bit fields in the flags */
 #define F_RESPONSE      (1 << 15)   /* packet is response */
@@ -249,6 +318,14 @@ const std::unordered_map<int, std::string> dns_class_vals = {
 #define O_REPORT_CHANNEL    18     /* DNS Error Reporting (RFC9567) */
 #define O_ZONEVERSION       19     /* DNS Zone Version (ZONEVERSION) Option (RFC9660) */
 
+/* EDNS(0) (RFC 6891) */
+#define EDNS_PAYLOAD_SIZE 1232      // UDP payload we advertise and accept, avoids IP fragmentation
+#define EDNS_DO           (1 << 15) /* DNSSEC OK bit in the TTL of OPT (RFC 3225) */
+
+/* Address families of the Client Subnet option (RFC 7871) */
+#define ECS_FAMILY_IPV4 1
+#define ECS_FAMILY_IPV6 2
+
 /* Opcodes */
 #define OPCODE_QUERY  0 /* standard query */
 #define OPCODE_IQUERY 1 /* inverse query */
@@ -257,14 +334,14 @@ const std::unordered_map<int, std::string> dns_class_vals = {
 #define OPCODE_UPDATE 5 /* dynamic update */
 #define OPCODE_DSO    6 /* DNS stateful operations */
 
-const std::unordered_map<int, std::string> dns_opcode_vals = {
-    {OPCODE_QUERY,  "Standard query"               },
-    {OPCODE_IQUERY, "Inverse query"                },
-    {OPCODE_STATUS, "Server status request"        },
-    {OPCODE_NOTIFY, "Zone change notification"     },
-    {OPCODE_UPDATE, "Dynamic update"               },
-    {OPCODE_DSO,    "DNS Stateful operations (DSO)"},
-};
+inline constexpr auto dns_opcode_vals = valueTable<16>({
+    {OPCODE_QUERY,  "QUERY" },
+    {OPCODE_IQUERY, "IQUERY"},
+    {OPCODE_STATUS, "STATUS"},
+    {OPCODE_NOTIFY, "NOTIFY"},
+    {OPCODE_UPDATE, "UPDATE"},
+    {OPCODE_DSO,    "DSO"   },
+});
 
 /* Reply codes */
 #define RCODE_NOERROR   0
@@ -289,7 +366,7 @@ const std::unordered_map<int, std::string> dns_opcode_vals = {
 #define RCODE_BADTRUNC  22
 #define RCODE_BADCOOKIE 23
 
-const std::unordered_map<int, std::string> dns_rcode_vals = {
+inline constexpr auto dns_rcode_vals = valueTable<32>({
     {RCODE_NOERROR,   "No error"                                 },
     {RCODE_FORMERR,   "Format error"                             },
     {RCODE_SERVFAIL,  "Server failure"                           },
@@ -311,7 +388,7 @@ const std::unordered_map<int, std::string> dns_rcode_vals = {
     {RCODE_BADALG,    "Algorithm not supported"                  },
     {RCODE_BADTRUNC,  "Bad Truncation"                           },
     {RCODE_BADCOOKIE, "Bad/missing Server Cookie"                },
-};
+});
 
 /*
                         DNS Header
@@ -355,9 +432,11 @@ struct DNSHeader {
     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
 */
 struct DNSQuery {
-  std::string name;
-  uint16_t    type;
-  uint16_t    qclass;
+  std::string_view name; /* as sent by the client, echoed back in the reply */
+  std::string_view key;  /* lowercased name used for the lookup */
+  uint64_t         hash;
+  uint16_t         type;
+  uint16_t         qclass;
 };
 
 /*
@@ -384,42 +463,200 @@ struct DNSQuery {
     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
 */
 struct DNSAnswer {
-  std::string          name;
-  uint16_t             type;
-  uint16_t             qclass;
-  uint32_t             ttl;
-  uint16_t             rdlength;
-  std::vector<uint8_t> rdata;
+  std::string_view name;
+  uint16_t         type;
+  uint16_t         qclass;
+  uint32_t         ttl;
+  uint16_t         rdlength;
+  const uint8_t   *rdata; /* points into the arena, the zone or the parsed packet */
+};
+
+/* What the COOKIE option of a request proved, see DNS::setClient() */
+enum CookieState {
+  COOKIE_NONE,      /* no option, or no EDNS */
+  COOKIE_MALFORMED, /* answered with FORMERR (RFC 7873 5.2.2) */
+  COOKIE_UNCHECKED, /* parsed, the client address is not known yet */
+  COOKIE_CLIENT,    /* a client cookie without a valid server cookie */
+  COOKIE_VALID      /* our server cookie for this client, its address is real */
+};
+
+/* EDNS(0) parameters of a request, taken from its OPT record */
+struct EDNS {
+  bool     present;
+  uint8_t  version;
+  uint16_t payload;      /* largest UDP reply the client accepts */
+  bool     dnssecOk;
+  bool     clientSubnet; /* a Client Subnet option came along (RFC 7871) */
+  uint16_t family;       /* of the subnet, ECS_FAMILY_ */
+  uint8_t  sourcePrefix; /* bits of the subnet the client sent */
+  uint8_t  scopePrefix;  /* bits the answer depended on, echoed back */
+  uint8_t  subnet[16];   /* IPv4 mapped into IPv6 */
+  uint8_t  cookie;       /* CookieState */
+  uint8_t  serverLength; /* of the server cookie, received until setClient() puts the one to send there */
+  uint8_t  clientCookie[COOKIE_CLIENT_SIZE];
+  uint8_t  serverCookie[COOKIE_SERVER_MAX];
+};
+
+/* Fixed capacity output buffer, writes that do not fit are dropped and flagged */
+struct PacketWriter {
+  uint8_t *data;
+  size_t   capacity;
+  size_t   size;
+  bool     overflow;
+
+  void append(const void *bytes, size_t length);
+  void appendUint16(uint16_t value);
+  void appendUint32(uint32_t value);
+  void appendName(std::string_view name);
 };
 
+/*
+  Remembers where names were written in a message so later names can point
+  back at them (RFC 1035 4.1.4). Names must be canonical and stay alive
+  until clear().
+*/
+class NameCompressor {
+public:
+  void clear();
+  void appendName(PacketWriter &out, std::string_view name);
+
+private:
+  std::unordered_map<std::string_view, uint16_t> offsets;
+};
+
+struct QueryTrace;
+
+#define DNS_SUMMARY_SIZE 384 // a one line summary of a message with the longest name, see DNS::summarize()
+#define MAX_CNAME_CHAIN  8   // CNAME records followed within a zone before the client is left to go on
+
+/*
+  A DNS message being processed. All of its storage comes from the arena of
+  the worker handling it, the arena outlives the object and is reset by the
+  worker once the packet (or batch) has been answered.
+*/
 class DNS {
 public:
-  DNS();
-  DNS(const uint8_t *data);
+  DNS(Arena &arena);
+  DNS(Arena &arena, const uint8_t *data, size_t size);
+
+  bool parseDNS(const uint8_t *data, size_t size);
+
+  const DNSHeader                  &getHeader() const;
+  const std::pmr::vector<DNSQuery> &getQueries() const;
+  uint8_t                           getOpcode() const;
+  CookieState                       getCookieState() const;
+
+  /* A query without a question that carries a cookie, answered with the server cookie alone (RFC 7873 5.4) */
+  bool cookieOnly() const;
+
+  /*
+    One line about the message for the packet log, e.g.
+      192.0.2.1#53000 0x1a2b QUERY rd www.example.com IN A edns 1232 do
+    written to `line` without allocating, from `address` and `port` in
+    network byte order. Returns its length, cut short to fit `capacity`.
+  */
+  size_t summarize(char *line, size_t capacity, uint32_t address, uint16_t port) const;
 
-  void                 parseDNS(const uint8_t *data);
-  std::vector<uint8_t> buildDNSResponse();
+  /*
+    IPv4 source address of the request in network byte order, picks its
+    view, steers its answers and checks its DNS cookie
+  */
+  void setClient(uint32_t address);
+
+  /* Mark the end of the lookup in `trace`, see Tracer */
+  void setTrace(QueryTrace *trace);
+
+  /* Capacity of a UDP reply: 512 bytes, or what EDNS allows up to EDNS_PAYLOAD_SIZE */
+  size_t udpPayloadSize() const;
+
+  /* Write the response to `response` and return its length. Answers that do not fit are dropped and TC is set. */
+  size_t buildDNSResponse(uint8_t *response, size_t capacity);
+
+  /* Reply with the question only and `rcode`, extended ones such as RCODE_BADCOOKIE need EDNS */
+  size_t buildDNSError(uint8_t *response, size_t capacity, uint16_t rcode);
+
+  /* Reply with the question only and TC set, without a lookup, so the client retries over TCP */
+  size_t buildTruncated(uint8_t *response, size_t capacity);
 
   friend std::ostream &operator<<(std::ostream &os, const DNS &packet);
 
 private:
-  struct DNSHeader       header;
-  std::vector<DNSQuery>  queries;
-  std::vector<DNSAnswer> answers;
+  Arena                      &arena;
+  struct DNSHeader            header;
+  struct EDNS                 edns;
+  uint16_t                    rcode;
+  const ZoneData             *view;          /* nullptr for the main zone */
+  uint8_t                     client[16];    /* source address, IPv4 mapped into IPv6 */
+  bool                        authoritative; /* the question lies in one of our zones */
+  const std::vector<uint8_t> *negative;      /* precomputed start of the authority section, see ZoneEntry */
+  uint16_t                    negativeCount;
+  QueryTrace                 *trace;         /* nullptr unless the query is traced */
+  std::pmr::vector<DNSQuery>  queries;
+  std::pmr::vector<DNSAnswer> answers;
+  std::pmr::vector<DNSAnswer> authority;
+  std::pmr::vector<DNSAnswer> additional;
 
-  std::string parseDNSQueryName(const uint8_t *data, int &offset);
-  DNSQuery    parseDNSQuery(const uint8_t *data, int &offset);
-  DNSAnswer   parseDNSAnswer(const uint8_t *data, int &offset);
+  bool parseDNSQueryName(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed);
+  bool parseDNSQuery(const uint8_t *data, size_t size, size_t &offset, DNSQuery &query);
+  bool parseDNSAnswer(const uint8_t *data, size_t size, size_t &offset, DNSAnswer &answer);
+  void parseEDNSOptions(const uint8_t *data, size_t size);
 
   void createDNSAnswer();
 
-  void appendDNSQuery(std::vector<uint8_t> &response, const DNSQuery &query);
-  void appendDNSAnswer(std::vector<uint8_t> &response, const DNSAnswer &answer);
-  void appendDNSName(std::vector<uint8_t> &response, const std::string &name);
-  void appendUint16(std::vector<uint8_t> &response, uint16_t value);
-  void appendUint32(std::vector<uint8_t> &response, uint32_t value);
+  /*
+    Answer `query` for one name of the CNAME chain, the question itself
+    when `first`. True when that name has a CNAME, whose target is then
+    put in the name of `target` for the next round.
+  */
+  bool answerName(const ZoneData &zone, const ZoneEntry *entry, const DNSQuery &query, bool first, bool dnssec, DNSQuery &target);
+
+  /* The CNAME among `records` under `owner`, true with its canonical target in `target` if there is one */
+  bool appendCNAME(std::string_view owner, const std::vector<DNSRecord> &records, bool dnssec, DNSQuery &target);
+
+  /* Records of `type` from `records` under `owner`, with their RRSIGs if `dnssec` */
+  bool appendRRset(std::pmr::vector<DNSAnswer> &section, std::string_view owner, const std::vector<DNSRecord> &records, uint16_t type, bool dnssec);
+
+  /*
+    Negative answers: the SOA of the zone, which also bounds how long they
+    are cached (RFC 2308) and is copied from its precomputed wire form, and
+    with DNSSEC the NSEC records proving the name or type does not exist
+    (RFC 4035 3.1.3)
+  */
+  void appendNegativeSOA(const ZoneEntry &zone, bool dnssec);
+  void appendCoveringNSEC(const ZoneData &zone, std::string_view apex, std::string_view key);
+
+  /*
+    Referral to the child zone delegated at `owner` with `records` (RFC 1034
+    4.3.2): its NS records in the authority section, without AA, and the
+    addresses of the servers we hold in the additional section, glue
+    included. With DNSSEC the DS records prove the child signed, or the
+    NSEC of the cut proves it is not (RFC 4035 3.1.4).
+  */
+  void appendReferral(const ZoneData &zone, const ZoneEntry &entry, std::string_view owner, const std::vector<DNSRecord> &records, bool dnssec);
+
+  /*
+    Copies into the arena, so names built while answering never reach the
+    global allocator: `text` itself, the wildcard "*." + `encloser`, the
+    sort key of `name` or the name of `key` (see orderKey()), and the name at
+    the start of `rdata`, canonical and hashed like a question.
+  */
+  std::string_view keep(std::string_view text);
+  std::string_view keepWildcard(std::string_view encloser);
+  std::string_view keepOrderKey(std::string_view name);
+  std::string_view keepOrderKeyName(std::string_view key);
+  bool             keepName(const uint8_t *rdata, size_t length, DNSQuery &name);
+
+  void appendDNSQuery(PacketWriter &response, const DNSQuery &query);
+  void appendDNSAnswer(PacketWriter &response, const DNSAnswer &answer);
+  void appendOPT(PacketWriter &response, uint16_t rcode);
 };
 
-std::string to_string(int value, std::unordered_map<int, std::string> values);
+
+/*
+  Move the calling worker to the latest zone, blocklists, views and
+  steering configuration. What a DNS object answers from stays valid until
+  the next call, so workers call it once per packet or batch.
+*/
+void pinQueryState();
 
 #endif /* __DNS_HPP__ */
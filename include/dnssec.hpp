@@ -0,0 +1,90 @@
+#ifndef __DNSSEC_HPP__
+#define __DNSSEC_HPP__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db.hpp"
+#include "ed25519.hpp"
+#include "threadpool.hpp"
+
+#define DNSSEC_ALGORITHM   15           // Ed25519 (RFC 8080)
+#define DNSKEY_FLAGS       257          // zone key and secure entry point, one key signs everything
+#define DNSKEY_PROTOCOL    3
+#define SIG_VALIDITY       (14 * 86400) // lifetime of a fresh signature
+#define SIG_JITTER         86400        // spread of expirations so they do not come due at once
+#define SIG_REFRESH        (7 * 86400)  // signatures with less left are replaced
+#define SIG_INCEPTION_SKEW 3600         // inception backdated against clock skew of validators
+#define SIG_CHECK_INTERVAL 3600         // seconds between looks for signatures coming due
+
+/*
+  Online DNSSEC signing of the primary zone. Signatures are computed when
+  the zone is loaded, reloaded or changed and stored as ordinary RRSIG and
+  NSEC records next to the data they cover, so queries with the DO bit and
+  zone transfers serve them at no signing cost. The NSEC chain follows the
+  ordered name index of the zone. Work is spread over a thread pool.
+*/
+class Signer {
+public:
+  static Signer &getInstance();
+
+  /* Load the hex encoded Ed25519 seed from `path`, a new key is generated there if the file does not exist */
+  bool loadKey(const std::string &path);
+  bool enabled() const;
+
+  /*
+    Signed copy of `zone`: our DNSKEY at the apex, an NSEC chain and RRSIGs
+    for every authoritative RRset. Signatures from `previous` are kept for
+    RRsets that did not change and are not coming due. nullptr when
+    $GENERATE or $SYNTHESIZE lines put names in the zone: those are only
+    computed at query time, so they could not be signed and the NSEC chain
+    would deny them.
+  */
+  std::shared_ptr<ZoneData> signZone(const ZoneData &zone, const ZoneData *previous);
+
+  /*
+    Apply `change` to `old` and extend it with the NSEC and RRSIG changes
+    it implies, plus fresh signatures for the names in `resign` that are
+    coming due. Returns the signed next version.
+  */
+  std::shared_ptr<ZoneData> signChange(const ZoneData &old, ZoneChange &change, const std::vector<std::string> &resign = {});
+
+  /* Names holding signatures that are coming due */
+  std::vector<std::string> dueNames(const ZoneData &zone) const;
+
+private:
+  Ed25519Key                  key;
+  bool                        loaded;
+  uint16_t                    keyTag;
+  std::vector<uint8_t>        dnskey; /* RDATA of our DNSKEY */
+  std::unique_ptr<ThreadPool> pool;
+
+  Signer();
+  Signer(const Signer &)            = delete;
+  Signer &operator=(const Signer &) = delete;
+
+  bool occluded(const ZoneData &zone, const std::string &name) const;
+  bool authoritative(const ZoneData &zone, const std::string &name) const;
+  std::string nextName(const ZoneData &zone, const std::string &name) const;
+  std::string previousName(const ZoneData &zone, const std::string &name) const;
+
+  /* NSEC and RRSIG records `name` should carry in `zone` */
+  void signName(const ZoneData &zone, const ZoneData *previous, const std::string &name, uint32_t now, std::vector<DNSRecord> &out);
+
+  const DNSRecord *reusable(
+      const ZoneData *previous, const std::string &name, uint16_t type, const std::vector<const DNSRecord *> &rrset, uint32_t now
+  ) const;
+
+  DNSRecord sign(const std::string &apex, const std::string &name, uint16_t type, std::vector<const DNSRecord *> rrset, uint32_t now);
+
+  /* Signatures for `names` of `zone`, the returned change holds the records to swap */
+  ZoneChange signNames(const ZoneData &zone, const ZoneData *previous, const std::vector<std::string> &names);
+};
+
+/* Fields of a wire-form RRSIG RDATA */
+uint16_t rrsigCovered(const std::vector<uint8_t> &rdata);
+uint32_t rrsigExpiration(const std::vector<uint8_t> &rdata);
+
+#endif /* __DNSSEC_HPP__ */
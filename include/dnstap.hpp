@@ -0,0 +1,101 @@
+#ifndef __DNSTAP_HPP__
+#define __DNSTAP_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DNSTAP_CONTENT_TYPE    "protobuf:dnstap.Dnstap"
+#define DNSTAP_RING_SIZE       (1 << 20) // 1 MB of frames buffered per worker thread
+#define DNSTAP_BATCH_SIZE      (1 << 18) // 256 kB handed to one write()
+#define DNSTAP_FLUSH_INTERVAL  10        // milliseconds the writer sleeps when the buffers ran dry
+#define DNSTAP_REPORT_INTERVAL 10        // seconds between reports of dropped messages
+#define DNSTAP_HANDSHAKE_WAIT  1000      // milliseconds a socket reader may take to answer a control frame
+
+/* dnstap SocketProtocol of the transport a query came in on */
+#define DNSTAP_UDP 1
+#define DNSTAP_TCP 2
+#define DNSTAP_DOT 3
+
+/*
+  Single producer, single consumer byte ring of Frame Streams data frames.
+  A worker thread appends, the writer thread drains.
+*/
+struct DnstapRing {
+  std::unique_ptr<uint8_t[]>        data{new uint8_t[DNSTAP_RING_SIZE]};
+  alignas(64) std::atomic<uint64_t> head    = 0;     /* bytes ever appended, written by the worker */
+  alignas(64) std::atomic<uint64_t> tail    = 0;     /* bytes ever drained, written by the writer */
+  std::atomic<uint64_t>             dropped = 0;     /* messages that did not fit */
+  std::atomic<bool>                 retired = false; /* the worker thread exited */
+};
+
+/*
+  Binary log of queries and responses in the dnstap format: protobuf
+  messages in Frame Streams framing, written to a file or, with a `unix:`
+  prefix, to a socket that a collector like fstrm_capture listens on.
+
+  Each worker thread appends to a ring of its own without locks or system
+  calls and a background writer drains all rings in large write() calls.
+  When a ring is full, because the disk or the collector falls behind, the
+  message is dropped and counted; the query path never waits.
+*/
+class Dnstap {
+public:
+  static Dnstap &getInstance();
+
+  /* `target` is a file path or unix:/path/to/socket, `version` goes into every message */
+  bool configure(const std::string &target, const std::string &version);
+  bool enabled() const;
+
+  void start();
+  void stop();
+
+  /* Start a new file, or reconnect the socket, once the writer comes around; for log rotation */
+  void reopen();
+
+  /*
+    Log a query from `address`:`port` (network byte order) that arrived at
+    `received` and its response, nullptr to log the query alone.
+  */
+  void log(int protocol, uint32_t address, uint16_t port, const struct timespec &received, const uint8_t *query, size_t queryLength, const uint8_t *response, size_t responseLength);
+
+  /* Messages lost so far, dropped by full rings or by failed writes */
+  uint64_t dropped() const;
+
+private:
+  std::string                              target;
+  bool                                     socketOutput;
+  std::string                              identity;
+  std::string                              version;
+  bool                                     active;
+  int                                      fd;
+  std::vector<std::shared_ptr<DnstapRing>> rings;
+  mutable std::mutex                       mutex;
+  std::condition_variable                  wakeup;
+  std::thread                              writer;
+  bool                                     running;
+  std::atomic<bool>                        reopenRequested;
+  std::atomic<uint64_t>                    lost; /* messages in batches that failed to write */
+  uint64_t                                 retiredDrops;
+
+  Dnstap();
+  ~Dnstap();
+  Dnstap(const Dnstap &)            = delete;
+  Dnstap &operator=(const Dnstap &) = delete;
+
+  DnstapRing *localRing();
+
+  void runWriter();
+  bool openOutput();
+  void closeOutput();
+  bool writeAll(const uint8_t *data, size_t length);
+};
+
+#endif /* __DNSTAP_HPP__ */
@@ -0,0 +1,46 @@
+#ifndef __ED25519_HPP__
+#define __ED25519_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+  Small self-contained Ed25519 (RFC 8032) signer for online DNSSEC
+  (algorithm 15, RFC 8080). Only signing is implemented: field elements use
+  five 51-bit limbs and the base point multiple comes from a precomputed
+  table of 4-bit windows, read in constant time.
+*/
+
+#define SHA512_DIGEST_SIZE      64
+#define ED25519_SEED_SIZE       32
+#define ED25519_PUBLIC_KEY_SIZE 32
+#define ED25519_SIGNATURE_SIZE  64
+
+/* SHA-512 (FIPS 180-4) */
+class SHA512 {
+public:
+  SHA512();
+
+  void update(const void *data, size_t length);
+  void final(uint8_t digest[SHA512_DIGEST_SIZE]);
+
+private:
+  uint64_t state[8];
+  uint8_t  block[128];
+  size_t   used;
+  uint64_t total;
+
+  void compress(const uint8_t *block);
+};
+
+/* Signing key expanded once from its seed */
+struct Ed25519Key {
+  uint8_t scalar[32]; /* clamped secret scalar */
+  uint8_t prefix[32]; /* nonce derivation key */
+  uint8_t publicKey[ED25519_PUBLIC_KEY_SIZE];
+};
+
+void ed25519Expand(const uint8_t seed[ED25519_SEED_SIZE], Ed25519Key &key);
+void ed25519Sign(const Ed25519Key &key, const uint8_t *message, size_t length, uint8_t signature[ED25519_SIGNATURE_SIZE]);
+
+#endif /* __ED25519_HPP__ */
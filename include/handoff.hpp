@@ -0,0 +1,77 @@
+#ifndef __HANDOFF_HPP__
+#define __HANDOFF_HPP__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define HANDOFF_UDP 'u'
+#define HANDOFF_TCP 't'
+#define HANDOFF_TLS 's'
+
+#define HANDOFF_REQUEST     'H'  // successor asks for the sockets
+#define HANDOFF_READY       'R'  // successor serves, the previous instance may drain
+#define HANDOFF_MAX_SOCKETS 8
+#define HANDOFF_TIMEOUT     5000 // milliseconds to answer a request with the sockets
+#define HANDOFF_DRAIN_WAIT  30   // seconds a successor waits for the previous instance to exit
+
+/* Kind and current descriptor of a socket to hand over, -1 while it has none */
+typedef std::pair<char, std::function<int()>> HandoffSource;
+
+/*
+  Zero downtime upgrades. A running instance listens on a UNIX socket for
+  its successor and passes it the bound UDP, TCP and TLS sockets with
+  SCM_RIGHTS. The successor serves on them right away, so it needs no
+  privileges to bind, and both instances read the same sockets until the
+  successor has loaded its zones and says it is ready. The old instance
+  then stops reading, answers what it already took and exits; datagrams
+  and connections it did not take stay queued on the shared sockets.
+*/
+class Handoff {
+public:
+  static Handoff &getInstance();
+
+  /* Ask the instance listening at `path` for its sockets; false when there is none */
+  bool takeOver(const std::string &path);
+
+  /* Socket of `kind` taken over, -1 if none */
+  int claim(char kind);
+
+  /* Tell the previous instance to drain and wait for it to exit, closing the sockets nobody claimed */
+  void release();
+
+  /* Listen at `path` for a successor and hand it `sources` */
+  bool offer(const std::string &path, const std::vector<HandoffSource> &sources);
+
+  /* A successor took over, this instance should drain and exit */
+  bool handedOver() const;
+
+  void stop();
+
+private:
+  int                               predecessor;
+  std::vector<std::pair<char, int>> inherited;
+  std::vector<HandoffSource>        sources;
+  std::string                       path;
+  int                               listenfd;
+  int                               successor;
+  std::thread                       listener;
+  std::atomic<bool>                 running;
+  std::atomic<bool>                 done;
+
+  Handoff();
+  ~Handoff();
+  Handoff(const Handoff &)            = delete;
+  Handoff &operator=(const Handoff &) = delete;
+
+  void runListener();
+  bool serve(int fd);
+};
+
+/* Port a socket is bound to */
+int boundPort(int fd);
+
+#endif /* __HANDOFF_HPP__ */
@@ -0,0 +1,145 @@
+#ifndef __HITTERS_HPP__
+#define __HITTERS_HPP__
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define HITTER_LINES  1024 // cache lines of 16 counters, a power of two
+#define HITTER_TOP    32   // heaviest keys tracked per sketch
+#define HITTER_WINDOW 10   // seconds after which every count is halved
+#define HITTER_WAIT   500  // milliseconds a dump waits for the workers to publish
+
+/* A key and its estimated count, decayed */
+struct Hitter {
+  uint64_t    hash;
+  uint32_t    count;
+  std::string key;
+};
+
+/*
+  Count-Min sketch with conservative update, plus the HITTER_TOP keys with
+  the highest estimates. A key counts in two counters in each of two cache
+  lines, so an update is two independent memory accesses and a few
+  branchless min/max operations. Estimates never undercount and overcount
+  by about the total over 8 * HITTER_LINES. A key only costs its counters
+  unless its estimate reaches the smallest one of the top, which the long
+  tail of a query stream never does.
+*/
+class HitterSketch {
+public:
+  HitterSketch();
+
+  /* Count `key`, whose 64 bit hash is `hash`; the key is copied only when it enters the top */
+  void add(uint64_t hash, std::string_view key) {
+    uint64_t  mixed = hash * 0x9E3779B97F4A7C15ULL;
+    uint32_t *first = counters[(mixed >> 54) & (HITTER_LINES - 1)];
+    uint32_t *other = counters[(mixed >> 44) & (HITTER_LINES - 1)];
+    uint32_t &a     = first[(mixed >> 40) & 15];
+    uint32_t &b     = first[(mixed >> 36) & 15];
+    uint32_t &c     = other[(mixed >> 32) & 15];
+    uint32_t &d     = other[(mixed >> 28) & 15];
+
+    /* stores without branches, whether a counter grows is a coin flip the predictor would lose */
+    uint32_t estimate = std::min(std::min(a, b), std::min(c, d)) + 1;
+    a                 = std::max(a, estimate);
+    b                 = std::max(b, estimate);
+    c                 = std::max(c, estimate);
+    d                 = std::max(d, estimate);
+
+    if (estimate > floor || used < HITTER_TOP)
+      promote(hash, key, estimate);
+  }
+
+  /* Halve every count, the sliding window of the sketch */
+  void decay();
+  void clear();
+
+  std::vector<Hitter> top() const;
+
+private:
+  alignas(64) uint32_t counters[HITTER_LINES][16];
+  uint64_t             hashes[HITTER_TOP];
+  uint32_t             counts[HITTER_TOP];
+  std::string          keys[HITTER_TOP];
+  uint8_t              slots[2 * HITTER_TOP]; /* top entry + 1 by hash, linear probing, 0 for none */
+  int                  used;
+  int                  lowest; /* top entry with the smallest count */
+  uint32_t             floor;  /* its count, once the top is full */
+
+  void promote(uint64_t hash, std::string_view key, uint32_t estimate);
+  int  find(uint64_t hash) const;
+  void insert(uint64_t hash, int entry);
+  void erase(uint64_t hash);
+  void findLowest();
+};
+
+/*
+  Sketches of one worker thread: query names and client networks (/24).
+  Only the owning thread touches them; a dump asks it to publish a copy of
+  its top lists, which it does between packets.
+*/
+struct HitterWorker {
+  HitterSketch names;
+  HitterSketch clients;
+  int64_t      window = 0; /* HITTER_WINDOW periods since the epoch */
+
+  std::atomic<uint64_t> requested = 0; /* dump generation asked for */
+  std::atomic<uint64_t> answered  = 0; /* dump generation published */
+  std::atomic<bool>     retired   = false;
+  std::mutex            mutex; /* guards the published lists */
+  std::vector<Hitter>   publishedNames;
+  std::vector<Hitter>   publishedClients;
+
+  /* Count a query for `key` from `address` (network byte order) */
+  void add(uint64_t hash, std::string_view key, uint32_t address) {
+    uint32_t network = address & htonl(0xffffff00);
+    names.add(hash, key);
+    clients.add(network * 0xC2B2AE3D27D4EB4FULL + network, std::string_view((const char *)&network, sizeof(network)));
+  }
+
+  /* Once per batch: decay at window boundaries and answer a pending dump; `now` in seconds */
+  void tick(int64_t now) {
+    if (now / HITTER_WINDOW != window)
+      advance(now / HITTER_WINDOW);
+    if (requested.load(std::memory_order_relaxed) != answered.load(std::memory_order_relaxed))
+      publish();
+  }
+
+private:
+  void advance(int64_t next);
+  void publish();
+};
+
+/*
+  Heavy hitters of all workers: which names and which client networks
+  drive the load right now. Workers count every query in sketches of their
+  own, a few nanoseconds without locks; dump() merges them on demand.
+*/
+class HeavyHitters {
+public:
+  static HeavyHitters &getInstance();
+
+  /* Sketches of the calling thread, created on first use and retired when the thread exits */
+  HitterWorker &worker();
+
+  /* Merge the workers' top lists and log them */
+  void dump();
+
+private:
+  std::mutex                                 mutex;
+  std::vector<std::shared_ptr<HitterWorker>> workers;
+  uint64_t                                   generation;
+
+  HeavyHitters();
+  HeavyHitters(const HeavyHitters &)            = delete;
+  HeavyHitters &operator=(const HeavyHitters &) = delete;
+};
+
+#endif /* __HITTERS_HPP__ */
@@ -0,0 +1,39 @@
+#ifndef __MAPPEDFILE_HPP__
+#define __MAPPEDFILE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Read-only mapping of a whole file, released with the object */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &)            = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /* Map `path`, an empty file maps to no bytes; false with errno set if it cannot be read */
+  bool open(const std::string &path, bool sequential = false);
+  void close();
+
+  const uint8_t *data() const;
+  size_t         size() const;
+
+private:
+  void  *map    = nullptr;
+  size_t length = 0;
+};
+
+/* True if `path` exists and was modified after `than` */
+bool newerFile(const std::string &path, const std::string &than);
+
+/* Replace `path` with `data` through a temporary file and a rename, so readers never map half of it */
+bool writeFileAtomically(const std::string &path, const std::vector<uint8_t> &data);
+
+/* Whitespace separated fields of a text line up to a `#` or `;` comment */
+void splitFields(std::string_view line, std::vector<std::string_view> &fields);
+
+#endif /* __MAPPEDFILE_HPP__ */
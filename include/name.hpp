@@ -0,0 +1,102 @@
+#ifndef __NAME_HPP__
+#define __NAME_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+  Domain names are compared case-insensitively (RFC 4343). Zone data is
+  canonicalized (lowercased, no trailing dot) once at load time and query
+  names are lowercased and hashed in a single pass, so the lookup itself is
+  a plain byte comparison.
+*/
+
+#define MAX_LABEL_LENGTH 63
+#define MAX_WIRE_NAME    255                    /* wire form, length octets and root label included */
+#define MAX_NAME_LENGTH  (MAX_WIRE_NAME - 2)    /* presentation form without the trailing dot */
+#define NAME_BUFFER_SIZE (MAX_NAME_LENGTH + 35) /* leaves room for full vector stores past the end */
+
+/* Lowercased form of a name together with its lookup hash */
+struct NameKey {
+  std::string_view name;
+  uint64_t         hash;
+};
+
+/* Lowercase `length` bytes of `src` into `dst` and return the hash of the lowercased bytes */
+uint64_t lowerAndHash(const char *src, size_t length, char *dst);
+
+/* Implementations of the wire-format name parser */
+enum class NameParser {
+  SCALAR,
+  SSE2,
+  AVX2,
+};
+
+struct ParsedName {
+  size_t   length; /* of the presentation form, without the trailing dot */
+  uint64_t hash;   /* lookup hash of the lowercased form */
+};
+
+/*
+  Parse the uncompressed wire-format name at `data[offset]` of a `size` byte
+  message. The presentation form is written to `text` as sent and lowercased
+  to `key`, both must hold NAME_BUFFER_SIZE bytes. Label bytes are validated,
+  lowercased and hashed in the same pass, 16 or 32 bytes at a time when the
+  CPU allows. Returns false for malformed or compressed names.
+*/
+bool parseWireName(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed);
+
+/* The implementation in use is picked at startup from the CPU features */
+NameParser  nameParser();
+bool        setNameParser(NameParser parser);
+const char *nameParserName(NameParser parser);
+
+/* Hash of an already canonical name */
+uint64_t hashName(std::string_view name);
+
+/* Lowercased copy of `name` without the trailing root dot */
+std::string canonicalName(std::string_view name);
+
+/*
+  Sort key of a canonical name in DNSSEC canonical order (RFC 4034 6.1):
+  labels from the rightmost one, separated by NUL bytes, so plain byte
+  comparison of keys orders the names.
+*/
+std::string orderKey(std::string_view name);
+std::string orderKeyName(std::string_view key);
+
+/* The same into `key` or `name` of as many bytes as the input, for callers keeping them in their own storage */
+void orderKey(std::string_view name, char *key);
+void orderKeyName(std::string_view key, char *name);
+
+struct NameHash {
+  using is_transparent = void;
+
+  size_t operator()(const std::string &name) const {
+    return hashName(name);
+  }
+
+  size_t operator()(const NameKey &key) const {
+    return key.hash;
+  }
+};
+
+struct NameEqual {
+  using is_transparent = void;
+
+  bool operator()(const std::string &lhs, const std::string &rhs) const {
+    return lhs == rhs;
+  }
+
+  bool operator()(const NameKey &lhs, const std::string &rhs) const {
+    return lhs.name == rhs;
+  }
+
+  bool operator()(const std::string &lhs, const NameKey &rhs) const {
+    return lhs == rhs.name;
+  }
+};
+
+#endif /* __NAME_HPP__ */
@@ -0,0 +1,89 @@
+#ifndef __OVERLOAD_HPP__
+#define __OVERLOAD_HPP__
+
+#include <algorithm>
+#include <cstdint>
+
+#define OVERLOAD_TARGET    5   // milliseconds of queueing delay tolerated as a standing queue
+#define OVERLOAD_INTERVAL  100 // milliseconds over which the smallest delay is taken
+#define OVERLOAD_REPORT    10  // seconds between reports of drops and shed queries
+#define OVERLOAD_BACKOFF   10  // seconds before truncating everything is tried again when it did not help
+#define OVERLOAD_MAX_DELAY 10  // seconds of delay beyond which a sample is taken for a clock step and ignored
+
+/* What a worker sheds, in order of escalation */
+enum ShedLevel {
+  SHED_NONE,      /* answer everything */
+  SHED_EXPENSIVE, /* send ANY queries and updates to TCP, skip the packet dump */
+  SHED_ALL,       /* answer every query with TC and no lookup */
+};
+
+/*
+  Overload control of one UDP worker, after CoDel. Every datagram carries
+  its kernel receive timestamp; the time it waited in the socket buffer
+  before the worker took it is its queueing delay. A short burst builds a
+  queue that drains within an interval, while a worker that falls behind
+  keeps one: when even the smallest delay of an interval exceeds the
+  target, or the kernel dropped datagrams, the worker sheds one more level
+  of work, and it steps back once an interval stays below the target.
+  Truncated replies are a few dozen bytes without a lookup, so the worker
+  keeps answering at line rate and real clients still get through over
+  TCP, instead of the socket buffer overflowing and dropping at random.
+  When the cost of a datagram is mostly the system calls, truncating
+  everything buys no capacity and only sends clients to TCP: an interval
+  of it that is not clearly cheaper per datagram falls back a level and
+  the next try waits OVERLOAD_BACKOFF seconds.
+*/
+class OverloadControl {
+public:
+  OverloadControl();
+
+  /*
+    Queueing delay of one datagram in nanoseconds. Receive timestamps are
+    wall clock time, so a delay that is negative or too long for any queue
+    comes from the clock being set and is left out.
+  */
+  void sample(int64_t delay) {
+    if (delay < 0 || delay > OVERLOAD_MAX_DELAY * 1000000000LL)
+      return;
+    minimum = std::min(minimum, delay);
+    maximum = std::max(maximum, delay);
+  }
+
+  /* Datagrams the kernel has dropped for the socket so far, from SO_RXQ_OVFL */
+  void overflow(uint32_t total);
+
+  /* Once per batch, `now` in nanoseconds of CLOCK_MONOTONIC: ends the interval when it is over and returns the level to shed at */
+  ShedLevel update(int64_t now);
+
+  /* A batch of `packets` datagrams took `busy` nanoseconds from receive to send */
+  void served(int packets, int64_t busy) {
+    this->packets += packets;
+    this->busy += busy;
+  }
+
+  /* A query answered with TC instead of its answer */
+  void truncated() {
+    shed++;
+  }
+
+private:
+  ShedLevel level;
+  int64_t   intervalEnd;
+  int64_t   reportEnd;
+  int64_t   probeAfter; /* when SHED_ALL may be tried again */
+  int64_t   packets;    /* datagrams served in the interval */
+  int64_t   busy;       /* and the time it took */
+  int64_t   cost;       /* time per datagram of the last interval at SHED_EXPENSIVE */
+  int64_t   minimum;    /* smallest delay of the interval */
+  int64_t   maximum;    /* largest delay since the last report */
+  uint32_t  kernel;     /* last SO_RXQ_OVFL total seen */
+  bool      known;      /* kernel holds a total */
+  uint64_t  dropped;    /* datagrams the kernel dropped in the interval */
+  uint64_t  lost;       /* and since the last report */
+  uint64_t  shed;       /* queries shed since the last report */
+  uint64_t  overloaded; /* intervals over target since the last report */
+
+  void report(int64_t now);
+};
+
+#endif /* __OVERLOAD_HPP__ */
@@ -0,0 +1,118 @@
+#ifndef __POLICY_HPP__
+#define __POLICY_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db.hpp"
+#include "mappedfile.hpp"
+
+#define POLICY_MAGIC      "DNSDSET1" // first bytes of a compiled name set
+#define POLICY_BLOCK_SIZE 16         // names front coded after each full one
+#define POLICY_TTL        60         // TTL of sinkhole answers
+
+/* What a name set entry covers */
+#define POLICY_SELF  1 /* the name itself */
+#define POLICY_BELOW 2 /* every name below it */
+
+/*
+  Read-only set of domain names compiled into one position independent
+  image, so a compiled set can be mapped straight from disk. Names are kept
+  as sort keys (see orderKey()) in canonical order and front coded: every
+  POLICY_BLOCK_SIZE names start over with a full key, the names in between
+  only store the bytes that differ from the one before. A lookup binary
+  searches the block heads and decodes a single block. The image is smaller
+  than the list text, where a tree would spend a node per label.
+*/
+class NameSet {
+public:
+  /* Image of the `entries` (canonical name, POLICY_ flags), duplicates have their flags merged */
+  static std::vector<uint8_t> compile(std::vector<std::pair<std::string, uint8_t>> &&entries);
+
+  /* Use the image at `data`, which must outlive the set; false if it is not a valid image */
+  bool open(const uint8_t *data, size_t size);
+
+  /* True if the canonical `name` or one of its ancestors covers it */
+  bool contains(std::string_view name) const;
+
+  size_t size() const;
+
+private:
+  const uint8_t  *data    = nullptr;
+  size_t          length  = 0;
+  uint32_t        count   = 0;
+  uint32_t        blocks  = 0;
+  const uint32_t *offsets = nullptr; /* of each block, from the start of the image */
+
+  std::vector<uint64_t> prefixes; /* first bytes of each block head, searched before the heads themselves */
+
+  std::string_view head(uint32_t block) const;
+  uint8_t          flags(std::string_view key, uint32_t &first) const;
+};
+
+enum class PolicyAction {
+  NXDOMAIN,
+  NODATA,
+  SINKHOLE,
+};
+
+/* One blocklist: the names, what to answer for them and how often that happened */
+struct PolicyList {
+  std::string            path;
+  PolicyAction           action;
+  std::vector<DNSRecord> sinkholes; /* A and AAAA records answered instead */
+  NameSet                names;
+  std::vector<uint8_t>   image; /* when built in memory */
+  MappedFile             map;   /* when mapped from the compiled file */
+  std::atomic<uint64_t>  hits = 0;
+};
+
+/*
+  Response policy layer checked before the zones. Lists are plain text, one
+  name per line or hosts file style, `*.name` blocks only the names below
+  `name` and a plain name blocks the name and everything below it. The first
+  load compiles a list into `<list>.set` next to it, later loads map that
+  image as long as it is newer than the list. All lists are swapped at once
+  on reload; workers pin them like the zone, once per packet or batch.
+*/
+class Policy {
+public:
+  static Policy &getInstance();
+
+  /* Comma separated `file[=action]`, action is nxdomain (default), nodata or sinkhole addresses joined by `+` */
+  bool configure(const std::string &spec);
+
+  /* Reread every list and swap them in together, the running ones stay if one fails */
+  bool reload();
+
+  bool enabled() const;
+  void pin();
+
+  /* First list blocking the canonical `name`, nullptr if none does */
+  const PolicyList *match(std::string_view name);
+
+private:
+  struct ListSpec {
+    std::string            path;
+    PolicyAction           action;
+    std::vector<DNSRecord> sinkholes;
+  };
+
+  typedef std::vector<std::shared_ptr<PolicyList>> ListSet;
+
+  std::vector<ListSpec>                       specs;
+  std::atomic<std::shared_ptr<const ListSet>> current;
+
+  Policy();
+  Policy(const Policy &)            = delete;
+  Policy &operator=(const Policy &) = delete;
+
+  std::shared_ptr<PolicyList> load(const ListSpec &spec);
+};
+
+#endif /* __POLICY_HPP__ */
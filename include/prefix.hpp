@@ -0,0 +1,60 @@
+#ifndef __PREFIX_HPP__
+#define __PREFIX_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+#define PREFIX_MAX_VALUE  0x7fff // values share the table entries with the group flag
+#define PREFIX_TBL8_GROUP 0x8000 // tbl24 entry points at a group of 256 tbl8 entries
+
+/*
+  Longest prefix match of client addresses to small non-zero values, 0 when
+  no prefix covers the address. IPv4 uses a DIR-24-8 table: one entry per
+  /24, and prefixes longer than /24 get a group of 256 entries the /24 entry
+  points at, so a lookup is one or two memory reads. IPv6 uses a trie with
+  8 bit strides and prefix expansion, at most 16 steps for the few prefixes
+  a view usually lists.
+
+  Prefixes are collected with add() and the tables built once by compile(),
+  after which the matcher is read only and safe to share between threads.
+*/
+class PrefixMatcher {
+public:
+  /* `prefix` is address/length or a single address, IPv4 or IPv6; false if it does not parse */
+  bool add(const std::string &prefix, uint16_t value);
+
+  /* Build the tables; false if longer than /24 IPv4 prefixes need more groups than an entry can address */
+  bool compile();
+
+  uint16_t lookup(uint32_t address) const; /* network byte order */
+  uint16_t lookup(const struct in6_addr &address) const;
+
+  size_t size() const;
+
+private:
+  struct Prefix {
+    uint8_t  address[16];
+    uint8_t  length;
+    uint16_t value;
+  };
+
+  struct Node6 {
+    uint32_t child[256]; /* 0 for none, the root is never a child */
+    uint16_t value[256]; /* longest prefix ending within this byte */
+  };
+
+  std::vector<Prefix>   prefixes4;
+  std::vector<Prefix>   prefixes6;
+  std::vector<uint16_t> tbl24;
+  std::vector<uint16_t> tbl8;
+  std::vector<Node6>    nodes6;
+  uint16_t              default6 = 0; /* value of ::/0 */
+};
+
+/* Parse address/length or a single address into `address` with the host bits cleared, IPv4 uses the first 4 bytes */
+bool parsePrefix(const std::string &text, uint8_t address[16], uint8_t &length, bool &v4);
+
+#endif /* __PREFIX_HPP__ */
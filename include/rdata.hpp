@@ -0,0 +1,59 @@
+#ifndef __RDATA_HPP__
+#define __RDATA_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+  Conversion between the presentation form of resource records, as written
+  in the zone file, and the wire form kept in the zone store. Names inside
+  RDATA are stored uncompressed.
+*/
+
+/* Numeric value of a type or class mnemonic (also TYPEnnn / CLASSnnn), -1 if unknown */
+int typeValue(std::string_view name);
+int classValue(std::string_view name);
+
+/* Append the uncompressed wire form of a dotted name */
+bool encodeName(std::string_view name, std::vector<uint8_t> &out);
+
+/* Read a possibly compressed name from a message, `offset` ends up after the name as it appears in place */
+bool decodeName(const uint8_t *data, size_t size, size_t &offset, std::string &name);
+
+/*
+  Read the resource record at `offset` of a message. The owner is returned
+  canonical and names inside well-known RDATA are decompressed, so the
+  result can go into the zone store as is.
+*/
+bool decodeRecord(
+    const uint8_t *data, size_t size, size_t &offset, std::string &name, uint16_t &type, uint16_t &rclass, uint32_t &ttl,
+    std::vector<uint8_t> &rdata
+);
+
+/* Wire form of the RDATA given by its presentation fields, false if malformed or unsupported */
+bool encodeRdata(uint16_t type, const std::vector<std::string_view> &fields, std::vector<uint8_t> &rdata);
+
+/* Lowercase the names embedded in `rdata` in place, the canonical form DNSSEC signs (RFC 4034 6.2) */
+void canonicalRdata(uint16_t type, std::vector<uint8_t> &rdata);
+
+/* Fields following the names of a wire-form SOA RDATA, 0 if the RDATA is malformed */
+#define SOA_SERIAL  0
+#define SOA_REFRESH 1
+#define SOA_RETRY   2
+#define SOA_EXPIRE  3
+#define SOA_MINIMUM 4
+
+uint32_t soaField(const std::vector<uint8_t> &rdata, int field);
+uint32_t soaSerial(const std::vector<uint8_t> &rdata);
+void     setSoaSerial(std::vector<uint8_t> &rdata, uint32_t serial);
+
+/* Decode exactly `length` bytes from `text`, which must be twice as many hex digits */
+bool parseHex(std::string_view text, uint8_t *out, size_t length);
+
+/* True if `name` equals `zone` or lies below it, both canonical */
+bool isSubdomain(std::string_view name, std::string_view zone);
+
+#endif /* __RDATA_HPP__ */
@@ -0,0 +1,55 @@
+#ifndef __SECONDARY_HPP__
+#define __SECONDARY_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <thread>
+
+#define SECONDARY_REFRESH 3600 // seconds between checks until the zone's SOA says otherwise
+#define SECONDARY_RETRY   300  // seconds before retrying a failed check
+#define TRANSFER_TIMEOUT  30   // seconds a transfer may stall before it is abandoned
+
+/*
+  Keeps the zone in sync with a primary server. The SOA serial is checked
+  every refresh interval and whenever the primary sends a NOTIFY. Newer
+  versions are pulled with IXFR and applied change by change to the live
+  store, with AXFR as the fallback. Queries keep being answered from the
+  previous version throughout.
+*/
+class Secondary {
+public:
+  Secondary();
+  ~Secondary();
+
+  /* `primary` is an IPv4 address with an optional :port */
+  bool configure(const std::string &zone, const std::string &primary, int defaultPort);
+
+  void start();
+  void stop();
+
+  /* NOTIFY received from `source`, false if it does not come from the primary */
+  bool notify(uint32_t source);
+
+private:
+  std::string             zone;
+  struct sockaddr_in      primaryAddr;
+  std::atomic<bool>       running;
+  std::thread             secondaryThread;
+  std::mutex              mutex;
+  std::condition_variable wakeup;
+  bool                    notified;
+  uint32_t                refreshInterval;
+  uint32_t                retryInterval;
+
+  void run();
+  bool refresh();
+  int  connectPrimary();
+  bool querySerial(int fd, uint32_t &serial);
+  bool transfer(int fd, uint16_t qtype, uint32_t serial);
+};
+
+#endif /* __SECONDARY_HPP__ */
@@ -0,0 +1,155 @@
+#ifndef __STEERING_HPP__
+#define __STEERING_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "db.hpp"
+#include "mappedfile.hpp"
+
+#define GEO_MAGIC               "DNSDGEO1" // first bytes of a compiled prefix to region table
+#define STEERING_MAX_RECORDS    64         // records of one RRset considered, one bit each
+#define STEERING_CHECK_INTERVAL 10         // seconds between health checks of an endpoint
+#define STEERING_CHECK_TIMEOUT  1000       // milliseconds a TCP connect may take before the endpoint counts as down
+
+/* One prefix of a GeoIP table, IPv4 prefixes mapped into IPv6 (::ffff:0:0/96) */
+struct GeoPrefix {
+  uint8_t     address[16];
+  uint8_t     length;
+  std::string region;
+};
+
+/*
+  Read-only table from client address to region, compiled into one position
+  independent image that can be mapped straight from disk. Nested prefixes
+  are flattened into the sorted start addresses of ranges that each have
+  one region, so a lookup is a binary search over 16 byte keys.
+*/
+class GeoTable {
+public:
+  static std::vector<uint8_t> compile(std::vector<GeoPrefix> &&prefixes);
+
+  /* Use the image at `data`, which must outlive the table; false if it is not a valid image */
+  bool open(const uint8_t *data, size_t size);
+
+  /* Region of `address` (IPv6 or IPv4 mapped) counted from 1, 0 if no prefix covers it */
+  uint16_t lookup(const uint8_t address[16]) const;
+
+  std::vector<std::string> regions() const;
+  size_t                   size() const;
+
+private:
+  const uint8_t  *starts      = nullptr; /* 16 bytes per range */
+  const uint16_t *values      = nullptr;
+  const uint8_t  *names       = nullptr; /* length prefixed region names */
+  size_t          length      = 0;
+  uint32_t        ranges      = 0;
+  uint32_t        regionCount = 0;
+};
+
+/* TCP connect check of an endpoint, shared between versions of the configuration so its state survives a reload */
+struct HealthCheck {
+  std::string             target; /* address:port */
+  struct sockaddr_storage address;
+  socklen_t               addressLength;
+  std::atomic<bool>       up = true;
+};
+
+/* An address of a steered RRset and how to treat it */
+struct Endpoint {
+  uint8_t                      rdata[16];
+  uint8_t                      rdlength;
+  uint32_t                     weight;
+  int                          region; /* index into SteeringSet::regions, -1 for none */
+  std::shared_ptr<HealthCheck> check;  /* nullptr when never checked */
+};
+
+struct SteeringPool {
+  std::vector<Endpoint>         endpoints;
+  mutable std::atomic<uint32_t> cursor = 0; /* weighted round robin position */
+};
+
+/* One version of the steering configuration, never modified once published */
+struct SteeringSet {
+  std::unordered_map<std::string, SteeringPool, NameHash, NameEqual> pools;
+  std::vector<std::string>                                           regions;
+  std::vector<float>                                                 distances; /* km between regions, regions.size() squared */
+  GeoTable                                                           geo;
+  MappedFile                                                         geoMap;
+  std::vector<uint8_t>                                               geoImage;
+  std::vector<int>                                                   geoRegions; /* steering region of each geo table region */
+  std::vector<std::shared_ptr<HealthCheck>>                          checks;
+};
+
+/*
+  Traffic steering of A and AAAA answers. The steering file lists
+  endpoints, the addresses of zone RRsets, with a weight, a region and an
+  optional TCP port to check:
+
+    geo geoip.txt
+    region eu 50.1 8.7
+    region us 39.0 -77.5
+    www.example.com 192.0.2.1 weight 3 region eu check 80
+    www.example.com 198.51.100.1 region us
+
+  A query for a listed name gets one record of the RRset. Endpoints that
+  fail their check are left out, unless all of them do. A client located
+  through the GeoIP table (`prefix region` lines, compiled next to it as
+  `<file>.map`) by its address or EDNS Client Subnet gets the endpoints
+  nearest to its region. The rest is weighted round robin. Addresses of the
+  RRset that are not listed count as weight 1 without region or check.
+
+  Selection reads the pinned configuration and atomics only. Checks run on
+  a thread of their own.
+*/
+class Steering {
+public:
+  static Steering &getInstance();
+
+  bool configure(const std::string &path);
+
+  /* Reread the steering file and the GeoIP table, the running ones stay if that fails */
+  bool reload();
+
+  bool enabled() const;
+  void pin();
+
+  void start();
+  void stop();
+
+  /*
+    Record of `records` to answer a `type` query for `name` with, nullptr
+    if the name is not steered. `client` is the address or subnet of the
+    client, IPv4 mapped into IPv6; `located` is set when its region decided.
+  */
+  const DNSRecord *select(const NameKey &name, const std::vector<DNSRecord> &records, uint16_t type, const uint8_t client[16], bool &located);
+
+private:
+  std::string                                     path;
+  std::atomic<std::shared_ptr<const SteeringSet>> current;
+  std::thread                                     prober;
+  std::mutex                                      mutex;
+  std::condition_variable                         wakeup;
+  bool                                            running;
+
+  Steering();
+  ~Steering();
+  Steering(const Steering &)            = delete;
+  Steering &operator=(const Steering &) = delete;
+
+  std::shared_ptr<SteeringSet> load();
+  bool                         loadGeo(SteeringSet &set, const std::string &file);
+
+  void runProber();
+  bool probe(const HealthCheck &check);
+};
+
+#endif /* __STEERING_HPP__ */
@@ -0,0 +1,23 @@
+#ifndef __STREAM_HPP__
+#define __STREAM_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define MAX_STREAM_MESSAGE 65535 // largest message behind the two byte length
+
+/*
+  Blocking helpers for DNS over stream sockets, where every message is
+  preceded by its length (RFC 1035 4.2.2). Sockets are expected to have a
+  short SO_RCVTIMEO so reads can notice shutdown and enforce `timeout`, and
+  a short SO_SNDTIMEO so a peer that stops reading cannot hold a write
+  past its `timeout`.
+*/
+bool readFull(int fd, uint8_t *buffer, size_t length, const std::atomic<bool> &running, int timeout);
+bool writeFull(int fd, const uint8_t *buffer, size_t length, int timeout);
+
+bool readMessage(int fd, uint8_t *buffer, size_t capacity, size_t &length, const std::atomic<bool> &running, int timeout);
+bool writeMessage(int fd, const uint8_t *message, size_t length, int timeout);
+
+#endif /* __STREAM_HPP__ */
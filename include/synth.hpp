@@ -0,0 +1,175 @@
+#ifndef __SYNTH_HPP__
+#define __SYNTH_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "name.hpp"
+
+class Arena;
+struct DNSAnswer;
+struct DNSQuery;
+struct DNSRecord;
+
+/* Number put in place of `$` by a $GENERATE template, ${offset,width,base} in BIND syntax */
+struct RangeNumber {
+  int32_t offset;
+  uint8_t width; /* padded with zeros up to it */
+  char    base;  /* d, o, x or X */
+
+  bool operator==(const RangeNumber &other) const = default;
+};
+
+/* Text of a $GENERATE template: literal pieces with a number between each two */
+struct RangeTemplate {
+  std::vector<std::string> literals; /* one more than numbers */
+  std::vector<RangeNumber> numbers;
+
+  /* Split `text` at its `$` and `${...}` placeholders, `\$` stays a literal */
+  static bool parse(std::string_view text, RangeTemplate &out, std::string &error);
+
+  void render(uint32_t value, std::string &out) const;
+
+  bool operator==(const RangeTemplate &other) const = default;
+};
+
+/*
+  Owner of synthesized names: one placeholder in the first label, between
+  `prefix` and `suffix`, below the canonical `parent`
+*/
+struct RangeOwner {
+  std::string parent;
+  std::string prefix;
+  std::string suffix;
+
+  /* Owner of the template of an absolute name, false unless it has one placeholder and that is in the first label */
+  static bool parse(const RangeTemplate &name, RangeOwner &out, RangeNumber &number);
+
+  bool operator==(const RangeOwner &other) const = default;
+};
+
+/* Records of one $GENERATE line, at the owners of first, first + step, ... up to last */
+struct GeneratedRange {
+  RangeOwner                 owner;
+  RangeNumber                number; /* of the owner */
+  uint32_t                   first;
+  uint32_t                   last;
+  uint32_t                   step;
+  uint16_t                   type;
+  uint16_t                   rclass;
+  uint32_t                   ttl;
+  std::vector<RangeTemplate> rdata; /* one per field, names already absolute */
+
+  bool operator==(const GeneratedRange &other) const = default;
+};
+
+/*
+  A network from one $SYNTHESIZE line. Each address gets a forward name, the
+  address written with dashes in place of the owner placeholder such as
+  host-192-0-2-1.example.net or host-2001-db8--1.example.net, answering
+  A or AAAA, and a PTR record back to it under in-addr.arpa or ip6.arpa.
+*/
+struct SynthesizedNetwork {
+  RangeOwner owner;
+  uint8_t    first[16]; /* IPv4 mapped into IPv6, so the bytes compare in address order */
+  uint8_t    last[16];
+  bool       v4;
+  uint32_t   ttl;
+
+  bool operator==(const SynthesizedNetwork &other) const = default;
+};
+
+/* Receives each record of RangeIndex::expand() under its canonical owner, returns false to stop */
+typedef std::function<bool(std::string_view owner, const DNSRecord &record)> RangeSink;
+
+/* What the ranges hold at a name, see RangeIndex::lookup() */
+enum RangeMatch {
+  RANGE_NONE,  /* nothing, the name does not exist as far as the ranges go */
+  RANGE_EMPTY, /* no records, but synthesized names lie below it */
+  RANGE_NAME   /* a synthesized name, answers of the query type or its CNAME appended if it has any */
+};
+
+/*
+  Records computed at query time from $GENERATE and $SYNTHESIZE lines of
+  the zone file instead of being stored one by one, so a line covers
+  millions of names in the memory of its descriptor.
+
+  Forward names are found by their parent: the first label is matched
+  against the prefixes below that parent, only at the prefix lengths some
+  owner there uses, and the number or address in between is parsed. The
+  ranges of an owner and the networks are each sorted by their start with
+  the running maximum of their ends alongside, so the ones covering a
+  value are found by a binary search and a short walk back even when they
+  overlap. A name also has to come out of its number exactly as rendered,
+  so every synthesized record has a single owner spelling.
+
+  Built once with the zone and read only afterwards.
+*/
+class RangeIndex {
+public:
+  /* nullptr when there is nothing to index */
+  static std::shared_ptr<const RangeIndex> build(std::vector<GeneratedRange> &&generated, std::vector<SynthesizedNetwork> &&networks);
+
+  /*
+    Answers to `query` synthesized at its name, with their RDATA carved out
+    of `arena`. Static records of the zone take precedence, so it is only
+    consulted for names the zone does not hold.
+  */
+  RangeMatch lookup(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const;
+
+  /*
+    Every record synthesized at names that may lie in the zone at `apex`,
+    written out for zone transfers: those below the parent of an owner and
+    the PTR records under in-addr.arpa or ip6.arpa. Which zone a name falls
+    in is left to `sink`. False when the sink stopped.
+  */
+  bool expand(std::string_view apex, const RangeSink &sink) const;
+
+  /* Records expand() gives for `apex`, UINT64_MAX when there are more */
+  uint64_t expandedSize(std::string_view apex) const;
+
+  size_t generatedSize() const;
+  size_t networkSize() const;
+
+  bool operator==(const RangeIndex &other) const;
+
+private:
+  /* Owners below one parent with the same prefix that differ only in their number */
+  struct Pattern {
+    std::string suffix;
+    RangeNumber number;
+    size_t      begin; /* their ranges in `generated` */
+    size_t      end;
+    bool        networks; /* networks use the plain `$` form of the owner */
+  };
+
+  struct Parent {
+    uint64_t                                                                  lengths = 0; /* bit n set when a prefix is n bytes long */
+    std::unordered_map<std::string, std::vector<Pattern>, NameHash, NameEqual> prefixes;
+  };
+
+  std::vector<GeneratedRange>                                  generated;    /* by owner and number, then first */
+  std::vector<uint32_t>                                        reach;        /* greatest `last` of the pattern up to each range */
+  std::vector<SynthesizedNetwork>                              networks;     /* by first */
+  std::vector<std::array<uint8_t, 16>>                         networkReach; /* greatest `last` up to each network */
+  std::unordered_map<std::string, Parent, NameHash, NameEqual> parents;
+  std::unordered_set<std::string, NameHash, NameEqual>         nonTerminals; /* parents and the names above them */
+
+  RangeMatch matchForward(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const;
+  RangeMatch matchReverse(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const;
+
+  /* Call `found` with each network overlapping [first, last] */
+  template<typename Function>
+  void overlapping(const uint8_t *first, const uint8_t *last, Function found) const;
+};
+
+#endif /* __SYNTH_HPP__ */
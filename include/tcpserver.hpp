@@ -0,0 +1,49 @@
+#ifndef __TCPSERVER_HPP__
+#define __TCPSERVER_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+/*
+  DNS over TCP (RFC 7766). Serves regular queries, mostly retries of
+  truncated UDP answers, and zone transfers to the allowed clients. Each
+  connection gets its own thread, up to MAX_TCP_CONNECTIONS.
+*/
+class TCPServer {
+public:
+  TCPServer(int port);
+  ~TCPServer();
+
+  void start();
+  void stop();
+
+  void setPort(int port);
+
+  /* Comma separated IPv4 addresses allowed to transfer the zone */
+  bool setTransferClients(const std::string &clients);
+
+  /* Serve on `fd`, a bound socket taken over from a running instance, instead of binding one; see Handoff */
+  void setSocket(int fd);
+  /* The bound socket while serving, -1 otherwise */
+  int getSocket() const;
+
+private:
+  int                     port;
+  std::atomic<bool>       running;
+  std::atomic<int>        listenfd;
+  std::atomic<int>        connections;
+  std::mutex              clientsMutex;
+  std::unordered_set<int> clients; /* sockets of the open connections, shut down by stop() once the drain runs out */
+  std::thread             serverThread;
+  std::vector<uint32_t>   transferClients;
+
+  void run();
+  void serveConnection(int clientfd, uint32_t clientAddr, uint16_t clientPort);
+};
+
+#endif /* __TCPSERVER_HPP__ */
@@ -0,0 +1,46 @@
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Fixed set of worker threads for CPU-bound batch jobs such as signing a
+  zone. parallelFor() splits [0, count) into chunks handed out to the
+  workers and to the calling thread, and returns once all are done.
+*/
+class ThreadPool {
+public:
+  /* 0 picks one thread per CPU */
+  ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  size_t size() const;
+
+  void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)> &body);
+
+private:
+  std::vector<std::thread>                   workers;
+  std::mutex                                 mutex;
+  std::condition_variable                    wakeup;
+  std::condition_variable                    finished;
+  const std::function<void(size_t, size_t)> *job;
+  size_t                                     count;
+  size_t                                     chunk;
+  size_t                                     next;    /* first index not handed out yet */
+  size_t                                     pending; /* indexes not finished yet */
+  bool                                       stopping;
+  std::mutex                                 callerMutex; /* one parallelFor() at a time */
+
+  ThreadPool(const ThreadPool &)            = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void run();
+  bool work();
+};
+
+#endif /* __THREADPOOL_HPP__ */
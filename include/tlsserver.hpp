@@ -0,0 +1,88 @@
+#ifndef __TLSSERVER_HPP__
+#define __TLSSERVER_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef struct ssl_st     SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+class Arena;
+
+#define TLS_PORT            853
+#define TLS_MAX_CONNECTIONS 16384 // open connections, most of them idle
+#define TLS_IDLE_TIMEOUT    30    // seconds without traffic before closing
+
+/*
+  DNS over TLS (RFC 7858). One thread multiplexes all connections with
+  epoll, so an idle connection costs its socket, its SSL object and a few
+  bytes of state: OpenSSL drops its record buffers between reads
+  (SSL_MODE_RELEASE_BUFFERS) and partial messages are kept only while they
+  are incomplete. Clients resume with stateless session tickets, so
+  reconnects skip the key exchange and the server keeps no session cache.
+  When the kernel supports it, record encryption is offloaded to kTLS.
+
+  Queries go through the same pipeline as UDP; updates, notifies and zone
+  transfers are refused.
+*/
+class TLSServer {
+public:
+  TLSServer(int port);
+  ~TLSServer();
+
+  /* PEM certificate chain and private key, `key` may be empty when the certificate file holds it */
+  bool configure(const std::string &certificate, const std::string &key);
+  bool enabled() const;
+
+  void start();
+  void stop();
+
+  void setPort(int port);
+
+  /* Serve on `fd`, a bound socket taken over from a running instance, instead of binding one; see Handoff */
+  void setSocket(int fd);
+  /* The bound socket while serving, -1 otherwise */
+  int getSocket() const;
+
+private:
+  struct Connection {
+    int                  fd;
+    SSL                 *ssl;
+    uint32_t             address;    /* network byte order */
+    uint16_t             port;       /* network byte order */
+    int64_t              lastActive; /* steady clock seconds */
+    bool                 handshaken;
+    bool                 wantWrite;  /* OpenSSL waits for the socket to become writable */
+    uint32_t             events;     /* registered with epoll */
+    size_t               written;    /* bytes of `output` already sent */
+    std::vector<uint8_t> input;      /* incomplete message, usually empty */
+    std::vector<uint8_t> output;     /* answers the socket did not take yet, usually empty */
+  };
+
+  int                                 port;
+  std::atomic<bool>                   running;
+  std::atomic<int>                    listenfd;
+  std::thread                         serverThread;
+  SSL_CTX                            *context;
+  int                                 epollfd;
+  std::unordered_map<int, Connection> connections;
+  std::vector<uint8_t>                readBuffer;
+  std::vector<uint8_t>                response;
+  size_t                              offloaded; /* connections that got kTLS */
+
+  void run();
+  void acceptConnections(int listenfd);
+  bool serve(Connection &connection, Arena &arena);
+  bool consume(Connection &connection, const uint8_t *data, size_t length, size_t &used, Arena &arena);
+  void send(Connection &connection, const uint8_t *data, size_t length);
+  bool flush(Connection &connection);
+  void watch(Connection &connection);
+  void closeConnection(int fd);
+};
+
+#endif /* __TLSSERVER_HPP__ */
@@ -0,0 +1,120 @@
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_BUCKETS   160 // quarter octaves of nanoseconds, the last one collects everything above 18 minutes
+#define TRACE_SLOW_RATE 10  // slow queries each worker logs per second, the rest are only counted
+
+/* Where the time of a UDP query goes, in the order it passes the stages */
+enum TraceStage {
+  STAGE_QUEUE,     /* in the socket buffer, from the kernel receive timestamp to recvmmsg() */
+  STAGE_BATCH,     /* waiting for the other datagrams of its batch, before and after its own turn */
+  STAGE_PARSE,     /* DNS::parseDNS() */
+  STAGE_LOOKUP,    /* up to the end of the lookup in DNS::buildDNSResponse() */
+  STAGE_SERIALIZE, /* writing the reply */
+  STAGE_SEND,      /* sendmmsg() of the batch */
+  STAGE_COUNT
+};
+
+/* Cycle counter on x86, the monotonic clock in nanoseconds elsewhere */
+inline uint64_t traceTicks() {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/* Stage times of one query, in ticks except the queueing time */
+struct QueryTrace {
+  uint64_t last;
+  uint64_t spent[STAGE_COUNT];
+  int64_t  queued; /* nanoseconds */
+
+  void start(uint64_t now, int64_t queue) {
+    last   = now;
+    queued = queue;
+    for (uint64_t &stage : spent) {
+      stage = 0;
+    }
+  }
+
+  /* Charge the time since the previous mark to `stage` */
+  void mark(TraceStage stage, uint64_t now = traceTicks()) {
+    spent[stage] += now - last;
+    last = now;
+  }
+};
+
+/*
+  Stage histograms of one worker thread. Only the owner writes them, with
+  relaxed atomics that compile to plain loads and stores, so a dump reads
+  them without stopping it.
+*/
+struct TraceWorker {
+  std::atomic<uint64_t> histogram[STAGE_COUNT + 1][TRACE_BUCKETS] = {}; /* the last row holds the totals */
+  int64_t               second                                    = 0;  /* of the slow queries logged */
+  uint32_t              logged                                    = 0;
+  uint64_t              unlogged                                  = 0;  /* slow queries past TRACE_SLOW_RATE since the last logged one */
+};
+
+/*
+  Per-stage latency of UDP queries, opt-in with -T. Each stage is timed
+  with the cycle counter and counted into histograms of the worker; the
+  socket queueing time comes from the kernel receive timestamp. Queries
+  slower than the threshold are logged with their stage breakdown, at most
+  TRACE_SLOW_RATE a second per worker. When off, the UDP loop skips it all
+  on one flag per batch and the DNS object on a null pointer.
+*/
+class Tracer {
+public:
+  static Tracer &getInstance();
+
+  /* Trace queries and log those slower than `threshold` microseconds */
+  void configure(int threshold);
+
+  bool enabled() const;
+
+  /* Histograms of the calling thread, created on first use and kept after it exits */
+  TraceWorker &worker();
+
+  /*
+    Count a finished query and return whether it is slow and due for the
+    log; `unlogged` is then set to the slow ones skipped since the last
+  */
+  bool record(TraceWorker &worker, const QueryTrace &trace, int64_t second, uint64_t &unlogged) const;
+
+  /* `line` with the total and the stages of `trace` appended */
+  std::string describe(const std::string &line, const QueryTrace &trace) const;
+
+  /* Log the percentiles of every stage since startup, summed over the workers */
+  void dump();
+
+private:
+  bool                                      active;
+  double                                    nsPerTick;
+  uint64_t                                  slow; /* threshold in nanoseconds */
+  std::mutex                                mutex;
+  std::vector<std::shared_ptr<TraceWorker>> workers;
+
+  Tracer();
+  Tracer(const Tracer &)            = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  uint64_t nanoseconds(const QueryTrace &trace, int stage) const;
+};
+
+#endif /* __TRACE_HPP__ */
@@ -2,7 +2,34 @@
 #define __UDPSERVER_HPP__
 
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <netinet/in.h>
 #include <thread>
+#include <vector>
+
+/* Called with the source address of a NOTIFY, returns false to refuse it */
+typedef std::function<bool(uint32_t source)> NotifyHandler;
+
+class DNS;
+
+/*
+  The query processing of the UDP server without its socket, also driven
+  by the pcap replay bench. Answers `packet`, parsed from the `length`
+  bytes at `data` sent by `address` (network byte order), into `reply`,
+  which holds EDNS_PAYLOAD_SIZE bytes, and returns the reply length.
+  `shed` answers without a lookup: BADCOOKIE with a fresh cookie to
+  clients that sent one, TC to the rest. It is cleared for clients whose
+  server cookie proves their address, those are answered in full. A reply
+  to an update must wait until the journal reaches `ticket`, which is 0 for
+  other replies.
+*/
+size_t answerDatagram(DNS &packet, const uint8_t *data, size_t length, uint32_t address, uint8_t *reply, bool &shed, const NotifyHandler &notify, uint64_t &ticket);
 
 class UDPServer {
 public:
@@ -13,13 +40,37 @@ public:
   void stop();
 
   void setPort(int port);
+  void setNotifyHandler(NotifyHandler handler);
+
+  /* Serve on `fd`, a bound socket taken over from a running instance, instead of binding one; see Handoff */
+  void setSocket(int fd);
+  /* The bound socket while serving, -1 otherwise */
+  int getSocket() const;
 
 private:
+  /* Reply to an update, held until the journal has the change on disk */
+  struct Acknowledgement {
+    uint64_t             ticket;
+    struct sockaddr_in   address;
+    struct timespec      received;
+    std::vector<uint8_t> query; /* for dnstap */
+    std::vector<uint8_t> reply;
+  };
+
   int               port;
   std::atomic<bool> running;
+  std::atomic<int>  listenfd;
   std::thread       serverThread;
+  NotifyHandler     notifyHandler;
+
+  /* the worker hands replies to updates to a thread of their own, so no query waits for the disk */
+  std::mutex                  ackMutex;
+  std::condition_variable     ackReady;
+  std::deque<Acknowledgement> acks;
+  bool                        acknowledging;
 
   void run();
+  void runAcknowledger(int sockfd);
 };
 
 #endif /* __UDPSERVER_HPP__ */
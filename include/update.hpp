@@ -0,0 +1,48 @@
+#ifndef __UPDATE_HPP__
+#define __UPDATE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "db.hpp"
+#include "dns.hpp"
+
+/*
+  Processes RFC 2136 UPDATE messages. Prerequisites are checked and the
+  update section is applied against the live zone in one step under the DB
+  writer lock; the resulting change bumps the SOA serial, lands in the
+  write-ahead log and is journaled for IXFR like any other change.
+*/
+class ZoneUpdate {
+public:
+  /* Comma separated IPv4 addresses allowed to send updates */
+  static bool setClients(const std::string &clients);
+  static bool allowed(uint32_t client);
+
+  ZoneUpdate();
+
+  /* `request` is the raw message `update` was parsed from, returns the RCODE of the reply */
+  uint16_t process(const uint8_t *request, size_t size, const DNS &update);
+
+  /* What DB::waitDurable() needs before the reply goes out, 0 if nothing changed */
+  uint64_t ticket() const;
+
+private:
+  std::string                 zone;
+  uint16_t                    zclass;
+  std::vector<ResourceRecord> prerequisites;
+  std::vector<ResourceRecord> updates;
+  RecordMap                   names; /* tentative state of the names touched so far */
+  uint64_t                    durableTicket;
+
+  std::vector<DNSRecord> &lookup(const ZoneData &data, const std::string &name);
+
+  uint16_t checkPrerequisites(const ZoneData &data);
+  uint16_t prescan() const;
+  void     applyUpdate(const ZoneData &data, const ResourceRecord &rr);
+  uint16_t build(const ZoneData &data, ZoneChange &change);
+};
+
+#endif /* __UPDATE_HPP__ */
@@ -0,0 +1,52 @@
+#ifndef __VIEW_HPP__
+#define __VIEW_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db.hpp"
+#include "prefix.hpp"
+
+/*
+  Split horizon: each view is a zone file served to the clients in its
+  list of prefixes, clients outside every view get the main zone. The view
+  of a packet is picked by longest prefix match over all views, so a /24
+  in one view wins over the /8 of another. View zones are read only, loaded
+  at startup and on SIGHUP and swapped in together; workers pin them like
+  the main zone, once per packet or batch.
+*/
+class Views {
+public:
+  static Views &getInstance();
+
+  /* Comma separated `file=prefix+prefix`, prefixes are IPv4 or IPv6 address/length */
+  bool configure(const std::string &spec);
+
+  /* Reread every view zone and swap them in together, the running ones stay if one fails */
+  bool reload();
+
+  bool enabled() const;
+  void pin();
+
+  /* Zone of the view a client belongs to, nullptr for the main zone */
+  const ZoneData *select(uint32_t address); /* network byte order */
+  const ZoneData *select(const struct in6_addr &address);
+
+private:
+  typedef std::vector<std::shared_ptr<const ZoneData>> ZoneSet;
+
+  std::vector<std::string>                    files;
+  PrefixMatcher                               matcher; /* value n selects files[n - 1] */
+  std::atomic<std::shared_ptr<const ZoneSet>> current;
+
+  Views();
+  Views(const Views &)            = delete;
+  Views &operator=(const Views &) = delete;
+
+  const ZoneData *zoneOf(uint16_t view);
+};
+
+#endif /* __VIEW_HPP__ */
@@ -0,0 +1,81 @@
+#ifndef __WAL_HPP__
+#define __WAL_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "db.hpp"
+
+#define WAL_COMPACT_SIZE (16 << 20) // journal bytes that trigger a new snapshot
+
+/*
+  Append-only journal of zone changes. append() only queues the encoded
+  change; a background thread writes and fsyncs whatever has accumulated
+  in one go, so concurrent writers share the cost of a sync. Callers wait
+  for their ticket with waitDurable() before acknowledging a change.
+
+  Entries are length prefixed and checksummed. A torn tail left by a crash
+  is cut off when the journal is opened again.
+*/
+class WriteAheadLog {
+public:
+  /* Called for every intact entry while opening, returning false stops the replay */
+  typedef std::function<bool(ZoneChange &&change)> ReplayHandler;
+
+  WriteAheadLog();
+  ~WriteAheadLog();
+
+  bool open(const std::string &path, const ReplayHandler &replay);
+  bool isOpen() const;
+
+  /* Queue a change, returns the ticket to wait for */
+  uint64_t append(const ZoneChange &change);
+
+  /* Block until the change of `ticket` and all before it are on disk, false after an I/O error */
+  bool waitDurable(uint64_t ticket);
+
+  /* Whether waitDurable(ticket) would return right away */
+  bool settled(uint64_t ticket) const;
+
+  /* Logical end of the journal, pending entries included */
+  uint64_t position() const;
+  uint64_t size() const;
+
+  /* Drop everything before `position` once a snapshot covers it */
+  bool truncate(uint64_t position);
+
+private:
+  std::string             path;
+  int                     fd;
+  mutable std::mutex      mutex;
+  std::mutex              fileMutex; /* held while the file itself is written or swapped */
+  std::condition_variable pendingReady;
+  std::condition_variable durableReady;
+  std::vector<uint8_t>    pending;
+  uint64_t                appended; /* tickets handed out */
+  uint64_t                durable;  /* tickets known to be on disk */
+  uint64_t                base;     /* logical position of the first byte in the file */
+  uint64_t                written;  /* logical position of the end of the file */
+  bool                    failed;
+  bool                    running;
+  std::thread             flusher;
+
+  WriteAheadLog(const WriteAheadLog &)            = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  void run();
+  void flush();
+  void close();
+};
+
+/* Whole-zone image the journal is compacted into, written atomically next to it */
+bool                      writeSnapshot(const std::string &path, const ZoneData &zone);
+std::shared_ptr<ZoneData> readSnapshot(const std::string &path);
+
+#endif /* __WAL_HPP__ */
@@ -0,0 +1,47 @@
+#ifndef __XDPSERVER_HPP__
+#define __XDPSERVER_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "udpserver.hpp"
+
+/*
+  Optional AF_XDP receive and transmit path for UDP queries, next to the
+  socket based UDPServer. An XDP program on the interface steers IPv4 UDP
+  datagrams for our port on one receive queue into the rings of an AF_XDP
+  socket; everything else, and everything while no socket is bound,
+  passes on to the kernel stack and the UDP server. Queries are parsed
+  straight from the UMEM frame they arrived in, and the reply is written
+  back into that frame behind swapped Ethernet, IPv4 and UDP headers.
+*/
+class XDPServer {
+public:
+  XDPServer(int port);
+  ~XDPServer();
+
+  /* Serve the queries arriving on `spec`, interface[:queue] with queue 0 by default */
+  bool configure(const std::string &spec);
+  bool enabled() const;
+
+  void start();
+  void stop();
+
+  void setPort(int port);
+  void setNotifyHandler(NotifyHandler handler);
+
+private:
+  int               port;
+  std::string       interface;
+  unsigned          ifindex;
+  uint32_t          queue;
+  std::atomic<bool> running;
+  std::thread       serverThread;
+  NotifyHandler     notifyHandler;
+
+  void run();
+};
+
+#endif /* __XDPSERVER_HPP__ */
@@ -0,0 +1,64 @@
+#ifndef __XFR_HPP__
+#define __XFR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db.hpp"
+#include "dns.hpp"
+
+#define XFR_MESSAGE_SIZE    65535     // largest message a TCP frame can carry
+#define XFR_MAX_SYNTHESIZED (1 << 20) // records of $GENERATE and $SYNTHESIZE lines a full transfer writes out
+
+/* Receives each finished message, returns false to abort the transfer */
+typedef std::function<bool(const uint8_t *message, size_t length)> MessageSink;
+
+/*
+  Serves AXFR (RFC 5936) and IXFR (RFC 1995) requests for any zone of the
+  store. The zone is walked in canonical order straight from a snapshot of
+  the store and packed into as many messages as needed, each filled up to
+  64 kB with compressed owner names, so nothing larger than one message is
+  ever built. Records synthesized from $GENERATE and $SYNTHESIZE lines
+  follow as plain records, so a secondary answers the same names; a zone
+  whose lines stand for more than XFR_MAX_SYNTHESIZED of them is refused
+  rather than sent without them. IXFR replays the DB journal of the
+  primary zone and falls back to a full transfer when the journal does not
+  reach back to the client's serial, or for the other zones.
+*/
+class ZoneTransfer {
+public:
+  ZoneTransfer(MessageSink sink);
+
+  /* `request` is the raw message `query` was parsed from */
+  bool serve(const uint8_t *request, size_t size, const DNS &query);
+
+private:
+  MessageSink             sink;
+  std::vector<uint8_t>    buffer;
+  PacketWriter            writer;
+  NameCompressor          compressor;
+  uint16_t                transactionId;
+  const DNSQuery         *question;
+  uint16_t                ancount;
+  bool                    failed;
+  std::deque<std::string> owners; /* of synthesized records, until the message compressed against them is sent */
+
+  bool sendError(uint16_t rcode);
+  void beginMessage(bool withQuestion);
+  bool flush();
+  bool addRecord(std::string_view name, const DNSRecord &record);
+  bool addSynthesized(std::string_view name, const DNSRecord &record);
+
+  bool sendFull(const ZoneData &zone, const ZoneEntry &entry, const DNSRecord &soa);
+  bool sendIncremental(const ZoneData &zone, const DNSRecord &soa, const std::vector<std::shared_ptr<const ZoneChange>> &changes);
+};
+
+/* Serial of the SOA in the authority section of an IXFR request, false if there is none */
+bool requestedSerial(const uint8_t *request, size_t size, uint32_t &serial);
+
+#endif /* __XFR_HPP__ */
@@ -0,0 +1,38 @@
+#ifndef __ZONELOADER_HPP__
+#define __ZONELOADER_HPP__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "db.hpp"
+
+#define LOADER_CHUNK_SIZE        (4 << 20) // smallest piece of the zone file parsed by one thread
+#define LOADER_MAX_ERRORS        20        // malformed entries reported one by one, the rest are only counted
+#define LOADER_MAX_INCLUDE_DEPTH 8         // $INCLUDE nesting, stops include loops
+
+/*
+  Load a zone file in RFC 1035 master file syntax using every CPU: $ORIGIN,
+  $TTL, $INCLUDE, @, relative names, omitted owners, TTLs and classes,
+  parentheses and quoted strings. Names start relative to the root, so
+  plain `name ttl class type rdata` lines keep working.
+
+  The file is mapped into memory and a quick scan cuts it into chunks at
+  entries with an owner, noting the directives in effect there. Each chunk
+  is tokenized in place, without iostreams, into its own arena of
+  wire-format records. The arenas are then merged shard by shard into the
+  zone and its name index. $GENERATE and $SYNTHESIZE lines stay compact
+  descriptors in the RangeIndex of the zone instead of being expanded.
+
+  Malformed entries, unknown types and types without a presentation
+  parser (RFC 3597 \# RDATA works for any type) are reported with their
+  line number and skipped. Returns nullptr when the file cannot be read
+  at all, or in strict mode when any entry was skipped. `threads` 0 uses
+  one thread per CPU.
+*/
+std::shared_ptr<ZoneData> loadZoneFile(const std::string &filename, size_t threads = 0);
+
+/* Strict mode: a zone file with an entry that cannot be loaded is refused as a whole, the live zone stays */
+void setStrictLoading(bool strict);
+
+#endif /* __ZONELOADER_HPP__ */
@@ -0,0 +1,84 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/* block payload starts right after the header, suitably aligned */
+#define BLOCK_HEADER    ((sizeof(Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1))
+#define BLOCK_DATA(blk) ((char *)(blk) + BLOCK_HEADER)
+
+Arena::Arena(size_t blockSize): blockSize(blockSize), head(nullptr), current(nullptr), cursor(nullptr), end(nullptr) {
+  head = current = grow(0, alignof(std::max_align_t));
+  cursor         = BLOCK_DATA(head);
+  end            = cursor + head->size;
+}
+
+Arena::~Arena() {
+  while (head != nullptr) {
+    Block *next = head->next;
+    std::free(head);
+    head = next;
+  }
+}
+
+void Arena::reset() {
+  current = head;
+  cursor  = BLOCK_DATA(head);
+  end     = cursor + head->size;
+}
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for (Block *block = head; block != nullptr; block = block->next) {
+    total += block->size;
+  }
+  return total;
+}
+
+/* Allocate a block able to hold `bytes`, only happens while the arena warms up */
+Arena::Block *Arena::grow(size_t bytes, size_t alignment) {
+  size_t size  = std::max(blockSize, bytes + alignment);
+  Block *block = (Block *)std::malloc(BLOCK_HEADER + size);
+  if (block == nullptr)
+    throw std::bad_alloc();
+
+  block->next = nullptr;
+  block->size = size;
+  return block;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+  while (true) {
+    uintptr_t aligned = ((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned + bytes <= (uintptr_t)end) {
+      cursor = (char *)(aligned + bytes);
+      return (void *)aligned;
+    }
+
+    /* reuse the blocks kept from earlier packets before asking for a new one */
+    Block *next = current->next;
+    if (next == nullptr || next->size < bytes + alignment) {
+      Block *block  = grow(bytes, alignment);
+      block->next   = next;
+      current->next = block;
+      next          = block;
+    }
+
+    current = next;
+    cursor  = BLOCK_DATA(current);
+    end     = cursor + current->size;
+  }
+}
+
+void Arena::do_deallocate(void *ptr, size_t bytes, size_t alignment) {
+  /* memory is reclaimed by reset() */
+  (void)ptr;
+  (void)bytes;
+  (void)alignment;
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
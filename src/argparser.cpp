@@ -64,8 +64,10 @@ std::string Option<bool>::getHelp() const {
 ArgParser::ArgParser(const std::string &appname, const std::string &description): appname(appname), description(description) {}
 
 ArgParser::~ArgParser() {
+  /* every option is listed under its short and its long name */
   for (auto &pair : options) {
-    delete pair.second;
+    if (pair.first == pair.second->getLongName())
+      delete pair.second;
   }
 }
 
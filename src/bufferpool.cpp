@@ -0,0 +1,34 @@
+#include "bufferpool.hpp"
+
+#define BUFFER_ALIGN 64 // keep every buffer on its own cache lines
+
+BufferPool::BufferPool(size_t count, size_t bufferSize): size((bufferSize + BUFFER_ALIGN - 1) & ~(size_t)(BUFFER_ALIGN - 1)) {
+  storage.resize(count * size + BUFFER_ALIGN);
+  freeList.reserve(count);
+
+  uint8_t *base = storage.data() + (BUFFER_ALIGN - (uintptr_t)storage.data() % BUFFER_ALIGN) % BUFFER_ALIGN;
+  for (size_t i = count; i > 0; --i) {
+    freeList.push_back(base + (i - 1) * size);
+  }
+}
+
+uint8_t *BufferPool::acquire() {
+  if (freeList.empty())
+    return nullptr;
+
+  uint8_t *buffer = freeList.back();
+  freeList.pop_back();
+  return buffer;
+}
+
+void BufferPool::release(uint8_t *buffer) {
+  freeList.push_back(buffer);
+}
+
+size_t BufferPool::bufferSize() const {
+  return size;
+}
+
+size_t BufferPool::available() const {
+  return freeList.size();
+}
@@ -0,0 +1,181 @@
+#include "cookie.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "rdata.hpp"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return le64toh(value);
+}
+
+static inline void sipRound(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) {
+  v0 += v1;
+  v1 = ROTL(v1, 13);
+  v1 ^= v0;
+  v0 = ROTL(v0, 32);
+  v2 += v3;
+  v3 = ROTL(v3, 16);
+  v3 ^= v2;
+  v0 += v3;
+  v3 = ROTL(v3, 21);
+  v3 ^= v0;
+  v2 += v1;
+  v1 = ROTL(v1, 17);
+  v1 ^= v2;
+  v2 = ROTL(v2, 32);
+}
+
+uint64_t siphash24(const uint8_t *key, const uint8_t *data, size_t length) {
+  uint64_t k0 = load64(key);
+  uint64_t k1 = load64(key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+  const uint8_t *end = data + (length & ~(size_t)7);
+  for (; data != end; data += 8) {
+    uint64_t m = load64(data);
+    v3 ^= m;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  uint64_t last = (uint64_t)length << 56;
+  for (size_t i = 0; i < (length & 7); ++i) {
+    last |= (uint64_t)data[i] << (8 * i);
+  }
+  v3 ^= last;
+  sipRound(v0, v1, v2, v3);
+  sipRound(v0, v1, v2, v3);
+  v0 ^= last;
+
+  v2 ^= 0xff;
+  for (int i = 0; i < 4; ++i) {
+    sipRound(v0, v1, v2, v3);
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+Cookies &Cookies::getInstance() {
+  static Cookies instance;
+  return instance;
+}
+
+Cookies::Cookies() : generation(1) {
+  if (getrandom(master, sizeof(master), 0) != sizeof(master)) {
+    Logger::getInstance().error("Cannot generate a cookie secret: " + std::string(strerror(errno)));
+  }
+}
+
+bool Cookies::loadSecret(const std::string &path) {
+  Logger &logger = Logger::getInstance();
+  uint8_t secret[sizeof(master)];
+
+  std::ifstream file(path);
+  if (file.is_open()) {
+    std::string text;
+    file >> text;
+    if (!parseHex(text, secret, sizeof(secret))) {
+      logger.error("Cookie secret " + path + " is not 32 hex digits");
+      return false;
+    }
+  } else {
+    if (getrandom(secret, sizeof(secret), 0) != sizeof(secret)) {
+      logger.error("Cannot generate a cookie secret: " + std::string(strerror(errno)));
+      return false;
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string       text;
+    for (uint8_t byte : secret) {
+      text.push_back(digits[byte >> 4]);
+      text.push_back(digits[byte & 15]);
+    }
+    text.push_back('\n');
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || write(fd, text.data(), text.size()) != (ssize_t)text.size() || fsync(fd) < 0) {
+      logger.error("Cannot write cookie secret " + path + ": " + std::string(strerror(errno)));
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    close(fd);
+    logger.info("Generated a new cookie secret in " + path);
+  }
+
+  std::memcpy(master, secret, sizeof(master));
+  std::memset(secret, 0, sizeof(secret));
+  generation++;
+  return true;
+}
+
+const uint8_t *Cookies::secret(uint32_t period) const {
+  /* a cookie is checked against the current or the previous period, two slots hit almost always */
+  struct Slot {
+    uint32_t generation;
+    uint32_t period;
+    uint8_t  key[16];
+  };
+  static thread_local Slot slots[2];
+
+  Slot &slot = slots[period & 1];
+  if (slot.generation != generation || slot.period != period) {
+    uint8_t input[4];
+    std::memcpy(input, &period, sizeof(input));
+    uint64_t halves[2] = {siphash24(master, input, sizeof(input)), 0};
+    input[0] ^= 0xff;
+    halves[1] = siphash24(master, input, sizeof(input));
+    std::memcpy(slot.key, halves, sizeof(slot.key));
+    slot.generation = generation;
+    slot.period     = period;
+  }
+  return slot.key;
+}
+
+uint64_t Cookies::hash(const uint8_t *clientCookie, const uint8_t *serverCookie, uint32_t address, const uint8_t *key) const {
+  /* RFC 9018: client cookie | version | reserved | timestamp | client address */
+  uint8_t input[COOKIE_CLIENT_SIZE + 8 + 4];
+  std::memcpy(input, clientCookie, COOKIE_CLIENT_SIZE);
+  std::memcpy(input + COOKIE_CLIENT_SIZE, serverCookie, 8);
+  std::memcpy(input + COOKIE_CLIENT_SIZE + 8, &address, 4);
+  return siphash24(key, input, sizeof(input));
+}
+
+void Cookies::generate(const uint8_t *clientCookie, uint32_t address, uint32_t now, uint8_t *serverCookie) const {
+  serverCookie[0] = COOKIE_VERSION;
+  serverCookie[1] = serverCookie[2] = serverCookie[3] = 0;
+  serverCookie[4] = now >> 24;
+  serverCookie[5] = now >> 16;
+  serverCookie[6] = now >> 8;
+  serverCookie[7] = now;
+
+  uint64_t value = htole64(hash(clientCookie, serverCookie, address, secret(now / COOKIE_ROTATE)));
+  std::memcpy(serverCookie + 8, &value, sizeof(value));
+}
+
+bool Cookies::verify(const uint8_t *clientCookie, const uint8_t *serverCookie, size_t length, uint32_t address, uint32_t now) const {
+  if (length != COOKIE_SERVER_SIZE || serverCookie[0] != COOKIE_VERSION)
+    return false;
+
+  uint32_t stamp = (uint32_t)serverCookie[4] << 24 | (uint32_t)serverCookie[5] << 16 | (uint32_t)serverCookie[6] << 8 | serverCookie[7];
+  /* serial number arithmetic, the timestamp wraps in 2106 */
+  int32_t  age   = (int32_t)(now - stamp);
+  if (age > COOKIE_LIFETIME || age < -COOKIE_SKEW)
+    return false;
+
+  return load64(serverCookie + 8) == hash(clientCookie, serverCookie, address, secret(stamp / COOKIE_ROTATE));
+}
@@ -1,75 +1,769 @@
 #include "db.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <string>
 
+#include "dns.hpp"
+#include "dnssec.hpp"
 #include "logger.hpp"
+#include "rdata.hpp"
+#include "synth.hpp"
+#include "wal.hpp"
+#include "zoneloader.hpp"
+
+static thread_local std::shared_ptr<const ZoneData> pinned;
 
 DB &DB::getInstance(std::string filename) {
   static DB instance(filename);
   return instance;
 }
 
-std::optional<std::vector<DNSRecord>> DB::get(std::string name) {
-  auto it = records.find(name);
-  if (it != records.end()) {
-    return it->second;
+void DB::pin() {
+  pinned = current.load(std::memory_order_acquire);
+}
+
+const std::vector<DNSRecord> *DB::get(const NameKey &key) const {
+  if (!pinned)
+    pinned = current.load(std::memory_order_acquire);
+
+  return pinned->find(key);
+}
+
+const ZoneData &DB::zone() const {
+  if (!pinned)
+    pinned = current.load(std::memory_order_acquire);
+
+  return *pinned;
+}
+
+const std::vector<DNSRecord> *DB::get(std::string_view name) const {
+  std::string canonical = canonicalName(name);
+  return get(NameKey{canonical, hashName(canonical)});
+}
+
+std::shared_ptr<const NameIndex> NameIndex::build(std::vector<std::string> &&keys) {
+  auto index = std::make_shared<NameIndex>();
+
+  if (!std::is_sorted(keys.begin(), keys.end()))
+    std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  index->count = keys.size();
+  for (size_t begin = 0; begin < keys.size(); begin += INDEX_CHUNK_SIZE) {
+    size_t end = std::min(keys.size(), begin + INDEX_CHUNK_SIZE);
+    index->chunks.push_back(
+        std::make_shared<Chunk>(std::make_move_iterator(keys.begin() + begin), std::make_move_iterator(keys.begin() + end))
+    );
   }
-  return std::nullopt;
+  return index;
 }
 
-inline std::string removeComment(const std::string &line) {
-  size_t pos = line.find(';');
-  return (pos != std::string::npos) ? line.substr(0, pos) : line;
+/* First chunk whose last key is not below `key`, chunks.size() if there is none */
+size_t NameIndex::chunkFor(std::string_view key) const {
+  auto it = std::lower_bound(chunks.begin(), chunks.end(), key, [](const std::shared_ptr<const Chunk> &chunk, std::string_view key) {
+    return chunk->back() < key;
+  });
+  return it - chunks.begin();
 }
 
-DB::DB(std::string filename) {
-  Logger &logger = Logger::getInstance();
+std::shared_ptr<const NameIndex> NameIndex::update(std::vector<std::string> &&added, std::vector<std::string> &&removed) const {
+  auto next = std::make_shared<NameIndex>(*this); // shares every chunk for now
 
-  std::string   line;
-  std::ifstream configFile(filename);
+  std::unordered_map<size_t, Chunk *> copied;
+  auto chunkAt = [&](size_t i) -> Chunk & {
+    auto it = copied.find(i);
+    if (it != copied.end())
+      return *it->second;
 
-  if (!configFile.is_open()) {
-    logger.error("Cann't reading config file: " + std::string(strerror(errno)));
-    exit(EXIT_FAILURE);
+    auto chunk      = std::make_shared<Chunk>(*next->chunks[i]);
+    next->chunks[i] = chunk;
+    copied[i]       = chunk.get();
+    return *chunk;
+  };
+
+  /* additions first, no chunk is empty while they look for their place */
+  for (auto &key : added) {
+    if (next->chunks.empty())
+      next->chunks.push_back(std::make_shared<Chunk>());
+
+    size_t i     = std::min(next->chunkFor(key), next->chunks.size() - 1);
+    Chunk &chunk = chunkAt(i);
+    auto   it    = std::lower_bound(chunk.begin(), chunk.end(), key);
+    if (it == chunk.end() || *it != key) {
+      chunk.insert(it, std::move(key));
+      next->count++;
+    }
   }
 
-  while (std::getline(configFile, line)) {
-    line = removeComment(line);
-    std::stringstream ss(line);
-    std::string       domain;
-    DNSRecord         dnsrecord;
+  for (const auto &key : removed) {
+    size_t i = next->chunkFor(key);
+    if (i == next->chunks.size())
+      continue;
 
-    if (!(ss >> domain))
+    Chunk &chunk = chunkAt(i);
+    auto   it    = std::lower_bound(chunk.begin(), chunk.end(), key);
+    if (it != chunk.end() && *it == key) {
+      chunk.erase(it);
+      next->count--;
+    }
+  }
+
+  /* drop emptied chunks and split the ones that grew too large */
+  std::vector<std::shared_ptr<const Chunk>> chunks;
+  for (size_t i = 0; i < next->chunks.size(); ++i) {
+    auto &chunk = next->chunks[i];
+    if (chunk->empty())
+      continue;
+    if (chunk->size() <= 2 * INDEX_CHUNK_SIZE) {
+      chunks.push_back(std::move(chunk));
       continue;
+    }
+
+    Chunk &full = *copied[i];
+    for (size_t begin = 0; begin < full.size(); begin += INDEX_CHUNK_SIZE) {
+      size_t end = std::min(full.size(), begin + INDEX_CHUNK_SIZE);
+      chunks.push_back(
+          std::make_shared<Chunk>(std::make_move_iterator(full.begin() + begin), std::make_move_iterator(full.begin() + end))
+      );
+    }
+  }
+  next->chunks = std::move(chunks);
+  return next;
+}
+
+const std::string *NameIndex::before(std::string_view key) const {
+  size_t i = chunkFor(key);
+  if (i == chunks.size())
+    return chunks.empty() ? nullptr : &chunks.back()->back();
+
+  const Chunk &chunk = *chunks[i];
+  auto         it    = std::lower_bound(chunk.begin(), chunk.end(), key);
+  if (it != chunk.begin())
+    return &*(it - 1);
+  return i > 0 ? &chunks[i - 1]->back() : nullptr;
+}
+
+const std::string *NameIndex::after(std::string_view key) const {
+  auto next = std::upper_bound(chunks.begin(), chunks.end(), key, [](std::string_view key, const std::shared_ptr<const Chunk> &chunk) {
+    return key < chunk->back();
+  });
+  if (next == chunks.end())
+    return nullptr;
+
+  return &*std::upper_bound((*next)->begin(), (*next)->end(), key);
+}
+
+size_t NameIndex::size() const {
+  return count;
+}
+
+static size_t countLabels(std::string_view name) {
+  return name.empty() ? 0 : 1 + std::count(name.begin(), name.end(), '.');
+}
+
+bool hasType(const std::vector<DNSRecord> *records, uint16_t type) {
+  return records && std::any_of(records->begin(), records->end(), [type](const DNSRecord &record) { return record.type == type; });
+}
+
+/* Entry of the zone at `apex`, nullptr if it has no SOA there */
+static std::shared_ptr<const ZoneEntry> makeEntry(const ZoneData &zone, const std::string &apex) {
+  const auto *records = zone.find(apex);
+  if (!hasType(records, T_SOA))
+    return nullptr;
 
-    int tempTTL;
-    if (ss >> tempTTL) {
-      dnsrecord.ttl = tempTTL;
-    } else {
-      ss.clear();
+  auto entry  = std::make_shared<ZoneEntry>();
+  entry->apex = apex;
+
+  uint32_t ttl    = 0;
+  auto     append = [&](std::vector<uint8_t> &out, const DNSRecord &record) {
+    encodeName(apex, out);
+    for (uint32_t value : {(uint32_t)record.type << 16 | record.rclass, ttl}) {
+      out.insert(out.end(), {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value});
     }
+    out.insert(out.end(), {(uint8_t)(record.rdata.size() >> 8), (uint8_t)record.rdata.size()});
+    out.insert(out.end(), record.rdata.begin(), record.rdata.end());
+  };
 
-    if (!(ss >> dnsrecord.recordclass >> dnsrecord.type >> dnsrecord.value))
+  for (const auto &record : *records) {
+    if (record.type != T_SOA)
       continue;
+    ttl = std::min(record.ttl, soaField(record.rdata, SOA_MINIMUM));
+    append(entry->negative[0], record);
+    break;
+  }
+  entry->negative[1]      = entry->negative[0];
+  entry->negativeCount[0] = entry->negativeCount[1] = 1;
 
-    records[domain].push_back(dnsrecord);
+  for (const auto &record : *records) {
+    if (record.type == T_RRSIG && rrsigCovered(record.rdata) == T_SOA) {
+      append(entry->negative[1], record);
+      entry->negativeCount[1]++;
+    }
   }
+  return entry;
+}
+
+std::shared_ptr<const ZoneRegistry> ZoneRegistry::build(const ZoneData &zone, const std::vector<std::string> &apexes) {
+  auto registry = std::make_shared<ZoneRegistry>();
+  for (const auto &apex : apexes) {
+    if (auto entry = makeEntry(zone, apex))
+      registry->entries[apex] = std::move(entry);
+  }
+  registry->countDepths();
+  return registry;
+}
+
+std::shared_ptr<const ZoneRegistry> ZoneRegistry::update(const ZoneData &zone, const std::vector<std::string> &names) const {
+  auto next = std::make_shared<ZoneRegistry>(*this);
+  for (const auto &name : names) {
+    if (auto entry = makeEntry(zone, name))
+      next->entries[name] = std::move(entry);
+    else
+      next->entries.erase(name);
+  }
+  next->countDepths();
+  return next;
+}
+
+void ZoneRegistry::countDepths() {
+  depths = 0;
+  for (const auto &[apex, entry] : entries) {
+    depths |= 1ULL << std::min<size_t>(countLabels(apex), 63);
+  }
+}
+
+const ZoneEntry *ZoneRegistry::find(const NameKey &name) const {
+  size_t start = 0;
+  for (size_t labels = countLabels(name.name);; --labels) {
+    if (depths >> std::min<size_t>(labels, 63) & 1) {
+      std::string_view suffix = name.name.substr(start);
+      auto             it     = entries.find(NameKey{suffix, start == 0 ? name.hash : hashName(suffix)});
+      if (it != entries.end())
+        return it->second.get();
+    }
+    if (labels == 0)
+      return nullptr;
+
+    size_t dot = name.name.find('.', start);
+    start      = dot == std::string_view::npos ? name.name.size() : dot + 1;
+  }
+}
+
+bool ZoneRegistry::contains(const std::string &apex) const {
+  return entries.count(apex) > 0;
+}
+
+bool ZoneRegistry::empty() const {
+  return entries.empty();
+}
+
+size_t ZoneRegistry::size() const {
+  return entries.size();
+}
+
+std::shared_ptr<ZoneData> ZoneData::build(RecordMap &&records) {
+  std::vector<std::string> keys, apexes;
+  keys.reserve(records.size());
+  for (const auto &entry : records) {
+    keys.push_back(orderKey(entry.first));
+    if (hasType(&entry.second, T_SOA))
+      apexes.push_back(entry.first);
+  }
+
+  size_t count = MIN_ZONE_SHARDS;
+  while (count * NAMES_PER_SHARD < records.size()) {
+    count *= 2;
+  }
+
+  std::vector<std::shared_ptr<RecordMap>> shards;
+  for (size_t i = 0; i < count; ++i) {
+    shards.push_back(std::make_shared<RecordMap>());
+  }
+
+  auto zone    = std::make_shared<ZoneData>();
+  zone->index  = NameIndex::build(std::move(keys));
+  zone->serial = 0;
+  zone->shards.resize(count);
+
+  while (!records.empty()) {
+    auto node = records.extract(records.begin());
+    shards[hashName(node.key()) >> 32 & (count - 1)]->insert(std::move(node));
+  }
+  for (size_t i = 0; i < count; ++i) {
+    zone->shards[i] = std::move(shards[i]);
+  }
+  zone->zones = ZoneRegistry::build(*zone, apexes);
+  return zone;
+}
+
+size_t ZoneData::shardIndex(uint64_t hash) const {
+  /* the low bits already pick the bucket inside the shard */
+  return hash >> 32 & (shards.size() - 1);
+}
+
+const std::vector<DNSRecord> *ZoneData::find(const NameKey &key) const {
+  const RecordMap &shard = *shards[shardIndex(key.hash)];
+
+  auto it = shard.find(key);
+  if (it != shard.end()) {
+    return &it->second;
+  }
+  return nullptr;
+}
+
+const std::vector<DNSRecord> *ZoneData::find(std::string_view name) const {
+  return find(NameKey{name, hashName(name)});
+}
+
+size_t ZoneData::size() const {
+  size_t total = 0;
+  for (const auto &shard : shards) {
+    total += shard->size();
+  }
+  return total;
+}
+
+std::shared_ptr<const ZoneData> DB::snapshot() const {
+  return current.load(std::memory_order_acquire);
+}
+
+DB::DB(std::string filename): filename(filename), journalRecords(0), compactRequested(false), stopping(false) {
+  /* secondaries start empty and get their data from the primary; only a reload may keep serving after a bad file */
+  auto zone = filename.empty() ? ZoneData::build(RecordMap()) : loadZoneFile(filename);
+  if (!zone) {
+    Logger::getInstance().error("Cannot start without the db file " + filename);
+    exit(EXIT_FAILURE);
+  }
+
+  if (!filename.empty())
+    openJournal(zone);
+
+  /* signatures we made before a restart are kept until they come due */
+  Signer &signer = Signer::getInstance();
+  if (signer.enabled() && !filename.empty()) {
+    zone = signer.signZone(*zone, zone.get());
+    if (!zone)
+      exit(EXIT_FAILURE);
+    clearJournal();
+  }
+
+  publish(zone);
+  if (wal)
+    compactor = std::thread(&DB::runCompactor, this);
+  if (signer.enabled() && !filename.empty())
+    resigner = std::thread(&DB::runResigner, this);
+}
+
+DB::~DB() {
+  {
+    std::lock_guard<std::mutex> lock(compactMutex);
+    stopping = true;
+  }
+  compactWakeup.notify_all();
+  resignWakeup.notify_all();
+  if (compactor.joinable())
+    compactor.join();
+  if (resigner.joinable())
+    resigner.join();
+}
+
+/* Bring `zone` up to date with the snapshot and journal of dynamic updates kept next to the db file */
+void DB::openJournal(std::shared_ptr<ZoneData> &zone) {
+  Logger &logger = Logger::getInstance();
+
+  auto saved = readSnapshot(filename + ".snap");
+  if (saved && saved->apex == zone->apex && (int32_t)(saved->serial - zone->serial) >= 0) {
+    logger.info("Starting from the snapshot of dynamic updates at serial " + std::to_string(saved->serial));
+    saved->ranges = zone->ranges; // updates only change records
+    zone          = saved;
+  } else if (saved) {
+    logger.info("Db file is newer than the snapshot of dynamic updates, starting from the db file");
+  }
+
+  wal        = std::make_unique<WriteAheadLog>();
+  bool ok    = wal->open(filename + ".jnl", [&](ZoneChange &&change) {
+    /* already part of the snapshot or of a newer db file */
+    if ((int32_t)(change.toSerial - zone->serial) <= 0)
+      return true;
+
+    if (change.fromSerial != zone->serial) {
+      logger.warn("Journal skips from serial " + std::to_string(zone->serial) + " to " + std::to_string(change.fromSerial) + ", ignoring the rest");
+      return false;
+    }
 
-  //   for (const auto &[domain, record] : records) {
-  //     std::cout << "Domain: " << domain << std::endl;
-  //     for (const auto &r : record) {
-  //       std::cout << "    TTL: " << (r.ttl ? std::to_string(*r.ttl) : "N/A")
-  //                 << std::endl
-  //                 << "  Class: " << r.recordclass << std::endl
-  //                 << "   Type: " << r.type << std::endl
-  //                 << "  Value: " << r.value << std::endl;
-  //     }
-  //   }
+    zone = zone->withChange(change);
+    record(std::make_shared<ZoneChange>(std::move(change)));
+    return true;
+  });
 
-  configFile.close();
+  if (!ok) {
+    logger.warn("Dynamic updates are disabled");
+    wal.reset();
+    return;
+  }
+
+  /* fold whatever was replayed or skipped into a fresh snapshot */
+  compactRequested = wal->size() > 0;
+}
+
+void DB::publish(std::shared_ptr<ZoneData> data) {
+  current.store(std::move(data), std::memory_order_release);
+}
+
+/* Records present in `from` but not in `to` */
+static void collectMissing(const ZoneData &from, const ZoneData &to, std::vector<ResourceRecord> &out) {
+  for (const auto &shard : from.shards) {
+    for (const auto &[name, records] : *shard) {
+      auto other = to.find(NameKey{name, hashName(name)});
+      for (const auto &record : records) {
+        if (other == nullptr || std::find(other->begin(), other->end(), record) == other->end())
+          out.push_back(ResourceRecord{name, record});
+      }
+    }
+  }
+}
+
+bool DB::reload() {
+  Logger                     &logger = Logger::getInstance();
+  std::lock_guard<std::mutex> lock(writerMutex);
+
+  if (filename.empty()) {
+    logger.warn("Zone comes from the primary, nothing to reload");
+    return false;
+  }
+
+  auto zone = loadZoneFile(filename);
+  if (!zone)
+    return false;
+
+  auto old = snapshot();
+  if (Signer::getInstance().enabled() && !(zone = Signer::getInstance().signZone(*zone, old.get())))
+    return false;
+  if (wal && zone->apex == old->apex && (int32_t)(zone->serial - old->serial) < 0) {
+    logger.warn(
+        "Db file serial " + std::to_string(zone->serial) + " is behind the live zone at " + std::to_string(old->serial)
+        + " after dynamic updates, raise it to reload"
+    );
+    return false;
+  }
+
+  auto change = std::make_shared<ZoneChange>();
+
+  change->fromSerial = old->serial;
+  change->toSerial   = zone->serial;
+  collectMissing(*old, *zone, change->removed);
+  collectMissing(*zone, *old, change->added);
+
+  /*
+    $GENERATE and $SYNTHESIZE lines are not records the journal can hold,
+    but transfers write them out, so changing them restarts incremental
+    transfers and secondaries get them with the next full one
+  */
+  bool sameRanges = old->ranges == zone->ranges || (old->ranges && zone->ranges && *old->ranges == *zone->ranges);
+  if (change->removed.empty() && change->added.empty() && sameRanges) {
+    logger.info("Zone unchanged after reload");
+    return true;
+  }
+
+  /* serial arithmetic (RFC 1982), IXFR can only describe forward steps of the same zone */
+  if (!sameRanges) {
+    logger.info("$GENERATE or $SYNTHESIZE lines changed, incremental transfers restart from " + std::to_string(zone->serial));
+    clearJournal();
+  } else if (zone->apex == old->apex && !zone->apex.empty() && (int32_t)(zone->serial - old->serial) > 0) {
+    record(change);
+  } else {
+    logger.warn("Zone changed without a serial increase, incremental transfers restart from " + std::to_string(zone->serial));
+    clearJournal();
+  }
+
+  publish(zone);
+  if (wal)
+    requestCompaction(); // the journal only holds dynamic updates, the snapshot takes the reload
+  logger.info(
+      "Zone reloaded at serial " + std::to_string(zone->serial) + ": " + std::to_string(change->removed.size()) + " removed, "
+      + std::to_string(change->added.size()) + " added"
+  );
+  return true;
+}
+
+std::shared_ptr<ZoneData> ZoneData::withChange(const ZoneChange &change) const {
+  const ZoneData &old  = *this;
+  auto            next = std::make_shared<ZoneData>(old); // shares every shard for now
+
+  std::vector<std::string> touched;
+  std::vector<std::string> soaOwners; /* owners of changed SOA and RRSIG records */
+
+  std::unordered_map<size_t, RecordMap *> copied;
+  auto shardFor = [&](const std::string &name) -> RecordMap & {
+    size_t index = next->shardIndex(hashName(name));
+    auto   it    = copied.find(index);
+    if (it != copied.end())
+      return *it->second;
+
+    auto shard          = std::make_shared<RecordMap>(*old.shards[index]);
+    next->shards[index] = shard;
+    copied[index]       = shard.get();
+    return *shard;
+  };
+
+  for (const auto &rr : change.removed) {
+    RecordMap &shard = shardFor(rr.name);
+    auto       it    = shard.find(rr.name);
+    if (it == shard.end())
+      continue;
+
+    auto &records = it->second;
+    records.erase(std::remove(records.begin(), records.end(), rr.record), records.end());
+    if (rr.record.type == T_SOA || rr.record.type == T_RRSIG)
+      soaOwners.push_back(rr.name);
+    if (records.empty()) {
+      shard.erase(it);
+      touched.push_back(rr.name);
+    }
+  }
+
+  for (const auto &rr : change.added) {
+    auto [it, created] = shardFor(rr.name).try_emplace(rr.name);
+    auto &records      = it->second;
+    if (created)
+      touched.push_back(rr.name);
+    if (std::find(records.begin(), records.end(), rr.record) == records.end())
+      records.push_back(rr.record);
+
+    if (rr.record.type == T_SOA && (next->apex.empty() || next->apex == rr.name)) {
+      next->apex   = rr.name;
+      next->serial = soaSerial(rr.record.rdata);
+    }
+    if (rr.record.type == T_SOA || rr.record.type == T_RRSIG)
+      soaOwners.push_back(rr.name);
+  }
+
+  /* zones that came or went and apexes whose SOA or signatures changed, other changes leave the registry shared */
+  std::vector<std::string> apexes;
+  for (const auto &name : soaOwners) {
+    bool zone = old.zones->contains(name) || hasType(next->find(name), T_SOA);
+    if (zone && std::find(apexes.begin(), apexes.end(), name) == apexes.end())
+      apexes.push_back(name);
+  }
+  if (!apexes.empty())
+    next->zones = old.zones->update(*next, apexes);
+
+  /* names that appeared or disappeared, a name may have done both */
+  std::vector<std::string> added, removed;
+  for (const auto &name : touched) {
+    bool before = old.find(name) != nullptr;
+    bool now    = next->find(name) != nullptr;
+    if (before != now)
+      (now ? added : removed).push_back(orderKey(name));
+  }
+  if (!added.empty() || !removed.empty())
+    next->index = old.index->update(std::move(added), std::move(removed));
+
+  return next;
+}
+
+void ZoneData::bumpSerial(ZoneChange &change) const {
+  const auto *records = find(apex);
+  auto        soa     = std::find_if(records->begin(), records->end(), [](const DNSRecord &record) {
+    return record.type == T_SOA;
+  });
+
+  DNSRecord next = *soa;
+  setSoaSerial(next.rdata, serial + 1);
+  change.removed.push_back(ResourceRecord{apex, *soa});
+  change.added.push_back(ResourceRecord{apex, next});
+}
+
+void DB::commit(const ZoneData &old, std::shared_ptr<ZoneData> next, const ZoneChange &change) {
+  if (!next->apex.empty() && (int32_t)(next->serial - old.serial) > 0 && old.serial == change.fromSerial) {
+    auto journaled        = std::make_shared<ZoneChange>(change);
+    journaled->fromSerial = old.serial;
+    journaled->toSerial   = next->serial;
+    record(journaled);
+  } else if (next->serial != old.serial) {
+    clearJournal();
+  }
+
+  publish(std::move(next));
+}
+
+void DB::apply(const ZoneChange &change) {
+  std::lock_guard<std::mutex> lock(writerMutex);
+
+  auto old = snapshot();
+  commit(*old, old->withChange(change), change);
+}
+
+uint16_t DB::update(const ChangeBuilder &build, uint64_t &ticket) {
+  ticket = 0;
+  if (!wal)
+    return RCODE_REFUSED;
+
+  std::lock_guard<std::mutex> lock(writerMutex);
+
+  auto       old    = snapshot();
+  ZoneChange change = {old->serial, old->serial, {}, {}};
+  uint16_t   rcode  = build(*old, change);
+  if (rcode != RCODE_NOERROR || (change.removed.empty() && change.added.empty()))
+    return rcode;
+
+  Signer &signer  = Signer::getInstance();
+  auto    next    = signer.enabled() ? signer.signChange(*old, change) : old->withChange(change);
+  change.toSerial = next->serial;
+  ticket          = wal->append(change);
+  commit(*old, next, change);
+
+  if (wal->size() >= WAL_COMPACT_SIZE)
+    requestCompaction();
+  return RCODE_NOERROR;
+}
+
+bool DB::waitDurable(uint64_t ticket) {
+  return ticket == 0 || (wal && wal->waitDurable(ticket));
+}
+
+bool DB::settled(uint64_t ticket) const {
+  return ticket == 0 || !wal || wal->settled(ticket);
+}
+
+void DB::requestCompaction() {
+  {
+    std::lock_guard<std::mutex> lock(compactMutex);
+    compactRequested = true;
+  }
+  compactWakeup.notify_one();
+}
+
+void DB::runCompactor() {
+  std::unique_lock<std::mutex> lock(compactMutex);
+
+  while (true) {
+    compactWakeup.wait(lock, [this] { return compactRequested || stopping; });
+    if (stopping)
+      break;
+
+    compactRequested = false;
+    lock.unlock();
+    compact();
+    lock.lock();
+  }
+}
+
+/*
+  Write the live zone as a snapshot and drop the journal entries it covers.
+  Updates keep flowing meanwhile: the position is taken together with the
+  version under the writer lock, so later entries survive the truncation.
+  The snapshot is renamed into place first, replay skips entries it covers.
+*/
+bool DB::compact() {
+  Logger &logger = Logger::getInstance();
+
+  std::shared_ptr<const ZoneData> data;
+  uint64_t                        position;
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    data     = snapshot();
+    position = wal->position();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  if (!writeSnapshot(filename + ".snap", *data)) {
+    logger.error("Cannot write snapshot " + filename + ".snap: " + std::string(strerror(errno)));
+    return false;
+  }
+  if (!wal->truncate(position))
+    return false;
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  logger.info(
+      "Journal compacted into a snapshot at serial " + std::to_string(data->serial) + " (" + std::to_string(data->size())
+      + " names, " + std::to_string(elapsed.count()) + " ms)"
+  );
+  return true;
+}
+
+void DB::runResigner() {
+  std::unique_lock<std::mutex> lock(compactMutex);
+
+  while (!resignWakeup.wait_for(lock, std::chrono::seconds(SIG_CHECK_INTERVAL), [this] { return stopping; })) {
+    lock.unlock();
+    resign();
+    lock.lock();
+  }
+}
+
+/* Re-sign what is coming due as one more change of the zone, so secondaries pick it up by IXFR */
+void DB::resign() {
+  Signer &signer = Signer::getInstance();
+
+  auto names = signer.dueNames(*snapshot());
+  if (names.empty())
+    return;
+
+  uint64_t   ticket = 0;
+  ZoneChange change;
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+
+    auto old = snapshot();
+    change   = {old->serial, old->serial, {}, {}};
+    old->bumpSerial(change);
+
+    auto next       = signer.signChange(*old, change, names);
+    change.toSerial = next->serial;
+    if (wal)
+      ticket = wal->append(change);
+    commit(*old, next, change);
+
+    if (wal && wal->size() >= WAL_COMPACT_SIZE)
+      requestCompaction();
+  }
+
+  if (!waitDurable(ticket))
+    Logger::getInstance().error("Refreshed signatures are not durable");
+  Logger::getInstance().info(
+      "Refreshed signatures of " + std::to_string(names.size()) + " names, serial " + std::to_string(change.toSerial)
+  );
+}
+
+void DB::replace(std::shared_ptr<ZoneData> data) {
+  std::lock_guard<std::mutex> lock(writerMutex);
+
+  clearJournal();
+  publish(std::move(data));
+}
+
+void DB::clearJournal() {
+  std::lock_guard<std::mutex> lock(journalMutex);
+
+  journal.clear();
+  journalRecords = 0;
+}
+
+void DB::record(std::shared_ptr<const ZoneChange> change) {
+  std::lock_guard<std::mutex> lock(journalMutex);
+
+  journalRecords += change->removed.size() + change->added.size();
+  journal.push_back(std::move(change));
+
+  /* keep at least the newest change even if it alone is over the limit */
+  while (journalRecords > JOURNAL_MAX_RECORDS && journal.size() > 1) {
+    journalRecords -= journal.front()->removed.size() + journal.front()->added.size();
+    journal.pop_front();
+  }
+}
+
+bool DB::changesSince(uint32_t serial, std::vector<std::shared_ptr<const ZoneChange>> &changes) const {
+  std::lock_guard<std::mutex> lock(journalMutex);
+
+  changes.clear();
+  for (const auto &change : journal) {
+    if (changes.empty() && change->fromSerial != serial)
+      continue;
+    changes.push_back(change);
+  }
+  return !changes.empty();
 }
@@ -2,35 +2,85 @@
 
 #include <algorithm>
 #include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+#include <ctime>
 #include <iomanip>
 #include <netinet/in.h>
-#include <sstream>
+#include <strings.h>
 
 #include "db.hpp"
-
-template<typename Cont, typename Pred>
-Cont filter(const Cont &container, Pred predicate) {
-  Cont result;
-  std::copy_if(container.begin(), container.end(), std::back_inserter(result), predicate);
-  return result;
+#include "dnssec.hpp"
+#include "name.hpp"
+#include "policy.hpp"
+#include "rdata.hpp"
+#include "steering.hpp"
+#include "synth.hpp"
+#include "trace.hpp"
+#include "view.hpp"
+
+/*
+  Topmost delegation strictly below `apex` at or above `name`, whose own
+  records are `records`. Its owner goes to `cut`, nullptr if there is none.
+*/
+static const std::vector<DNSRecord> *zoneCut(
+    const ZoneData &zone, std::string_view apex, std::string_view name, const std::vector<DNSRecord> *records, std::string_view &cut
+) {
+  const std::vector<DNSRecord> *found = nullptr;
+  if (name.size() > apex.size() && hasType(records, T_NS)) {
+    found = records;
+    cut   = name;
+  }
+  for (size_t dot = name.find('.'); dot != std::string_view::npos && name.size() - dot - 1 > apex.size(); dot = name.find('.', dot + 1)) {
+    std::string_view ancestor = name.substr(dot + 1);
+    const auto      *above    = zone.find(NameKey{ancestor, hashName(ancestor)});
+    if (hasType(above, T_NS)) {
+      found = above;
+      cut   = ancestor;
+    }
+  }
+  return found;
 }
 
-std::string to_string(int value, std::unordered_map<int, std::string> values) {
-  auto it = values.find(value);
-  if (it != values.end()) {
-    return it->second;
+/* Bounded writer of one text line, output that does not fit is dropped */
+struct LineWriter {
+  char *next;
+  char *end;
+
+  void append(std::string_view text) {
+    size_t length = std::min<size_t>(text.size(), end - next);
+    std::memcpy(next, text.data(), length);
+    next += length;
   }
-  return "UNKNOWN";
-}
 
-DNS::DNS() {}
+  void appendNumber(unsigned value, int base = 10) {
+    next = std::to_chars(next, end, value, base).ptr;
+  }
+
+  /* Mnemonic of `value`, or the generic form of RFC 3597 such as TYPE65534 */
+  template<typename Table>
+  void appendValue(const Table &table, int value, std::string_view generic) {
+    std::string_view name = table.find(value);
+    if (name.empty()) {
+      append(generic);
+      appendNumber(value);
+    } else {
+      append(name);
+    }
+  }
+};
+
+DNS::DNS(Arena &arena): arena(arena), header(), edns(), rcode(RCODE_NOERROR), view(nullptr), client(), authoritative(false), negative(nullptr), negativeCount(0), trace(nullptr), queries(&arena), answers(&arena), authority(&arena), additional(&arena) {}
 
-DNS::DNS(const uint8_t *data) {
-  parseDNS(data);
+DNS::DNS(Arena &arena, const uint8_t *data, size_t size): DNS(arena) {
+  parseDNS(data, size);
 }
 
-void DNS::parseDNS(const uint8_t *data) {
-  int offset = 0;
+bool DNS::parseDNS(const uint8_t *data, size_t size) {
+  size_t offset = 0;
+
+  if (size < sizeof(DNSHeader))
+    return false;
 
   const DNSHeader *dnsHeader = (DNSHeader *)data;
   this->header.transactionId = ntohs(dnsHeader->transactionId);
@@ -41,80 +91,281 @@ void DNS::parseDNS(const uint8_t *data) {
   this->header.arcount       = ntohs(dnsHeader->arcount);
 
   offset += sizeof(DNSHeader);
-  for (int i = 0; i < header.qdcount; ++i) {
-    queries.push_back(parseDNSQuery(data, offset));
+  /* every opcode served here takes one question, more get a FORMERR without reading on; none may still fetch a cookie */
+  if (header.qdcount > 1)
+    return true;
+  if (header.qdcount == 1) {
+    DNSQuery query;
+    if (!parseDNSQuery(data, size, offset, query))
+      return false;
+    queries.push_back(query);
+  }
+
+  /* only the OPT record of a query matters, a damaged tail just means no EDNS */
+  if (getOpcode() != OPCODE_QUERY)
+    return true;
+  for (int i = 0; i < header.ancount + header.nscount + header.arcount; ++i) {
+    DNSAnswer record;
+    if (!parseDNSAnswer(data, size, offset, record))
+      break;
+
+    if (i >= header.ancount + header.nscount && record.type == T_OPT && record.name.empty()) {
+      edns.present  = true;
+      edns.version  = record.ttl >> 16;
+      edns.payload  = record.qclass;
+      edns.dnssecOk = record.ttl & EDNS_DO;
+      parseEDNSOptions(record.rdata, record.rdlength);
+    }
+  }
+  return true;
+}
+
+/* Options of the OPT record, Client Subnet and Cookie are used; a malformed subnet is ignored */
+void DNS::parseEDNSOptions(const uint8_t *data, size_t size) {
+  for (size_t offset = 0; offset + 4 <= size;) {
+    uint16_t code   = data[offset] << 8 | data[offset + 1];
+    uint16_t length = data[offset + 2] << 8 | data[offset + 3];
+    offset += 4;
+    if (offset + length > size)
+      return;
+
+    const uint8_t *option = data + offset;
+    offset += length;
+    if (code == O_COOKIE) {
+      /* a client cookie, optionally followed by a server cookie of 8 to 32 bytes (RFC 7873 4) */
+      if (length != COOKIE_CLIENT_SIZE && (length < COOKIE_CLIENT_SIZE + 8 || length > COOKIE_CLIENT_SIZE + COOKIE_SERVER_MAX)) {
+        edns.cookie = COOKIE_MALFORMED;
+        continue;
+      }
+      std::memcpy(edns.clientCookie, option, COOKIE_CLIENT_SIZE);
+      std::memcpy(edns.serverCookie, option + COOKIE_CLIENT_SIZE, length - COOKIE_CLIENT_SIZE);
+      edns.serverLength = length - COOKIE_CLIENT_SIZE;
+      edns.cookie       = COOKIE_UNCHECKED;
+      continue;
+    }
+    if (code != O_CLIENT_SUBNET || length < 4)
+      continue;
+
+    uint16_t family = option[0] << 8 | option[1];
+    uint8_t  source = option[2];
+    size_t   bytes  = (source + 7) / 8;
+    if (!(family == ECS_FAMILY_IPV4 && source <= 32) && !(family == ECS_FAMILY_IPV6 && source <= 128))
+      continue;
+    if (length != 4 + bytes)
+      continue;
+
+    std::memset(edns.subnet, 0, sizeof(edns.subnet));
+    if (family == ECS_FAMILY_IPV4) {
+      edns.subnet[10] = edns.subnet[11] = 0xff;
+      std::memcpy(edns.subnet + 12, option + 4, bytes);
+    } else {
+      std::memcpy(edns.subnet, option + 4, bytes);
+    }
+    edns.clientSubnet = true;
+    edns.family       = family;
+    edns.sourcePrefix = source;
+    edns.scopePrefix  = 0;
+  }
+}
+
+const DNSHeader &DNS::getHeader() const {
+  return header;
+}
+
+const std::pmr::vector<DNSQuery> &DNS::getQueries() const {
+  return queries;
+}
+
+uint8_t DNS::getOpcode() const {
+  return (header.flags & F_OPCODE) >> OPCODE_SHIFT;
+}
+
+CookieState DNS::getCookieState() const {
+  return (CookieState)edns.cookie;
+}
+
+bool DNS::cookieOnly() const {
+  return header.qdcount == 0 && getOpcode() == OPCODE_QUERY && edns.cookie != COOKIE_NONE && edns.cookie != COOKIE_MALFORMED;
+}
+
+void DNS::setClient(uint32_t address) {
+  view = Views::getInstance().select(address);
+  std::memset(client, 0, sizeof(client));
+  client[10] = client[11] = 0xff;
+  std::memcpy(client + 12, &address, sizeof(address));
+
+  if (edns.cookie != COOKIE_UNCHECKED)
+    return;
+
+  /* a valid server cookie is sent back as it is until it is half way through its lifetime (RFC 9018 4.3) */
+  const Cookies &cookies = Cookies::getInstance();
+  uint32_t       now     = time(nullptr);
+  if (cookies.verify(edns.clientCookie, edns.serverCookie, edns.serverLength, address, now)) {
+    edns.cookie    = COOKIE_VALID;
+    uint32_t stamp = (uint32_t)edns.serverCookie[4] << 24 | (uint32_t)edns.serverCookie[5] << 16 | (uint32_t)edns.serverCookie[6] << 8 | edns.serverCookie[7];
+    if ((int32_t)(now - stamp) < COOKIE_REFRESH)
+      return;
+  } else {
+    edns.cookie = COOKIE_CLIENT;
   }
+  cookies.generate(edns.clientCookie, address, now, edns.serverCookie);
+  edns.serverLength = COOKIE_SERVER_SIZE;
+}
+
+void DNS::setTrace(QueryTrace *trace) {
+  this->trace = trace;
 }
 
-std::vector<uint8_t> DNS::buildDNSResponse() {
-  std::vector<uint8_t> response;
+size_t DNS::udpPayloadSize() const {
+  if (!edns.present)
+    return 512;
+  return std::clamp<size_t>(edns.payload, 512, EDNS_PAYLOAD_SIZE);
+}
+
+size_t DNS::buildDNSError(uint8_t *buffer, size_t capacity, uint16_t rcode) {
+  PacketWriter response = {buffer, capacity, 0, false};
 
   DNSHeader responseHeader     = {};
   responseHeader.transactionId = htons(header.transactionId);
+  responseHeader.flags         = htons(F_RESPONSE | (header.flags & (F_OPCODE | F_RECDESIRED)) | (rcode & F_RCODE));
+  responseHeader.qdcount       = htons(queries.size());
+  responseHeader.arcount       = htons(edns.present ? 1 : 0);
+  response.append(&responseHeader, sizeof(DNSHeader));
 
-  createDNSAnswer();
+  for (const auto &query : queries) {
+    appendDNSQuery(response, query);
+  }
+  if (edns.present)
+    appendOPT(response, rcode);
 
-  if (answers.size() == 0) {
-    /* Standard query response, No such name */
-    responseHeader.flags |= F_RESPONSE;
-    responseHeader.flags |= (OPCODE_QUERY << OPCODE_SHIFT);
-    responseHeader.flags |= RCODE_NXDOMAIN;
-    responseHeader.flags = htons(responseHeader.flags);
-  } else {
-    /* Standard query response, No error */
-    responseHeader.flags |= F_RESPONSE;
-    responseHeader.flags |= (OPCODE_QUERY << OPCODE_SHIFT);
-    responseHeader.flags |= RCODE_NOERROR;
-    responseHeader.flags = htons(responseHeader.flags);
+  return response.overflow ? std::min(capacity, sizeof(DNSHeader)) : response.size;
+}
+
+size_t DNS::buildTruncated(uint8_t *buffer, size_t capacity) {
+  size_t size = buildDNSError(buffer, capacity, RCODE_NOERROR);
+  if (size >= sizeof(DNSHeader)) {
+    DNSHeader *responseHeader = (DNSHeader *)buffer;
+    responseHeader->flags |= htons(F_TRUNCATED);
   }
+  return size;
+}
+
+size_t DNS::buildDNSResponse(uint8_t *buffer, size_t capacity) {
+  PacketWriter response = {buffer, capacity, 0, false};
+
+  switch (getOpcode()) {
+    case OPCODE_QUERY:
+      break;
+
+    case OPCODE_NOTIFY:
+      /* acknowledged here, acted upon by the secondary (RFC 1996) */
+      return buildDNSError(buffer, capacity, RCODE_NOERROR);
 
-  responseHeader.qdcount = htons(header.qdcount);
+    default:
+      return buildDNSError(buffer, capacity, RCODE_NOTIMPL);
+  }
+
+  DNSHeader responseHeader     = {};
+  responseHeader.transactionId = htons(header.transactionId);
+
+  if (edns.present && edns.version > 0) {
+    rcode = RCODE_BAD; // BADVERS, we only speak EDNS version 0
+  } else if (edns.cookie == COOKIE_MALFORMED || (queries.empty() && !cookieOnly())) {
+    rcode = RCODE_FORMERR;
+  } else if (queries.empty()) {
+    rcode = RCODE_NOERROR;
+  } else {
+    createDNSAnswer();
+  }
+  if (trace)
+    trace->mark(STAGE_LOOKUP);
+
+  /* Standard query response, the low bits of the RCODE go in the header and the rest in OPT */
+  responseHeader.flags |= F_RESPONSE;
+  responseHeader.flags |= (OPCODE_QUERY << OPCODE_SHIFT);
+  responseHeader.flags |= rcode & F_RCODE;
+  responseHeader.flags |= header.flags & (F_RECDESIRED | F_CHECKDISABLE);
+  if (authoritative)
+    responseHeader.flags |= F_AUTHORITATIVE;
+
+  responseHeader.qdcount = htons(queries.size());
   responseHeader.ancount = htons(answers.size());
-  responseHeader.nscount = htons(0);
-  responseHeader.arcount = htons(0);
+  responseHeader.nscount = htons(negativeCount + authority.size());
+  responseHeader.arcount = htons(additional.size() + (edns.present ? 1 : 0));
 
-  uint8_t *headerPtr = (uint8_t *)&responseHeader;
-  response.insert(response.end(), headerPtr, headerPtr + sizeof(DNSHeader));
+  response.append(&responseHeader, sizeof(DNSHeader));
 
   for (const auto &query : queries) {
     appendDNSQuery(response, query);
   }
+  size_t questionEnd = response.size;
 
   for (const auto &answer : answers) {
     appendDNSAnswer(response, answer);
   }
+  if (negative != nullptr)
+    response.append(negative->data(), negative->size());
+  for (const auto &record : authority) {
+    appendDNSAnswer(response, record);
+  }
+  for (const auto &record : additional) {
+    appendDNSAnswer(response, record);
+  }
+  if (edns.present)
+    appendOPT(response, rcode);
+
+  if (response.overflow) {
+    /* keep the question and OPT only and let the client retry over TCP */
+    responseHeader.flags |= F_TRUNCATED;
+    responseHeader.ancount = htons(0);
+    responseHeader.nscount = htons(0);
+    responseHeader.arcount = htons(edns.present ? 1 : 0);
+    response.size          = std::min(questionEnd, capacity);
+    response.overflow      = false;
+    if (edns.present)
+      appendOPT(response, rcode);
+    if (response.overflow)
+      responseHeader.arcount = htons(0);
+  }
+
+  responseHeader.flags = htons(responseHeader.flags);
+  if (capacity >= sizeof(DNSHeader))
+    std::memcpy(buffer, &responseHeader, sizeof(DNSHeader));
 
-  return response;
+  return response.size;
 }
 
-std::string DNS::parseDNSQueryName(const uint8_t *data, int &offset) {
-  std::ostringstream name;
-  while (data[offset] != 0) {
-    int length = data[offset];
-    offset++;
-    if (!name.str().empty()) {
-      name << ".";
-    }
-    name.write((const char *)(&data[offset]), length);
-    offset += length;
-  }
-  offset++; // skip the null terminator
-  return name.str();
+bool DNS::parseDNSQueryName(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed) {
+  return parseWireName(data, size, offset, text, key, parsed);
 }
 
-DNSQuery DNS::parseDNSQuery(const uint8_t *data, int &offset) {
-  DNSQuery query;
-  query.name = parseDNSQueryName(data, offset);
+bool DNS::parseDNSQuery(const uint8_t *data, size_t size, size_t &offset, DNSQuery &query) {
+  char      *text = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  char      *key  = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  ParsedName parsed;
+
+  if (!parseDNSQueryName(data, size, offset, text, key, parsed) || offset + 4 > size)
+    return false;
+
+  query.name = std::string_view(text, parsed.length);
+  query.key  = std::string_view(key, parsed.length);
+  query.hash = parsed.hash;
   query.type = ntohs(*(uint16_t *)(data + offset));
   offset += 2;
   query.qclass = ntohs(*(uint16_t *)(data + offset));
   offset += 2;
-  return query;
+  return true;
 }
 
-DNSAnswer DNS::parseDNSAnswer(const uint8_t *data, int &offset) {
-  DNSAnswer answer;
-  answer.name = parseDNSQueryName(data, offset);
+bool DNS::parseDNSAnswer(const uint8_t *data, size_t size, size_t &offset, DNSAnswer &answer) {
+  char      *text = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  char      *key  = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  ParsedName parsed;
+
+  if (!parseDNSQueryName(data, size, offset, text, key, parsed) || offset + 10 > size)
+    return false;
+
+  answer.name = std::string_view(text, parsed.length);
   answer.type = ntohs(*(uint16_t *)(data + offset));
   offset += 2;
   answer.qclass = ntohs(*(uint16_t *)(data + offset));
@@ -123,101 +374,436 @@ DNSAnswer DNS::parseDNSAnswer(const uint8_t *data, int &offset) {
   offset += 4;
   answer.rdlength = ntohs(*(uint16_t *)(data + offset));
   offset += 2;
-  answer.rdata.insert(answer.rdata.end(), data + offset, data + offset + answer.rdlength);
+  if (offset + answer.rdlength > size)
+    return false;
+  answer.rdata = data + offset;
   offset += answer.rdlength;
-  return answer;
+  return true;
 }
 
 void DNS::createDNSAnswer() {
-  DB      &db             = DB::getInstance("");
-  DNSQuery query          = queries.at(0);
-  auto     returnedRecord = db.get(query.name);
-  if (!returnedRecord.has_value())
+  rcode = RCODE_NXDOMAIN;
+  if (queries.empty())
     return;
 
-  switch (query.type) {
-    case T_A: {
-      auto records = filter(returnedRecord.value(), [](DNSRecord record) { return record.type == "A"; });
-      if (records.empty())
-        return;
+  const ZoneData &zone   = view != nullptr ? *view : DB::getInstance("").zone();
+  const DNSQuery &query  = queries.front();
+  bool            dnssec = edns.dnssecOk;
+
+  /* blocked names are answered before the zones, without AA since the answer is not the zone data */
+  const PolicyList *blocked = Policy::getInstance().match(query.key);
+  if (blocked != nullptr) {
+    rcode = blocked->action == PolicyAction::NXDOMAIN ? RCODE_NXDOMAIN : RCODE_NOERROR;
+    if (blocked->action == PolicyAction::SINKHOLE)
+      appendRRset(answers, query.name, blocked->sinkholes, query.type, false);
+    return;
+  }
+
+  /* names outside our zones are refused, a store without any SOA is served as one flat namespace */
+  const ZoneEntry *entry = zone.zones->find(NameKey{query.key, query.hash});
+  if (entry == nullptr && !zone.zones->empty()) {
+    rcode = RCODE_REFUSED;
+    return;
+  }
+  authoritative = entry != nullptr;
+
+  /* CNAME targets in the same zone are answered along (RFC 1034 4.3.2), the rest is up to the client */
+  DNSQuery current = query;
+  DNSQuery target  = query;
+  for (int links = 0; answerName(zone, entry, current, links == 0, dnssec, target); ++links) {
+    auto seen = [&target](const DNSAnswer &answer) {
+      return answer.name.size() == target.key.size() && strncasecmp(answer.name.data(), target.key.data(), target.key.size()) == 0;
+    };
+    if (links == MAX_CNAME_CHAIN || std::any_of(answers.begin(), answers.end(), seen))
+      return;
+
+    current = target;
+    if (zone.zones->find(NameKey{current.key, current.hash}) != entry)
+      return;
+  }
+}
 
-      auto record = records.front();
+bool DNS::answerName(const ZoneData &zone, const ZoneEntry *entry, const DNSQuery &query, bool first, bool dnssec, DNSQuery &target) {
+  rcode = RCODE_NXDOMAIN;
+
+  /* SOA queries are how secondaries poll the serial */
+  auto returnedRecord = zone.find(NameKey{query.key, query.hash});
+
+  /* below a zone cut the child answers, only the DS records at the cut belong to us */
+  std::string_view cut;
+  const auto      *delegation = entry != nullptr ? zoneCut(zone, entry->apex, query.key, returnedRecord, cut) : nullptr;
+  if (delegation != nullptr && !(cut.size() == query.key.size() && query.type == T_DS)) {
+    /* a CNAME into a delegated subtree is left for the client to follow */
+    if (first)
+      appendReferral(zone, *entry, query.name.substr(query.name.size() - cut.size()), *delegation, dnssec);
+    else
+      rcode = RCODE_NOERROR;
+    return false;
+  }
 
-      DNSAnswer answer = {
-          .name     = query.name,
-          .type     = T_A,
-          .qclass   = query.qclass,
-          .ttl      = 0,
-          .rdlength = 4,
-          .rdata    = {192, 168, 1, 1}
-      };
+  if (returnedRecord != nullptr) {
+    rcode = RCODE_NOERROR;
+
+    /* steered names get one address, a part of a signed RRset would not validate so DNSSEC clients get all */
+    Steering &steering = Steering::getInstance();
+    if (steering.enabled() && (query.type == T_A || query.type == T_AAAA) && !dnssec) {
+      bool             located = false;
+      const DNSRecord *record  = steering.select(
+          NameKey{query.key, query.hash}, *returnedRecord, query.type, edns.clientSubnet ? edns.subnet : client, located
+      );
+      if (record != nullptr) {
+        answers.push_back(DNSAnswer{
+            .name     = query.name,
+            .type     = record->type,
+            .qclass   = record->rclass,
+            .ttl      = record->ttl,
+            .rdlength = (uint16_t)record->rdata.size(),
+            .rdata    = record->rdata.data()
+        });
+        if (located && edns.clientSubnet)
+          edns.scopePrefix = edns.sourcePrefix;
+        return false;
+      }
+    }
 
-      if (record.ttl.has_value()) {
-        answer.ttl = record.ttl.value();
+    if (appendRRset(answers, query.name, *returnedRecord, query.type, dnssec))
+      return false;
+
+    if (appendCNAME(query.name, *returnedRecord, dnssec, target))
+      return true;
+    if (entry == nullptr)
+      return false;
+
+    /* no data of that type, the NSEC of the name lists the types it has */
+    appendNegativeSOA(*entry, dnssec);
+    if (dnssec)
+      appendRRset(authority, query.key, *returnedRecord, T_NSEC, true);
+    return false;
+  }
+
+  /* then the names computed from $GENERATE and $SYNTHESIZE lines, which signed zones cannot have */
+  if (zone.ranges) {
+    size_t     before = answers.size();
+    RangeMatch match  = zone.ranges->lookup(query, arena, answers);
+    if (match != RANGE_NONE) {
+      rcode = RCODE_NOERROR;
+      if (answers.size() == before) {
+        if (entry != nullptr)
+          appendNegativeSOA(*entry, dnssec);
+        return false;
       }
 
-      struct in_addr addr;
-      if (inet_pton(AF_INET, record.value.data(), &addr) != 1)
-        return;
+      /* a generated CNAME is answered for every type and followed like a stored one */
+      const DNSAnswer &cname = answers.back();
+      return cname.type == T_CNAME && query.type != T_CNAME && keepName(cname.rdata, cname.rdlength, target);
+    }
+  }
 
-      answer.rdlength = sizeof(addr);
-      answer.rdata[0] = static_cast<uint8_t>(addr.s_addr & 0xFF);
-      answer.rdata[1] = static_cast<uint8_t>((addr.s_addr >> 8) & 0xFF);
-      answer.rdata[2] = static_cast<uint8_t>((addr.s_addr >> 16) & 0xFF);
-      answer.rdata[3] = static_cast<uint8_t>((addr.s_addr >> 24) & 0xFF);
+  if (entry == nullptr)
+    return false;
+
+  std::string_view   key      = keepOrderKey(query.key);
+  const std::string &apex     = entry->apex;
+  bool               withNSEC = dnssec && hasType(zone.find(apex), T_NSEC);
+  auto               hasBelow = [&zone](std::string_view key) {
+    const std::string *next = zone.index->after(key);
+    return next && next->size() > key.size() && next->compare(0, key.size(), key) == 0 && (*next)[key.size()] == '\0';
+  };
+
+  /* an empty non-terminal exists, it only has no records of its own */
+  if (hasBelow(key)) {
+    rcode = RCODE_NOERROR;
+    appendNegativeSOA(*entry, dnssec);
+    if (withNSEC)
+      appendCoveringNSEC(zone, apex, key);
+    return false;
+  }
+
+  /* the closest encloser is the longest name above that exists, its wildcard stands for the names missing below it (RFC 4592) */
+  std::string_view encloser = query.key;
+  do {
+    size_t dot = encloser.find('.');
+    encloser   = dot == std::string_view::npos ? std::string_view() : encloser.substr(dot + 1);
+  } while (encloser.size() > apex.size() && zone.find(encloser) == nullptr && !hasBelow(keepOrderKey(encloser)));
+
+  std::string_view wildcard  = keepWildcard(encloser);
+  const auto      *expansion = zone.find(wildcard);
+  if (expansion == nullptr) {
+    appendNegativeSOA(*entry, dnssec);
+    if (withNSEC) {
+      appendCoveringNSEC(zone, apex, key);
+      appendCoveringNSEC(zone, apex, keepOrderKey(wildcard));
+    }
+    return false;
+  }
 
-      answers.push_back(answer);
+  /*
+    Records of the wildcard under the query name. Their RRSIGs keep the label
+    count of the wildcard, which tells validators it was expanded, and the
+    NSEC covering the name proves no closer match exists (RFC 4035 3.1.3.3).
+  */
+  rcode         = RCODE_NOERROR;
+  bool answered = appendRRset(answers, query.name, *expansion, query.type, dnssec);
+  bool follow   = !answered && appendCNAME(query.name, *expansion, dnssec, target);
+  if (answered || follow) {
+    if (withNSEC)
+      appendCoveringNSEC(zone, apex, key);
+    return follow;
+  }
 
-      break;
+  /* the wildcard has no records of that type, its NSEC lists those it has and often covers the name too */
+  appendNegativeSOA(*entry, dnssec);
+  if (withNSEC) {
+    appendRRset(authority, wildcard, *expansion, T_NSEC, true);
+    appendCoveringNSEC(zone, apex, key);
+  }
+  return false;
+}
+
+bool DNS::appendCNAME(std::string_view owner, const std::vector<DNSRecord> &records, bool dnssec, DNSQuery &target) {
+  auto cname = std::find_if(records.begin(), records.end(), [](const DNSRecord &record) { return record.type == T_CNAME; });
+  if (cname == records.end())
+    return false;
+
+  appendRRset(answers, owner, records, T_CNAME, dnssec);
+  return keepName(cname->rdata.data(), cname->rdata.size(), target);
+}
+
+bool DNS::appendRRset(
+    std::pmr::vector<DNSAnswer> &section, std::string_view owner, const std::vector<DNSRecord> &records, uint16_t type, bool dnssec
+) {
+  size_t start = section.size();
+  auto   add   = [&](const DNSRecord &record) {
+    section.push_back(DNSAnswer{
+          .name     = owner,
+          .type     = record.type,
+          .qclass   = record.rclass,
+          .ttl      = record.ttl,
+          .rdlength = (uint16_t)record.rdata.size(),
+          .rdata    = record.rdata.data()
+    });
+  };
+
+  for (const auto &record : records) {
+    if (record.type == type)
+      add(record);
+  }
+  if (section.size() == start)
+    return false;
+
+  if (dnssec && type != T_RRSIG) {
+    for (const auto &record : records) {
+      if (record.type == T_RRSIG && rrsigCovered(record.rdata) == type)
+        add(record);
     }
+  }
+  return true;
+}
 
-    default:
-      break;
+void DNS::appendNegativeSOA(const ZoneEntry &zone, bool dnssec) {
+  negative      = &zone.negative[dnssec];
+  negativeCount = zone.negativeCount[dnssec];
+}
+
+/* The NSEC whose owner comes before `key` in canonical order, its next name lies beyond it */
+void DNS::appendCoveringNSEC(const ZoneData &zone, std::string_view apex, std::string_view key) {
+  for (const std::string *previous = zone.index->before(key); previous != nullptr; previous = zone.index->before(*previous)) {
+    std::string_view name    = keepOrderKeyName(*previous);
+    const auto      *records = zone.find(name);
+    if (!isSubdomain(name, apex))
+      return;
+    if (!hasType(records, T_NSEC))
+      continue;
+
+    /* the same NSEC may cover both the name and the wildcard */
+    for (const auto &record : authority) {
+      if (record.type == T_NSEC && record.name == name)
+        return;
+    }
+    appendRRset(authority, name, *records, T_NSEC, true);
+    return;
+  }
+}
+
+void DNS::appendReferral(const ZoneData &zone, const ZoneEntry &entry, std::string_view owner, const std::vector<DNSRecord> &records, bool dnssec) {
+  rcode         = RCODE_NOERROR;
+  authoritative = false;
+  appendRRset(authority, owner, records, T_NS, false);
+  if (dnssec && !appendRRset(authority, owner, records, T_DS, true))
+    appendRRset(authority, owner, records, T_NSEC, true);
+
+  for (const auto &record : records) {
+    DNSQuery server;
+    if (record.type != T_NS || !keepName(record.rdata.data(), record.rdata.size(), server))
+      continue;
+
+    const auto *hosts = isSubdomain(server.key, entry.apex) ? zone.find(NameKey{server.key, server.hash}) : nullptr;
+    if (hosts == nullptr || (!hasType(hosts, T_A) && !hasType(hosts, T_AAAA)))
+      continue;
+    appendRRset(additional, server.name, *hosts, T_A, false);
+    appendRRset(additional, server.name, *hosts, T_AAAA, false);
+  }
+}
+
+std::string_view DNS::keep(std::string_view text) {
+  char *copy = (char *)arena.allocate(text.size(), 1);
+  std::memcpy(copy, text.data(), text.size());
+  return std::string_view(copy, text.size());
+}
+
+std::string_view DNS::keepWildcard(std::string_view encloser) {
+  if (encloser.empty())
+    return "*";
+
+  char *copy = (char *)arena.allocate(encloser.size() + 2, 1);
+  copy[0]    = '*';
+  copy[1]    = '.';
+  std::memcpy(copy + 2, encloser.data(), encloser.size());
+  return std::string_view(copy, encloser.size() + 2);
+}
+
+std::string_view DNS::keepOrderKey(std::string_view name) {
+  char *key = (char *)arena.allocate(name.size(), 1);
+  orderKey(name, key);
+  return std::string_view(key, name.size());
+}
+
+std::string_view DNS::keepOrderKeyName(std::string_view key) {
+  char *name = (char *)arena.allocate(key.size(), 1);
+  orderKeyName(key, name);
+  return std::string_view(name, key.size());
+}
+
+/* Names in zone data are stored uncompressed, so the question parser reads them too */
+bool DNS::keepName(const uint8_t *rdata, size_t length, DNSQuery &name) {
+  char      *text   = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  char      *key    = (char *)arena.allocate(NAME_BUFFER_SIZE, 32);
+  size_t     offset = 0;
+  ParsedName parsed;
+
+  if (!parseDNSQueryName(rdata, length, offset, text, key, parsed))
+    return false;
+
+  name.name = name.key = std::string_view(key, parsed.length);
+  name.hash            = parsed.hash;
+  return true;
+}
+
+void DNS::appendDNSQuery(PacketWriter &response, const DNSQuery &query) {
+  response.appendName(query.name);
+  response.appendUint16(query.type);
+  response.appendUint16(query.qclass);
+}
+
+void DNS::appendDNSAnswer(PacketWriter &response, const DNSAnswer &answer) {
+  response.appendName(answer.name);
+  response.appendUint16(answer.type);
+  response.appendUint16(answer.qclass);
+  response.appendUint32(answer.ttl);
+  response.appendUint16(answer.rdlength);
+  response.append(answer.rdata, answer.rdlength);
+}
+
+/* OPT pseudo-record closing a reply to an EDNS request (RFC 6891 6.1.2) */
+void DNS::appendOPT(PacketWriter &response, uint16_t rcode) {
+  response.append("", 1);
+  response.appendUint16(T_OPT);
+  response.appendUint16(EDNS_PAYLOAD_SIZE);
+  response.appendUint32((uint32_t)(rcode >> 4) << 24 | (edns.dnssecOk ? EDNS_DO : 0));
+
+  size_t bytes  = (edns.sourcePrefix + 7) / 8;
+  bool   cookie = edns.cookie == COOKIE_CLIENT || edns.cookie == COOKIE_VALID;
+  response.appendUint16((edns.clientSubnet ? 8 + bytes : 0) + (cookie ? 4 + COOKIE_CLIENT_SIZE + edns.serverLength : 0));
+
+  /* the Client Subnet option is echoed with the scope the answer holds for (RFC 7871 7.2.1) */
+  if (edns.clientSubnet) {
+    uint8_t prefixes[] = {edns.sourcePrefix, edns.scopePrefix};
+    response.appendUint16(O_CLIENT_SUBNET);
+    response.appendUint16(4 + bytes);
+    response.appendUint16(edns.family);
+    response.append(prefixes, sizeof(prefixes));
+    response.append(edns.subnet + (edns.family == ECS_FAMILY_IPV4 ? 12 : 0), bytes);
+  }
+
+  /* the client cookie comes back with the server cookie to present next time (RFC 7873 5.2) */
+  if (cookie) {
+    response.appendUint16(O_COOKIE);
+    response.appendUint16(COOKIE_CLIENT_SIZE + edns.serverLength);
+    response.append(edns.clientCookie, COOKIE_CLIENT_SIZE);
+    response.append(edns.serverCookie, edns.serverLength);
   }
 }
 
-void DNS::appendDNSQuery(std::vector<uint8_t> &response, const DNSQuery &query) {
-  appendDNSName(response, query.name);
-  appendUint16(response, query.type);
-  appendUint16(response, query.qclass);
+void PacketWriter::append(const void *bytes, size_t length) {
+  if (overflow || size + length > capacity) {
+    overflow = true;
+    return;
+  }
+  std::memcpy(data + size, bytes, length);
+  size += length;
+}
+
+void PacketWriter::appendUint16(uint16_t value) {
+  value = htons(value);
+  append(&value, 2);
 }
 
-void DNS::appendDNSAnswer(std::vector<uint8_t> &response, const DNSAnswer &answer) {
-  appendDNSName(response, answer.name);
-  appendUint16(response, answer.type);
-  appendUint16(response, answer.qclass);
-  appendUint32(response, answer.ttl);
-  appendUint16(response, answer.rdlength);
-  response.insert(response.end(), answer.rdata.begin(), answer.rdata.end());
+void PacketWriter::appendUint32(uint32_t value) {
+  value = htonl(value);
+  append(&value, 4);
 }
 
-void DNS::appendDNSName(std::vector<uint8_t> &response, const std::string &name) {
-  std::istringstream iss(name);
-  std::string        part;
-  while (std::getline(iss, part, '.')) {
-    response.push_back(part.length());
-    response.insert(response.end(), part.begin(), part.end());
+void PacketWriter::appendName(std::string_view name) {
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string_view::npos)
+      end = name.size();
+
+    uint8_t length = end - start;
+    append(&length, 1);
+    append(name.data() + start, length);
+    start = end + 1;
   }
-  response.push_back('\0');
+  append("", 1);
 }
 
-void DNS::appendUint16(std::vector<uint8_t> &response, uint16_t value) {
-  value        = htons(value);
-  uint8_t *ptr = (uint8_t *)&value;
-  response.insert(response.end(), ptr, ptr + 2);
+void NameCompressor::clear() {
+  offsets.clear();
 }
 
-void DNS::appendUint32(std::vector<uint8_t> &response, uint32_t value) {
-  value        = htonl(value);
-  uint8_t *ptr = (uint8_t *)&value;
-  response.insert(response.end(), ptr, ptr + 4);
+void NameCompressor::appendName(PacketWriter &out, std::string_view name) {
+  size_t start = 0;
+  while (start < name.size()) {
+    std::string_view suffix = name.substr(start);
+
+    auto it = offsets.find(suffix);
+    if (it != offsets.end()) {
+      out.appendUint16(0xC000 | it->second);
+      return;
+    }
+
+    /* pointers only reach the first 16 kB of a message */
+    if (out.size < 0x4000 && !out.overflow)
+      offsets.emplace(suffix, out.size);
+
+    size_t end = name.find('.', start);
+    if (end == std::string_view::npos)
+      end = name.size();
+
+    uint8_t length = end - start;
+    out.append(&length, 1);
+    out.append(name.data() + start, length);
+    start = end + 1;
+  }
+  out.append("", 1);
 }
 
 std::ostream &operator<<(std::ostream &os, const DNSQuery &query) {
   os << "+------------------+-------------------+" << std::endl;
   os << "|       Query Name | " << query.name << std::endl;
-  os << "|       Query Type | " << std::left << std::setw(17) << to_string(query.type, dns_type_vals) << " |" << std::endl;
-  os << "|      Query Class | " << std::left << std::setw(17) << to_string(query.qclass, dns_class_vals) << " |" << std::endl;
+  os << "|       Query Type | " << std::left << std::setw(17) << dns_type_vals.name(query.type) << " |" << std::endl;
+  os << "|      Query Class | " << std::left << std::setw(17) << dns_class_vals.name(query.qclass) << " |" << std::endl;
   os << "+------------------+-------------------+" << std::endl;
   return os;
 }
@@ -240,3 +826,62 @@ std::ostream &operator<<(std::ostream &os, const DNS &packet) {
 
   return os;
 }
+
+size_t DNS::summarize(char *line, size_t capacity, uint32_t address, uint16_t port) const {
+  static constexpr std::pair<uint16_t, std::string_view> flags[] = {
+      {F_RESPONSE,      " qr"},
+      {F_AUTHORITATIVE, " aa"},
+      {F_TRUNCATED,     " tc"},
+      {F_RECDESIRED,    " rd"},
+      {F_RECAVAIL,      " ra"},
+      {F_AUTHENTIC,     " ad"},
+      {F_CHECKDISABLE,  " cd"},
+  };
+
+  LineWriter out  = {line, line + capacity};
+  uint32_t   host = ntohl(address);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.appendNumber((host >> shift) & 0xFF);
+    out.append(shift ? "." : "#");
+  }
+  out.appendNumber(ntohs(port));
+  out.append(" 0x");
+  out.appendNumber(header.transactionId, 16);
+  out.append(" ");
+  out.appendValue(dns_opcode_vals, getOpcode(), "OPCODE");
+  for (const auto &[flag, text] : flags) {
+    if (header.flags & flag)
+      out.append(text);
+  }
+
+  if (!queries.empty()) {
+    out.append(" ");
+    out.append(queries.front().name.empty() ? "." : queries.front().name);
+    out.append(" ");
+    out.appendValue(dns_class_vals, queries.front().qclass, "CLASS");
+    out.append(" ");
+    out.appendValue(dns_type_vals, queries.front().type, "TYPE");
+  } else {
+    out.append(" qdcount ");
+    out.appendNumber(header.qdcount);
+  }
+
+  if (edns.present) {
+    out.append(" edns ");
+    out.appendNumber(edns.payload);
+    if (edns.dnssecOk)
+      out.append(" do");
+    if (edns.clientSubnet)
+      out.append(" ecs");
+    if (edns.cookie != COOKIE_NONE)
+      out.append(" cookie");
+  }
+  return out.next - line;
+}
+
+void pinQueryState() {
+  DB::getInstance("").pin();
+  Policy::getInstance().pin();
+  Views::getInstance().pin();
+  Steering::getInstance().pin();
+}
@@ -0,0 +1,485 @@
+#include "dnssec.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "dns.hpp"
+#include "logger.hpp"
+#include "rdata.hpp"
+#include "synth.hpp"
+
+uint16_t rrsigCovered(const std::vector<uint8_t> &rdata) {
+  return rdata.size() < 2 ? 0 : (rdata[0] << 8) | rdata[1];
+}
+
+uint32_t rrsigExpiration(const std::vector<uint8_t> &rdata) {
+  if (rdata.size() < 12)
+    return 0;
+  return ((uint32_t)rdata[8] << 24) | (rdata[9] << 16) | (rdata[10] << 8) | rdata[11];
+}
+
+static uint16_t rrsigKeyTag(const std::vector<uint8_t> &rdata) {
+  return rdata.size() < 18 ? 0 : (rdata[16] << 8) | rdata[17];
+}
+
+static bool isDnssecType(uint16_t type) {
+  return type == T_RRSIG || type == T_NSEC;
+}
+
+static void putUint16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+static void putUint32(std::vector<uint8_t> &out, uint32_t value) {
+  putUint16(out, value >> 16);
+  putUint16(out, value);
+}
+
+/* RFC 4034 Appendix B */
+static uint16_t keyTagOf(const std::vector<uint8_t> &rdata) {
+  uint32_t ac = 0;
+  for (size_t i = 0; i < rdata.size(); ++i) {
+    ac += (i & 1) ? rdata[i] : rdata[i] << 8;
+  }
+  ac += (ac >> 16) & 0xFFFF;
+  return ac & 0xFFFF;
+}
+
+static std::string base64(const uint8_t *data, size_t length) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  std::string out;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t group = data[i] << 16;
+    if (i + 1 < length)
+      group |= data[i + 1] << 8;
+    if (i + 2 < length)
+      group |= data[i + 2];
+
+    out.push_back(alphabet[group >> 18 & 63]);
+    out.push_back(alphabet[group >> 12 & 63]);
+    out.push_back(i + 1 < length ? alphabet[group >> 6 & 63] : '=');
+    out.push_back(i + 2 < length ? alphabet[group & 63] : '=');
+  }
+  return out;
+}
+
+/* Labels of an owner name as counted by RRSIG, a leading wildcard label is left out (RFC 4034 3.1.3) */
+static uint8_t labelCount(std::string_view name) {
+  if (name.empty())
+    return 0;
+  if (name.starts_with("*."))
+    name.remove_prefix(2);
+  return std::count(name.begin(), name.end(), '.') + 1;
+}
+
+/* TTL of NSEC records and negative answers (RFC 9077) */
+static uint32_t negativeTtl(const ZoneData &zone) {
+  const auto *records = zone.find(zone.apex);
+  if (records == nullptr)
+    return 0;
+
+  for (const auto &record : *records) {
+    if (record.type == T_SOA)
+      return std::min(record.ttl, soaField(record.rdata, SOA_MINIMUM));
+  }
+  return 0;
+}
+
+/* Type bit maps field of NSEC (RFC 4034 4.1.2), `types` sorted */
+static void appendTypeBitmaps(const std::vector<uint16_t> &types, std::vector<uint8_t> &out) {
+  size_t i = 0;
+  while (i < types.size()) {
+    uint8_t window = types[i] >> 8;
+    uint8_t bitmap[32] = {};
+    uint8_t length     = 0;
+
+    for (; i < types.size() && (types[i] >> 8) == window; ++i) {
+      uint8_t low = types[i] & 0xFF;
+      bitmap[low / 8] |= 0x80 >> (low % 8);
+      length = low / 8 + 1;
+    }
+
+    out.push_back(window);
+    out.push_back(length);
+    out.insert(out.end(), bitmap, bitmap + length);
+  }
+}
+
+static std::string parentName(const std::string &name) {
+  size_t dot = name.find('.');
+  return dot == std::string::npos ? std::string() : name.substr(dot + 1);
+}
+
+Signer &Signer::getInstance() {
+  static Signer instance;
+  return instance;
+}
+
+Signer::Signer(): key(), loaded(false), keyTag(0) {}
+
+bool Signer::loadKey(const std::string &path) {
+  Logger &logger = Logger::getInstance();
+  uint8_t seed[ED25519_SEED_SIZE];
+
+  std::ifstream file(path);
+  if (file.is_open()) {
+    std::string text;
+    file >> text;
+    if (!parseHex(text, seed, sizeof(seed))) {
+      logger.error("DNSSEC key " + path + " is not a hex encoded Ed25519 seed");
+      return false;
+    }
+  } else {
+    if (getrandom(seed, sizeof(seed), 0) != sizeof(seed)) {
+      logger.error("Cannot generate a DNSSEC key: " + std::string(strerror(errno)));
+      return false;
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string       text;
+    for (uint8_t byte : seed) {
+      text.push_back(digits[byte >> 4]);
+      text.push_back(digits[byte & 15]);
+    }
+    text.push_back('\n');
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || write(fd, text.data(), text.size()) != (ssize_t)text.size() || fsync(fd) < 0) {
+      logger.error("Cannot write DNSSEC key " + path + ": " + std::string(strerror(errno)));
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    close(fd);
+    logger.info("Generated a new DNSSEC key in " + path);
+  }
+
+  ed25519Expand(seed, key);
+  std::memset(seed, 0, sizeof(seed));
+
+  dnskey.clear();
+  putUint16(dnskey, DNSKEY_FLAGS);
+  dnskey.push_back(DNSKEY_PROTOCOL);
+  dnskey.push_back(DNSSEC_ALGORITHM);
+  dnskey.insert(dnskey.end(), key.publicKey, key.publicKey + ED25519_PUBLIC_KEY_SIZE);
+  keyTag = keyTagOf(dnskey);
+
+  pool   = std::make_unique<ThreadPool>();
+  loaded = true;
+  logger.info(
+      "DNSSEC key tag " + std::to_string(keyTag) + ": DNSKEY " + std::to_string(DNSKEY_FLAGS) + " " + std::to_string(DNSKEY_PROTOCOL)
+      + " " + std::to_string(DNSSEC_ALGORITHM) + " " + base64(key.publicKey, ED25519_PUBLIC_KEY_SIZE)
+  );
+  return true;
+}
+
+bool Signer::enabled() const {
+  return loaded;
+}
+
+/* Below a delegation, glue and anything else there is not ours to sign */
+bool Signer::occluded(const ZoneData &zone, const std::string &name) const {
+  for (std::string ancestor = parentName(name); ancestor.size() > zone.apex.size(); ancestor = parentName(ancestor)) {
+    if (hasType(zone.find(ancestor), T_NS))
+      return true;
+  }
+  return false;
+}
+
+/* Names taking part in the NSEC chain */
+bool Signer::authoritative(const ZoneData &zone, const std::string &name) const {
+  const auto *records = zone.find(name);
+  if (records == nullptr || !isSubdomain(name, zone.apex))
+    return false;
+
+  bool data = std::any_of(records->begin(), records->end(), [](const DNSRecord &record) { return !isDnssecType(record.type); });
+  return data && !occluded(zone, name);
+}
+
+/* Following name of the chain, wrapping around to the apex */
+std::string Signer::nextName(const ZoneData &zone, const std::string &name) const {
+  for (const std::string *key = zone.index->after(orderKey(name)); key != nullptr; key = zone.index->after(*key)) {
+    std::string candidate = orderKeyName(*key);
+    if (!isSubdomain(candidate, zone.apex))
+      break;
+    if (authoritative(zone, candidate))
+      return candidate;
+  }
+  return zone.apex;
+}
+
+std::string Signer::previousName(const ZoneData &zone, const std::string &name) const {
+  for (const std::string *key = zone.index->before(orderKey(name)); key != nullptr; key = zone.index->before(*key)) {
+    std::string candidate = orderKeyName(*key);
+    if (!isSubdomain(candidate, zone.apex))
+      break;
+    if (authoritative(zone, candidate))
+      return candidate;
+  }
+  return zone.apex;
+}
+
+void Signer::signName(const ZoneData &zone, const ZoneData *previous, const std::string &name, uint32_t now, std::vector<DNSRecord> &out) {
+  if (!authoritative(zone, name))
+    return;
+
+  const auto           &records    = *zone.find(name);
+  bool                  delegation = name != zone.apex && hasType(&records, T_NS);
+  std::vector<uint16_t> types;
+  for (const auto &record : records) {
+    /* a delegation point only owns its NS and DS records */
+    if (isDnssecType(record.type) || (delegation && record.type != T_NS && record.type != T_DS))
+      continue;
+    types.push_back(record.type);
+  }
+
+  std::vector<uint16_t> present = types;
+  present.push_back(T_RRSIG);
+  present.push_back(T_NSEC);
+  std::sort(present.begin(), present.end());
+  present.erase(std::unique(present.begin(), present.end()), present.end());
+
+  DNSRecord nsec = {T_NSEC, C_IN, negativeTtl(zone), {}};
+  encodeName(nextName(zone, name), nsec.rdata);
+  appendTypeBitmaps(present, nsec.rdata);
+  out.push_back(nsec);
+
+  types.push_back(T_NSEC);
+  std::sort(types.begin(), types.end());
+  types.erase(std::unique(types.begin(), types.end()), types.end());
+
+  for (uint16_t type : types) {
+    /* the child signs the NS records of a delegation */
+    if (delegation && type == T_NS)
+      continue;
+
+    std::vector<const DNSRecord *> rrset;
+    if (type == T_NSEC) {
+      rrset.push_back(&nsec);
+    } else {
+      for (const auto &record : records) {
+        if (record.type == type)
+          rrset.push_back(&record);
+      }
+    }
+
+    const DNSRecord *kept = reusable(previous, name, type, rrset, now);
+    out.push_back(kept ? *kept : sign(zone.apex, name, type, rrset, now));
+  }
+}
+
+/* Signature of `previous` over the same RRset that is not coming due yet */
+const DNSRecord *Signer::reusable(
+    const ZoneData *previous, const std::string &name, uint16_t type, const std::vector<const DNSRecord *> &rrset, uint32_t now
+) const {
+  if (previous == nullptr)
+    return nullptr;
+
+  const auto *records = previous->find(name);
+  if (records == nullptr)
+    return nullptr;
+
+  size_t before = std::count_if(records->begin(), records->end(), [type](const DNSRecord &record) { return record.type == type; });
+  if (before != rrset.size())
+    return nullptr;
+  for (const auto *record : rrset) {
+    if (std::find(records->begin(), records->end(), *record) == records->end())
+      return nullptr;
+  }
+
+  for (const auto &record : *records) {
+    if (record.type == T_RRSIG && rrsigCovered(record.rdata) == type && record.rdata[2] == DNSSEC_ALGORITHM
+        && rrsigKeyTag(record.rdata) == keyTag && (int32_t)(rrsigExpiration(record.rdata) - now) > SIG_REFRESH)
+      return &record;
+  }
+  return nullptr;
+}
+
+/* RRSIG over `rrset` (RFC 4034 3.1.8.1, canonical form and order of 6.2 and 6.3) */
+DNSRecord Signer::sign(const std::string &apex, const std::string &name, uint16_t type, std::vector<const DNSRecord *> rrset, uint32_t now) {
+  uint32_t ttl        = rrset.front()->ttl;
+  uint32_t expiration = now + SIG_VALIDITY - (uint32_t)((hashName(name) + type) % SIG_JITTER);
+
+  DNSRecord rrsig = {T_RRSIG, C_IN, ttl, {}};
+  putUint16(rrsig.rdata, type);
+  rrsig.rdata.push_back(DNSSEC_ALGORITHM);
+  rrsig.rdata.push_back(labelCount(name));
+  putUint32(rrsig.rdata, ttl);
+  putUint32(rrsig.rdata, expiration);
+  putUint32(rrsig.rdata, now - SIG_INCEPTION_SKEW);
+  putUint16(rrsig.rdata, keyTag);
+  encodeName(apex, rrsig.rdata);
+
+  std::vector<std::vector<uint8_t>> canonical;
+  for (const auto *record : rrset) {
+    canonical.push_back(record->rdata);
+    canonicalRdata(type, canonical.back());
+  }
+  std::sort(canonical.begin(), canonical.end());
+  canonical.erase(std::unique(canonical.begin(), canonical.end()), canonical.end());
+
+  std::vector<uint8_t> owner;
+  encodeName(name, owner);
+
+  std::vector<uint8_t> data = rrsig.rdata;
+  for (const auto &rdata : canonical) {
+    data.insert(data.end(), owner.begin(), owner.end());
+    putUint16(data, type);
+    putUint16(data, rrset.front()->rclass);
+    putUint32(data, ttl);
+    putUint16(data, rdata.size());
+    data.insert(data.end(), rdata.begin(), rdata.end());
+  }
+
+  uint8_t signature[ED25519_SIGNATURE_SIZE];
+  ed25519Sign(key, data.data(), data.size(), signature);
+  rrsig.rdata.insert(rrsig.rdata.end(), signature, signature + ED25519_SIGNATURE_SIZE);
+  return rrsig;
+}
+
+ZoneChange Signer::signNames(const ZoneData &zone, const ZoneData *previous, const std::vector<std::string> &names) {
+  uint32_t                                 now = time(nullptr);
+  std::vector<std::vector<ResourceRecord>> removed(names.size()), added(names.size());
+
+  pool->parallelFor(names.size(), [&](size_t begin, size_t end) {
+    std::vector<DNSRecord> wanted;
+    for (size_t i = begin; i < end; ++i) {
+      const std::string &name = names[i];
+
+      wanted.clear();
+      signName(zone, previous, name, now, wanted);
+
+      const auto *records = zone.find(name);
+      if (records != nullptr) {
+        for (const auto &record : *records) {
+          if (isDnssecType(record.type) && std::find(wanted.begin(), wanted.end(), record) == wanted.end())
+            removed[i].push_back(ResourceRecord{name, record});
+        }
+      }
+      for (auto &record : wanted) {
+        if (records == nullptr || std::find(records->begin(), records->end(), record) == records->end())
+          added[i].push_back(ResourceRecord{name, std::move(record)});
+      }
+    }
+  });
+
+  ZoneChange change = {zone.serial, zone.serial, {}, {}};
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::move(removed[i].begin(), removed[i].end(), std::back_inserter(change.removed));
+    std::move(added[i].begin(), added[i].end(), std::back_inserter(change.added));
+  }
+  return change;
+}
+
+std::shared_ptr<ZoneData> Signer::signZone(const ZoneData &zone, const ZoneData *previous) {
+  Logger &logger = Logger::getInstance();
+  auto    start  = std::chrono::steady_clock::now();
+
+  if (zone.apex.empty()) {
+    logger.warn("Zone has no SOA, leaving it unsigned");
+    return std::make_shared<ZoneData>(zone);
+  }
+  if (zone.ranges && zone.ranges->expandedSize(zone.apex) > 0) {
+    logger.error("Cannot sign " + zone.apex + " with $GENERATE or $SYNTHESIZE lines in it, list their records in the file instead");
+    return nullptr;
+  }
+
+  /* signatures and NSEC records from the zone file are replaced by our own */
+  RecordMap records;
+  for (const auto &shard : zone.shards) {
+    for (const auto &[name, data] : *shard) {
+      auto &kept = records[name];
+      std::copy_if(data.begin(), data.end(), std::back_inserter(kept), [](const DNSRecord &record) {
+        return !isDnssecType(record.type);
+      });
+      if (kept.empty())
+        records.erase(name);
+    }
+  }
+
+  auto &apexRecords = records[zone.apex];
+  auto  soa         = std::find_if(apexRecords.begin(), apexRecords.end(), [](const DNSRecord &record) { return record.type == T_SOA; });
+  DNSRecord ours    = {T_DNSKEY, C_IN, soa->ttl, dnskey};
+  if (std::find(apexRecords.begin(), apexRecords.end(), ours) == apexRecords.end())
+    apexRecords.push_back(ours);
+
+  std::vector<std::string> names;
+  for (const auto &entry : records) {
+    if (isSubdomain(entry.first, zone.apex))
+      names.push_back(entry.first);
+  }
+
+  auto unsignedZone    = ZoneData::build(std::move(records));
+  unsignedZone->apex   = zone.apex;
+  unsignedZone->serial = zone.serial;
+  unsignedZone->ranges = zone.ranges;
+
+  ZoneChange signatures = signNames(*unsignedZone, previous, names);
+  auto       signedZone = unsignedZone->withChange(signatures);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  logger.info(
+      "Signed " + zone.apex + " at serial " + std::to_string(zone.serial) + ": " + std::to_string(names.size()) + " names, "
+      + std::to_string(signatures.added.size()) + " records in " + std::to_string(elapsed.count()) + " ms, "
+      + std::to_string(pool->size()) + " signing threads"
+  );
+  return signedZone;
+}
+
+std::shared_ptr<ZoneData> Signer::signChange(const ZoneData &old, ZoneChange &change, const std::vector<std::string> &resign) {
+  auto next = old.withChange(change);
+
+  std::vector<std::string> names = resign;
+  for (const auto *records : {&change.removed, &change.added}) {
+    for (const auto &rr : *records) {
+      names.push_back(rr.name);
+    }
+  }
+
+  /* names that joined or left the chain change the NSEC of their predecessor */
+  size_t touched = names.size();
+  for (size_t i = 0; i < touched; ++i) {
+    names.push_back(previousName(*next, names[i]));
+  }
+
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  names.erase(
+      std::remove_if(names.begin(), names.end(), [&](const std::string &name) { return !isSubdomain(name, next->apex); }),
+      names.end()
+  );
+
+  ZoneChange signatures = signNames(*next, &old, names);
+  if (signatures.removed.empty() && signatures.added.empty())
+    return next;
+
+  auto signedNext = next->withChange(signatures);
+  std::move(signatures.removed.begin(), signatures.removed.end(), std::back_inserter(change.removed));
+  std::move(signatures.added.begin(), signatures.added.end(), std::back_inserter(change.added));
+  return signedNext;
+}
+
+std::vector<std::string> Signer::dueNames(const ZoneData &zone) const {
+  uint32_t                 now = time(nullptr);
+  std::vector<std::string> names;
+
+  for (const auto &shard : zone.shards) {
+    for (const auto &[name, records] : *shard) {
+      bool due = std::any_of(records.begin(), records.end(), [&](const DNSRecord &record) {
+        return record.type == T_RRSIG && (int32_t)(rrsigExpiration(record.rdata) - now) <= SIG_REFRESH;
+      });
+      if (due)
+        names.push_back(name);
+    }
+  }
+  return names;
+}
@@ -0,0 +1,419 @@
+#include "dnstap.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+/* Frame Streams control frames, announced by a zero length */
+#define FSTRM_CONTROL_ACCEPT     1
+#define FSTRM_CONTROL_START      2
+#define FSTRM_CONTROL_STOP       3
+#define FSTRM_CONTROL_READY      4
+#define FSTRM_CONTROL_FINISH     5
+#define FSTRM_FIELD_CONTENT_TYPE 1
+
+/* dnstap.proto types and field numbers */
+#define DNSTAP_TYPE_MESSAGE  1
+#define DNSTAP_AUTH_QUERY    1
+#define DNSTAP_AUTH_RESPONSE 2
+#define DNSTAP_FAMILY_INET   1
+
+#define PB_VARINT  0
+#define PB_BYTES   2
+#define PB_FIXED32 5
+
+/* Flags the ring of the thread as retired when the thread exits, the writer frees it once drained */
+struct RingHolder {
+  std::shared_ptr<DnstapRing> ring;
+
+  ~RingHolder() {
+    if (ring)
+      ring->retired.store(true, std::memory_order_release);
+  }
+};
+
+static thread_local RingHolder local;
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)value | 0x80);
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+static void putTag(std::vector<uint8_t> &out, int field, int wireType) {
+  putVarint(out, (field << 3) | wireType);
+}
+
+static void putVarintField(std::vector<uint8_t> &out, int field, uint64_t value) {
+  putTag(out, field, PB_VARINT);
+  putVarint(out, value);
+}
+
+static void putFixed32Field(std::vector<uint8_t> &out, int field, uint32_t value) {
+  putTag(out, field, PB_FIXED32);
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+static void putBytesField(std::vector<uint8_t> &out, int field, const void *data, size_t length) {
+  putTag(out, field, PB_BYTES);
+  putVarint(out, length);
+  out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + length);
+}
+
+static void putBigEndian32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back((uint8_t)(value >> shift));
+  }
+}
+
+static std::vector<uint8_t> controlFrame(uint32_t type) {
+  std::vector<uint8_t> frame;
+  bool                 typed = type != FSTRM_CONTROL_STOP && type != FSTRM_CONTROL_FINISH;
+
+  putBigEndian32(frame, 0);
+  putBigEndian32(frame, 4 + (typed ? 8 + sizeof(DNSTAP_CONTENT_TYPE) - 1 : 0));
+  putBigEndian32(frame, type);
+  if (typed) {
+    putBigEndian32(frame, FSTRM_FIELD_CONTENT_TYPE);
+    putBigEndian32(frame, sizeof(DNSTAP_CONTENT_TYPE) - 1);
+    frame.insert(frame.end(), DNSTAP_CONTENT_TYPE, DNSTAP_CONTENT_TYPE + sizeof(DNSTAP_CONTENT_TYPE) - 1);
+  }
+  return frame;
+}
+
+/* Wait for a control frame of `type` from a socket reader, skipping its fields */
+static bool readControlFrame(int fd, uint32_t type) {
+  uint8_t  buffer[512];
+  size_t   done = 0, needed = 12;
+  auto     deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DNSTAP_HANDSHAKE_WAIT);
+  uint32_t length   = 0;
+
+  while (done < needed) {
+    int           left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    struct pollfd pfd  = {fd, POLLIN, 0};
+    if (left <= 0 || poll(&pfd, 1, left) <= 0)
+      return false;
+
+    ssize_t n = recv(fd, buffer + done, needed - done, 0);
+    if (n <= 0)
+      return false;
+    done += n;
+
+    if (done == 12 && needed == 12) {
+      length = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+      if (length < 4 || 8 + length > sizeof(buffer))
+        return false;
+      needed = 8 + length;
+    }
+  }
+  return (uint32_t)((buffer[8] << 24) | (buffer[9] << 16) | (buffer[10] << 8) | buffer[11]) == type;
+}
+
+/* Append the data frame of one dnstap message */
+static void appendFrame(
+    std::vector<uint8_t> &out, std::vector<uint8_t> &message, const std::string &identity, const std::string &version, int type, int protocol, uint32_t address,
+    uint16_t port, const struct timespec &received, const struct timespec &now, const uint8_t *dns, size_t length
+) {
+  message.clear();
+  putVarintField(message, 1, type);
+  putVarintField(message, 2, DNSTAP_FAMILY_INET);
+  putVarintField(message, 3, protocol);
+  putBytesField(message, 4, &address, 4);
+  putVarintField(message, 6, ntohs(port));
+  putVarintField(message, 8, received.tv_sec);
+  putFixed32Field(message, 9, received.tv_nsec);
+  if (type == DNSTAP_AUTH_QUERY) {
+    putBytesField(message, 10, dns, length);
+  } else {
+    putVarintField(message, 12, now.tv_sec);
+    putFixed32Field(message, 13, now.tv_nsec);
+    putBytesField(message, 14, dns, length);
+  }
+
+  size_t start = out.size();
+  putBigEndian32(out, 0);
+  putBytesField(out, 1, identity.data(), identity.size());
+  putBytesField(out, 2, version.data(), version.size());
+  putBytesField(out, 14, message.data(), message.size());
+  putVarintField(out, 15, DNSTAP_TYPE_MESSAGE);
+
+  uint32_t frameLength = out.size() - start - 4;
+  for (int i = 0; i < 4; ++i) {
+    out[start + i] = (uint8_t)(frameLength >> (24 - 8 * i));
+  }
+}
+
+/* Data frames in `batch`, which holds whole frames only */
+static uint64_t countFrames(const std::vector<uint8_t> &batch) {
+  uint64_t frames = 0;
+  for (size_t offset = 0; offset + 4 <= batch.size(); ++frames) {
+    offset += 4 + ((batch[offset] << 24) | (batch[offset + 1] << 16) | (batch[offset + 2] << 8) | batch[offset + 3]);
+  }
+  return frames;
+}
+
+Dnstap &Dnstap::getInstance() {
+  static Dnstap instance;
+  return instance;
+}
+
+Dnstap::Dnstap(): socketOutput(false), active(false), fd(-1), running(false), reopenRequested(false), lost(0), retiredDrops(0) {}
+
+Dnstap::~Dnstap() {
+  stop();
+}
+
+bool Dnstap::configure(const std::string &target, const std::string &version) {
+  this->target  = target;
+  this->version = version;
+  socketOutput  = target.rfind("unix:", 0) == 0;
+
+  char host[256] = {};
+  gethostname(host, sizeof(host) - 1);
+  identity = host;
+
+  if (socketOutput && target.size() - 5 >= sizeof(sockaddr_un::sun_path)) {
+    Logger::getInstance().error("Dnstap socket path is too long: " + target);
+    return false;
+  }
+  active = true;
+  return true;
+}
+
+bool Dnstap::enabled() const {
+  return active;
+}
+
+void Dnstap::start() {
+  if (!active)
+    return;
+  running = true;
+  writer  = std::thread(&Dnstap::runWriter, this);
+}
+
+void Dnstap::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running)
+      return;
+    running = false;
+  }
+  wakeup.notify_all();
+  if (writer.joinable())
+    writer.join();
+}
+
+void Dnstap::reopen() {
+  reopenRequested = true;
+}
+
+DnstapRing *Dnstap::localRing() {
+  if (!local.ring) {
+    local.ring = std::make_shared<DnstapRing>();
+    std::lock_guard<std::mutex> lock(mutex);
+    rings.push_back(local.ring);
+  }
+  return local.ring.get();
+}
+
+void Dnstap::log(
+    int protocol, uint32_t address, uint16_t port, const struct timespec &received, const uint8_t *query, size_t queryLength, const uint8_t *response,
+    size_t responseLength
+) {
+  static thread_local std::vector<uint8_t> frames, message;
+
+  DnstapRing     *ring = localRing();
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  frames.clear();
+  appendFrame(frames, message, identity, version, DNSTAP_AUTH_QUERY, protocol, address, port, received, now, query, queryLength);
+  if (response)
+    appendFrame(frames, message, identity, version, DNSTAP_AUTH_RESPONSE, protocol, address, port, received, now, response, responseLength);
+
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  uint64_t tail = ring->tail.load(std::memory_order_acquire);
+  if (DNSTAP_RING_SIZE - (head - tail) < frames.size()) {
+    ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + (response ? 2 : 1), std::memory_order_relaxed);
+    return;
+  }
+
+  size_t offset = head & (DNSTAP_RING_SIZE - 1);
+  size_t first  = std::min(frames.size(), (size_t)DNSTAP_RING_SIZE - offset);
+  std::memcpy(ring->data.get() + offset, frames.data(), first);
+  std::memcpy(ring->data.get(), frames.data() + first, frames.size() - first);
+  ring->head.store(head + frames.size(), std::memory_order_release);
+}
+
+uint64_t Dnstap::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  uint64_t total = retiredDrops + lost;
+  for (const auto &ring : rings) {
+    total += ring->dropped.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void Dnstap::runWriter() {
+  Logger &logger = Logger::getInstance();
+
+  std::vector<uint8_t>                     batch;
+  std::vector<std::shared_ptr<DnstapRing>> snapshot;
+  auto                                     lastAttempt = std::chrono::steady_clock::time_point();
+  auto                                     lastReport  = std::chrono::steady_clock::now();
+  uint64_t                                 reported    = 0;
+  bool                                     failing     = false;
+
+  logger.info("Logging queries in dnstap format to " + target);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    bool stopping = !running;
+    snapshot      = rings;
+    lock.unlock();
+
+    auto now = std::chrono::steady_clock::now();
+    if (reopenRequested.exchange(false))
+      closeOutput();
+    if (fd < 0 && now - lastAttempt >= std::chrono::seconds(1)) {
+      lastAttempt = now;
+      if (openOutput()) {
+        if (failing)
+          logger.info("Dnstap output " + target + " is back");
+        failing = false;
+      } else if (!failing) {
+        logger.warn("Dnstap output " + target + " is unavailable: " + std::string(strerror(errno)));
+        failing = true;
+      }
+    }
+
+    /* whole rings at a time, frames of different threads must not interleave */
+    batch.clear();
+    for (const auto &ring : snapshot) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      if (head == tail)
+        continue;
+
+      size_t offset = tail & (DNSTAP_RING_SIZE - 1);
+      size_t length = head - tail;
+      size_t first  = std::min(length, (size_t)DNSTAP_RING_SIZE - offset);
+      batch.insert(batch.end(), ring->data.get() + offset, ring->data.get() + offset + first);
+      batch.insert(batch.end(), ring->data.get(), ring->data.get() + length - first);
+      ring->tail.store(head, std::memory_order_release);
+    }
+
+    if (!batch.empty() && (fd < 0 || !writeAll(batch.data(), batch.size()))) {
+      lost += countFrames(batch);
+      if (fd >= 0) {
+        logger.warn("Writing dnstap output " + target + " failed: " + std::string(strerror(errno)));
+        ::close(fd);
+        fd = -1;
+      }
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < rings.size();) {
+      DnstapRing &ring = *rings[i];
+      if (ring.retired.load(std::memory_order_acquire) && ring.head.load(std::memory_order_acquire) == ring.tail.load(std::memory_order_relaxed)) {
+        retiredDrops += ring.dropped.load(std::memory_order_relaxed);
+        rings[i] = std::move(rings.back());
+        rings.pop_back();
+      } else {
+        ++i;
+      }
+    }
+    snapshot.clear();
+
+    if (now - lastReport >= std::chrono::seconds(DNSTAP_REPORT_INTERVAL) || stopping) {
+      lastReport = now;
+      lock.unlock();
+      uint64_t total = dropped();
+      lock.lock();
+      if (total > reported) {
+        logger.warn("Dnstap dropped " + std::to_string(total - reported) + " messages, " + std::to_string(total) + " in total");
+        reported = total;
+      }
+    }
+
+    if (stopping)
+      break;
+    if (batch.size() < DNSTAP_BATCH_SIZE)
+      wakeup.wait_for(lock, std::chrono::milliseconds(DNSTAP_FLUSH_INTERVAL), [this] { return !running; });
+  }
+  lock.unlock();
+
+  closeOutput();
+}
+
+bool Dnstap::openOutput() {
+  if (socketOutput) {
+    struct sockaddr_un address = {};
+    address.sun_family         = AF_UNIX;
+    std::strncpy(address.sun_path, target.c_str() + 5, sizeof(address.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      return false;
+
+    std::vector<uint8_t> ready = controlFrame(FSTRM_CONTROL_READY);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || !writeAll(ready.data(), ready.size()) ||
+        !readControlFrame(fd, FSTRM_CONTROL_ACCEPT)) {
+      int error = errno;
+      ::close(fd);
+      fd    = -1;
+      errno = error;
+      return false;
+    }
+  } else {
+    fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0)
+      return false;
+  }
+
+  std::vector<uint8_t> start = controlFrame(FSTRM_CONTROL_START);
+  if (!writeAll(start.data(), start.size())) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void Dnstap::closeOutput() {
+  if (fd < 0)
+    return;
+
+  std::vector<uint8_t> stop = controlFrame(FSTRM_CONTROL_STOP);
+  if (writeAll(stop.data(), stop.size()) && socketOutput)
+    readControlFrame(fd, FSTRM_CONTROL_FINISH);
+  ::close(fd);
+  fd = -1;
+}
+
+bool Dnstap::writeAll(const uint8_t *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = socketOutput ? send(fd, data, length, MSG_NOSIGNAL) : write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    length -= n;
+  }
+  return true;
+}
@@ -0,0 +1,437 @@
+#include "ed25519.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/* SHA-512 */
+
+static const uint64_t K[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL,
+    0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL, 0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL, 0x983e5152ee66dfabULL,
+    0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL,
+    0x53380d139d95b3dfULL, 0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL, 0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL,
+    0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL, 0xca273eceea26619cULL,
+    0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL, 0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static inline uint64_t rotr(uint64_t x, int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t load64be(const uint8_t *p) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+static inline void store64be(uint8_t *p, uint64_t value) {
+  for (int i = 7; i >= 0; --i) {
+    p[i] = value;
+    value >>= 8;
+  }
+}
+
+SHA512::SHA512(): used(0), total(0) {
+  static const uint64_t initial[8] = {
+      0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+      0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+  };
+  std::memcpy(state, initial, sizeof(state));
+}
+
+void SHA512::compress(const uint8_t *data) {
+  uint64_t w[80];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = load64be(data + 8 * i);
+  }
+  for (int i = 16; i < 80; ++i) {
+    uint64_t s0 = rotr(w[i - 15], 1) ^ rotr(w[i - 15], 8) ^ (w[i - 15] >> 7);
+    uint64_t s1 = rotr(w[i - 2], 19) ^ rotr(w[i - 2], 61) ^ (w[i - 2] >> 6);
+    w[i]        = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 80; ++i) {
+    uint64_t t1 = h + (rotr(e, 14) ^ rotr(e, 18) ^ rotr(e, 41)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint64_t t2 = (rotr(a, 28) ^ rotr(a, 34) ^ rotr(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+    h           = g;
+    g           = f;
+    f           = e;
+    e           = d + t1;
+    d           = c;
+    c           = b;
+    b           = a;
+    a           = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void SHA512::update(const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  total += length;
+
+  if (used > 0) {
+    size_t take = std::min(length, sizeof(block) - used);
+    std::memcpy(block + used, bytes, take);
+    used += take;
+    bytes += take;
+    length -= take;
+    if (used < sizeof(block))
+      return;
+    compress(block);
+    used = 0;
+  }
+
+  for (; length >= sizeof(block); bytes += sizeof(block), length -= sizeof(block)) {
+    compress(bytes);
+  }
+  std::memcpy(block, bytes, length);
+  used = length;
+}
+
+void SHA512::final(uint8_t digest[SHA512_DIGEST_SIZE]) {
+  uint64_t bits = total * 8;
+
+  block[used++] = 0x80;
+  if (used > 112) {
+    std::memset(block + used, 0, sizeof(block) - used);
+    compress(block);
+    used = 0;
+  }
+  std::memset(block + used, 0, 120 - used);
+  store64be(block + 120, bits);
+  compress(block);
+
+  for (int i = 0; i < 8; ++i) {
+    store64be(digest + 8 * i, state[i]);
+  }
+}
+
+/* Field arithmetic modulo 2^255 - 19, five 51-bit limbs */
+
+typedef uint64_t          fe[5];
+typedef unsigned __int128 uint128_t;
+
+#define MASK51 ((1ULL << 51) - 1)
+
+static const fe D2 = {0x69b9426b2f159ULL, 0x35050762add7aULL, 0x3cf44c0038052ULL, 0x6738cc7407977ULL, 0x2406d9dc56dffULL};
+
+static inline void feCopy(fe r, const fe a) {
+  std::memcpy(r, a, sizeof(fe));
+}
+
+static inline void feCarry(fe r) {
+  for (int i = 0; i < 4; ++i) {
+    r[i + 1] += r[i] >> 51;
+    r[i] &= MASK51;
+  }
+  r[0] += 19 * (r[4] >> 51);
+  r[4] &= MASK51;
+}
+
+static inline void feAdd(fe r, const fe a, const fe b) {
+  for (int i = 0; i < 5; ++i) {
+    r[i] = a[i] + b[i];
+  }
+  feCarry(r);
+}
+
+/* adds 4p first so limbs never go negative */
+static inline void feSub(fe r, const fe a, const fe b) {
+  r[0] = a[0] + 0x1FFFFFFFFFFFB4ULL - b[0];
+  for (int i = 1; i < 5; ++i) {
+    r[i] = a[i] + 0x1FFFFFFFFFFFFCULL - b[i];
+  }
+  feCarry(r);
+}
+
+static void feMul(fe r, const fe a, const fe b) {
+  uint64_t b1 = 19 * b[1], b2 = 19 * b[2], b3 = 19 * b[3], b4 = 19 * b[4];
+
+  uint128_t t0 = (uint128_t)a[0] * b[0] + (uint128_t)a[1] * b4 + (uint128_t)a[2] * b3 + (uint128_t)a[3] * b2 + (uint128_t)a[4] * b1;
+  uint128_t t1 = (uint128_t)a[0] * b[1] + (uint128_t)a[1] * b[0] + (uint128_t)a[2] * b4 + (uint128_t)a[3] * b3 + (uint128_t)a[4] * b2;
+  uint128_t t2 = (uint128_t)a[0] * b[2] + (uint128_t)a[1] * b[1] + (uint128_t)a[2] * b[0] + (uint128_t)a[3] * b4 + (uint128_t)a[4] * b3;
+  uint128_t t3 = (uint128_t)a[0] * b[3] + (uint128_t)a[1] * b[2] + (uint128_t)a[2] * b[1] + (uint128_t)a[3] * b[0] + (uint128_t)a[4] * b4;
+  uint128_t t4 = (uint128_t)a[0] * b[4] + (uint128_t)a[1] * b[3] + (uint128_t)a[2] * b[2] + (uint128_t)a[3] * b[1] + (uint128_t)a[4] * b[0];
+
+  t1 += (uint64_t)(t0 >> 51);
+  t2 += (uint64_t)(t1 >> 51);
+  t3 += (uint64_t)(t2 >> 51);
+  t4 += (uint64_t)(t3 >> 51);
+
+  r[0] = ((uint64_t)t0 & MASK51) + 19 * (uint64_t)(t4 >> 51);
+  r[1] = (uint64_t)t1 & MASK51;
+  r[2] = (uint64_t)t2 & MASK51;
+  r[3] = (uint64_t)t3 & MASK51;
+  r[4] = (uint64_t)t4 & MASK51;
+  r[1] += r[0] >> 51;
+  r[0] &= MASK51;
+}
+
+static void feSquare(fe r, const fe a, int times = 1) {
+  feCopy(r, a);
+  for (int i = 0; i < times; ++i) {
+    feMul(r, r, r);
+  }
+}
+
+/* a^(p - 2) */
+static void feInvert(fe r, const fe z) {
+  fe t0, t1, t2, t3;
+
+  feSquare(t0, z);
+  feSquare(t1, t0, 2);
+  feMul(t1, z, t1);
+  feMul(t0, t0, t1);
+  feSquare(t2, t0);
+  feMul(t1, t1, t2); // 2^5 - 1
+  feSquare(t2, t1, 5);
+  feMul(t1, t2, t1); // 2^10 - 1
+  feSquare(t2, t1, 10);
+  feMul(t2, t2, t1); // 2^20 - 1
+  feSquare(t3, t2, 20);
+  feMul(t2, t3, t2); // 2^40 - 1
+  feSquare(t2, t2, 10);
+  feMul(t1, t2, t1); // 2^50 - 1
+  feSquare(t2, t1, 50);
+  feMul(t2, t2, t1); // 2^100 - 1
+  feSquare(t3, t2, 100);
+  feMul(t2, t3, t2); // 2^200 - 1
+  feSquare(t2, t2, 50);
+  feMul(t1, t2, t1); // 2^250 - 1
+  feSquare(t1, t1, 5);
+  feMul(r, t1, t0); // 2^255 - 21
+}
+
+static void feToBytes(uint8_t out[32], const fe a) {
+  fe h;
+  feCopy(h, a);
+  feCarry(h);
+  feCarry(h);
+
+  /* subtract p once if h >= p */
+  uint64_t q = (h[0] + 19) >> 51;
+  for (int i = 1; i < 5; ++i) {
+    q = (h[i] + q) >> 51;
+  }
+  h[0] += 19 * q;
+  for (int i = 0; i < 4; ++i) {
+    h[i + 1] += h[i] >> 51;
+    h[i] &= MASK51;
+  }
+  h[4] &= MASK51;
+
+  uint64_t words[4] = {h[0] | (h[1] << 51), (h[1] >> 13) | (h[2] << 38), (h[2] >> 26) | (h[3] << 25), (h[3] >> 39) | (h[4] << 12)};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      out[8 * i + j] = words[i] >> (8 * j);
+    }
+  }
+}
+
+/* Points in extended twisted Edwards coordinates, x = X/Z, y = Y/Z, xy = T/Z */
+
+struct Point {
+  fe X, Y, Z, T;
+};
+
+static void pointIdentity(Point &p) {
+  std::memset(&p, 0, sizeof(p));
+  p.Y[0] = 1;
+  p.Z[0] = 1;
+}
+
+/* add-2008-hwcd-3, complete for a = -1, also used for doubling */
+static void pointAdd(Point &r, const Point &p, const Point &q) {
+  fe a, b, c, d, e, f, g, h;
+
+  feSub(a, p.Y, p.X);
+  feSub(h, q.Y, q.X);
+  feMul(a, a, h);
+  feAdd(b, p.Y, p.X);
+  feAdd(h, q.Y, q.X);
+  feMul(b, b, h);
+  feMul(c, p.T, q.T);
+  feMul(c, c, D2);
+  feMul(d, p.Z, q.Z);
+  feAdd(d, d, d);
+  feSub(e, b, a);
+  feSub(f, d, c);
+  feAdd(g, d, c);
+  feAdd(h, b, a);
+
+  feMul(r.X, e, f);
+  feMul(r.Y, g, h);
+  feMul(r.T, e, h);
+  feMul(r.Z, f, g);
+}
+
+static void pointEncode(uint8_t out[32], const Point &p) {
+  fe     zi, x, y;
+  uint8_t xs[32];
+
+  feInvert(zi, p.Z);
+  feMul(x, p.X, zi);
+  feMul(y, p.Y, zi);
+  feToBytes(out, y);
+  feToBytes(xs, x);
+  out[31] ^= (xs[0] & 1) << 7;
+}
+
+/* BASE[i][j] = j * 16^i * B */
+static Point BASE[64][16];
+
+static bool buildBaseTable() {
+  Point b = {
+      {0x62d608f25d51aULL, 0x412a4b4f6592aULL, 0x75b7171a4b31dULL, 0x1ff60527118feULL, 0x216936d3cd6e5ULL},
+      {0x6666666666658ULL, 0x4ccccccccccccULL, 0x1999999999999ULL, 0x3333333333333ULL, 0x6666666666666ULL},
+      {1, 0, 0, 0, 0},
+      {0x68ab3a5b7dda3ULL, 0x00eea2a5eadbbULL, 0x2af8df483c27eULL, 0x332b375274732ULL, 0x67875f0fd78b7ULL},
+  };
+
+  for (int i = 0; i < 64; ++i) {
+    pointIdentity(BASE[i][0]);
+    BASE[i][1] = b;
+    for (int j = 2; j < 16; ++j) {
+      pointAdd(BASE[i][j], BASE[i][j - 1], b);
+    }
+    pointAdd(b, BASE[i][15], b);
+  }
+  return true;
+}
+
+static const bool baseTableReady = buildBaseTable();
+
+/* r = a * B, a little-endian scalar; table entries are selected without secret-dependent addressing */
+static void scalarMultBase(Point &r, const uint8_t a[32]) {
+  pointIdentity(r);
+
+  for (int i = 0; i < 64; ++i) {
+    uint64_t nibble = (a[i / 2] >> (4 * (i & 1))) & 15;
+
+    Point selected;
+    std::memset(&selected, 0, sizeof(selected));
+    for (uint64_t j = 0; j < 16; ++j) {
+      uint64_t        mask = -(uint64_t)(j == nibble);
+      const uint64_t *src  = (const uint64_t *)&BASE[i][j];
+      uint64_t       *dst  = (uint64_t *)&selected;
+      for (size_t k = 0; k < sizeof(Point) / 8; ++k) {
+        dst[k] |= src[k] & mask;
+      }
+    }
+    pointAdd(r, r, selected);
+  }
+}
+
+/* Scalars modulo the group order L = 2^252 + 27742317777372353535851937790883648493 */
+
+static const int64_t L[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+                              0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0x10};
+
+static void reduceModL(uint8_t r[32], int64_t x[64]) {
+  for (int i = 63; i >= 32; --i) {
+    int64_t carry = 0;
+    int     j;
+    for (j = i - 32; j < i - 12; ++j) {
+      x[j] += carry - 16 * x[i] * L[j - (i - 32)];
+      carry = (x[j] + 128) >> 8;
+      x[j] -= carry * 256;
+    }
+    x[j] += carry;
+    x[i] = 0;
+  }
+
+  int64_t carry = 0;
+  for (int j = 0; j < 32; ++j) {
+    x[j] += carry - (x[31] >> 4) * L[j];
+    carry = x[j] >> 8;
+    x[j] &= 255;
+  }
+  for (int j = 0; j < 32; ++j) {
+    x[j] -= carry * L[j];
+  }
+  for (int i = 0; i < 32; ++i) {
+    x[i + 1] += x[i] >> 8;
+    r[i] = x[i] & 255;
+  }
+}
+
+static void reduceDigest(uint8_t r[32], const uint8_t digest[SHA512_DIGEST_SIZE]) {
+  int64_t x[64];
+  for (int i = 0; i < 64; ++i) {
+    x[i] = digest[i];
+  }
+  reduceModL(r, x);
+}
+
+void ed25519Expand(const uint8_t seed[ED25519_SEED_SIZE], Ed25519Key &key) {
+  uint8_t digest[SHA512_DIGEST_SIZE];
+  SHA512  hash;
+  hash.update(seed, ED25519_SEED_SIZE);
+  hash.final(digest);
+
+  digest[0] &= 248;
+  digest[31] &= 127;
+  digest[31] |= 64;
+  std::memcpy(key.scalar, digest, 32);
+  std::memcpy(key.prefix, digest + 32, 32);
+
+  Point a;
+  scalarMultBase(a, key.scalar);
+  pointEncode(key.publicKey, a);
+}
+
+void ed25519Sign(const Ed25519Key &key, const uint8_t *message, size_t length, uint8_t signature[ED25519_SIGNATURE_SIZE]) {
+  uint8_t digest[SHA512_DIGEST_SIZE], r[32], h[32];
+
+  /* deterministic nonce r = H(prefix || M) */
+  SHA512 nonce;
+  nonce.update(key.prefix, 32);
+  nonce.update(message, length);
+  nonce.final(digest);
+  reduceDigest(r, digest);
+
+  Point R;
+  scalarMultBase(R, r);
+  pointEncode(signature, R);
+
+  /* h = H(R || A || M), S = r + h * a */
+  SHA512 challenge;
+  challenge.update(signature, 32);
+  challenge.update(key.publicKey, ED25519_PUBLIC_KEY_SIZE);
+  challenge.update(message, length);
+  challenge.final(digest);
+  reduceDigest(h, digest);
+
+  int64_t x[64] = {};
+  for (int i = 0; i < 32; ++i) {
+    x[i] = r[i];
+  }
+  for (int i = 0; i < 32; ++i) {
+    for (int j = 0; j < 32; ++j) {
+      x[i + j] += h[i] * (int64_t)key.scalar[j];
+    }
+  }
+  reduceModL(signature + 32, x);
+}
@@ -0,0 +1,262 @@
+#include "handoff.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+
+/* Wait up to `timeout` milliseconds for `fd` to become readable, stopping early once `running` clears */
+static bool waitReadable(int fd, int timeout, const std::atomic<bool> *running = nullptr) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  while (!running || *running) {
+    int left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (left <= 0)
+      return false;
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int           n   = poll(&pfd, 1, std::min(left, 100));
+    if (n > 0)
+      return true;
+    if (n < 0 && errno != EINTR)
+      return false;
+  }
+  return false;
+}
+
+static bool unixAddress(const std::string &path, struct sockaddr_un &address) {
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+int boundPort(int fd) {
+  struct sockaddr_in address = {};
+  socklen_t          length  = sizeof(address);
+  if (getsockname(fd, (struct sockaddr *)&address, &length) < 0)
+    return -1;
+  return ntohs(address.sin_port);
+}
+
+Handoff &Handoff::getInstance() {
+  static Handoff instance;
+  return instance;
+}
+
+Handoff::Handoff(): predecessor(-1), listenfd(-1), successor(-1), running(false), done(false) {}
+
+Handoff::~Handoff() {
+  stop();
+}
+
+bool Handoff::takeOver(const std::string &path) {
+  Logger &logger = Logger::getInstance();
+
+  struct sockaddr_un address;
+  if (!unixAddress(path, address)) {
+    logger.error("Handoff socket path is too long: " + path);
+    return false;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+
+  char request = HANDOFF_REQUEST;
+  if (send(fd, &request, 1, MSG_NOSIGNAL) != 1 || !waitReadable(fd, HANDOFF_TIMEOUT)) {
+    logger.warn("Running instance at " + path + " did not hand over its sockets");
+    close(fd);
+    return false;
+  }
+
+  char            kinds[HANDOFF_MAX_SOCKETS];
+  alignas(8) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)];
+  struct iovec    vector  = {kinds, sizeof(kinds)};
+  struct msghdr   message = {};
+  message.msg_iov         = &vector;
+  message.msg_iovlen      = 1;
+  message.msg_control     = control;
+  message.msg_controllen  = sizeof(control);
+
+  ssize_t         count  = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (count <= 0 || !header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+    logger.warn("Running instance at " + path + " sent no sockets");
+    close(fd);
+    return false;
+  }
+
+  int    fds[HANDOFF_MAX_SOCKETS];
+  size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  std::memcpy(fds, CMSG_DATA(header), received * sizeof(int));
+  for (size_t i = 0; i < received; ++i) {
+    if ((ssize_t)i < count)
+      inherited.emplace_back(kinds[i], fds[i]);
+    else
+      close(fds[i]);
+  }
+
+  predecessor = fd;
+  logger.info("Took over " + std::to_string(inherited.size()) + " sockets from the running instance at " + path);
+  return true;
+}
+
+int Handoff::claim(char kind) {
+  for (auto &[socketKind, fd] : inherited) {
+    if (socketKind == kind && fd >= 0) {
+      int claimed = fd;
+      fd          = -1;
+      return claimed;
+    }
+  }
+  return -1;
+}
+
+void Handoff::release() {
+  Logger &logger = Logger::getInstance();
+
+  for (auto &[kind, fd] : inherited) {
+    if (fd >= 0)
+      close(fd);
+  }
+  inherited.clear();
+
+  if (predecessor < 0)
+    return;
+
+  /* the previous instance keeps the connection open until it exits */
+  char ready = HANDOFF_READY;
+  if (send(predecessor, &ready, 1, MSG_NOSIGNAL) == 1) {
+    logger.info("Serving, waiting for the previous instance to drain");
+    char byte;
+    if (!waitReadable(predecessor, HANDOFF_DRAIN_WAIT * 1000) || recv(predecessor, &byte, 1, 0) != 0)
+      logger.warn("Previous instance did not exit in time");
+  }
+  close(predecessor);
+  predecessor = -1;
+}
+
+bool Handoff::offer(const std::string &path, const std::vector<HandoffSource> &sources) {
+  Logger &logger = Logger::getInstance();
+
+  struct sockaddr_un address;
+  if (!unixAddress(path, address)) {
+    logger.error("Handoff socket path is too long: " + path);
+    return false;
+  }
+
+  /* a leftover of an instance that is gone, or of the one this instance replaced */
+  unlink(path.c_str());
+  listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenfd < 0 || bind(listenfd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listenfd, 1) < 0) {
+    logger.error("Handoff socket " + path + " failed: " + std::string(strerror(errno)));
+    if (listenfd >= 0)
+      close(listenfd);
+    listenfd = -1;
+    return false;
+  }
+
+  this->path    = path;
+  this->sources = sources;
+  running       = true;
+  listener      = std::thread(&Handoff::runListener, this);
+  return true;
+}
+
+bool Handoff::handedOver() const {
+  return done;
+}
+
+void Handoff::stop() {
+  if (running) {
+    running = false;
+    if (listener.joinable())
+      listener.join();
+  }
+  if (listenfd >= 0) {
+    close(listenfd);
+    listenfd = -1;
+  }
+}
+
+void Handoff::runListener() {
+  while (running && !done) {
+    if (!waitReadable(listenfd, 1000, &running))
+      continue;
+
+    int fd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    if (serve(fd)) {
+      successor = fd;
+      done      = true;
+    } else {
+      close(fd);
+    }
+  }
+}
+
+/* Pass the sockets to a successor and wait until it serves; false if it gives up */
+bool Handoff::serve(int fd) {
+  Logger &logger = Logger::getInstance();
+
+  char request;
+  if (!waitReadable(fd, HANDOFF_TIMEOUT, &running) || recv(fd, &request, 1, 0) != 1 || request != HANDOFF_REQUEST)
+    return false;
+
+  char kinds[HANDOFF_MAX_SOCKETS];
+  int  fds[HANDOFF_MAX_SOCKETS];
+  int  count = 0;
+  for (const auto &[kind, source] : sources) {
+    int socket = source();
+    if (socket >= 0 && count < HANDOFF_MAX_SOCKETS) {
+      kinds[count] = kind;
+      fds[count++] = socket;
+    }
+  }
+  if (count == 0)
+    return false;
+
+  alignas(8) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)] = {};
+  struct iovec    vector  = {kinds, (size_t)count};
+  struct msghdr   message = {};
+  message.msg_iov         = &vector;
+  message.msg_iovlen      = 1;
+  message.msg_control     = control;
+  message.msg_controllen  = CMSG_SPACE(sizeof(int) * count);
+
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level     = SOL_SOCKET;
+  header->cmsg_type      = SCM_RIGHTS;
+  header->cmsg_len       = CMSG_LEN(sizeof(int) * count);
+  std::memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+
+  if (sendmsg(fd, &message, MSG_NOSIGNAL) < 0)
+    return false;
+  logger.info("Handed " + std::to_string(count) + " sockets to a new instance, serving until it is ready");
+
+  /* loading the zones may take the successor a while */
+  char ready;
+  while (running) {
+    if (!waitReadable(fd, 1000, &running))
+      continue;
+    if (recv(fd, &ready, 1, 0) == 1 && ready == HANDOFF_READY)
+      return true;
+    logger.warn("New instance gave up, serving on");
+    return false;
+  }
+  return false;
+}
@@ -0,0 +1,231 @@
+#include "hitters.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#include "logger.hpp"
+
+/* Flags the sketches of the thread as retired when the thread exits, the next dump drops them */
+struct WorkerHolder {
+  std::shared_ptr<HitterWorker> worker;
+
+  ~WorkerHolder() {
+    if (worker)
+      worker->retired.store(true, std::memory_order_release);
+  }
+};
+
+static thread_local WorkerHolder local;
+
+HitterSketch::HitterSketch() {
+  clear();
+}
+
+void HitterSketch::clear() {
+  std::memset(counters, 0, sizeof(counters));
+  std::memset(slots, 0, sizeof(slots));
+  used   = 0;
+  lowest = 0;
+  floor  = 0;
+}
+
+void HitterSketch::decay() {
+  for (auto &row : counters) {
+    for (uint32_t &counter : row) {
+      counter >>= 1;
+    }
+  }
+  for (int i = 0; i < used; ++i) {
+    counts[i] >>= 1;
+  }
+  if (used == HITTER_TOP)
+    findLowest();
+}
+
+std::vector<Hitter> HitterSketch::top() const {
+  std::vector<Hitter> hitters;
+  for (int i = 0; i < used; ++i) {
+    if (counts[i] > 0)
+      hitters.push_back({hashes[i], counts[i], keys[i]});
+  }
+  std::sort(hitters.begin(), hitters.end(), [](const Hitter &a, const Hitter &b) { return a.count > b.count; });
+  return hitters;
+}
+
+/* Update or admit a key whose estimate beats the smallest of the top, replacing that one when the top is full */
+void HitterSketch::promote(uint64_t hash, std::string_view key, uint32_t estimate) {
+  int  entry  = find(hash);
+  bool filled = false;
+
+  if (entry < 0) {
+    if (used < HITTER_TOP) {
+      entry  = used++;
+      filled = used == HITTER_TOP;
+    } else {
+      entry = lowest;
+      erase(hashes[entry]);
+    }
+    hashes[entry] = hash;
+    keys[entry].assign(key);
+    insert(hash, entry);
+  }
+  counts[entry] = estimate;
+
+  if (filled || (used == HITTER_TOP && entry == lowest))
+    findLowest();
+}
+
+int HitterSketch::find(uint64_t hash) const {
+  for (unsigned i = hash & (2 * HITTER_TOP - 1); slots[i]; i = (i + 1) & (2 * HITTER_TOP - 1)) {
+    if (hashes[slots[i] - 1] == hash)
+      return slots[i] - 1;
+  }
+  return -1;
+}
+
+void HitterSketch::insert(uint64_t hash, int entry) {
+  unsigned i = hash & (2 * HITTER_TOP - 1);
+  while (slots[i]) {
+    i = (i + 1) & (2 * HITTER_TOP - 1);
+  }
+  slots[i] = entry + 1;
+}
+
+/* Remove `hash` from the index, moving later entries of its probe run back into the gap */
+void HitterSketch::erase(uint64_t hash) {
+  const unsigned mask = 2 * HITTER_TOP - 1;
+
+  unsigned gap = hash & mask;
+  while (hashes[slots[gap] - 1] != hash) {
+    gap = (gap + 1) & mask;
+  }
+  for (unsigned i = (gap + 1) & mask; slots[i]; i = (i + 1) & mask) {
+    unsigned home = hashes[slots[i] - 1] & mask;
+    if (((i - home) & mask) >= ((i - gap) & mask)) {
+      slots[gap] = slots[i];
+      gap        = i;
+    }
+  }
+  slots[gap] = 0;
+}
+
+void HitterSketch::findLowest() {
+  lowest = 0;
+  for (int i = 1; i < used; ++i) {
+    if (counts[i] < counts[lowest])
+      lowest = i;
+  }
+  floor = counts[lowest];
+}
+
+void HitterWorker::advance(int64_t next) {
+  int64_t steps = window == 0 ? 0 : next - window;
+  window        = next;
+
+  if (steps >= 32) {
+    names.clear();
+    clients.clear();
+    return;
+  }
+  for (int64_t i = 0; i < steps; ++i) {
+    names.decay();
+    clients.decay();
+  }
+}
+
+void HitterWorker::publish() {
+  uint64_t                    generation = requested.load(std::memory_order_acquire);
+  std::lock_guard<std::mutex> lock(mutex);
+  publishedNames   = names.top();
+  publishedClients = clients.top();
+  answered.store(generation, std::memory_order_release);
+}
+
+HeavyHitters &HeavyHitters::getInstance() {
+  static HeavyHitters instance;
+  return instance;
+}
+
+HeavyHitters::HeavyHitters(): generation(0) {}
+
+HitterWorker &HeavyHitters::worker() {
+  if (!local.worker) {
+    local.worker = std::make_shared<HitterWorker>();
+    std::lock_guard<std::mutex> lock(mutex);
+    workers.push_back(local.worker);
+  }
+  return *local.worker;
+}
+
+static std::vector<Hitter> merge(std::unordered_map<uint64_t, Hitter> &merged) {
+  std::vector<Hitter> hitters;
+  for (auto &[hash, hitter] : merged) {
+    hitters.push_back(std::move(hitter));
+  }
+  std::sort(hitters.begin(), hitters.end(), [](const Hitter &a, const Hitter &b) { return a.count > b.count; });
+  if (hitters.size() > HITTER_TOP)
+    hitters.resize(HITTER_TOP);
+  return hitters;
+}
+
+void HeavyHitters::dump() {
+  Logger &logger = Logger::getInstance();
+
+  std::vector<std::shared_ptr<HitterWorker>> snapshot;
+  uint64_t                                   target;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::erase_if(workers, [](const std::shared_ptr<HitterWorker> &worker) { return worker->retired.load(std::memory_order_acquire); });
+    snapshot = workers;
+    target   = ++generation;
+  }
+
+  for (const auto &worker : snapshot) {
+    worker->requested.store(target, std::memory_order_release);
+  }
+
+  /* workers publish between batches and wake up at least every 100 ms */
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(HITTER_WAIT);
+  for (const auto &worker : snapshot) {
+    while (worker->answered.load(std::memory_order_acquire) != target && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+
+  std::unordered_map<uint64_t, Hitter> names, clients;
+  size_t                               missing = 0;
+  for (const auto &worker : snapshot) {
+    if (worker->answered.load(std::memory_order_acquire) != target) {
+      missing++;
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (const auto &hitter : worker->publishedNames) {
+      auto [entry, added] = names.try_emplace(hitter.hash, hitter);
+      if (!added)
+        entry->second.count += hitter.count;
+    }
+    for (const auto &hitter : worker->publishedClients) {
+      auto [entry, added] = clients.try_emplace(hitter.hash, hitter);
+      if (!added)
+        entry->second.count += hitter.count;
+    }
+  }
+
+  if (missing > 0)
+    logger.warn(std::to_string(missing) + " workers did not answer the heavy hitter dump");
+
+  logger.info("Heaviest query names, decayed over " + std::to_string(HITTER_WINDOW) + " s windows:");
+  for (const auto &hitter : merge(names)) {
+    logger.info("  " + std::to_string(hitter.count) + " " + (hitter.key.empty() ? "." : hitter.key));
+  }
+
+  logger.info("Heaviest client networks:");
+  for (const auto &hitter : merge(clients)) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, hitter.key.data(), address, sizeof(address));
+    logger.info("  " + std::to_string(hitter.count) + " " + address + "/24");
+  }
+}
@@ -1,25 +1,81 @@
+#include <chrono>
 #include <csignal>
 #include <iostream>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <thread>
 #include <unistd.h>
 
 #include "argparser.hpp"
+#include "cookie.hpp"
 #include "db.hpp"
+#include "dnssec.hpp"
+#include "dnstap.hpp"
+#include "handoff.hpp"
+#include "hitters.hpp"
 #include "logger.hpp"
+#include "policy.hpp"
+#include "secondary.hpp"
+#include "steering.hpp"
+#include "tcpserver.hpp"
+#include "tlsserver.hpp"
+#include "trace.hpp"
 #include "udpserver.hpp"
+#include "update.hpp"
+#include "view.hpp"
+#include "xdpserver.hpp"
+#include "zoneloader.hpp"
 
 #define APPNAME "DNSD"
 #define VERSION "v0.1.0"
 
 #define PORT 5353
 UDPServer server(PORT);
+TCPServer tcpServer(PORT);
+XDPServer xdpServer(PORT);
+TLSServer tlsServer(TLS_PORT);
+Secondary secondary;
 
+#define SHUTDOWN_TIMEOUT 20 // seconds the drain may take before exiting anyway, below HANDOFF_DRAIN_WAIT
+
+volatile std::sig_atomic_t stopRequested   = 0;
+volatile std::sig_atomic_t reloadRequested = 0;
+volatile std::sig_atomic_t dumpRequested   = 0;
+
+/* Stop serving and drain what was taken, on the main thread; a stop that hangs does not keep the process alive */
+void shutdown() {
+  std::thread([] {
+    std::this_thread::sleep_for(std::chrono::seconds(SHUTDOWN_TIMEOUT));
+    Logger::getInstance().warn("Draining took longer than " + std::to_string(SHUTDOWN_TIMEOUT) + " seconds, exiting");
+    _exit(EXIT_FAILURE);
+  }).detach();
+
+  Handoff::getInstance().stop();
+  secondary.stop();
+  xdpServer.stop();
+  server.stop();
+  tcpServer.stop();
+  tlsServer.stop();
+  Dnstap::getInstance().stop();
+  Steering::getInstance().stop();
+  exit(EXIT_SUCCESS);
+}
+
+/* Only sets flags for the main loop, a second SIGINT exits without draining */
 void signalHandler(int signum) {
   switch (signum) {
     case SIGINT:
-      server.stop();
-      exit(EXIT_SUCCESS);
+      if (stopRequested)
+        _exit(EXIT_FAILURE);
+      stopRequested = 1;
+      break;
+
+    case SIGHUP:
+      reloadRequested = 1;
+      break;
+
+    case SIGUSR1:
+      dumpRequested = 1;
       break;
 
     default:
@@ -30,11 +86,43 @@ void signalHandler(int signum) {
 int main(int argc, char **argv) {
   ArgParser parser(APPNAME " " VERSION, "This is a simple dns server.");
 
-  std::string dbFile = "db.conf";
-  int         port   = PORT;
+  std::string dbFile    = "db.conf";
+  int         port      = PORT;
+  std::string transfer  = "127.0.0.1";
+  std::string update    = "127.0.0.1";
+  std::string primary   = "";
+  std::string zone      = "";
+  std::string key       = "";
+  std::string blocklist = "";
+  std::string views     = "";
+  std::string steering  = "";
+  std::string tls       = "";
+  int         tlsPort   = TLS_PORT;
+  std::string dnstap    = "";
+  std::string handoff   = "";
+  std::string cookie    = "";
+  int         trace     = 0;
+  std::string xdp       = "";
+  bool        strict    = false;
 
   parser.add_option<std::string>("f", "file", "Dns records file name", dbFile);
   parser.add_option<int>("p", "port", "Port to listening", port);
+  parser.add_option<std::string>("t", "transfer", "Comma separated addresses allowed to transfer the zone", transfer);
+  parser.add_option<std::string>("u", "update", "Comma separated addresses allowed to send dynamic updates", update);
+  parser.add_option<std::string>("s", "primary", "Run as a secondary of this primary (address[:port])", primary);
+  parser.add_option<std::string>("z", "zone", "Zone to pull from the primary", zone);
+  parser.add_option<std::string>("k", "key", "Sign the zone with the Ed25519 key in this file, created if missing", key);
+  parser.add_option<std::string>("b", "blocklist", "Comma separated blocklists, file[=nxdomain|nodata|address+address]", blocklist);
+  parser.add_option<std::string>("v", "views", "Comma separated views, file=prefix+prefix served to clients in those prefixes", views);
+  parser.add_option<std::string>("g", "steering", "Steer A and AAAA answers by weight, health and GeoIP as set in this file", steering);
+  parser.add_option<std::string>("c", "tls", "Serve DNS over TLS with this PEM certificate[:key] file", tls);
+  parser.add_option<int>("d", "tls-port", "Port to listening for DNS over TLS", tlsPort);
+  parser.add_option<std::string>("l", "dnstap", "Log queries and responses in dnstap format to this file or unix:socket", dnstap);
+  parser.add_option<std::string>("H", "handoff", "Take over the sockets of the instance listening at this unix socket, then listen there", handoff);
+  parser.add_option<std::string>("C", "cookie-secret", "Sign DNS cookies with the secret in this file, created if missing, to share them between instances", cookie);
+  parser.add_option<int>("T", "trace", "Time the stages of UDP queries and log those slower than this many microseconds", trace);
+  parser.add_option<std::string>("X", "xdp", "Serve UDP queries arriving on this interface[:queue] over AF_XDP", xdp);
+  parser.add_option<bool>("S", "strict", "Refuse zone files with entries that cannot be loaded, such as unknown types, instead of skipping them", strict);
   parser.add_option<bool>("h", "help", "Show help message", false);
 
   try {
@@ -45,8 +133,24 @@ int main(int argc, char **argv) {
       exit(EXIT_SUCCESS);
     }
 
-    dbFile = parser.get_value<std::string>("f");
-    port   = parser.get_value<int>("p");
+    dbFile    = parser.get_value<std::string>("f");
+    port      = parser.get_value<int>("p");
+    transfer  = parser.get_value<std::string>("t");
+    update    = parser.get_value<std::string>("u");
+    primary   = parser.get_value<std::string>("s");
+    zone      = parser.get_value<std::string>("z");
+    key       = parser.get_value<std::string>("k");
+    blocklist = parser.get_value<std::string>("b");
+    views     = parser.get_value<std::string>("v");
+    steering  = parser.get_value<std::string>("g");
+    tls       = parser.get_value<std::string>("c");
+    tlsPort   = parser.get_value<int>("d");
+    dnstap    = parser.get_value<std::string>("l");
+    handoff   = parser.get_value<std::string>("H");
+    cookie    = parser.get_value<std::string>("C");
+    trace     = parser.get_value<int>("T");
+    xdp       = parser.get_value<std::string>("X");
+    strict    = parser.get_value<bool>("S");
 
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << "\n";
@@ -56,17 +160,120 @@ int main(int argc, char **argv) {
   Logger &logger = Logger::getInstance();
 
   server.setPort(port);
+  tcpServer.setPort(port);
+  xdpServer.setPort(port);
+  if (!handoff.empty() && Handoff::getInstance().takeOver(handoff)) {
+    server.setSocket(Handoff::getInstance().claim(HANDOFF_UDP));
+    tcpServer.setSocket(Handoff::getInstance().claim(HANDOFF_TCP));
+    tlsServer.setSocket(Handoff::getInstance().claim(HANDOFF_TLS));
+  }
+  if (!tcpServer.setTransferClients(transfer)) {
+    logger.error("Invalid transfer address list: " + transfer);
+    exit(EXIT_FAILURE);
+  }
+  if (!ZoneUpdate::setClients(update)) {
+    logger.error("Invalid update address list: " + update);
+    exit(EXIT_FAILURE);
+  }
 
-  logger.info("Reading db file from " + dbFile);
-  DB::getInstance(dbFile);
+  setStrictLoading(strict);
+  if (primary.empty()) {
+    if (!key.empty() && !Signer::getInstance().loadKey(key))
+      exit(EXIT_FAILURE);
+    logger.info("Reading db file from " + dbFile);
+    DB::getInstance(dbFile);
+  } else {
+    if (!secondary.configure(zone, primary, port)) {
+      logger.error("Secondary mode needs a zone and a valid primary address");
+      exit(EXIT_FAILURE);
+    }
+    if (!key.empty())
+      logger.warn("Secondaries serve the signatures of the primary, ignoring the DNSSEC key");
+    logger.info("Pulling " + zone + " from " + primary);
+    DB::getInstance("");
+    server.setNotifyHandler([](uint32_t source) { return secondary.notify(source); });
+    xdpServer.setNotifyHandler([](uint32_t source) { return secondary.notify(source); });
+  }
+
+  if (trace > 0)
+    Tracer::getInstance().configure(trace);
+  if (!cookie.empty() && !Cookies::getInstance().loadSecret(cookie))
+    exit(EXIT_FAILURE);
+  if (!blocklist.empty() && !Policy::getInstance().configure(blocklist))
+    exit(EXIT_FAILURE);
+  if (!views.empty() && !Views::getInstance().configure(views))
+    exit(EXIT_FAILURE);
+  if (!steering.empty() && !Steering::getInstance().configure(steering))
+    exit(EXIT_FAILURE);
+  if (!tls.empty()) {
+    size_t colon = tls.find(':');
+    if (!tlsServer.configure(tls.substr(0, colon), colon == std::string::npos ? "" : tls.substr(colon + 1)))
+      exit(EXIT_FAILURE);
+    tlsServer.setPort(tlsPort);
+  }
+
+  if (!dnstap.empty() && !Dnstap::getInstance().configure(dnstap, APPNAME " " VERSION))
+    exit(EXIT_FAILURE);
+  if (!xdp.empty() && !xdpServer.configure(xdp))
+    exit(EXIT_FAILURE);
 
   std::signal(SIGINT, signalHandler);
+  std::signal(SIGHUP, signalHandler);
+  std::signal(SIGUSR1, signalHandler);
 
   server.start();
+  if (xdpServer.enabled())
+    xdpServer.start();
+  tcpServer.start();
+  tlsServer.start();
+  /* the previous instance still writes the dnstap output until it exits */
+  Handoff::getInstance().release();
+  Dnstap::getInstance().start();
+  if (!handoff.empty()) {
+    Handoff::getInstance().offer(
+        handoff, {{HANDOFF_UDP, [] { return server.getSocket(); }},
+                  {HANDOFF_TCP, [] { return tcpServer.getSocket(); }},
+                  {HANDOFF_TLS, [] { return tlsServer.getSocket(); }}}
+    );
+  }
+  if (!primary.empty())
+    secondary.start();
+  Steering::getInstance().start();
 
   while (true) {
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
     // logger.info("tick");
+
+    if (stopRequested) {
+      logger.info("Interrupted, draining");
+      shutdown();
+    }
+
+    if (reloadRequested) {
+      reloadRequested = 0;
+      logger.info("Reloading db file from " + dbFile);
+      DB::getInstance(dbFile).reload();
+      if (Policy::getInstance().enabled())
+        Policy::getInstance().reload();
+      if (Views::getInstance().enabled())
+        Views::getInstance().reload();
+      if (Steering::getInstance().enabled())
+        Steering::getInstance().reload();
+      if (Dnstap::getInstance().enabled())
+        Dnstap::getInstance().reopen();
+    }
+
+    if (dumpRequested) {
+      dumpRequested = 0;
+      HeavyHitters::getInstance().dump();
+      if (Tracer::getInstance().enabled())
+        Tracer::getInstance().dump();
+    }
+
+    if (Handoff::getInstance().handedOver()) {
+      logger.info("A new instance took over, draining");
+      shutdown();
+    }
   }
 
   return EXIT_SUCCESS;
@@ -0,0 +1,96 @@
+#include "mappedfile.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const std::string &path, bool sequential) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    ::close(fd);
+    return false;
+  }
+  if (info.st_size == 0) {
+    ::close(fd);
+    return true;
+  }
+
+  void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+  if (sequential)
+    madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+
+  map    = mapped;
+  length = info.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (map != nullptr)
+    munmap(map, length);
+  map    = nullptr;
+  length = 0;
+}
+
+const uint8_t *MappedFile::data() const {
+  return (const uint8_t *)map;
+}
+
+size_t MappedFile::size() const {
+  return length;
+}
+
+bool newerFile(const std::string &path, const std::string &than) {
+  struct stat lhs, rhs;
+  if (stat(path.c_str(), &lhs) < 0 || stat(than.c_str(), &rhs) < 0)
+    return false;
+
+  if (lhs.st_mtim.tv_sec != rhs.st_mtim.tv_sec)
+    return lhs.st_mtim.tv_sec > rhs.st_mtim.tv_sec;
+  return lhs.st_mtim.tv_nsec > rhs.st_mtim.tv_nsec;
+}
+
+bool writeFileAtomically(const std::string &path, const std::vector<uint8_t> &data) {
+  std::string temporary = path + ".tmp";
+  int         fd        = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool        written   = fd >= 0 && write(fd, data.data(), data.size()) == (ssize_t)data.size();
+  if (fd >= 0)
+    ::close(fd);
+
+  if (!written || rename(temporary.c_str(), path.c_str()) < 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+void splitFields(std::string_view line, std::vector<std::string_view> &fields) {
+  line = line.substr(0, std::min(line.find('#'), line.find(';')));
+
+  fields.clear();
+  for (size_t i = 0; i < line.size();) {
+    while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) {
+      ++i;
+    }
+    size_t begin = i;
+    while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+      ++i;
+    }
+    if (i > begin)
+      fields.push_back(line.substr(begin, i - begin));
+  }
+}
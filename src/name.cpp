@@ -0,0 +1,355 @@
+#include "name.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#define ONES 0x0101010101010101ULL
+
+/* Lowercase the ASCII letters of eight bytes at once, other bytes are left untouched */
+static inline uint64_t lowerWord(uint64_t word) {
+  uint64_t heptets = word & (0x7F * ONES);
+  uint64_t geA     = heptets + (0x80 - 'A') * ONES;     // high bit set where byte >= 'A'
+  uint64_t gtZ     = heptets + (0x80 - 'Z' - 1) * ONES; // high bit set where byte > 'Z'
+  uint64_t upper   = (geA ^ gtZ) & ~word & (0x80 * ONES);
+  return word | (upper >> 2);
+}
+
+static inline uint64_t mixWord(uint64_t hash, uint64_t word) {
+  hash ^= word;
+  hash *= 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 32);
+}
+
+static inline uint64_t finalizeHash(uint64_t hash) {
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  return hash ^ (hash >> 32);
+}
+
+uint64_t lowerAndHash(const char *src, size_t length, char *dst) {
+  uint64_t hash = length * 0xC2B2AE3D27D4EB4FULL;
+  size_t   i    = 0;
+
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, src + i, 8);
+    word = lowerWord(word);
+    std::memcpy(dst + i, &word, 8);
+    hash = mixWord(hash, word);
+  }
+
+  if (i < length) {
+    uint64_t word = 0;
+    std::memcpy(&word, src + i, length - i);
+    word = lowerWord(word);
+    std::memcpy(dst + i, &word, length - i);
+    hash = mixWord(hash, word);
+  }
+
+  return finalizeHash(hash);
+}
+
+uint64_t hashName(std::string_view name) {
+  uint64_t hash = name.size() * 0xC2B2AE3D27D4EB4FULL;
+  size_t   i    = 0;
+
+  for (; i + 8 <= name.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, name.data() + i, 8);
+    hash = mixWord(hash, word);
+  }
+
+  if (i < name.size()) {
+    uint64_t word = 0;
+    std::memcpy(&word, name.data() + i, name.size() - i);
+    hash = mixWord(hash, word);
+  }
+
+  return finalizeHash(hash);
+}
+
+std::string canonicalName(std::string_view name) {
+  if (!name.empty() && name.back() == '.') {
+    name.remove_suffix(1);
+  }
+
+  std::string canonical(name.size(), '\0');
+  lowerAndHash(name.data(), name.size(), canonical.data());
+  return canonical;
+}
+
+/* Reverse the order of the labels of `text` into `reversed`, joining them with `separator`; the length stays the same */
+static void reverseLabels(std::string_view text, char from, char separator, char *reversed) {
+  while (!text.empty()) {
+    size_t start = text.rfind(from);
+    if (start == std::string_view::npos) {
+      std::memcpy(reversed, text.data(), text.size());
+      break;
+    }
+
+    std::string_view label = text.substr(start + 1);
+    std::memcpy(reversed, label.data(), label.size());
+    reversed += label.size();
+    *reversed++ = separator;
+    text        = text.substr(0, start);
+  }
+}
+
+std::string orderKey(std::string_view name) {
+  std::string key(name.size(), '\0');
+  reverseLabels(name, '.', '\0', key.data());
+  return key;
+}
+
+std::string orderKeyName(std::string_view key) {
+  std::string name(key.size(), '\0');
+  reverseLabels(key, '\0', '.', name.data());
+  return name;
+}
+
+void orderKey(std::string_view name, char *key) {
+  reverseLabels(name, '.', '\0', key);
+}
+
+void orderKeyName(std::string_view key, char *name) {
+  reverseLabels(key, '\0', '.', name);
+}
+
+/*
+  Walk the length octets of a wire-format name. Fills `boundary` with 0xFF at
+  the positions that become dots in the presentation form and 0 elsewhere,
+  returns the presentation length or -1 for a malformed name.
+*/
+static int scanLabels(const uint8_t *data, size_t size, size_t &offset, uint8_t *boundary) {
+  size_t pos    = offset;
+  int    length = 0;
+
+  while (true) {
+    if (pos >= size)
+      return -1;
+
+    uint8_t label = data[pos++];
+    if (label == 0)
+      break;
+
+    /* also rejects compression pointers, questions never need them */
+    if (label > MAX_LABEL_LENGTH || pos + label > size || pos + label - offset >= MAX_WIRE_NAME)
+      return -1;
+
+    if (length > 0)
+      boundary[length++] = 0xFF;
+    std::memset(boundary + length, 0, label);
+    length += label;
+    pos += label;
+  }
+
+  std::memset(boundary + length, 0, 32);
+  offset = pos;
+  return length;
+}
+
+static bool parseScalar(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed) {
+  size_t pos    = offset;
+  size_t length = 0;
+
+  while (true) {
+    if (pos >= size)
+      return false;
+
+    uint8_t label = data[pos++];
+    if (label == 0)
+      break;
+
+    if (label > MAX_LABEL_LENGTH || pos + label > size || pos + label - offset >= MAX_WIRE_NAME)
+      return false;
+    if (std::memchr(data + pos, '.', label) != nullptr)
+      return false;
+
+    if (length > 0)
+      text[length++] = '.';
+    std::memcpy(text + length, data + pos, label);
+    length += label;
+    pos += label;
+  }
+
+  parsed.length = length;
+  parsed.hash   = lowerAndHash(text, length, key);
+  offset        = pos;
+  return true;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+__attribute__((target("sse2"))) static bool
+parseSSE2(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed) {
+  alignas(16) uint8_t boundary[NAME_BUFFER_SIZE];
+
+  size_t start  = offset;
+  int    length = scanLabels(data, size, offset, boundary);
+  if (length < 0)
+    return false;
+
+  const uint8_t *src   = data + start + 1;
+  size_t         avail = size - start - 1;
+  uint64_t       hash  = length * 0xC2B2AE3D27D4EB4FULL;
+
+  const __m128i dot     = _mm_set1_epi8('.');
+  const __m128i belowA  = _mm_set1_epi8('A' - 1);
+  const __m128i aboveZ  = _mm_set1_epi8('Z' + 1);
+  const __m128i caseBit = _mm_set1_epi8(0x20);
+  const __m128i index   = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i       bad     = _mm_setzero_si128();
+
+  for (int i = 0; i < length; i += 16) {
+    __m128i bytes;
+    if (i + 16 <= (int)avail) {
+      bytes = _mm_loadu_si128((const __m128i *)(src + i));
+    } else {
+      alignas(16) uint8_t tail[16] = {};
+      std::memcpy(tail, src + i, std::min<size_t>(16, avail - i));
+      bytes = _mm_load_si128((const __m128i *)tail);
+    }
+
+    __m128i dots  = _mm_loadu_si128((const __m128i *)(boundary + i));
+    __m128i valid = _mm_cmpgt_epi8(_mm_set1_epi8(std::min(length - i, 16)), index);
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, belowA), _mm_cmpgt_epi8(aboveZ, bytes));
+    __m128i lower = _mm_or_si128(bytes, _mm_and_si128(upper, caseBit));
+
+    bad = _mm_or_si128(bad, _mm_and_si128(valid, _mm_andnot_si128(dots, _mm_cmpeq_epi8(bytes, dot))));
+
+    __m128i t = _mm_and_si128(valid, _mm_or_si128(_mm_andnot_si128(dots, bytes), _mm_and_si128(dots, dot)));
+    __m128i k = _mm_and_si128(valid, _mm_or_si128(_mm_andnot_si128(dots, lower), _mm_and_si128(dots, dot)));
+    _mm_storeu_si128((__m128i *)(text + i), t);
+    _mm_storeu_si128((__m128i *)(key + i), k);
+
+    hash = mixWord(hash, (uint64_t)_mm_cvtsi128_si64(k));
+    if (i + 8 < length)
+      hash = mixWord(hash, (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(k, k)));
+  }
+
+  if (_mm_movemask_epi8(bad) != 0)
+    return false;
+
+  parsed.length = length;
+  parsed.hash   = finalizeHash(hash);
+  return true;
+}
+
+__attribute__((target("avx2"))) static bool
+parseAVX2(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed) {
+  alignas(32) uint8_t boundary[NAME_BUFFER_SIZE];
+
+  size_t start  = offset;
+  int    length = scanLabels(data, size, offset, boundary);
+  if (length < 0)
+    return false;
+
+  const uint8_t *src   = data + start + 1;
+  size_t         avail = size - start - 1;
+  uint64_t       hash  = length * 0xC2B2AE3D27D4EB4FULL;
+
+  const __m256i dot     = _mm256_set1_epi8('.');
+  const __m256i belowA  = _mm256_set1_epi8('A' - 1);
+  const __m256i aboveZ  = _mm256_set1_epi8('Z' + 1);
+  const __m256i caseBit = _mm256_set1_epi8(0x20);
+  const __m256i index   = _mm256_setr_epi8(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+  );
+  __m256i bad = _mm256_setzero_si256();
+
+  for (int i = 0; i < length; i += 32) {
+    __m256i bytes;
+    if (i + 32 <= (int)avail) {
+      bytes = _mm256_loadu_si256((const __m256i *)(src + i));
+    } else {
+      alignas(32) uint8_t tail[32] = {};
+      std::memcpy(tail, src + i, std::min<size_t>(32, avail - i));
+      bytes = _mm256_load_si256((const __m256i *)tail);
+    }
+
+    __m256i dots  = _mm256_loadu_si256((const __m256i *)(boundary + i));
+    __m256i valid = _mm256_cmpgt_epi8(_mm256_set1_epi8(std::min(length - i, 32)), index);
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, belowA), _mm256_cmpgt_epi8(aboveZ, bytes));
+    __m256i lower = _mm256_or_si256(bytes, _mm256_and_si256(upper, caseBit));
+
+    bad = _mm256_or_si256(bad, _mm256_and_si256(valid, _mm256_andnot_si256(dots, _mm256_cmpeq_epi8(bytes, dot))));
+
+    __m256i t = _mm256_and_si256(valid, _mm256_blendv_epi8(bytes, dot, dots));
+    __m256i k = _mm256_and_si256(valid, _mm256_blendv_epi8(lower, dot, dots));
+    _mm256_storeu_si256((__m256i *)(text + i), t);
+    _mm256_storeu_si256((__m256i *)(key + i), k);
+
+    hash = mixWord(hash, (uint64_t)_mm256_extract_epi64(k, 0));
+    if (i + 8 < length)
+      hash = mixWord(hash, (uint64_t)_mm256_extract_epi64(k, 1));
+    if (i + 16 < length)
+      hash = mixWord(hash, (uint64_t)_mm256_extract_epi64(k, 2));
+    if (i + 24 < length)
+      hash = mixWord(hash, (uint64_t)_mm256_extract_epi64(k, 3));
+  }
+
+  if (!_mm256_testz_si256(bad, bad))
+    return false;
+
+  parsed.length = length;
+  parsed.hash   = finalizeHash(hash);
+  return true;
+}
+#endif
+
+typedef bool (*ParseFn)(const uint8_t *, size_t, size_t &, char *, char *, ParsedName &);
+
+static NameParser detectParser() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return NameParser::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return NameParser::SSE2;
+#endif
+  return NameParser::SCALAR;
+}
+
+static ParseFn parserFunction(NameParser parser) {
+  switch (parser) {
+#if defined(__x86_64__)
+    case NameParser::AVX2:
+      return parseAVX2;
+    case NameParser::SSE2:
+      return parseSSE2;
+#endif
+    default:
+      return parseScalar;
+  }
+}
+
+static NameParser activeParser   = detectParser();
+static ParseFn    activeFunction = parserFunction(activeParser);
+
+bool parseWireName(const uint8_t *data, size_t size, size_t &offset, char *text, char *key, ParsedName &parsed) {
+  return activeFunction(data, size, offset, text, key, parsed);
+}
+
+NameParser nameParser() {
+  return activeParser;
+}
+
+bool setNameParser(NameParser parser) {
+  if (parser > detectParser())
+    return false;
+  activeParser   = parser;
+  activeFunction = parserFunction(parser);
+  return true;
+}
+
+const char *nameParserName(NameParser parser) {
+  switch (parser) {
+    case NameParser::AVX2:
+      return "avx2";
+    case NameParser::SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
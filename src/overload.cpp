@@ -0,0 +1,71 @@
+#include "overload.hpp"
+
+#include <climits>
+#include <string>
+
+#include "logger.hpp"
+
+#define MILLISECOND 1000000LL
+
+OverloadControl::OverloadControl()
+    : level(SHED_NONE), intervalEnd(0), reportEnd(0), probeAfter(0), packets(0), busy(0), cost(0), minimum(LLONG_MAX), maximum(0), kernel(0),
+      known(false), dropped(0), lost(0), shed(0), overloaded(0) {}
+
+void OverloadControl::overflow(uint32_t total) {
+  /* the kernel counter wraps, differences of unsigned 32 bit values do not care */
+  if (known)
+    dropped += (uint32_t)(total - kernel);
+  kernel = total;
+  known  = true;
+}
+
+ShedLevel OverloadControl::update(int64_t now) {
+  if (now < intervalEnd)
+    return level;
+
+  /* an interval without datagrams keeps minimum at LLONG_MAX but is no overload */
+  bool    idle  = minimum == LLONG_MAX;
+  int64_t spent = packets > 0 ? busy / packets : 0;
+  if (dropped > 0 || (!idle && minimum > OVERLOAD_TARGET * MILLISECOND)) {
+    if (level == SHED_NONE) {
+      level = SHED_EXPENSIVE;
+    } else if (level == SHED_EXPENSIVE) {
+      cost = spent;
+      if (now >= probeAfter)
+        level = SHED_ALL;
+    } else if (4 * spent > 3 * cost) {
+      /* truncating saved less than a quarter per datagram */
+      level      = SHED_EXPENSIVE;
+      probeAfter = now + OVERLOAD_BACKOFF * 1000 * MILLISECOND;
+    }
+    overloaded++;
+  } else if (level > SHED_NONE) {
+    level = (ShedLevel)(level - 1);
+  }
+
+  lost += dropped;
+  dropped     = 0;
+  packets     = 0;
+  busy        = 0;
+  minimum     = LLONG_MAX;
+  intervalEnd = now + OVERLOAD_INTERVAL * MILLISECOND;
+
+  if (now >= reportEnd)
+    report(now);
+  return level;
+}
+
+void OverloadControl::report(int64_t now) {
+  if (lost > 0 || shed > 0 || overloaded > 0) {
+    Logger::getInstance().warn(
+        "UDP overload in the last " + std::to_string(OVERLOAD_REPORT) + " s: " + std::to_string(lost) + " datagrams dropped by the kernel, " +
+        std::to_string(shed) + " queries shed, " + std::to_string(overloaded) + " intervals over target, queueing delay up to " +
+        std::to_string(maximum / MILLISECOND) + " ms"
+    );
+  }
+  lost       = 0;
+  shed       = 0;
+  overloaded = 0;
+  maximum    = 0;
+  reportEnd  = now + OVERLOAD_REPORT * 1000 * MILLISECOND;
+}
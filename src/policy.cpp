@@ -0,0 +1,357 @@
+#include "policy.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+
+#include "dns.hpp"
+#include "logger.hpp"
+#include "name.hpp"
+
+static thread_local std::shared_ptr<const std::vector<std::shared_ptr<PolicyList>>> pinned;
+
+/*
+  Image layout: the magic, the name count, the block count, the offset of
+  each block from the start of the image, then the entries. An entry is the
+  length of the prefix it shares with the entry before, the length of the
+  rest, the rest and its POLICY_ flags. Block heads share nothing.
+*/
+#define HEADER_SIZE 16
+
+std::vector<uint8_t> NameSet::compile(std::vector<std::pair<std::string, uint8_t>> &&entries) {
+  for (auto &[name, flags] : entries) {
+    name = orderKey(name);
+  }
+  std::sort(entries.begin(), entries.end());
+
+  /* merge the flags of duplicates into the first of them */
+  size_t kept = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (kept > 0 && entries[kept - 1].first == entries[i].first)
+      entries[kept - 1].second |= entries[i].second;
+    else if (kept++ != i)
+      entries[kept - 1] = std::move(entries[i]);
+  }
+  entries.resize(kept);
+
+  uint32_t count  = entries.size();
+  uint32_t blocks = (count + POLICY_BLOCK_SIZE - 1) / POLICY_BLOCK_SIZE;
+
+  std::vector<uint8_t> image(HEADER_SIZE + blocks * sizeof(uint32_t));
+  std::memcpy(image.data(), POLICY_MAGIC, 8);
+  std::memcpy(image.data() + 8, &count, sizeof(count));
+  std::memcpy(image.data() + 12, &blocks, sizeof(blocks));
+
+  for (uint32_t i = 0; i < count; ++i) {
+    const std::string &key    = entries[i].first;
+    size_t             shared = 0;
+    if (i % POLICY_BLOCK_SIZE == 0) {
+      uint32_t offset = image.size();
+      std::memcpy(image.data() + HEADER_SIZE + i / POLICY_BLOCK_SIZE * sizeof(uint32_t), &offset, sizeof(offset));
+    } else {
+      const std::string &previous = entries[i - 1].first;
+      while (shared < previous.size() && shared < key.size() && previous[shared] == key[shared]) {
+        ++shared;
+      }
+    }
+
+    image.push_back(shared);
+    image.push_back(key.size() - shared);
+    image.insert(image.end(), key.begin() + shared, key.end());
+    image.push_back(entries[i].second);
+  }
+  return image;
+}
+
+/* First 8 bytes of `key` as a big endian number, padded with zeros, orders like the keys do */
+static uint64_t keyPrefix(std::string_view key) {
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    prefix = prefix << 8 | (i < key.size() ? (uint8_t)key[i] : 0);
+  }
+  return prefix;
+}
+
+bool NameSet::open(const uint8_t *image, size_t size) {
+  if (size < HEADER_SIZE || std::memcmp(image, POLICY_MAGIC, 8) != 0)
+    return false;
+
+  uint32_t names, heads;
+  std::memcpy(&names, image + 8, sizeof(names));
+  std::memcpy(&heads, image + 12, sizeof(heads));
+  if (heads != (names + POLICY_BLOCK_SIZE - 1) / POLICY_BLOCK_SIZE || HEADER_SIZE + (size_t)heads * sizeof(uint32_t) > size)
+    return false;
+
+  /* entries are checked as they are decoded, heads once here */
+  const uint32_t *table = (const uint32_t *)(image + HEADER_SIZE);
+  for (uint32_t i = 0; i < heads; ++i) {
+    if ((size_t)table[i] + 2 > size || image[table[i]] != 0 || (size_t)table[i] + 3 + image[table[i] + 1] > size)
+      return false;
+  }
+
+  data    = image;
+  length  = size;
+  count   = names;
+  blocks  = heads;
+  offsets = table;
+
+  prefixes.resize(blocks);
+  for (uint32_t i = 0; i < blocks; ++i) {
+    prefixes[i] = keyPrefix(head(i));
+  }
+  return true;
+}
+
+std::string_view NameSet::head(uint32_t block) const {
+  const uint8_t *entry = data + offsets[block];
+  return std::string_view((const char *)entry + 2, entry[1]);
+}
+
+/* Set in what flags() returns when names below `key` are in the set, never stored */
+#define HAS_BELOW 0x80
+
+static bool below(std::string_view entry, std::string_view key) {
+  return entry.size() > key.size() && entry[key.size()] == '\0' && entry.substr(0, key.size()) == key;
+}
+
+/*
+  POLICY_ flags of exactly `key`, 0 if it is not in the set, plus HAS_BELOW.
+  Keys of the names below `key` follow it directly in the order, so looking
+  at the next key is enough. `first` is the lowest block to search and is
+  moved to the block of `key`, longer keys sort after it.
+*/
+uint8_t NameSet::flags(std::string_view key, uint32_t &first) const {
+  /* heads with another prefix order against `key` by it alone */
+  uint64_t prefix = keyPrefix(key);
+  uint32_t low    = std::lower_bound(prefixes.begin() + first, prefixes.end(), prefix) - prefixes.begin();
+  uint32_t high   = std::upper_bound(prefixes.begin() + low, prefixes.end(), prefix) - prefixes.begin();
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (head(middle) <= key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == 0)
+    return below(head(0), key) ? HAS_BELOW : 0;
+
+  uint32_t block = low - 1;
+  size_t   pos   = offsets[block];
+  char     current[256];
+  size_t   currentLength = 0;
+  uint8_t  found         = 0;
+  first                  = block;
+  for (uint32_t i = block * POLICY_BLOCK_SIZE; i < std::min(count, (block + 1) * POLICY_BLOCK_SIZE); ++i) {
+    if (pos + 2 > length)
+      return 0;
+    size_t shared = data[pos], rest = data[pos + 1];
+    if (shared > currentLength || shared + rest > sizeof(current) || pos + 3 + rest > length)
+      return 0;
+
+    std::memcpy(current + shared, data + pos + 2, rest);
+    currentLength = shared + rest;
+    uint8_t entryFlags = data[pos + 2 + rest];
+    pos += 3 + rest;
+
+    std::string_view entry(current, currentLength);
+    int              order = entry.compare(key);
+    if (order == 0)
+      found = entryFlags;
+    else if (order > 0)
+      return found | (below(entry, key) ? HAS_BELOW : 0);
+  }
+  return found | (block + 1 < blocks && below(head(block + 1), key) ? HAS_BELOW : 0);
+}
+
+bool NameSet::contains(std::string_view name) const {
+  if (count == 0 || name.empty() || name.size() > MAX_NAME_LENGTH)
+    return false;
+
+  /* build the key a label at a time from the top, each step is an ancestor to look up */
+  char     key[NAME_BUFFER_SIZE];
+  size_t   keyLength = 0;
+  uint32_t first     = 0;
+  while (true) {
+    size_t           dot   = name.rfind('.');
+    std::string_view label = dot == std::string_view::npos ? name : name.substr(dot + 1);
+    if (keyLength > 0)
+      key[keyLength++] = '\0';
+    std::memcpy(key + keyLength, label.data(), label.size());
+    keyLength += label.size();
+
+    bool    last  = dot == std::string_view::npos;
+    uint8_t found = flags(std::string_view(key, keyLength), first);
+    if (found & (last ? POLICY_SELF : POLICY_BELOW))
+      return true;
+    if (last || !(found & HAS_BELOW))
+      return false;
+    name = name.substr(0, dot);
+  }
+}
+
+size_t NameSet::size() const {
+  return count;
+}
+
+Policy &Policy::getInstance() {
+  static Policy instance;
+  return instance;
+}
+
+Policy::Policy() {
+  current.store(std::make_shared<const ListSet>());
+}
+
+bool Policy::configure(const std::string &spec) {
+  Logger &logger = Logger::getInstance();
+
+  size_t start = 0;
+  while (start <= spec.size()) {
+    size_t end = spec.find(',', start);
+    if (end == std::string::npos)
+      end = spec.size();
+    std::string item = spec.substr(start, end - start);
+    start            = end + 1;
+    if (item.empty())
+      continue;
+
+    ListSpec list;
+    size_t   equals = item.find('=');
+    list.path       = item.substr(0, equals);
+    std::string action = equals == std::string::npos ? "nxdomain" : item.substr(equals + 1);
+
+    if (action == "nxdomain") {
+      list.action = PolicyAction::NXDOMAIN;
+    } else if (action == "nodata") {
+      list.action = PolicyAction::NODATA;
+    } else {
+      list.action = PolicyAction::SINKHOLE;
+      for (size_t from = 0; from <= action.size();) {
+        size_t      to      = std::min(action.find('+', from), action.size());
+        std::string address = action.substr(from, to - from);
+        from                = to + 1;
+
+        uint8_t rdata[16];
+        if (inet_pton(AF_INET, address.c_str(), rdata) == 1) {
+          list.sinkholes.push_back(DNSRecord{T_A, C_IN, POLICY_TTL, std::vector<uint8_t>(rdata, rdata + 4)});
+        } else if (inet_pton(AF_INET6, address.c_str(), rdata) == 1) {
+          list.sinkholes.push_back(DNSRecord{T_AAAA, C_IN, POLICY_TTL, std::vector<uint8_t>(rdata, rdata + 16)});
+        } else {
+          logger.error("Invalid blocklist action " + action + " for " + list.path);
+          return false;
+        }
+      }
+    }
+    specs.push_back(std::move(list));
+  }
+
+  return reload();
+}
+
+bool Policy::enabled() const {
+  return !specs.empty();
+}
+
+/* Names of a text list: one per line or hosts file style, `#` and `;` start comments */
+static bool readList(const std::string &path, std::vector<std::pair<std::string, uint8_t>> &entries) {
+  MappedFile file;
+  if (!file.open(path, true))
+    return false;
+
+  std::string_view              text((const char *)file.data(), file.size());
+  std::vector<std::string_view> fields;
+  while (!text.empty()) {
+    size_t eol = text.find('\n');
+    splitFields(text.substr(0, eol), fields);
+    text = eol == std::string_view::npos ? std::string_view() : text.substr(eol + 1);
+
+    /* hosts files put an address first */
+    for (size_t i = fields.size() > 1 ? 1 : 0; i < fields.size(); ++i) {
+      std::string_view name  = fields[i];
+      uint8_t          flags = POLICY_SELF | POLICY_BELOW;
+      if (name.substr(0, 2) == "*.") {
+        name.remove_prefix(2);
+        flags = POLICY_BELOW;
+      }
+
+      std::string canonical = canonicalName(name);
+      if (!canonical.empty() && canonical.size() <= MAX_NAME_LENGTH)
+        entries.emplace_back(std::move(canonical), flags);
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<PolicyList> Policy::load(const ListSpec &spec) {
+  Logger &logger = Logger::getInstance();
+  auto    list   = std::make_shared<PolicyList>();
+  list->path      = spec.path;
+  list->action    = spec.action;
+  list->sinkholes = spec.sinkholes;
+
+  /* the compiled image is used as is when the list has not changed since */
+  std::string cache = spec.path + ".set";
+  if (newerFile(cache, spec.path)) {
+    if (list->map.open(cache) && list->names.open(list->map.data(), list->map.size())) {
+      logger.info("Mapped blocklist " + cache + ": " + std::to_string(list->names.size()) + " names");
+      return list;
+    }
+    list->map.close();
+    logger.warn("Ignoring damaged blocklist image " + cache);
+  }
+
+  std::vector<std::pair<std::string, uint8_t>> entries;
+  if (!readList(spec.path, entries)) {
+    logger.error("Cannot read blocklist " + spec.path + ": " + std::string(strerror(errno)));
+    return nullptr;
+  }
+  list->image = NameSet::compile(std::move(entries));
+  list->names.open(list->image.data(), list->image.size());
+
+  if (!writeFileAtomically(cache, list->image))
+    logger.warn("Cannot write blocklist image " + cache + ", the list is compiled again on every load");
+
+  logger.info(
+      "Compiled blocklist " + spec.path + ": " + std::to_string(list->names.size()) + " names in "
+      + std::to_string(list->image.size() >> 10) + " kB"
+  );
+  return list;
+}
+
+bool Policy::reload() {
+  Logger &logger = Logger::getInstance();
+
+  auto lists = std::make_shared<ListSet>();
+  for (const auto &spec : specs) {
+    auto list = load(spec);
+    if (!list) {
+      logger.warn("Keeping the running blocklists");
+      return false;
+    }
+    lists->push_back(std::move(list));
+  }
+
+  for (const auto &list : *current.load()) {
+    logger.info("Blocklist " + list->path + " answered " + std::to_string(list->hits.load(std::memory_order_relaxed)) + " queries");
+  }
+  current.store(std::move(lists));
+  return true;
+}
+
+void Policy::pin() {
+  pinned = current.load(std::memory_order_acquire);
+}
+
+const PolicyList *Policy::match(std::string_view name) {
+  if (!pinned)
+    pinned = current.load(std::memory_order_acquire);
+
+  for (const auto &list : *pinned) {
+    if (list->names.contains(name)) {
+      list->hits.fetch_add(1, std::memory_order_relaxed);
+      return list.get();
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,139 @@
+#include "prefix.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+
+bool parsePrefix(const std::string &text, uint8_t address[16], uint8_t &length, bool &v4) {
+  size_t      slash = text.find('/');
+  std::string host  = text.substr(0, slash);
+
+  std::memset(address, 0, 16);
+  v4 = inet_pton(AF_INET, host.c_str(), address) == 1;
+  if (!v4 && inet_pton(AF_INET6, host.c_str(), address) != 1)
+    return false;
+
+  int bits = v4 ? 32 : 128;
+  length   = bits;
+  if (slash != std::string::npos) {
+    const char *digits = text.c_str() + slash + 1;
+    char       *end;
+    long        parsed = std::strtol(digits, &end, 10);
+    if (end == digits || *end != '\0' || parsed < 0 || parsed > bits)
+      return false;
+    length = parsed;
+  }
+
+  /* clear the host bits */
+  for (int i = 0; i < bits / 8; ++i) {
+    int kept = std::clamp(length - i * 8, 0, 8);
+    address[i] &= (uint8_t)(0xff00 >> kept);
+  }
+  return true;
+}
+
+bool PrefixMatcher::add(const std::string &prefix, uint16_t value) {
+  Prefix entry = {};
+  bool   v4;
+  if (value == 0 || value > PREFIX_MAX_VALUE || !parsePrefix(prefix, entry.address, entry.length, v4))
+    return false;
+
+  entry.value = value;
+  (v4 ? prefixes4 : prefixes6).push_back(entry);
+  return true;
+}
+
+bool PrefixMatcher::compile() {
+  auto shorter = [](const Prefix &a, const Prefix &b) { return a.length < b.length; };
+
+  /* shorter prefixes first, longer ones then overwrite the part they cover */
+  std::stable_sort(prefixes4.begin(), prefixes4.end(), shorter);
+  std::stable_sort(prefixes6.begin(), prefixes6.end(), shorter);
+
+  tbl24.clear();
+  tbl8.clear();
+  if (!prefixes4.empty())
+    tbl24.assign(1 << 24, 0);
+
+  for (const auto &prefix : prefixes4) {
+    uint32_t host = (uint32_t)prefix.address[0] << 24 | prefix.address[1] << 16 | prefix.address[2] << 8 | prefix.address[3];
+    if (prefix.length <= 24) {
+      auto first = tbl24.begin() + (host >> 8);
+      std::fill(first, first + (1 << (24 - prefix.length)), prefix.value);
+      continue;
+    }
+
+    uint16_t &entry = tbl24[host >> 8];
+    if (!(entry & PREFIX_TBL8_GROUP)) {
+      size_t group = tbl8.size() >> 8;
+      if (group > PREFIX_MAX_VALUE)
+        return false;
+      tbl8.insert(tbl8.end(), 256, entry);
+      entry = PREFIX_TBL8_GROUP | group;
+    }
+    auto first = tbl8.begin() + ((entry & ~PREFIX_TBL8_GROUP) << 8 | (host & 0xff));
+    std::fill(first, first + (1 << (32 - prefix.length)), prefix.value);
+  }
+
+  nodes6.clear();
+  default6 = 0;
+  if (!prefixes6.empty())
+    nodes6.emplace_back();
+
+  for (const auto &prefix : prefixes6) {
+    if (prefix.length == 0) {
+      default6 = prefix.value;
+      continue;
+    }
+
+    /* the byte the prefix ends in, each value there covers the rest of its bits */
+    size_t depth = (prefix.length - 1) / 8;
+    size_t node  = 0;
+    for (size_t i = 0; i < depth; ++i) {
+      uint8_t byte = prefix.address[i];
+      if (nodes6[node].child[byte] == 0) {
+        nodes6[node].child[byte] = nodes6.size();
+        nodes6.emplace_back();
+      }
+      node = nodes6[node].child[byte];
+    }
+
+    int       rest  = prefix.length - depth * 8;
+    uint16_t *first = nodes6[node].value + prefix.address[depth];
+    std::fill(first, first + (1 << (8 - rest)), prefix.value);
+  }
+  return true;
+}
+
+uint16_t PrefixMatcher::lookup(uint32_t address) const {
+  if (tbl24.empty())
+    return 0;
+
+  uint32_t host  = ntohl(address);
+  uint16_t entry = tbl24[host >> 8];
+  if (entry & PREFIX_TBL8_GROUP)
+    entry = tbl8[(entry & ~PREFIX_TBL8_GROUP) << 8 | (host & 0xff)];
+  return entry;
+}
+
+uint16_t PrefixMatcher::lookup(const struct in6_addr &address) const {
+  uint16_t best = default6;
+  if (nodes6.empty())
+    return best;
+
+  size_t node = 0;
+  for (size_t i = 0; i < 16; ++i) {
+    uint8_t byte = address.s6_addr[i];
+    if (nodes6[node].value[byte] != 0)
+      best = nodes6[node].value[byte];
+    node = nodes6[node].child[byte];
+    if (node == 0)
+      break;
+  }
+  return best;
+}
+
+size_t PrefixMatcher::size() const {
+  return prefixes4.size() + prefixes6.size();
+}
@@ -0,0 +1,479 @@
+#include "rdata.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+#include <strings.h>
+
+#include "dns.hpp"
+#include "name.hpp"
+
+template<typename Table>
+static int lookupValue(std::string_view name, const Table &values, std::string_view prefix) {
+  for (const auto &[value, mnemonic] : values) {
+    if (name.size() == mnemonic.size() && strncasecmp(name.data(), mnemonic.data(), name.size()) == 0)
+      return value;
+  }
+
+  /* RFC 3597 generic form */
+  if (name.size() > prefix.size() && strncasecmp(name.data(), prefix.data(), prefix.size()) == 0) {
+    unsigned value;
+    auto [ptr, ec] = std::from_chars(name.data() + prefix.size(), name.data() + name.size(), value);
+    if (ec == std::errc() && ptr == name.data() + name.size() && value <= 0xFFFF)
+      return value;
+  }
+  return -1;
+}
+
+int typeValue(std::string_view name) {
+  return lookupValue(name, dns_type_vals, "TYPE");
+}
+
+int classValue(std::string_view name) {
+  return lookupValue(name, dns_class_vals, "CLASS");
+}
+
+bool encodeName(std::string_view name, std::vector<uint8_t> &out) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  if (name.size() > MAX_NAME_LENGTH)
+    return false;
+
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string_view::npos)
+      end = name.size();
+    if (end == start || end - start > MAX_LABEL_LENGTH)
+      return false;
+
+    out.push_back(end - start);
+    out.insert(out.end(), name.begin() + start, name.begin() + end);
+    start = end + 1;
+  }
+  out.push_back(0);
+  return true;
+}
+
+bool decodeName(const uint8_t *data, size_t size, size_t &offset, std::string &name) {
+  size_t pos    = offset;
+  int    jumps  = 0;
+  bool   jumped = false;
+
+  name.clear();
+  while (true) {
+    if (pos >= size)
+      return false;
+
+    uint8_t label = data[pos];
+    if ((label & 0xC0) == 0xC0) {
+      if (pos + 1 >= size || ++jumps > 64)
+        return false;
+      if (!jumped)
+        offset = pos + 2;
+      jumped = true;
+      pos    = ((label & 0x3F) << 8) | data[pos + 1];
+      continue;
+    }
+    if (label > MAX_LABEL_LENGTH || pos + 1 + label > size)
+      return false;
+
+    pos++;
+    if (label == 0)
+      break;
+    if (!name.empty())
+      name.push_back('.');
+    name.append((const char *)data + pos, label);
+    pos += label;
+    if (name.size() > MAX_NAME_LENGTH)
+      return false;
+  }
+
+  if (!jumped)
+    offset = pos;
+  return true;
+}
+
+/* Copy a possibly compressed name from a message into `out` uncompressed */
+static bool copyName(const uint8_t *data, size_t size, size_t &offset, std::vector<uint8_t> &out) {
+  std::string name;
+  return decodeName(data, size, offset, name) && encodeName(name, out);
+}
+
+bool decodeRecord(
+    const uint8_t *data, size_t size, size_t &offset, std::string &name, uint16_t &type, uint16_t &rclass, uint32_t &ttl,
+    std::vector<uint8_t> &rdata
+) {
+  if (!decodeName(data, size, offset, name) || offset + 10 > size)
+    return false;
+  name = canonicalName(name);
+
+  type     = (data[offset] << 8) | data[offset + 1];
+  rclass   = (data[offset + 2] << 8) | data[offset + 3];
+  ttl      = ((uint32_t)data[offset + 4] << 24) | (data[offset + 5] << 16) | (data[offset + 6] << 8) | data[offset + 7];
+  size_t rdlength = (data[offset + 8] << 8) | data[offset + 9];
+  offset += 10;
+
+  size_t end = offset + rdlength;
+  if (end > size)
+    return false;
+
+  /* empty RDATA shows up in UPDATE deletions and prerequisites (RFC 2136) */
+  rdata.clear();
+  if (rdlength == 0)
+    return true;
+
+  /* names may only be compressed in the RDATA of the RFC 1035 types, plus SRV by common practice */
+  switch (type) {
+    case T_NS:
+    case T_CNAME:
+    case T_PTR:
+    case T_DNAME:
+      if (!copyName(data, end, offset, rdata))
+        return false;
+      break;
+
+    case T_MX:
+    case T_SRV: {
+      size_t fixed = type == T_MX ? 2 : 6;
+      if (offset + fixed > end)
+        return false;
+      rdata.insert(rdata.end(), data + offset, data + offset + fixed);
+      offset += fixed;
+      if (!copyName(data, end, offset, rdata))
+        return false;
+      break;
+    }
+
+    case T_SOA:
+      if (!copyName(data, end, offset, rdata) || !copyName(data, end, offset, rdata) || offset + 20 > end)
+        return false;
+      rdata.insert(rdata.end(), data + offset, data + offset + 20);
+      offset += 20;
+      break;
+
+    default:
+      rdata.insert(rdata.end(), data + offset, data + end);
+      offset = end;
+      break;
+  }
+
+  return offset == end;
+}
+
+static bool appendNumber(std::string_view field, uint32_t max, int bytes, std::vector<uint8_t> &out) {
+  uint32_t value;
+  auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+  if (ec != std::errc() || ptr != field.data() + field.size() || value > max)
+    return false;
+
+  for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+    out.push_back((value >> shift) & 0xFF);
+  }
+  return true;
+}
+
+/* A character-string, quoted or not, with \X and \DDD escapes */
+static bool appendString(std::string_view field, std::vector<uint8_t> &out) {
+  if (field.size() >= 2 && field.front() == '"' && field.back() == '"')
+    field = field.substr(1, field.size() - 2);
+
+  size_t length = out.size();
+  out.push_back(0);
+  for (size_t i = 0; i < field.size(); ++i) {
+    uint8_t c = field[i];
+    if (c == '\\' && i + 1 < field.size()) {
+      c = field[++i];
+      if (c >= '0' && c <= '9') {
+        unsigned value;
+        auto [ptr, ec] = std::from_chars(field.data() + i, field.data() + std::min(i + 3, field.size()), value);
+        if (ec != std::errc() || ptr != field.data() + i + 3 || value > 255)
+          return false;
+        c = value;
+        i += 2;
+      }
+    }
+    out.push_back(c);
+  }
+
+  if (out.size() - length - 1 > 255)
+    return false;
+  out[length] = out.size() - length - 1;
+  return true;
+}
+
+bool parseHex(std::string_view text, uint8_t *out, size_t length) {
+  if (text.size() != 2 * length)
+    return false;
+
+  for (size_t i = 0; i < 2 * length; ++i) {
+    char    c = text[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9')
+      nibble = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      nibble = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      nibble = c - 'A' + 10;
+    else
+      return false;
+    out[i / 2] = (i & 1) ? out[i / 2] | nibble : nibble << 4;
+  }
+  return true;
+}
+
+static bool appendHex(std::string_view field, std::vector<uint8_t> &out) {
+  size_t length = out.size();
+  out.resize(length + field.size() / 2);
+  if (!parseHex(field, out.data() + length, field.size() / 2)) {
+    out.resize(length);
+    return false;
+  }
+  return true;
+}
+
+/* Fields from `first` on joined, the way keys and digests may be split by whitespace */
+static std::string joinFields(const std::vector<std::string_view> &fields, size_t first) {
+  std::string out;
+  for (size_t i = first; i < fields.size(); ++i) {
+    out.append(fields[i]);
+  }
+  return out;
+}
+
+static int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+' || c == '/')
+    return c == '+' ? 62 : 63;
+  return -1;
+}
+
+static bool appendBase64(std::string_view field, std::vector<uint8_t> &out) {
+  if (field.empty() || field.size() % 4 != 0)
+    return false;
+
+  for (size_t i = 0; i < field.size(); i += 4) {
+    uint32_t group   = 0;
+    int      padding = 0;
+    for (size_t j = i; j < i + 4; ++j) {
+      /* up to two `=` close the last group */
+      if (field[j] == '=' && i + 4 == field.size() && j >= i + 2) {
+        group <<= 6;
+        padding++;
+        continue;
+      }
+      int value = base64Value(field[j]);
+      if (value < 0 || padding > 0)
+        return false;
+      group = group << 6 | value;
+    }
+
+    out.push_back(group >> 16);
+    if (padding < 2)
+      out.push_back(group >> 8);
+    if (padding < 1)
+      out.push_back(group);
+  }
+  return true;
+}
+
+bool encodeRdata(uint16_t type, const std::vector<std::string_view> &fields, std::vector<uint8_t> &rdata) {
+  rdata.clear();
+
+  /* RFC 3597: \# <length> <hex data> works for every type */
+  if (!fields.empty() && fields[0] == "\\#") {
+    unsigned length;
+    if (fields.size() < 2 || std::from_chars(fields[1].data(), fields[1].data() + fields[1].size(), length).ec != std::errc())
+      return false;
+    for (size_t i = 2; i < fields.size(); ++i) {
+      if (!appendHex(fields[i], rdata))
+        return false;
+    }
+    return rdata.size() == length;
+  }
+
+  switch (type) {
+    case T_A: {
+      struct in_addr addr;
+      if (fields.size() != 1 || inet_pton(AF_INET, std::string(fields[0]).c_str(), &addr) != 1)
+        return false;
+      rdata.insert(rdata.end(), (uint8_t *)&addr, (uint8_t *)&addr + sizeof(addr));
+      return true;
+    }
+
+    case T_AAAA: {
+      struct in6_addr addr;
+      if (fields.size() != 1 || inet_pton(AF_INET6, std::string(fields[0]).c_str(), &addr) != 1)
+        return false;
+      rdata.insert(rdata.end(), (uint8_t *)&addr, (uint8_t *)&addr + sizeof(addr));
+      return true;
+    }
+
+    case T_NS:
+    case T_CNAME:
+    case T_PTR:
+    case T_DNAME:
+      return fields.size() == 1 && encodeName(fields[0], rdata);
+
+    case T_MX:
+      return fields.size() == 2 && appendNumber(fields[0], 0xFFFF, 2, rdata) && encodeName(fields[1], rdata);
+
+    case T_SRV:
+      return fields.size() == 4 && appendNumber(fields[0], 0xFFFF, 2, rdata) && appendNumber(fields[1], 0xFFFF, 2, rdata)
+          && appendNumber(fields[2], 0xFFFF, 2, rdata) && encodeName(fields[3], rdata);
+
+    case T_SOA:
+      if (fields.size() != 7 || !encodeName(fields[0], rdata) || !encodeName(fields[1], rdata))
+        return false;
+      for (size_t i = 2; i < 7; ++i) {
+        if (!appendNumber(fields[i], 0xFFFFFFFF, 4, rdata))
+          return false;
+      }
+      return true;
+
+    case T_TXT:
+    case T_SPF:
+      if (fields.empty())
+        return false;
+      for (const auto &field : fields) {
+        if (!appendString(field, rdata))
+          return false;
+      }
+      return true;
+
+    case T_HINFO:
+      return fields.size() == 2 && appendString(fields[0], rdata) && appendString(fields[1], rdata);
+
+    case T_NAPTR:
+      return fields.size() == 6 && appendNumber(fields[0], 0xFFFF, 2, rdata) && appendNumber(fields[1], 0xFFFF, 2, rdata)
+          && appendString(fields[2], rdata) && appendString(fields[3], rdata) && appendString(fields[4], rdata)
+          && encodeName(fields[5], rdata);
+
+    case T_DS:
+    case T_CDS:
+      return fields.size() >= 4 && appendNumber(fields[0], 0xFFFF, 2, rdata) && appendNumber(fields[1], 0xFF, 1, rdata)
+          && appendNumber(fields[2], 0xFF, 1, rdata) && appendHex(joinFields(fields, 3), rdata);
+
+    case T_DNSKEY:
+    case T_CDNSKEY:
+      return fields.size() >= 4 && appendNumber(fields[0], 0xFFFF, 2, rdata) && appendNumber(fields[1], 0xFF, 1, rdata)
+          && appendNumber(fields[2], 0xFF, 1, rdata) && appendBase64(joinFields(fields, 3), rdata);
+
+    case T_TLSA:
+      return fields.size() >= 4 && appendNumber(fields[0], 0xFF, 1, rdata) && appendNumber(fields[1], 0xFF, 1, rdata)
+          && appendNumber(fields[2], 0xFF, 1, rdata) && appendHex(joinFields(fields, 3), rdata);
+
+    case T_SSHFP:
+      return fields.size() >= 3 && appendNumber(fields[0], 0xFF, 1, rdata) && appendNumber(fields[1], 0xFF, 1, rdata)
+          && appendHex(joinFields(fields, 2), rdata);
+
+    case T_CAA:
+      if (fields.size() != 3 || !appendNumber(fields[0], 0xFF, 1, rdata) || fields[1].size() > 255)
+        return false;
+      rdata.push_back(fields[1].size());
+      rdata.insert(rdata.end(), fields[1].begin(), fields[1].end());
+      if (fields[2].size() >= 2 && fields[2].front() == '"' && fields[2].back() == '"')
+        rdata.insert(rdata.end(), fields[2].begin() + 1, fields[2].end() - 1);
+      else
+        rdata.insert(rdata.end(), fields[2].begin(), fields[2].end());
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* Lowercase the uncompressed name at `offset`, `offset` ends up after it */
+static bool lowerName(std::vector<uint8_t> &rdata, size_t &offset) {
+  while (offset < rdata.size()) {
+    uint8_t length = rdata[offset++];
+    if (length == 0)
+      return true;
+    if (length > 63 || offset + length > rdata.size())
+      return false;
+
+    for (size_t end = offset + length; offset < end; ++offset) {
+      if (rdata[offset] >= 'A' && rdata[offset] <= 'Z')
+        rdata[offset] += 'a' - 'A';
+    }
+  }
+  return false;
+}
+
+void canonicalRdata(uint16_t type, std::vector<uint8_t> &rdata) {
+  size_t offset = 0;
+
+  switch (type) {
+    case T_NS:
+    case T_CNAME:
+    case T_PTR:
+    case T_DNAME:
+      lowerName(rdata, offset);
+      break;
+
+    case T_MX:
+    case T_SRV:
+      offset = type == T_MX ? 2 : 6;
+      lowerName(rdata, offset);
+      break;
+
+    case T_SOA:
+      if (lowerName(rdata, offset))
+        lowerName(rdata, offset);
+      break;
+
+    case T_NAPTR:
+      /* the replacement follows the order, the preference and three character-strings */
+      offset = 4;
+      for (int i = 0; i < 3 && offset < rdata.size(); ++i) {
+        offset += 1 + rdata[offset];
+      }
+      lowerName(rdata, offset);
+      break;
+
+    default:
+      break;
+  }
+}
+
+uint32_t soaField(const std::vector<uint8_t> &rdata, int field) {
+  size_t      offset = 0;
+  std::string name;
+  if (!decodeName(rdata.data(), rdata.size(), offset, name) || !decodeName(rdata.data(), rdata.size(), offset, name))
+    return 0;
+
+  offset += 4 * field;
+  if (offset + 4 > rdata.size())
+    return 0;
+  return ((uint32_t)rdata[offset] << 24) | (rdata[offset + 1] << 16) | (rdata[offset + 2] << 8) | rdata[offset + 3];
+}
+
+uint32_t soaSerial(const std::vector<uint8_t> &rdata) {
+  return soaField(rdata, SOA_SERIAL);
+}
+
+void setSoaSerial(std::vector<uint8_t> &rdata, uint32_t serial) {
+  /* the five counters close the RDATA, the serial comes first */
+  if (rdata.size() < 20)
+    return;
+
+  uint8_t *field = rdata.data() + rdata.size() - 20;
+  field[0]       = serial >> 24;
+  field[1]       = serial >> 16;
+  field[2]       = serial >> 8;
+  field[3]       = serial;
+}
+
+bool isSubdomain(std::string_view name, std::string_view zone) {
+  if (zone.empty())
+    return true;
+  if (name.size() < zone.size() || name.substr(name.size() - zone.size()) != zone)
+    return false;
+  return name.size() == zone.size() || name[name.size() - zone.size() - 1] == '.';
+}
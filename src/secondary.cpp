@@ -0,0 +1,353 @@
+#include "secondary.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "logger.hpp"
+#include "rdata.hpp"
+#include "stream.hpp"
+
+Secondary::Secondary()
+    : primaryAddr(), running(false), notified(false), refreshInterval(SECONDARY_REFRESH), retryInterval(SECONDARY_RETRY) {}
+
+Secondary::~Secondary() {
+  stop();
+}
+
+bool Secondary::configure(const std::string &zone, const std::string &primary, int defaultPort) {
+  std::string address = primary;
+  int         port    = defaultPort;
+
+  size_t colon = primary.find(':');
+  if (colon != std::string::npos) {
+    address = primary.substr(0, colon);
+    port    = std::atoi(primary.c_str() + colon + 1);
+  }
+
+  this->zone             = canonicalName(zone);
+  primaryAddr.sin_family = AF_INET;
+  primaryAddr.sin_port   = htons(port);
+  return !this->zone.empty() && port > 0 && port < 65536 && inet_pton(AF_INET, address.c_str(), &primaryAddr.sin_addr) == 1;
+}
+
+void Secondary::start() {
+  running         = true;
+  secondaryThread = std::thread(&Secondary::run, this);
+}
+
+void Secondary::stop() {
+  if (running) {
+    running = false;
+    wakeup.notify_all();
+    if (secondaryThread.joinable()) {
+      secondaryThread.join();
+    }
+  }
+}
+
+bool Secondary::notify(uint32_t source) {
+  if (source != primaryAddr.sin_addr.s_addr)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  notified = true;
+  wakeup.notify_all();
+  return true;
+}
+
+void Secondary::run() {
+  Logger &logger = Logger::getInstance();
+  logger.info("Secondary for " + zone + " is running...");
+
+  while (running) {
+    bool ok = refresh();
+
+    /* follow the timers the primary publishes in the SOA */
+    auto data = DB::getInstance("").snapshot();
+    auto apex = data->apex == zone ? data->find(NameKey{zone, hashName(zone)}) : nullptr;
+    for (const auto &record : apex ? *apex : std::vector<DNSRecord>()) {
+      if (record.type == T_SOA) {
+        refreshInterval = std::max<uint32_t>(soaField(record.rdata, SOA_REFRESH), 1);
+        retryInterval   = std::max<uint32_t>(soaField(record.rdata, SOA_RETRY), 1);
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeup.wait_for(lock, std::chrono::seconds(ok ? refreshInterval : retryInterval), [this] { return notified || !running; });
+    if (notified)
+      logger.info("NOTIFY for " + zone + " received");
+    notified = false;
+  }
+
+  logger.info("Secondary is shutting down");
+}
+
+int Secondary::connectPrimary() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  struct timeval timeout;
+  timeout.tv_sec  = 0;
+  timeout.tv_usec = 100000; // 100 ms, reads check `running` in between
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct timeval connectTimeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &connectTimeout, sizeof(connectTimeout));
+
+  if (connect(fd, (struct sockaddr *)&primaryAddr, sizeof(primaryAddr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool Secondary::refresh() {
+  Logger &logger = Logger::getInstance();
+
+  auto     current   = DB::getInstance("").snapshot();
+  bool     haveZone  = current->apex == zone;
+  uint32_t ourSerial = haveZone ? current->serial : 0;
+
+  int fd = connectPrimary();
+  if (fd < 0) {
+    logger.warn("Cannot reach primary for " + zone + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  uint32_t serial;
+  if (!querySerial(fd, serial)) {
+    logger.warn("No SOA for " + zone + " from primary");
+    close(fd);
+    return false;
+  }
+
+  if (haveZone && (int32_t)(serial - ourSerial) <= 0) {
+    logger.debug("Zone " + zone + " is up to date at serial " + std::to_string(ourSerial));
+    close(fd);
+    return true;
+  }
+
+  bool ok = transfer(fd, haveZone ? T_IXFR : T_AXFR, ourSerial);
+  close(fd);
+
+  /* primaries without IXFR (or without our serial in their journal) may refuse it */
+  if (!ok && haveZone && running) {
+    logger.info("IXFR for " + zone + " failed, falling back to AXFR");
+    fd = connectPrimary();
+    if (fd < 0)
+      return false;
+    ok = transfer(fd, T_AXFR, 0);
+    close(fd);
+  }
+
+  return ok;
+}
+
+/* Write a query for `zone`, with our SOA in the authority section for IXFR */
+static size_t buildRequest(uint8_t *buffer, size_t capacity, uint16_t id, const std::string &zone, uint16_t qtype, uint32_t serial) {
+  PacketWriter request = {buffer, capacity, 0, false};
+
+  DNSHeader header     = {};
+  header.transactionId = htons(id);
+  header.qdcount       = htons(1);
+  header.nscount       = htons(qtype == T_IXFR ? 1 : 0);
+  request.append(&header, sizeof(DNSHeader));
+
+  request.appendName(zone);
+  request.appendUint16(qtype);
+  request.appendUint16(C_IN);
+
+  if (qtype == T_IXFR) {
+    request.appendUint16(0xC000 | sizeof(DNSHeader)); // owner: pointer to the question name
+    request.appendUint16(T_SOA);
+    request.appendUint16(C_IN);
+    request.appendUint32(0);
+    request.appendUint16(2 + 20);
+    request.append("\0\0", 2); // root MNAME and RNAME, only the serial matters
+    request.appendUint32(serial);
+    for (int i = 0; i < 4; ++i) {
+      request.appendUint32(0);
+    }
+  }
+  return request.size;
+}
+
+/* Check a response header and skip its question section */
+static bool startResponse(const uint8_t *message, size_t length, uint16_t id, size_t &offset, uint16_t &ancount) {
+  if (length < sizeof(DNSHeader))
+    return false;
+
+  const DNSHeader *header = (const DNSHeader *)message;
+  uint16_t         flags  = ntohs(header->flags);
+  if (ntohs(header->transactionId) != id || !(flags & F_RESPONSE) || (flags & F_RCODE) != RCODE_NOERROR)
+    return false;
+
+  std::string name;
+  offset = sizeof(DNSHeader);
+  for (int i = 0; i < ntohs(header->qdcount); ++i) {
+    if (!decodeName(message, length, offset, name) || offset + 4 > length)
+      return false;
+    offset += 4;
+  }
+  ancount = ntohs(header->ancount);
+  return true;
+}
+
+bool Secondary::querySerial(int fd, uint32_t &serial) {
+  static std::mt19937 rng(std::random_device{}());
+
+  std::vector<uint8_t> buffer(MAX_STREAM_MESSAGE);
+  uint16_t             id     = rng();
+  size_t               length = buildRequest(buffer.data(), buffer.size(), id, zone, T_SOA, 0);
+
+  if (!writeMessage(fd, buffer.data(), length, TRANSFER_TIMEOUT) || !readMessage(fd, buffer.data(), buffer.size(), length, running, TRANSFER_TIMEOUT))
+    return false;
+
+  size_t   offset;
+  uint16_t ancount;
+  if (!startResponse(buffer.data(), length, id, offset, ancount))
+    return false;
+
+  for (int i = 0; i < ancount; ++i) {
+    std::string          name;
+    uint16_t             type, rclass;
+    uint32_t             ttl;
+    std::vector<uint8_t> rdata;
+    if (!decodeRecord(buffer.data(), length, offset, name, type, rclass, ttl, rdata))
+      return false;
+    if (type == T_SOA && name == zone) {
+      serial = soaSerial(rdata);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Secondary::transfer(int fd, uint16_t qtype, uint32_t serial) {
+  static std::mt19937 rng(std::random_device{}());
+  Logger             &logger = Logger::getInstance();
+
+  std::vector<uint8_t> buffer(MAX_STREAM_MESSAGE);
+  uint16_t             id     = rng();
+  size_t               length = buildRequest(buffer.data(), buffer.size(), id, zone, qtype, serial);
+
+  if (!writeMessage(fd, buffer.data(), length, TRANSFER_TIMEOUT))
+    return false;
+
+  enum { FIRST, SECOND, FULL, INCREMENTAL, DONE } state = FIRST;
+
+  uint32_t       newSerial = 0;
+  size_t         steps     = 0;
+  RecordMap      records;
+  ResourceRecord first;
+  ZoneChange     change;
+  bool           adding = false;
+
+  while (state != DONE) {
+    if (!readMessage(fd, buffer.data(), buffer.size(), length, running, TRANSFER_TIMEOUT))
+      return false;
+
+    size_t   offset;
+    uint16_t ancount;
+    if (!startResponse(buffer.data(), length, id, offset, ancount))
+      return false;
+
+    for (int i = 0; i < ancount && state != DONE; ++i) {
+      ResourceRecord rr;
+      if (!decodeRecord(buffer.data(), length, offset, rr.name, rr.record.type, rr.record.rclass, rr.record.ttl, rr.record.rdata))
+        return false;
+      if (!isSubdomain(rr.name, zone))
+        continue;
+
+      bool isSOA = rr.record.type == T_SOA && rr.name == zone;
+
+      switch (state) {
+        case FIRST:
+          /* every answer opens with the newest SOA */
+          if (!isSOA)
+            return false;
+          newSerial = soaSerial(rr.record.rdata);
+          first     = rr;
+          state     = SECOND;
+          break;
+
+        case SECOND:
+          /* an IXFR answer continues with the SOA of the version we have */
+          if (qtype == T_IXFR && isSOA && soaSerial(rr.record.rdata) == serial && newSerial != serial) {
+            change = ZoneChange{serial, 0, {rr}, {}};
+            adding = false;
+            state  = INCREMENTAL;
+            break;
+          }
+          records[first.name].push_back(first.record);
+          if (isSOA) {
+            state = DONE;
+            break;
+          }
+          records[rr.name].push_back(rr.record);
+          state = FULL;
+          break;
+
+        case FULL:
+          if (isSOA) {
+            state = DONE;
+            break;
+          }
+          records[rr.name].push_back(rr.record);
+          break;
+
+        case INCREMENTAL:
+          if (!isSOA) {
+            (adding ? change.added : change.removed).push_back(rr);
+            break;
+          }
+          if (!adding) {
+            change.toSerial = soaSerial(rr.record.rdata);
+            change.added.push_back(rr);
+            adding = true;
+            break;
+          }
+
+          /* a SOA while adding closes the step: apply it right away */
+          DB::getInstance("").apply(change);
+          steps++;
+          if (soaSerial(rr.record.rdata) == newSerial && change.toSerial == newSerial) {
+            state = DONE;
+            break;
+          }
+          change = ZoneChange{soaSerial(rr.record.rdata), 0, {rr}, {}};
+          adding = false;
+          break;
+
+        case DONE:
+          break;
+      }
+    }
+
+    /* an IXFR reply of a single SOA means either up to date or "ask for AXFR" */
+    if (state == SECOND && qtype == T_IXFR)
+      return newSerial == serial;
+  }
+
+  if (state == DONE && steps > 0) {
+    logger.info("IXFR of " + zone + " applied " + std::to_string(steps) + " changes up to serial " + std::to_string(newSerial));
+    return true;
+  }
+
+  size_t names = records.size();
+  auto   data  = ZoneData::build(std::move(records));
+  data->apex   = zone;
+  data->serial = newSerial;
+  DB::getInstance("").replace(data);
+
+  logger.info("AXFR of " + zone + " loaded " + std::to_string(names) + " names at serial " + std::to_string(newSerial));
+  return true;
+}
@@ -0,0 +1,569 @@
+#include "steering.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <tuple>
+#include <unistd.h>
+
+#include "dns.hpp"
+#include "logger.hpp"
+#include "prefix.hpp"
+
+static thread_local std::shared_ptr<const SteeringSet> pinned;
+
+/*
+  Image layout: the magic, the range count, the region count, the start
+  address of every range, the region of every range (0 for none) and the
+  region names, each preceded by its length.
+*/
+#define HEADER_SIZE 16
+
+typedef unsigned __int128 Address;
+
+static Address toNumber(const uint8_t bytes[16]) {
+  Address number = 0;
+  for (int i = 0; i < 16; ++i) {
+    number = number << 8 | bytes[i];
+  }
+  return number;
+}
+
+static void toBytes(Address number, uint8_t *bytes) {
+  for (int i = 15; i >= 0; --i) {
+    bytes[i] = (uint8_t)number;
+    number >>= 8;
+  }
+}
+
+std::vector<uint8_t> GeoTable::compile(std::vector<GeoPrefix> &&prefixes) {
+  struct Interval {
+    Address  first;
+    Address  last;
+    uint16_t value;
+  };
+
+  std::vector<std::string>                  names;
+  std::unordered_map<std::string, uint16_t> numbers;
+  std::vector<Interval>                     intervals;
+  for (const auto &prefix : prefixes) {
+    auto [region, added] = numbers.emplace(prefix.region, names.size() + 1);
+    if (added)
+      names.push_back(prefix.region);
+
+    Address first = toNumber(prefix.address);
+    Address rest  = prefix.length == 0 ? ~(Address)0 : prefix.length == 128 ? 0 : ~(Address)0 >> prefix.length;
+    intervals.push_back(Interval{first, first | rest, region->second});
+  }
+
+  /* enclosing prefixes before the ones inside them, the same prefix keeps the order of the file */
+  std::stable_sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b) {
+    return a.first != b.first ? a.first < b.first : a.last > b.last;
+  });
+
+  /* walk the nesting with a stack, every start or end of a prefix may start a range */
+  std::vector<std::pair<Address, uint16_t>> ranges = {{0, 0}};
+  auto emit = [&](Address start, uint16_t value) {
+    if (ranges.back().first == start) {
+      ranges.back().second = value;
+      if (ranges.size() > 1 && ranges[ranges.size() - 2].second == value)
+        ranges.pop_back();
+    } else if (ranges.back().second != value) {
+      ranges.emplace_back(start, value);
+    }
+  };
+
+  std::vector<Interval> open;
+  auto close = [&]() {
+    Interval ended = open.back();
+    open.pop_back();
+    if (ended.last != ~(Address)0)
+      emit(ended.last + 1, open.empty() ? 0 : open.back().value);
+  };
+  for (const auto &interval : intervals) {
+    while (!open.empty() && open.back().last < interval.first) {
+      close();
+    }
+    emit(interval.first, interval.value);
+    open.push_back(interval);
+  }
+  while (!open.empty()) {
+    close();
+  }
+
+  uint32_t count   = ranges.size();
+  uint32_t regions = names.size();
+
+  std::vector<uint8_t> image(HEADER_SIZE + count * 18);
+  std::memcpy(image.data(), GEO_MAGIC, 8);
+  std::memcpy(image.data() + 8, &count, sizeof(count));
+  std::memcpy(image.data() + 12, &regions, sizeof(regions));
+  for (uint32_t i = 0; i < count; ++i) {
+    toBytes(ranges[i].first, image.data() + HEADER_SIZE + i * 16);
+    std::memcpy(image.data() + HEADER_SIZE + count * 16 + i * 2, &ranges[i].second, 2);
+  }
+  for (const auto &name : names) {
+    image.push_back(std::min<size_t>(name.size(), 255));
+    image.insert(image.end(), name.begin(), name.begin() + std::min<size_t>(name.size(), 255));
+  }
+  return image;
+}
+
+bool GeoTable::open(const uint8_t *data, size_t size) {
+  if (size < HEADER_SIZE || std::memcmp(data, GEO_MAGIC, 8) != 0)
+    return false;
+
+  uint32_t count, regions;
+  std::memcpy(&count, data + 8, sizeof(count));
+  std::memcpy(&regions, data + 12, sizeof(regions));
+  if (count == 0 || HEADER_SIZE + (size_t)count * 18 > size)
+    return false;
+
+  /* every value must name a region and every name fit */
+  const uint16_t *table = (const uint16_t *)(data + HEADER_SIZE + count * 16);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (table[i] > regions)
+      return false;
+  }
+  size_t pos = HEADER_SIZE + count * 18;
+  for (uint32_t i = 0; i < regions; ++i) {
+    if (pos >= size || pos + 1 + data[pos] > size)
+      return false;
+    pos += 1 + data[pos];
+  }
+
+  starts      = data + HEADER_SIZE;
+  values      = table;
+  names       = data + HEADER_SIZE + count * 18;
+  length      = size;
+  ranges      = count;
+  regionCount = regions;
+  return true;
+}
+
+uint16_t GeoTable::lookup(const uint8_t address[16]) const {
+  if (ranges == 0)
+    return 0;
+
+  /* last range starting at or before the address, the first one starts at :: */
+  uint32_t low = 1, high = ranges;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (std::memcmp(starts + middle * 16, address, 16) <= 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return values[low - 1];
+}
+
+std::vector<std::string> GeoTable::regions() const {
+  std::vector<std::string> out;
+  const uint8_t           *name = names;
+  for (uint32_t i = 0; i < regionCount; ++i) {
+    out.emplace_back((const char *)name + 1, name[0]);
+    name += 1 + name[0];
+  }
+  return out;
+}
+
+size_t GeoTable::size() const {
+  return ranges;
+}
+
+Steering &Steering::getInstance() {
+  static Steering instance;
+  return instance;
+}
+
+Steering::Steering(): running(false) {
+  current.store(std::make_shared<const SteeringSet>());
+}
+
+Steering::~Steering() {
+  stop();
+}
+
+bool Steering::configure(const std::string &file) {
+  path = file;
+  return reload();
+}
+
+bool Steering::enabled() const {
+  return !path.empty();
+}
+
+/* Great circle distance in km */
+static float distance(float lat1, float lon1, float lat2, float lon2) {
+  const double radians = M_PI / 180;
+  double       dlat    = std::sin((lat2 - lat1) * radians / 2);
+  double       dlon    = std::sin((lon2 - lon1) * radians / 2);
+  double       a       = dlat * dlat + std::cos(lat1 * radians) * std::cos(lat2 * radians) * dlon * dlon;
+  return 2 * 6371 * std::asin(std::sqrt(a));
+}
+
+bool Steering::loadGeo(SteeringSet &set, const std::string &file) {
+  Logger &logger = Logger::getInstance();
+
+  /* the compiled image is used as is when the table has not changed since */
+  std::string cache = file + ".map";
+  if (newerFile(cache, file)) {
+    if (set.geoMap.open(cache) && set.geo.open(set.geoMap.data(), set.geoMap.size())) {
+      logger.info("Mapped GeoIP table " + cache + ": " + std::to_string(set.geo.size()) + " ranges");
+      return true;
+    }
+    set.geoMap.close();
+    logger.warn("Ignoring damaged GeoIP image " + cache);
+  }
+
+  MappedFile text;
+  if (!text.open(file, true)) {
+    logger.error("Cannot read GeoIP table " + file + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  std::vector<GeoPrefix>        prefixes;
+  std::vector<std::string_view> fields;
+  std::string_view              rest((const char *)text.data(), text.size());
+  for (size_t line = 1; !rest.empty(); ++line) {
+    size_t eol = rest.find('\n');
+    splitFields(rest.substr(0, eol), fields);
+    rest = eol == std::string_view::npos ? std::string_view() : rest.substr(eol + 1);
+    if (fields.empty())
+      continue;
+
+    GeoPrefix prefix;
+    bool      v4;
+    if (fields.size() != 2 || !parsePrefix(std::string(fields[0]), prefix.address, prefix.length, v4)) {
+      logger.error(file + ":" + std::to_string(line) + ": expected prefix and region");
+      return false;
+    }
+    if (v4) {
+      std::memmove(prefix.address + 12, prefix.address, 4);
+      std::memset(prefix.address, 0, 10);
+      prefix.address[10] = prefix.address[11] = 0xff;
+      prefix.length += 96;
+    }
+    prefix.region = fields[1];
+    prefixes.push_back(std::move(prefix));
+  }
+
+  set.geoImage = GeoTable::compile(std::move(prefixes));
+  set.geo.open(set.geoImage.data(), set.geoImage.size());
+  if (!writeFileAtomically(cache, set.geoImage))
+    logger.warn("Cannot write GeoIP image " + cache + ", the table is compiled again on every load");
+
+  logger.info("Compiled GeoIP table " + file + ": " + std::to_string(set.geo.size()) + " ranges");
+  return true;
+}
+
+std::shared_ptr<SteeringSet> Steering::load() {
+  Logger &logger = Logger::getInstance();
+  auto    set    = std::make_shared<SteeringSet>();
+
+  MappedFile file;
+  if (!file.open(path, true)) {
+    logger.error("Cannot read steering file " + path + ": " + std::string(strerror(errno)));
+    return nullptr;
+  }
+
+  /* checks keep their state across reloads */
+  std::unordered_map<std::string, std::shared_ptr<HealthCheck>> checks;
+  for (const auto &check : current.load()->checks) {
+    checks[check->target] = check;
+  }
+
+  std::string                          geoFile;
+  std::vector<std::pair<float, float>> coordinates;
+  std::vector<std::string_view>        fields;
+  std::string_view                     rest((const char *)file.data(), file.size());
+
+  /* endpoint by pool and position, with the name of its region */
+  std::vector<std::tuple<SteeringPool *, size_t, std::string>> regionNames;
+  for (size_t line = 1; !rest.empty(); ++line) {
+    size_t eol = rest.find('\n');
+    splitFields(rest.substr(0, eol), fields);
+    rest = eol == std::string_view::npos ? std::string_view() : rest.substr(eol + 1);
+    if (fields.empty())
+      continue;
+
+    std::string where = path + ":" + std::to_string(line) + ": ";
+    if (fields[0] == "geo" && fields.size() == 2) {
+      /* relative to the steering file */
+      geoFile = std::string(fields[1]);
+      if (geoFile[0] != '/' && path.find('/') != std::string::npos)
+        geoFile = path.substr(0, path.rfind('/') + 1) + geoFile;
+      continue;
+    }
+
+    if (fields[0] == "region" && fields.size() == 4) {
+      std::string latitude(fields[2]), longitude(fields[3]);
+      char       *latitudeEnd, *longitudeEnd;
+      float       lat = std::strtof(latitude.c_str(), &latitudeEnd);
+      float       lon = std::strtof(longitude.c_str(), &longitudeEnd);
+      if (*latitudeEnd != '\0' || *longitudeEnd != '\0' || std::fabs(lat) > 90 || std::fabs(lon) > 180) {
+        logger.error(where + "invalid coordinates");
+        return nullptr;
+      }
+      set->regions.emplace_back(fields[1]);
+      coordinates.emplace_back(lat, lon);
+      continue;
+    }
+
+    Endpoint    endpoint = {};
+    std::string address(fields.size() > 1 ? fields[1] : "");
+    endpoint.weight = 1;
+    endpoint.region = -1;
+    if (inet_pton(AF_INET, address.c_str(), endpoint.rdata) == 1) {
+      endpoint.rdlength = 4;
+    } else if (inet_pton(AF_INET6, address.c_str(), endpoint.rdata) == 1) {
+      endpoint.rdlength = 16;
+    } else {
+      logger.error(where + "expected owner and address");
+      return nullptr;
+    }
+
+    std::string region;
+    for (size_t i = 2; i < fields.size(); i += 2) {
+      if (i + 1 >= fields.size()) {
+        logger.error(where + "missing value of " + std::string(fields[i]));
+        return nullptr;
+      }
+
+      std::string value(fields[i + 1]);
+      char       *end;
+      long        number = std::strtol(value.c_str(), &end, 10);
+      bool        valid  = *end == '\0' && number >= 0;
+      if (fields[i] == "weight" && valid && number <= UINT16_MAX) {
+        endpoint.weight = number;
+      } else if (fields[i] == "check" && valid && number > 0 && number <= UINT16_MAX) {
+        std::string target = (endpoint.rdlength == 16 ? "[" + address + "]" : address) + ":" + value;
+        auto       &check  = checks[target];
+        if (!check) {
+          check         = std::make_shared<HealthCheck>();
+          check->target = target;
+          if (endpoint.rdlength == 4) {
+            struct sockaddr_in *in = (struct sockaddr_in *)&check->address;
+            in->sin_family         = AF_INET;
+            in->sin_port           = htons(number);
+            std::memcpy(&in->sin_addr, endpoint.rdata, 4);
+            check->addressLength = sizeof(*in);
+          } else {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&check->address;
+            in6->sin6_family         = AF_INET6;
+            in6->sin6_port           = htons(number);
+            std::memcpy(&in6->sin6_addr, endpoint.rdata, 16);
+            check->addressLength = sizeof(*in6);
+          }
+        }
+        endpoint.check = check;
+        if (std::find(set->checks.begin(), set->checks.end(), check) == set->checks.end())
+          set->checks.push_back(check);
+      } else if (fields[i] == "region") {
+        region = value;
+      } else {
+        logger.error(where + "invalid " + std::string(fields[i]) + " " + value);
+        return nullptr;
+      }
+    }
+
+    SteeringPool &pool = set->pools[canonicalName(fields[0])];
+    pool.endpoints.push_back(endpoint);
+    if (!region.empty())
+      regionNames.emplace_back(&pool, pool.endpoints.size() - 1, region);
+  }
+
+  /* regions may be declared after the endpoints in them */
+  for (const auto &[pool, index, name] : regionNames) {
+    auto found = std::find(set->regions.begin(), set->regions.end(), name);
+    if (found == set->regions.end()) {
+      logger.error(path + ": region " + name + " is not declared");
+      return nullptr;
+    }
+    pool->endpoints[index].region = found - set->regions.begin();
+  }
+
+  size_t regions = set->regions.size();
+  set->distances.resize(regions * regions);
+  for (size_t i = 0; i < regions; ++i) {
+    for (size_t j = 0; j < regions; ++j) {
+      set->distances[i * regions + j] = distance(coordinates[i].first, coordinates[i].second, coordinates[j].first, coordinates[j].second);
+    }
+  }
+
+  if (!geoFile.empty()) {
+    if (!loadGeo(*set, geoFile))
+      return nullptr;
+    for (const auto &name : set->geo.regions()) {
+      auto found = std::find(set->regions.begin(), set->regions.end(), name);
+      set->geoRegions.push_back(found == set->regions.end() ? -1 : found - set->regions.begin());
+    }
+  }
+
+  logger.info(
+      "Steering " + std::to_string(set->pools.size()) + " names over " + std::to_string(set->regions.size()) + " regions with "
+      + std::to_string(set->checks.size()) + " health checks"
+  );
+  return set;
+}
+
+bool Steering::reload() {
+  auto set = load();
+  if (!set) {
+    Logger::getInstance().warn("Keeping the running steering configuration");
+    return false;
+  }
+
+  current.store(std::move(set));
+  wakeup.notify_all(); // check new endpoints right away
+  return true;
+}
+
+void Steering::pin() {
+  pinned = current.load(std::memory_order_acquire);
+}
+
+const DNSRecord *Steering::select(
+    const NameKey &name, const std::vector<DNSRecord> &records, uint16_t type, const uint8_t client[16], bool &located
+) {
+  if (!pinned)
+    pinned = current.load(std::memory_order_acquire);
+
+  const SteeringSet &set  = *pinned;
+  auto               pool = set.pools.find(name);
+  if (pool == set.pools.end())
+    return nullptr;
+
+  /* the records of the RRset and what the configuration says about them, one bit each */
+  const DNSRecord *candidates[STEERING_MAX_RECORDS];
+  const Endpoint  *endpoints[STEERING_MAX_RECORDS];
+  uint32_t         weights[STEERING_MAX_RECORDS];
+  size_t           count = 0;
+  for (const auto &record : records) {
+    if (record.type != type || count == STEERING_MAX_RECORDS)
+      continue;
+
+    const Endpoint *endpoint = nullptr;
+    for (const auto &known : pool->second.endpoints) {
+      if (known.rdlength == record.rdata.size() && std::memcmp(known.rdata, record.rdata.data(), known.rdlength) == 0) {
+        endpoint = &known;
+        break;
+      }
+    }
+    if (endpoint != nullptr && endpoint->weight == 0)
+      continue; // drained
+
+    candidates[count] = &record;
+    endpoints[count]  = endpoint;
+    weights[count]    = endpoint != nullptr ? endpoint->weight : 1;
+    count++;
+  }
+  if (count == 0)
+    return nullptr;
+
+  /* leave out what failed its check, unless everything did: some answer beats none */
+  uint64_t usable = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (endpoints[i] == nullptr || !endpoints[i]->check || endpoints[i]->check->up.load(std::memory_order_relaxed))
+      usable |= 1ULL << i;
+  }
+  if (usable == 0)
+    usable = count == 64 ? ~0ULL : (1ULL << count) - 1;
+
+  /* nearest regions to the client's */
+  uint16_t geoRegion = set.geo.lookup(client);
+  int      region    = geoRegion == 0 ? -1 : set.geoRegions[geoRegion - 1];
+  if (region >= 0) {
+    const float *row  = set.distances.data() + region * set.regions.size();
+    float        best = HUGE_VALF;
+    for (size_t i = 0; i < count; ++i) {
+      if ((usable >> i & 1) && endpoints[i] != nullptr && endpoints[i]->region >= 0)
+        best = std::min(best, row[endpoints[i]->region]);
+    }
+    if (best != HUGE_VALF) {
+      located = true;
+      for (size_t i = 0; i < count; ++i) {
+        if (endpoints[i] == nullptr || endpoints[i]->region < 0 || row[endpoints[i]->region] != best)
+          usable &= ~(1ULL << i);
+      }
+    }
+  }
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (usable >> i & 1)
+      total += weights[i];
+  }
+  uint64_t ticket = pool->second.cursor.fetch_add(1, std::memory_order_relaxed) % total;
+  for (size_t i = 0; i < count; ++i) {
+    if (!(usable >> i & 1))
+      continue;
+    if (ticket < weights[i])
+      return candidates[i];
+    ticket -= weights[i];
+  }
+  return nullptr;
+}
+
+void Steering::start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running || !enabled())
+    return;
+
+  running = true;
+  prober  = std::thread(&Steering::runProber, this);
+}
+
+void Steering::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  wakeup.notify_all();
+  if (prober.joinable())
+    prober.join();
+}
+
+void Steering::runProber() {
+  Logger                      &logger = Logger::getInstance();
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (running) {
+    auto set = current.load();
+    lock.unlock();
+
+    for (const auto &check : set->checks) {
+      bool up = probe(*check);
+      if (check->up.exchange(up, std::memory_order_relaxed) != up) {
+        if (up)
+          logger.info("Endpoint " + check->target + " is up");
+        else
+          logger.warn("Endpoint " + check->target + " is down");
+      }
+    }
+
+    lock.lock();
+    wakeup.wait_for(lock, std::chrono::seconds(STEERING_CHECK_INTERVAL), [&] { return !running || current.load() != set; });
+  }
+}
+
+/* A TCP connect that completes within the timeout */
+bool Steering::probe(const HealthCheck &check) {
+  int fd = socket(check.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  bool up = connect(fd, (const struct sockaddr *)&check.address, check.addressLength) == 0;
+  if (!up && errno == EINPROGRESS) {
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int           error;
+    socklen_t     length = sizeof(error);
+    up = poll(&pfd, 1, STEERING_CHECK_TIMEOUT) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+  }
+  close(fd);
+  return up;
+}
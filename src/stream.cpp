@@ -0,0 +1,53 @@
+#include "stream.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <sys/socket.h>
+
+bool readFull(int fd, uint8_t *buffer, size_t length, const std::atomic<bool> &running, int timeout) {
+  auto   deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+  size_t done     = 0;
+
+  while (done < length) {
+    ssize_t n = recv(fd, buffer + done, length - done, 0);
+    if (n == 0)
+      return false;
+    if (n < 0) {
+      if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || !running || std::chrono::steady_clock::now() > deadline)
+        return false;
+      continue;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool writeFull(int fd, const uint8_t *buffer, size_t length, int timeout) {
+  auto   deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+  size_t done     = 0;
+
+  while (done < length) {
+    ssize_t n = send(fd, buffer + done, length - done, MSG_NOSIGNAL);
+    if (n < 0) {
+      if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || std::chrono::steady_clock::now() > deadline)
+        return false;
+      continue;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool readMessage(int fd, uint8_t *buffer, size_t capacity, size_t &length, const std::atomic<bool> &running, int timeout) {
+  uint8_t prefix[2];
+  if (!readFull(fd, prefix, 2, running, timeout))
+    return false;
+
+  length = (prefix[0] << 8) | prefix[1];
+  return length > 0 && length <= capacity && readFull(fd, buffer, length, running, timeout);
+}
+
+bool writeMessage(int fd, const uint8_t *message, size_t length, int timeout) {
+  uint8_t prefix[2] = {(uint8_t)(length >> 8), (uint8_t)(length & 0xFF)};
+  return writeFull(fd, prefix, 2, timeout) && writeFull(fd, message, length, timeout);
+}
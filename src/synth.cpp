@@ -0,0 +1,585 @@
+#include "synth.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <tuple>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "rdata.hpp"
+
+#define RANGE_MAX_WIDTH 32 // digits a number may be padded to
+#define IN_ADDR_ARPA    "in-addr.arpa"
+#define IP6_ARPA        "ip6.arpa"
+
+static const RangeNumber plainNumber = {0, 0, 'd'};
+
+/* `value` shifted by the offset of `number` and written as it asks into `text`, which holds RANGE_MAX_WIDTH + 24 bytes */
+static size_t formatNumber(char *text, uint32_t value, const RangeNumber &number, bool lower) {
+  int64_t shifted = (int64_t)value + number.offset;
+  char   *next    = text;
+  if (shifted < 0) {
+    *next++ = '-';
+    shifted = -shifted;
+  }
+
+  char  digits[24];
+  int   base   = number.base == 'o' ? 8 : number.base == 'd' ? 10 : 16;
+  char *end    = std::to_chars(digits, digits + sizeof(digits), (uint64_t)shifted, base).ptr;
+  int   length = end - digits;
+  for (int i = length; i < number.width; ++i) {
+    *next++ = '0';
+  }
+  for (char *digit = digits; digit < end; ++digit) {
+    *next++ = number.base == 'X' && !lower ? std::toupper(*digit) : *digit;
+  }
+  return next - text;
+}
+
+bool RangeTemplate::parse(std::string_view text, RangeTemplate &out, std::string &error) {
+  out.literals.assign(1, std::string());
+  out.numbers.clear();
+
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '\\' && i + 1 < text.size()) {
+      out.literals.back().append(text.substr(i++, 2));
+      continue;
+    }
+    if (text[i] != '$') {
+      out.literals.back().push_back(text[i]);
+      continue;
+    }
+
+    RangeNumber number = plainNumber;
+    if (i + 1 < text.size() && text[i + 1] == '{') {
+      size_t close = text.find('}', i);
+      if (close == std::string_view::npos) {
+        error = "unterminated ${ in " + std::string(text);
+        return false;
+      }
+
+      /* offset[,width[,base]] */
+      const char *cursor = text.data() + i + 2;
+      const char *end    = text.data() + close;
+      unsigned    width  = 0;
+      auto        result = std::from_chars(cursor, end, number.offset);
+      bool        valid  = result.ec == std::errc();
+      if (valid && result.ptr < end && *result.ptr == ',') {
+        result = std::from_chars(result.ptr + 1, end, width);
+        valid  = result.ec == std::errc() && width <= RANGE_MAX_WIDTH;
+        if (valid && result.ptr < end && *result.ptr == ',') {
+          number.base = result.ptr[1];
+          valid       = result.ptr + 2 == end && std::strchr("doxX", number.base) != nullptr;
+          result.ptr  = end;
+        }
+      }
+      if (!valid || result.ptr != end) {
+        error = "expected ${offset[,width[,base]]} with a base of d, o, x or X in " + std::string(text);
+        return false;
+      }
+      number.width = width;
+      i            = close;
+    }
+
+    out.numbers.push_back(number);
+    out.literals.emplace_back();
+  }
+  return true;
+}
+
+void RangeTemplate::render(uint32_t value, std::string &out) const {
+  char text[RANGE_MAX_WIDTH + 24];
+
+  out.clear();
+  for (size_t i = 0; i < numbers.size(); ++i) {
+    out.append(literals[i]);
+    out.append(text, formatNumber(text, value, numbers[i], false));
+  }
+  out.append(literals.back());
+}
+
+bool RangeOwner::parse(const RangeTemplate &name, RangeOwner &out, RangeNumber &number) {
+  if (name.numbers.size() != 1 || name.literals[0].find('.') != std::string::npos)
+    return false;
+
+  const std::string &rest = name.literals[1];
+  size_t             dot  = rest.find('.');
+  out.prefix              = canonicalName(name.literals[0]);
+  out.suffix              = canonicalName(rest.substr(0, dot));
+  out.parent              = dot == std::string::npos ? std::string() : canonicalName(rest.substr(dot + 1));
+  number                  = name.numbers[0];
+  return out.prefix.find('\\') == std::string::npos && out.suffix.find('\\') == std::string::npos;
+}
+
+std::shared_ptr<const RangeIndex> RangeIndex::build(std::vector<GeneratedRange> &&generated, std::vector<SynthesizedNetwork> &&networks) {
+  if (generated.empty() && networks.empty())
+    return nullptr;
+
+  auto index = std::make_shared<RangeIndex>();
+
+  auto order = [](const GeneratedRange &range) {
+    const RangeOwner &owner = range.owner;
+    return std::tie(owner.parent, owner.prefix, owner.suffix, range.number.offset, range.number.width, range.number.base, range.first);
+  };
+  std::stable_sort(generated.begin(), generated.end(), [&](const GeneratedRange &lhs, const GeneratedRange &rhs) {
+    return order(lhs) < order(rhs);
+  });
+  std::stable_sort(networks.begin(), networks.end(), [](const SynthesizedNetwork &lhs, const SynthesizedNetwork &rhs) {
+    return std::memcmp(lhs.first, rhs.first, 16) < 0;
+  });
+
+  /* one pattern per run of ranges with the same owner */
+  index->reach.resize(generated.size());
+  for (size_t begin = 0, end; begin < generated.size(); begin = end) {
+    const GeneratedRange &range = generated[begin];
+    uint32_t              reach = 0;
+    for (end = begin; end < generated.size() && generated[end].owner == range.owner && generated[end].number == range.number; ++end) {
+      reach             = std::max(reach, generated[end].last);
+      index->reach[end] = reach;
+    }
+    index->parents[range.owner.parent].prefixes[range.owner.prefix].push_back(Pattern{range.owner.suffix, range.number, begin, end, false});
+  }
+
+  std::array<uint8_t, 16> reach = {};
+  for (const auto &network : networks) {
+    if (std::memcmp(network.last, reach.data(), 16) > 0)
+      std::memcpy(reach.data(), network.last, 16);
+    index->networkReach.push_back(reach);
+
+    auto &patterns = index->parents[network.owner.parent].prefixes[network.owner.prefix];
+    auto  pattern  = std::find_if(patterns.begin(), patterns.end(), [&](const Pattern &pattern) {
+      return pattern.suffix == network.owner.suffix && pattern.number == plainNumber;
+    });
+    if (pattern == patterns.end())
+      patterns.push_back(Pattern{network.owner.suffix, plainNumber, 0, 0, true});
+    else
+      pattern->networks = true;
+  }
+
+  for (auto &[name, parent] : index->parents) {
+    for (const auto &[prefix, patterns] : parent.prefixes) {
+      parent.lengths |= (uint64_t)1 << std::min<size_t>(prefix.size(), 63);
+    }
+
+    for (size_t dot = 0; dot != std::string::npos; dot = name.find('.', dot + 1)) {
+      index->nonTerminals.insert(name.substr(dot == 0 ? 0 : dot + 1));
+    }
+  }
+
+  index->generated = std::move(generated);
+  index->networks  = std::move(networks);
+  return index;
+}
+
+/* Bits of the addresses of a network, the ones `first` and `last` differ in */
+static int hostBits(const SynthesizedNetwork &network) {
+  int bits = 0;
+  for (int i = 0; i < 16; ++i) {
+    bits += __builtin_popcount(network.first[i] ^ network.last[i]);
+  }
+  return bits;
+}
+
+static uint64_t saturatingAdd(uint64_t total, uint64_t count) {
+  return total > UINT64_MAX - count ? UINT64_MAX : total + count;
+}
+
+/* Name under in-addr.arpa or ip6.arpa of the first `labels` octets or nibbles of an address */
+static void reverseName(const uint8_t address[16], bool v4, int labels, std::string &out) {
+  static const char hex[] = "0123456789abcdef";
+  char              text[4];
+
+  out.clear();
+  for (int i = labels - 1; i >= 0; --i) {
+    if (v4)
+      out.append(text, std::to_chars(text, text + sizeof(text), address[12 + i]).ptr - text);
+    else
+      out.push_back(hex[i % 2 == 0 ? address[i / 2] >> 4 : address[i / 2] & 0x0f]);
+    out.push_back('.');
+  }
+  out.append(v4 ? IN_ADDR_ARPA : IP6_ARPA);
+}
+
+/* Whether names one label below `parent`, as forward names are, may lie in the zone at `apex` */
+static bool mayHold(std::string_view apex, std::string_view parent) {
+  if (isSubdomain(parent, apex))
+    return true;
+  if (!isSubdomain(apex, parent))
+    return false;
+  return apex.substr(0, apex.size() - parent.size() - (parent.empty() ? 0 : 1)).find('.') == std::string_view::npos;
+}
+
+/* Whether the PTR records of `network` may lie in the zone at `apex`, they all sit below the name of its prefix */
+static bool mayHoldPointers(std::string_view apex, const SynthesizedNetwork &network) {
+  std::string prefix;
+  int         fixed = 128 - hostBits(network) - (network.v4 ? 96 : 0);
+  reverseName(network.first, network.v4, network.v4 ? fixed / 8 : fixed / 4, prefix);
+  return isSubdomain(prefix, apex) || isSubdomain(apex, prefix);
+}
+
+uint64_t RangeIndex::expandedSize(std::string_view apex) const {
+  uint64_t total = 0;
+  for (const auto &range : generated) {
+    if (mayHold(apex, range.owner.parent))
+      total = saturatingAdd(total, ((uint64_t)range.last - range.first) / range.step + 1);
+  }
+  for (const auto &network : networks) {
+    int      bits      = hostBits(network);
+    uint64_t addresses = bits >= 64 ? UINT64_MAX : (uint64_t)1 << bits;
+    if (mayHold(apex, network.owner.parent))
+      total = saturatingAdd(total, addresses);
+    if (mayHoldPointers(apex, network))
+      total = saturatingAdd(total, addresses);
+  }
+  return total;
+}
+
+size_t RangeIndex::generatedSize() const {
+  return generated.size();
+}
+
+size_t RangeIndex::networkSize() const {
+  return networks.size();
+}
+
+bool RangeIndex::operator==(const RangeIndex &other) const {
+  return generated == other.generated && networks == other.networks;
+}
+
+template<typename Function>
+void RangeIndex::overlapping(const uint8_t *first, const uint8_t *last, Function found) const {
+  auto after = std::upper_bound(networks.begin(), networks.end(), last, [](const uint8_t *last, const SynthesizedNetwork &network) {
+    return std::memcmp(last, network.first, 16) < 0;
+  });
+  for (size_t i = after - networks.begin(); i-- > 0 && std::memcmp(networkReach[i].data(), first, 16) >= 0;) {
+    if (std::memcmp(networks[i].last, first, 16) >= 0)
+      found(networks[i]);
+  }
+}
+
+/* The address written with dashes, as forward names of networks carry it; false for IPv6 that prints with dots */
+static bool dashedAddress(const uint8_t address[16], bool v4, char *text) {
+  if (v4) {
+    char *end = text + INET6_ADDRSTRLEN;
+    for (int i = 12; i < 16; ++i) {
+      text    = std::to_chars(text, end, address[i]).ptr;
+      *text++ = i < 15 ? '-' : '\0';
+    }
+    return true;
+  }
+
+  if (!inet_ntop(AF_INET6, address, text, INET6_ADDRSTRLEN))
+    return false;
+  for (char *c = text; *c != '\0'; ++c) {
+    if (*c == '.')
+      return false;
+    if (*c == ':')
+      *c = '-';
+  }
+  return true;
+}
+
+/* IPv4 address of a forward name, four decimal octets between dashes without leading zeros */
+static bool parseDashedV4(std::string_view text, uint8_t *address) {
+  for (int i = 0; i < 4; ++i) {
+    size_t   dash = i < 3 ? text.find('-') : text.size();
+    unsigned octet;
+    auto     result = std::from_chars(text.data(), text.data() + std::min(dash, text.size()), octet);
+    if (dash == std::string_view::npos || result.ec != std::errc() || result.ptr != text.data() + dash || octet > 255
+        || (dash > 1 && text[0] == '0'))
+      return false;
+    address[i] = octet;
+    text.remove_prefix(std::min(dash + 1, text.size()));
+  }
+  return true;
+}
+
+static const uint8_t *copyToArena(Arena &arena, const void *data, size_t size) {
+  uint8_t *copy = (uint8_t *)arena.allocate(size, 1);
+  std::memcpy(copy, data, size);
+  return copy;
+}
+
+RangeMatch RangeIndex::lookup(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const {
+  RangeMatch match = RANGE_NONE;
+  if (!parents.empty())
+    match = matchForward(query, arena, answers);
+  if (match == RANGE_NONE && !networks.empty())
+    match = matchReverse(query, arena, answers);
+  if (match == RANGE_NONE && nonTerminals.find(NameKey{query.key, query.hash}) != nonTerminals.end())
+    match = RANGE_EMPTY;
+  return match;
+}
+
+RangeMatch RangeIndex::matchForward(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const {
+  std::string_view key   = query.key;
+  size_t           dot   = key.find('.');
+  std::string_view label = key.substr(0, dot);
+  std::string_view above = dot == std::string_view::npos ? std::string_view() : key.substr(dot + 1);
+
+  auto parent = parents.find(NameKey{above, hashName(above)});
+  if (parent == parents.end())
+    return RANGE_NONE;
+
+  thread_local std::string                   text;
+  thread_local std::vector<std::string>      rendered;
+  thread_local std::vector<std::string_view> fields;
+  thread_local std::vector<uint8_t>          rdata;
+
+  RangeMatch match = RANGE_NONE;
+  auto       add   = [&](uint16_t type, uint16_t rclass, uint32_t ttl, const void *data, size_t size) {
+    answers.push_back(DNSAnswer{
+        .name     = query.name,
+        .type     = type,
+        .qclass   = rclass,
+        .ttl      = ttl,
+        .rdlength = (uint16_t)size,
+        .rdata    = copyToArena(arena, data, size)
+    });
+  };
+
+  const auto &prefixes = parent->second.prefixes;
+  for (uint64_t lengths = parent->second.lengths; lengths != 0; lengths &= lengths - 1) {
+    size_t length = __builtin_ctzll(lengths);
+    if (length >= label.size())
+      break;
+
+    std::string_view prefix   = label.substr(0, length);
+    auto             patterns = prefixes.find(NameKey{prefix, hashName(prefix)});
+    if (patterns == prefixes.end())
+      continue;
+    for (auto pattern = patterns->second.begin(); pattern != patterns->second.end(); ++pattern) {
+      const std::string &suffix = pattern->suffix;
+      if (label.size() <= length + suffix.size() || label.substr(label.size() - suffix.size()) != suffix)
+        continue;
+      std::string_view middle = label.substr(length, label.size() - length - suffix.size());
+
+      /* the number as the owner renders it, offset and padding included */
+      uint64_t number;
+      int      base   = pattern->number.base == 'o' ? 8 : pattern->number.base == 'd' ? 10 : 16;
+      auto     result = std::from_chars(middle.data(), middle.data() + middle.size(), number, base);
+      int64_t  value  = (int64_t)number - pattern->number.offset;
+      char     check[RANGE_MAX_WIDTH + 24];
+      if (pattern->begin < pattern->end && result.ec == std::errc() && result.ptr == middle.data() + middle.size() && value >= 0
+          && value <= UINT32_MAX && std::string_view(check, formatNumber(check, value, pattern->number, true)) == middle) {
+        auto after = std::upper_bound(generated.begin() + pattern->begin, generated.begin() + pattern->end, value,
+                                      [](int64_t value, const GeneratedRange &range) { return value < range.first; });
+        for (size_t i = after - generated.begin(); i-- > pattern->begin && reach[i] >= value;) {
+          const GeneratedRange &range = generated[i];
+          if (value > range.last || (value - range.first) % range.step != 0)
+            continue;
+          match = RANGE_NAME;
+          if (range.type != query.type && range.type != T_CNAME)
+            continue;
+
+          rendered.resize(range.rdata.size());
+          fields.clear();
+          for (size_t f = 0; f < range.rdata.size(); ++f) {
+            range.rdata[f].render(value, rendered[f]);
+            fields.push_back(rendered[f]);
+          }
+          if (encodeRdata(range.type, fields, rdata) && rdata.size() <= UINT16_MAX)
+            add(range.type, range.rclass, range.ttl, rdata.data(), rdata.size());
+        }
+      }
+
+      if (!pattern->networks)
+        continue;
+
+      /* an address with dashes for dots or colons, IPv6 spelled exactly as inet_ntop() does */
+      uint8_t address[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+      char    spelled[INET6_ADDRSTRLEN];
+      bool    v4 = parseDashedV4(middle, address + 12);
+      if (!v4) {
+        if (middle.size() >= sizeof(spelled))
+          continue;
+        text.assign(middle);
+        std::replace(text.begin(), text.end(), '-', ':');
+        if (inet_pton(AF_INET6, text.c_str(), address) != 1 || !dashedAddress(address, false, spelled) || middle != spelled)
+          continue;
+      }
+
+      overlapping(address, address, [&](const SynthesizedNetwork &network) {
+        if (network.v4 != v4 || network.owner.parent != above || network.owner.prefix != prefix || network.owner.suffix != suffix)
+          return;
+        match = RANGE_NAME;
+        if (query.type == (v4 ? T_A : T_AAAA))
+          add(query.type, C_IN, network.ttl, v4 ? address + 12 : address, v4 ? 4 : 16);
+      });
+    }
+  }
+  return match;
+}
+
+/* Address of a name under in-addr.arpa or ip6.arpa, with the bits its labels give; false for other names */
+static bool reverseAddress(std::string_view key, uint8_t address[16], int &bits, bool &v4) {
+  std::string_view labels;
+  if (key.ends_with(IN_ADDR_ARPA) && (key.size() == sizeof(IN_ADDR_ARPA) - 1 || key[key.size() - sizeof(IN_ADDR_ARPA)] == '.')) {
+    v4 = true;
+  } else if (key.ends_with(IP6_ARPA) && (key.size() == sizeof(IP6_ARPA) - 1 || key[key.size() - sizeof(IP6_ARPA)] == '.')) {
+    v4 = false;
+  } else {
+    return false;
+  }
+  size_t suffix = v4 ? sizeof(IN_ADDR_ARPA) : sizeof(IP6_ARPA);
+  labels        = key.size() >= suffix ? key.substr(0, key.size() - suffix) : std::string_view();
+
+  /* labels come least significant first */
+  std::memset(address, 0, 16);
+  if (v4)
+    address[10] = address[11] = 0xff;
+
+  int count = labels.empty() ? 0 : std::count(labels.begin(), labels.end(), '.') + 1;
+  if (count > (v4 ? 4 : 32))
+    return false;
+
+  bits = 0;
+  for (int i = count - 1; i >= 0; --i) {
+    size_t           start = labels.rfind('.', labels.size() - 1);
+    std::string_view label = labels.substr(start == std::string_view::npos ? 0 : start + 1);
+    labels                 = start == std::string_view::npos ? std::string_view() : labels.substr(0, start);
+
+    if (v4) {
+      unsigned octet;
+      auto     result = std::from_chars(label.data(), label.data() + label.size(), octet);
+      if (result.ec != std::errc() || result.ptr != label.data() + label.size() || octet > 255 || (label.size() > 1 && label[0] == '0'))
+        return false;
+      address[12 + bits / 8] = octet;
+      bits += 8;
+    } else {
+      unsigned nibble;
+      auto     result = std::from_chars(label.data(), label.data() + label.size(), nibble, 16);
+      if (label.size() != 1 || result.ec != std::errc())
+        return false;
+      address[bits / 8] |= nibble << (bits % 8 == 0 ? 4 : 0);
+      bits += 4;
+    }
+  }
+  return true;
+}
+
+RangeMatch RangeIndex::matchReverse(const DNSQuery &query, Arena &arena, std::pmr::vector<DNSAnswer> &answers) const {
+  uint8_t first[16], last[16];
+  int     bits;
+  bool    v4;
+  if (!reverseAddress(query.key, first, bits, v4))
+    return RANGE_NONE;
+
+  /* a partial address is the range of every address it starts */
+  std::memcpy(last, first, 16);
+  for (int bit = (v4 ? 96 : 0) + bits; bit < 128; ++bit) {
+    last[bit / 8] |= 0x80 >> (bit % 8);
+  }
+
+  thread_local std::string          target;
+  thread_local std::vector<uint8_t> rdata;
+
+  bool       whole = bits == (v4 ? 32 : 128);
+  RangeMatch match = RANGE_NONE;
+  overlapping(first, last, [&](const SynthesizedNetwork &network) {
+    char spelled[INET6_ADDRSTRLEN];
+    if (network.v4 != v4 || (whole && !dashedAddress(first, v4, spelled)))
+      return;
+    if (!whole) {
+      match = std::max(match, RANGE_EMPTY);
+      return;
+    }
+
+    match = RANGE_NAME;
+    if (query.type != T_PTR)
+      return;
+    target = network.owner.prefix + spelled + network.owner.suffix;
+    if (!network.owner.parent.empty())
+      target += "." + network.owner.parent;
+    rdata.clear();
+    if (encodeName(target, rdata))
+      answers.push_back(DNSAnswer{
+          .name     = query.name,
+          .type     = T_PTR,
+          .qclass   = C_IN,
+          .ttl      = network.ttl,
+          .rdlength = (uint16_t)rdata.size(),
+          .rdata    = copyToArena(arena, rdata.data(), rdata.size())
+      });
+  });
+  return match;
+}
+
+bool RangeIndex::expand(std::string_view apex, const RangeSink &sink) const {
+  std::string                   owner, reverse;
+  std::vector<std::string>      rendered;
+  std::vector<std::string_view> fields;
+  char                          text[RANGE_MAX_WIDTH + 24];
+  DNSRecord                     record;
+
+  for (const auto &range : generated) {
+    if (!mayHold(apex, range.owner.parent))
+      continue;
+    record.type   = range.type;
+    record.rclass = range.rclass;
+    record.ttl    = range.ttl;
+    rendered.resize(range.rdata.size());
+    for (uint64_t value = range.first; value <= range.last; value += range.step) {
+      /* an owner whose number renders negative cannot be asked for, see matchForward() */
+      if ((int64_t)value + range.number.offset < 0)
+        continue;
+
+      owner = range.owner.prefix;
+      owner.append(text, formatNumber(text, value, range.number, true));
+      owner += range.owner.suffix;
+      if (!range.owner.parent.empty())
+        owner += "." + range.owner.parent;
+
+      fields.clear();
+      for (size_t f = 0; f < range.rdata.size(); ++f) {
+        range.rdata[f].render(value, rendered[f]);
+        fields.push_back(rendered[f]);
+      }
+      if (encodeRdata(range.type, fields, record.rdata) && record.rdata.size() <= UINT16_MAX && !sink(owner, record))
+        return false;
+    }
+  }
+
+  for (const auto &network : networks) {
+    bool forward  = mayHold(apex, network.owner.parent);
+    bool pointers = mayHoldPointers(apex, network);
+    if (!forward && !pointers)
+      continue;
+    record.rclass = C_IN;
+    record.ttl    = network.ttl;
+
+    uint8_t address[16];
+    std::memcpy(address, network.first, 16);
+    while (true) {
+      char spelled[INET6_ADDRSTRLEN];
+      if (dashedAddress(address, network.v4, spelled)) {
+        owner = network.owner.prefix + spelled + network.owner.suffix;
+        if (!network.owner.parent.empty())
+          owner += "." + network.owner.parent;
+
+        record.type = network.v4 ? T_A : T_AAAA;
+        record.rdata.assign(network.v4 ? address + 12 : address, address + 16);
+        if (forward && !sink(owner, record))
+          return false;
+
+        record.type = T_PTR;
+        record.rdata.clear();
+        reverseName(address, network.v4, network.v4 ? 4 : 32, reverse);
+        if (pointers && encodeName(owner, record.rdata) && !sink(reverse, record))
+          return false;
+      }
+
+      if (std::memcmp(address, network.last, 16) == 0)
+        break;
+      for (int i = 15; i >= 0; --i) {
+        if (++address[i] != 0)
+          break;
+      }
+    }
+  }
+  return true;
+}
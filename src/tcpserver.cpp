@@ -0,0 +1,238 @@
+#include "tcpserver.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "dnstap.hpp"
+#include "handoff.hpp"
+#include "logger.hpp"
+#include "stream.hpp"
+#include "update.hpp"
+#include "xfr.hpp"
+
+#define MAX_TCP_CONNECTIONS 64
+#define TCP_IDLE_TIMEOUT    10 // seconds without a complete query before closing
+#define TCP_WRITE_TIMEOUT   10 // seconds a client may leave one answer unread
+#define TCP_DRAIN_TIMEOUT   5  // seconds stop() lets open connections finish before cutting them off
+
+TCPServer::TCPServer(int port): port(port), running(false), listenfd(-1), connections(0) {}
+
+TCPServer::~TCPServer() {
+  stop();
+}
+
+void TCPServer::start() {
+  running      = true;
+  serverThread = std::thread(&TCPServer::run, this);
+}
+
+void TCPServer::stop() {
+  if (running) {
+    running = false;
+    if (serverThread.joinable()) {
+      serverThread.join();
+    }
+    /* idle readers notice within 100 ms, a transfer to a slow client is cut off once the drain runs out */
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TCP_DRAIN_TIMEOUT);
+    while (connections > 0) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for (int fd : clients) {
+          shutdown(fd, SHUT_RDWR);
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+void TCPServer::setPort(int port) {
+  this->port = port;
+}
+
+bool TCPServer::setTransferClients(const std::string &clients) {
+  std::stringstream ss(clients);
+  std::string       address;
+
+  transferClients.clear();
+  while (std::getline(ss, address, ',')) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+      return false;
+    transferClients.push_back(addr.s_addr);
+  }
+  return true;
+}
+
+void TCPServer::setSocket(int fd) {
+  listenfd = fd;
+}
+
+int TCPServer::getSocket() const {
+  return listenfd;
+}
+
+void TCPServer::run() {
+  Logger &logger = Logger::getInstance();
+
+  int sockfd = listenfd;
+  if (sockfd >= 0) {
+    port = boundPort(sockfd);
+  } else {
+    struct sockaddr_in serverAddr = {};
+    socklen_t          addr_len   = sizeof(serverAddr);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+      logger.error("Socket creation failed: " + std::string(strerror(errno)));
+      return;
+    }
+
+    int reuse = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    serverAddr.sin_family      = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port        = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *)&serverAddr, addr_len) < 0 || listen(sockfd, SOMAXCONN) < 0) {
+      logger.error("Bind failed: " + std::string(strerror(errno)));
+      close(sockfd);
+      return;
+    }
+  }
+
+  struct timeval timeout;
+  timeout.tv_sec  = 0;
+  timeout.tv_usec = 100000; // 100 ms
+
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+    logger.error("Error setting socket timeout");
+    close(sockfd);
+    return;
+  }
+
+  listenfd = sockfd;
+  logger.info("TCP server is running on port " + std::to_string(port) + "...");
+
+  while (running) {
+    struct sockaddr_in clientAddr;
+    socklen_t          clientLen = sizeof(clientAddr);
+
+    int clientfd = accept(sockfd, (struct sockaddr *)&clientAddr, &clientLen);
+    if (clientfd < 0) {
+      if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR || errno == ECONNABORTED)
+        continue;
+      logger.error("Accept failed: " + std::string(strerror(errno)));
+      break;
+    }
+
+    if (connections >= MAX_TCP_CONNECTIONS) {
+      logger.warn("Too many TCP connections, closing new one");
+      close(clientfd);
+      continue;
+    }
+
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    {
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      clients.insert(clientfd);
+    }
+    connections++;
+    std::thread(&TCPServer::serveConnection, this, clientfd, clientAddr.sin_addr.s_addr, clientAddr.sin_port).detach();
+  }
+
+  listenfd = -1;
+  close(sockfd);
+  logger.info("TCP server is shutting down");
+}
+
+void TCPServer::serveConnection(int clientfd, uint32_t clientAddr, uint16_t clientPort) {
+  Logger              &logger = Logger::getInstance();
+  Dnstap              &dnstap = Dnstap::getInstance();
+  Arena                arena;
+  std::vector<uint8_t> request(MAX_STREAM_MESSAGE);
+  std::vector<uint8_t> response(MAX_STREAM_MESSAGE);
+
+  bool transferAllowed = std::find(transferClients.begin(), transferClients.end(), clientAddr) != transferClients.end();
+
+  while (running) {
+    size_t length;
+    if (!readMessage(clientfd, request.data(), request.size(), length, running, TCP_IDLE_TIMEOUT))
+      break;
+
+    struct timespec received;
+    clock_gettime(CLOCK_REALTIME, &received);
+    pinQueryState();
+    DNS dnspacket(arena);
+    if (!dnspacket.parseDNS(request.data(), length)) {
+      logger.debug("Dropping malformed TCP message");
+      break;
+    }
+    dnspacket.setClient(clientAddr);
+
+    uint16_t type = dnspacket.getQueries().empty() ? 0 : dnspacket.getQueries().front().type;
+    if (dnspacket.getQueries().empty() && !dnspacket.cookieOnly()) {
+      size_t size = dnspacket.buildDNSError(response.data(), response.size(), RCODE_FORMERR);
+      if (!writeMessage(clientfd, response.data(), size, TCP_WRITE_TIMEOUT))
+        break;
+    } else if (dnspacket.getOpcode() == OPCODE_UPDATE) {
+      ZoneUpdate update;
+      uint16_t   rcode = RCODE_REFUSED;
+      if (ZoneUpdate::allowed(clientAddr))
+        rcode = update.process(request.data(), length, dnspacket);
+      if (!DB::getInstance("").waitDurable(update.ticket()))
+        rcode = RCODE_SERVFAIL;
+
+      size_t size = dnspacket.buildDNSError(response.data(), response.size(), rcode);
+      if (!writeMessage(clientfd, response.data(), size, TCP_WRITE_TIMEOUT))
+        break;
+      if (dnstap.enabled())
+        dnstap.log(DNSTAP_TCP, clientAddr, clientPort, received, request.data(), length, response.data(), size);
+    } else if (type == T_AXFR || type == T_IXFR) {
+      char address[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &clientAddr, address, sizeof(address));
+
+      if (!transferAllowed) {
+        logger.warn(std::string("Refusing zone transfer to ") + address);
+        DNSHeader refused     = {};
+        refused.transactionId = htons(dnspacket.getHeader().transactionId);
+        refused.flags         = htons(F_RESPONSE | RCODE_REFUSED);
+        writeMessage(clientfd, (const uint8_t *)&refused, sizeof(refused), TCP_WRITE_TIMEOUT);
+        break;
+      }
+
+      logger.info(std::string(type == T_AXFR ? "AXFR" : "IXFR") + " to " + address);
+      if (dnstap.enabled())
+        dnstap.log(DNSTAP_TCP, clientAddr, clientPort, received, request.data(), length, nullptr, 0);
+      ZoneTransfer transfer([clientfd](const uint8_t *message, size_t size) { return writeMessage(clientfd, message, size, TCP_WRITE_TIMEOUT); });
+      if (!transfer.serve(request.data(), length, dnspacket))
+        break;
+    } else {
+      size_t size = dnspacket.buildDNSResponse(response.data(), response.size());
+      if (!writeMessage(clientfd, response.data(), size, TCP_WRITE_TIMEOUT))
+        break;
+      if (dnstap.enabled())
+        dnstap.log(DNSTAP_TCP, clientAddr, clientPort, received, request.data(), length, response.data(), size);
+    }
+
+    arena.reset();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    clients.erase(clientfd);
+  }
+  close(clientfd);
+  connections--;
+}
@@ -0,0 +1,84 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads): job(nullptr), count(0), chunk(1), next(0), pending(0), stopping(false) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  /* the caller of parallelFor() works too */
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::size() const {
+  return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t begin, size_t end)> &body) {
+  if (count == 0)
+    return;
+
+  std::lock_guard<std::mutex> caller(callerMutex);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->job   = &body;
+    this->count = count;
+    this->chunk = std::max<size_t>(1, count / (size() * 8)); // small enough to even out uneven chunks
+    this->next  = 0;
+    pending     = count;
+  }
+  wakeup.notify_all();
+
+  while (work()) {
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return pending == 0; });
+  job = nullptr;
+}
+
+bool ThreadPool::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (job == nullptr || next >= count)
+    return false;
+
+  size_t begin = next;
+  size_t end   = std::min(count, begin + chunk);
+  next         = end;
+
+  auto *body = job;
+  lock.unlock();
+  (*body)(begin, end);
+  lock.lock();
+
+  pending -= end - begin;
+  if (pending == 0)
+    finished.notify_all();
+  return true;
+}
+
+void ThreadPool::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeup.wait(lock, [this] { return stopping || (job != nullptr && next < count); });
+      if (stopping)
+        return;
+    }
+    while (work()) {
+    }
+  }
+}
@@ -0,0 +1,406 @@
+#include "tlsserver.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "dns.hpp"
+#include "dnstap.hpp"
+#include "handoff.hpp"
+#include "logger.hpp"
+#include "stream.hpp"
+
+#define TLS_EPOLL_EVENTS 256
+#define TLS_READ_SIZE    16384 // one TLS record of plaintext
+
+static int64_t seconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string sslError() {
+  char buffer[256];
+  ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+  return buffer;
+}
+
+TLSServer::TLSServer(int port): port(port), running(false), listenfd(-1), context(nullptr), epollfd(-1), offloaded(0) {}
+
+TLSServer::~TLSServer() {
+  stop();
+  if (context)
+    SSL_CTX_free(context);
+}
+
+bool TLSServer::configure(const std::string &certificate, const std::string &key) {
+  Logger &logger = Logger::getInstance();
+
+  context = SSL_CTX_new(TLS_server_method());
+  if (!context) {
+    logger.error("Creating the TLS context failed: " + sslError());
+    return false;
+  }
+
+  SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+  SSL_CTX_set_options(context, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+#endif
+  SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS | SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  /* resumption by stateless tickets only, encrypted with keys OpenSSL draws at startup */
+  SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_num_tickets(context, 1);
+
+  const std::string &keyFile = key.empty() ? certificate : key;
+  if (SSL_CTX_use_certificate_chain_file(context, certificate.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(context, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(context) != 1) {
+    logger.error("Loading TLS certificate " + certificate + " failed: " + sslError());
+    SSL_CTX_free(context);
+    context = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool TLSServer::enabled() const {
+  return context != nullptr;
+}
+
+void TLSServer::start() {
+  if (!context)
+    return;
+  running      = true;
+  serverThread = std::thread(&TLSServer::run, this);
+}
+
+void TLSServer::stop() {
+  if (running) {
+    running = false;
+    if (serverThread.joinable()) {
+      serverThread.join();
+    }
+  }
+}
+
+void TLSServer::setPort(int port) {
+  this->port = port;
+}
+
+void TLSServer::setSocket(int fd) {
+  listenfd = fd;
+}
+
+int TLSServer::getSocket() const {
+  return listenfd;
+}
+
+void TLSServer::run() {
+  Logger &logger = Logger::getInstance();
+
+  /* every idle client holds a descriptor, the default soft limit of 1024 is far too low */
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+
+  int sockfd = listenfd;
+  if (sockfd >= 0) {
+    port = boundPort(sockfd);
+  } else {
+    struct sockaddr_in serverAddr = {};
+    serverAddr.sin_family         = AF_INET;
+    serverAddr.sin_addr.s_addr    = INADDR_ANY;
+    serverAddr.sin_port           = htons(port);
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+      logger.error("Socket creation failed: " + std::string(strerror(errno)));
+      return;
+    }
+
+    int reuse = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0 || listen(sockfd, SOMAXCONN) < 0) {
+      logger.error("Bind failed: " + std::string(strerror(errno)));
+      close(sockfd);
+      return;
+    }
+  }
+
+  epollfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {};
+  event.events             = EPOLLIN;
+  event.data.fd            = sockfd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event);
+
+  listenfd = sockfd;
+  logger.info("TLS server is running on port " + std::to_string(port) + "...");
+
+  Arena              arena;
+  struct epoll_event events[TLS_EPOLL_EVENTS];
+  int64_t            lastSweep = seconds();
+
+  readBuffer.resize(TLS_READ_SIZE);
+  response.resize(2 + MAX_STREAM_MESSAGE);
+
+  while (running) {
+    int ready = epoll_wait(epollfd, events, TLS_EPOLL_EVENTS, 100);
+    if (ready < 0 && errno != EINTR) {
+      logger.error("Epoll failed: " + std::string(strerror(errno)));
+      break;
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      if (events[i].data.fd == sockfd) {
+        acceptConnections(sockfd);
+        continue;
+      }
+
+      auto found = connections.find(events[i].data.fd);
+      if (found == connections.end())
+        continue;
+      if ((events[i].events & (EPOLLERR | EPOLLHUP)) || !serve(found->second, arena))
+        closeConnection(found->first);
+    }
+
+    int64_t now = seconds();
+    if (now != lastSweep) {
+      lastSweep = now;
+      std::vector<int> idle;
+      for (const auto &[fd, connection] : connections) {
+        if (now - connection.lastActive > TLS_IDLE_TIMEOUT)
+          idle.push_back(fd);
+      }
+      for (int fd : idle) {
+        closeConnection(fd);
+      }
+    }
+  }
+
+  while (!connections.empty()) {
+    closeConnection(connections.begin()->first);
+  }
+  listenfd = -1;
+  close(epollfd);
+  close(sockfd);
+  logger.info("TLS server is shutting down, " + std::to_string(offloaded) + " connections used kTLS");
+}
+
+void TLSServer::acceptConnections(int listenfd) {
+  Logger &logger = Logger::getInstance();
+
+  while (true) {
+    struct sockaddr_in clientAddr;
+    socklen_t          clientLen = sizeof(clientAddr);
+
+    int clientfd = accept4(listenfd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (clientfd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        logger.warn("Accept failed: " + std::string(strerror(errno)));
+      return;
+    }
+
+    SSL *ssl = connections.size() < TLS_MAX_CONNECTIONS ? SSL_new(context) : nullptr;
+    if (!ssl) {
+      logger.warn("Too many TLS connections, closing new one");
+      close(clientfd);
+      continue;
+    }
+    SSL_set_fd(ssl, clientfd);
+
+    int nodelay = 1;
+    setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    Connection &connection = connections[clientfd];
+    connection.fd          = clientfd;
+    connection.ssl         = ssl;
+    connection.address     = clientAddr.sin_addr.s_addr;
+    connection.port        = clientAddr.sin_port;
+    connection.lastActive  = seconds();
+    connection.handshaken  = false;
+    connection.wantWrite   = false;
+    connection.events      = 0;
+    connection.written     = 0;
+    watch(connection);
+  }
+}
+
+/* Advance the handshake, send what is queued and answer what arrived; false closes the connection */
+bool TLSServer::serve(Connection &connection, Arena &arena) {
+  connection.lastActive = seconds();
+  connection.wantWrite  = false;
+
+  if (!connection.handshaken) {
+    int result = SSL_accept(connection.ssl);
+    if (result <= 0) {
+      int error = SSL_get_error(connection.ssl, result);
+      if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+        ERR_clear_error();
+        return false;
+      }
+      connection.wantWrite = error == SSL_ERROR_WANT_WRITE;
+      watch(connection);
+      return true;
+    }
+    connection.handshaken = true;
+    if (BIO_get_ktls_send(SSL_get_wbio(connection.ssl)))
+      offloaded++;
+  }
+
+  if (!flush(connection))
+    return false;
+
+  /* queued answers hold back reading, a client that does not read its answers gets no new ones */
+  while (connection.output.empty()) {
+    int result = SSL_read(connection.ssl, readBuffer.data(), readBuffer.size());
+    if (result <= 0) {
+      int error = SSL_get_error(connection.ssl, result);
+      if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+        ERR_clear_error();
+        return false;
+      }
+      connection.wantWrite = error == SSL_ERROR_WANT_WRITE;
+      break;
+    }
+
+    size_t used;
+    if (connection.input.empty()) {
+      if (!consume(connection, readBuffer.data(), result, used, arena))
+        return false;
+      connection.input.assign(readBuffer.data() + used, readBuffer.data() + result);
+    } else {
+      connection.input.insert(connection.input.end(), readBuffer.data(), readBuffer.data() + result);
+      if (!consume(connection, connection.input.data(), connection.input.size(), used, arena))
+        return false;
+      connection.input.erase(connection.input.begin(), connection.input.begin() + used);
+    }
+    if (connection.input.empty())
+      std::vector<uint8_t>().swap(connection.input);
+
+    if (!flush(connection))
+      return false;
+  }
+
+  watch(connection);
+  return true;
+}
+
+/* Answer every complete message in `data`, `used` is set to the bytes they took */
+bool TLSServer::consume(Connection &connection, const uint8_t *data, size_t length, size_t &used, Arena &arena) {
+  Logger &logger = Logger::getInstance();
+  Dnstap &dnstap = Dnstap::getInstance();
+
+  struct timespec received;
+  clock_gettime(CLOCK_REALTIME, &received);
+  pinQueryState();
+  for (used = 0; length - used >= 2;) {
+    size_t size = (data[used] << 8) | data[used + 1];
+    if (size == 0)
+      return false;
+    if (length - used - 2 < size)
+      break;
+
+    const uint8_t *message = data + used + 2;
+    used += 2 + size;
+
+    DNS dnspacket(arena);
+    if (!dnspacket.parseDNS(message, size)) {
+      logger.debug("Dropping malformed TLS message");
+      return false;
+    }
+    dnspacket.setClient(connection.address);
+
+    uint16_t type   = dnspacket.getQueries().empty() ? 0 : dnspacket.getQueries().front().type;
+    uint8_t  opcode = dnspacket.getOpcode();
+    size_t   answer;
+    if (dnspacket.getQueries().empty() && !dnspacket.cookieOnly())
+      answer = dnspacket.buildDNSError(response.data() + 2, MAX_STREAM_MESSAGE, RCODE_FORMERR);
+    else if (opcode == OPCODE_UPDATE || opcode == OPCODE_NOTIFY || type == T_AXFR || type == T_IXFR)
+      answer = dnspacket.buildDNSError(response.data() + 2, MAX_STREAM_MESSAGE, RCODE_REFUSED);
+    else
+      answer = dnspacket.buildDNSResponse(response.data() + 2, MAX_STREAM_MESSAGE);
+    arena.reset();
+
+    response[0] = answer >> 8;
+    response[1] = answer & 0xFF;
+    send(connection, response.data(), 2 + answer);
+    if (dnstap.enabled())
+      dnstap.log(DNSTAP_DOT, connection.address, connection.port, received, message, size, response.data() + 2, answer);
+  }
+  return true;
+}
+
+/* Write `data` now if nothing is queued before it, queue what the socket does not take */
+void TLSServer::send(Connection &connection, const uint8_t *data, size_t length) {
+  if (connection.output.empty()) {
+    size_t done = 0;
+    while (done < length) {
+      size_t n;
+      if (SSL_write_ex(connection.ssl, data + done, length - done, &n) != 1)
+        break;
+      done += n;
+    }
+    data += done;
+    length -= done;
+  }
+  connection.output.insert(connection.output.end(), data, data + length);
+}
+
+bool TLSServer::flush(Connection &connection) {
+  while (connection.written < connection.output.size()) {
+    size_t n;
+    if (SSL_write_ex(connection.ssl, connection.output.data() + connection.written, connection.output.size() - connection.written, &n) != 1) {
+      int error = SSL_get_error(connection.ssl, 0);
+      if (error != SSL_ERROR_WANT_WRITE && error != SSL_ERROR_WANT_READ) {
+        ERR_clear_error();
+        return false;
+      }
+      connection.wantWrite = error == SSL_ERROR_WANT_WRITE;
+      return true;
+    }
+    connection.written += n;
+  }
+
+  std::vector<uint8_t>().swap(connection.output);
+  connection.written = 0;
+  return true;
+}
+
+/* Wait for the socket to become writable only while OpenSSL or the queue needs it */
+void TLSServer::watch(Connection &connection) {
+  uint32_t events = EPOLLIN;
+  if (connection.wantWrite || !connection.output.empty())
+    events |= EPOLLOUT;
+  if (events == connection.events)
+    return;
+
+  struct epoll_event event = {};
+  event.events             = events;
+  event.data.fd            = connection.fd;
+  epoll_ctl(epollfd, connection.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, connection.fd, &event);
+  connection.events = events;
+}
+
+void TLSServer::closeConnection(int fd) {
+  auto found = connections.find(fd);
+  if (found == connections.end())
+    return;
+
+  if (found->second.handshaken)
+    SSL_shutdown(found->second.ssl);
+  SSL_free(found->second.ssl);
+  ERR_clear_error();
+  close(fd);
+  connections.erase(found);
+}
@@ -0,0 +1,163 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <thread>
+
+#include "logger.hpp"
+
+#define TRACE_CALIBRATION 20 // milliseconds the cycle counter is timed against the clock
+
+static const char *stageNames[STAGE_COUNT + 1] = {"queue", "batch", "parse", "lookup", "serialize", "send", "total"};
+
+static thread_local std::shared_ptr<TraceWorker> local;
+
+/* 0 to 3 ns get a bucket each, above that every power of two is cut in four */
+static int bucketOf(uint64_t ns) {
+  if (ns < 4)
+    return ns;
+  int bits   = 63 - __builtin_clzll(ns);
+  int bucket = 4 * (bits - 1) + ((ns >> (bits - 2)) & 3);
+  return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+/* Largest value counted in `bucket` */
+static uint64_t bucketLimit(int bucket) {
+  if (bucket < 4)
+    return bucket;
+  int bits = bucket / 4 + 1;
+  return ((uint64_t)(4 + bucket % 4) << (bits - 2)) + ((uint64_t)1 << (bits - 2)) - 1;
+}
+
+static std::string duration(uint64_t ns) {
+  char text[32];
+  if (ns < 10000)
+    std::snprintf(text, sizeof(text), "%" PRIu64 " ns", ns);
+  else if (ns < 10000000)
+    std::snprintf(text, sizeof(text), "%.1f us", ns / 1e3);
+  else
+    std::snprintf(text, sizeof(text), "%.1f ms", ns / 1e6);
+  return text;
+}
+
+Tracer &Tracer::getInstance() {
+  static Tracer instance;
+  return instance;
+}
+
+Tracer::Tracer(): active(false), nsPerTick(1), slow(0) {}
+
+void Tracer::configure(int threshold) {
+#if defined(__x86_64__)
+  auto     begin = std::chrono::steady_clock::now();
+  uint64_t first = traceTicks();
+  std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_CALIBRATION));
+  uint64_t ticks = traceTicks() - first;
+  nsPerTick      = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / ticks;
+#endif
+  slow   = (uint64_t)threshold * 1000;
+  active = true;
+  Logger::getInstance().info(
+      "Tracing UDP query stages at " + std::to_string((int)(1 / nsPerTick * 1000)) + " MHz, logging queries slower than " + duration(slow)
+  );
+}
+
+bool Tracer::enabled() const {
+  return active;
+}
+
+TraceWorker &Tracer::worker() {
+  if (!local) {
+    local = std::make_shared<TraceWorker>();
+    std::lock_guard<std::mutex> lock(mutex);
+    workers.push_back(local);
+  }
+  return *local;
+}
+
+uint64_t Tracer::nanoseconds(const QueryTrace &trace, int stage) const {
+  if (stage == STAGE_QUEUE)
+    return trace.queued > 0 ? trace.queued : 0;
+  return trace.spent[stage] * nsPerTick;
+}
+
+bool Tracer::record(TraceWorker &worker, const QueryTrace &trace, int64_t second, uint64_t &unlogged) const {
+  uint64_t total = 0;
+  for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+    uint64_t ns = nanoseconds(trace, stage);
+    total += ns;
+    auto &counter = worker.histogram[stage][bucketOf(ns)];
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+  auto &counter = worker.histogram[STAGE_COUNT][bucketOf(total)];
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+  if (total < slow)
+    return false;
+  if (second != worker.second) {
+    worker.second = second;
+    worker.logged = 0;
+  }
+  if (worker.logged >= TRACE_SLOW_RATE) {
+    worker.unlogged++;
+    return false;
+  }
+  worker.logged++;
+  unlogged        = worker.unlogged;
+  worker.unlogged = 0;
+  return true;
+}
+
+std::string Tracer::describe(const std::string &line, const QueryTrace &trace) const {
+  uint64_t    total = 0;
+  std::string stages;
+  for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+    uint64_t ns = nanoseconds(trace, stage);
+    total += ns;
+    stages += std::string(stage > 0 ? ", " : "") + stageNames[stage] + " " + duration(ns);
+  }
+  return line + " took " + duration(total) + ": " + stages;
+}
+
+void Tracer::dump() {
+  Logger &logger = Logger::getInstance();
+
+  std::vector<std::shared_ptr<TraceWorker>> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshot = workers;
+  }
+
+  logger.info("UDP query stages since startup, upper bounds within a quarter octave:");
+  for (int stage = 0; stage <= STAGE_COUNT; ++stage) {
+    uint64_t counts[TRACE_BUCKETS] = {};
+    uint64_t count                 = 0;
+    for (const auto &worker : snapshot) {
+      for (int bucket = 0; bucket < TRACE_BUCKETS; ++bucket) {
+        uint64_t value = worker->histogram[stage][bucket].load(std::memory_order_relaxed);
+        counts[bucket] += value;
+        count += value;
+      }
+    }
+    if (count == 0)
+      continue;
+
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    static const char  *labels[]    = {" p50 ", " p90 ", " p99 ", " p99.9 "};
+    std::string         text        = "  " + std::string(stageNames[stage]) + ":";
+    size_t              next        = 0;
+    uint64_t            seen        = 0;
+    int                 highest     = 0;
+    for (int bucket = 0; bucket < TRACE_BUCKETS; ++bucket) {
+      seen += counts[bucket];
+      while (next < 4 && seen >= quantiles[next] * count) {
+        text += labels[next] + duration(bucketLimit(bucket));
+        next++;
+      }
+      if (counts[bucket] > 0)
+        highest = bucket;
+    }
+    logger.info(text + " max " + duration(bucketLimit(highest)) + " (" + std::to_string(count) + " queries)");
+  }
+}
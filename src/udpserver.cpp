@@ -1,5 +1,8 @@
 #include "udpserver.hpp"
 
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <netinet/in.h>
@@ -7,12 +10,25 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "arena.hpp"
+#include "bufferpool.hpp"
+#include "db.hpp"
 #include "dns.hpp"
+#include "dnstap.hpp"
+#include "handoff.hpp"
+#include "hitters.hpp"
 #include "logger.hpp"
+#include "overload.hpp"
+#include "trace.hpp"
+#include "update.hpp"
 
-#define BUFFER_SIZE 1024 // 1 kB
+#define BUFFER_SIZE      4096      // 4 kB
+#define BATCH_SIZE       32        // datagrams received and answered per system call
+#define UDP_PAYLOAD_SIZE 512       // largest plain DNS reply over UDP (RFC 1035)
+#define UDP_RCVBUF       (8 << 20) // socket receive buffer, absorbs bursts the worker catches up with
+#define UDP_CONTROL_SIZE 64        // control messages per datagram: receive timestamp and drop counter
 
-UDPServer::UDPServer(int port): port(port), running(false) {}
+UDPServer::UDPServer(int port): port(port), running(false), listenfd(-1), acknowledging(false) {}
 
 UDPServer::~UDPServer() {
   stop();
@@ -36,27 +52,107 @@ void UDPServer::setPort(int port) {
   this->port = port;
 }
 
-void UDPServer::run() {
-  Logger &logger = Logger::getInstance();
+void UDPServer::setNotifyHandler(NotifyHandler handler) {
+  notifyHandler = handler;
+}
 
-  struct sockaddr_in serverAddr, clientAddr;
-  socklen_t          addr_len = sizeof(clientAddr);
-  uint8_t            buffer[BUFFER_SIZE];
+void UDPServer::setSocket(int fd) {
+  listenfd = fd;
+}
 
-  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-  if (sockfd < 0) {
-    logger.error("Socket creation failed: " + std::string(strerror(errno)));
-    return;
+int UDPServer::getSocket() const {
+  return listenfd;
+}
+
+/* Kernel receive timestamp of a datagram, left alone when missing, and the drop counter of its socket */
+static void readControl(struct msghdr &message, struct timespec &stamp, OverloadControl &overload) {
+  for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level != SOL_SOCKET)
+      continue;
+    if (header->cmsg_type == SCM_TIMESTAMPNS) {
+      std::memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+    } else if (header->cmsg_type == SO_RXQ_OVFL) {
+      uint32_t total;
+      std::memcpy(&total, CMSG_DATA(header), sizeof(total));
+      overload.overflow(total);
+    }
   }
+}
 
-  serverAddr.sin_family      = AF_INET;
-  serverAddr.sin_addr.s_addr = INADDR_ANY;
-  serverAddr.sin_port        = htons(port);
+/*
+  Whether to answer with TC instead of a lookup at `level`. ANY queries
+  build the largest answers and updates make the whole batch wait for the
+  journal, they go first; other opcodes are cheap and always answered.
+*/
+static bool shed(const DNS &packet, ShedLevel level) {
+  if (level == SHED_NONE)
+    return false;
+  if (packet.getOpcode() == OPCODE_UPDATE)
+    return true;
+  if (packet.getOpcode() != OPCODE_QUERY)
+    return false;
+  return level == SHED_ALL || (!packet.getQueries().empty() && packet.getQueries().front().type == T_ANY);
+}
 
-  if (bind(sockfd, (struct sockaddr *)&serverAddr, addr_len) < 0) {
-    logger.error("Bind failed: " + std::string(strerror(errno)));
-    close(sockfd);
-    return;
+size_t answerDatagram(DNS &packet, const uint8_t *data, size_t length, uint32_t address, uint8_t *reply, bool &shed, const NotifyHandler &notify, uint64_t &ticket) {
+  ticket = 0;
+  packet.setClient(address);
+
+  if (shed) {
+    switch (packet.getCookieState()) {
+      case COOKIE_VALID:
+        shed = false;
+        break;
+      case COOKIE_CLIENT:
+        return packet.buildDNSError(reply, UDP_PAYLOAD_SIZE, RCODE_BADCOOKIE);
+      default:
+        return packet.buildTruncated(reply, UDP_PAYLOAD_SIZE);
+    }
+  }
+  if (packet.getQueries().empty() && !packet.cookieOnly())
+    return packet.buildDNSError(reply, UDP_PAYLOAD_SIZE, RCODE_FORMERR);
+  if (packet.getOpcode() == OPCODE_NOTIFY && !(notify && notify(address)))
+    return packet.buildDNSError(reply, UDP_PAYLOAD_SIZE, RCODE_REFUSED);
+  if (packet.getOpcode() == OPCODE_UPDATE) {
+    ZoneUpdate update;
+    uint16_t   rcode = RCODE_REFUSED;
+    if (ZoneUpdate::allowed(address))
+      rcode = update.process(data, length, packet);
+    ticket = update.ticket();
+    return packet.buildDNSError(reply, UDP_PAYLOAD_SIZE, rcode);
+  }
+  return packet.buildDNSResponse(reply, packet.udpPayloadSize());
+}
+
+void UDPServer::run() {
+  Logger       &logger  = Logger::getInstance();
+  Dnstap       &dnstap  = Dnstap::getInstance();
+  HitterWorker &hitters = HeavyHitters::getInstance().worker();
+  Tracer       &tracer  = Tracer::getInstance();
+  TraceWorker  *traced  = tracer.enabled() ? &tracer.worker() : nullptr;
+
+  int sockfd = listenfd;
+  if (sockfd >= 0) {
+    port = boundPort(sockfd);
+  } else {
+    struct sockaddr_in serverAddr;
+    socklen_t          addr_len = sizeof(serverAddr);
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+      logger.error("Socket creation failed: " + std::string(strerror(errno)));
+      return;
+    }
+
+    serverAddr.sin_family      = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port        = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *)&serverAddr, addr_len) < 0) {
+      logger.error("Bind failed: " + std::string(strerror(errno)));
+      close(sockfd);
+      return;
+    }
   }
 
   struct timeval timeout;
@@ -69,15 +165,79 @@ void UDPServer::run() {
     return;
   }
 
+  /* SO_RCVBUFFORCE goes past net.core.rmem_max when privileged */
+  int       option = UDP_RCVBUF;
+  socklen_t length = sizeof(option);
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &option, sizeof(option)) < 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &option, sizeof(option));
+  if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &option, &length) == 0 && option < UDP_RCVBUF)
+    logger.warn("UDP receive buffer is only " + std::to_string(option / 1024) + " kB, raise net.core.rmem_max");
+
+  /* every datagram carries when it arrived and how many the socket dropped so far */
+  option = 1;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &option, sizeof(option)) < 0 ||
+      setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &option, sizeof(option)) < 0)
+    logger.warn("No receive timestamps or drop counts, overload control is blind: " + std::string(strerror(errno)));
+
+  listenfd = sockfd;
   logger.info("UDP server is running on port " + std::to_string(port) + "...");
 
+  acknowledging = true;
+  std::thread acknowledger(&UDPServer::runAcknowledger, this, sockfd);
+
+  /* per-worker storage, steady-state request handling never reaches the global allocator */
+  Arena           arena;
+  BufferPool      pool(2 * BATCH_SIZE, BUFFER_SIZE);
+  OverloadControl overload;
+
+  struct sockaddr_in clientAddrs[BATCH_SIZE];
+  struct timespec    stamps[BATCH_SIZE];   // when the kernel received each datagram
+  alignas(8) uint8_t controls[BATCH_SIZE][UDP_CONTROL_SIZE];
+  int                requests[BATCH_SIZE]; // datagram each reply answers
+  QueryTrace         traces[BATCH_SIZE];   // stage times of each reply, when tracing
+  struct iovec       rxVecs[BATCH_SIZE], txVecs[BATCH_SIZE];
+  struct mmsghdr     rxMsgs[BATCH_SIZE], txMsgs[BATCH_SIZE];
+
+  for (int i = 0; i < BATCH_SIZE; ++i) {
+    rxVecs[i].iov_base = pool.acquire();
+    rxVecs[i].iov_len  = pool.bufferSize();
+    txVecs[i].iov_base = pool.acquire();
+  }
+
   while (running) {
-    ssize_t received = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&clientAddr, &addr_len);
-    if (!running)
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+      std::memset(&rxMsgs[i], 0, sizeof(rxMsgs[i]));
+      rxMsgs[i].msg_hdr.msg_name       = &clientAddrs[i];
+      rxMsgs[i].msg_hdr.msg_namelen    = sizeof(clientAddrs[i]);
+      rxMsgs[i].msg_hdr.msg_iov        = &rxVecs[i];
+      rxMsgs[i].msg_hdr.msg_iovlen     = 1;
+      rxMsgs[i].msg_hdr.msg_control    = controls[i];
+      rxMsgs[i].msg_hdr.msg_controllen = UDP_CONTROL_SIZE;
+    }
+
+    /* answer what was taken even when stopping, the socket may live on in a successor */
+    int received = recvmmsg(sockfd, rxMsgs, BATCH_SIZE, MSG_WAITFORONE, nullptr);
+    if (!running && received <= 0)
       break;
+    uint64_t batchStart = traced ? traceTicks() : 0;
+
+    /* delays against the wall clock the kernel stamps with, intervals on one that is never set */
+    struct timespec arrival, clock;
+    clock_gettime(CLOCK_REALTIME, &arrival);
+    clock_gettime(CLOCK_MONOTONIC, &clock);
+    hitters.tick(arrival.tv_sec);
+
+    int64_t wall = arrival.tv_sec * 1000000000LL + arrival.tv_nsec;
+    int64_t now  = clock.tv_sec * 1000000000LL + clock.tv_nsec;
+    for (int i = 0; i < received; ++i) {
+      stamps[i] = arrival;
+      readControl(rxMsgs[i].msg_hdr, stamps[i], overload);
+      overload.sample(wall - (stamps[i].tv_sec * 1000000000LL + stamps[i].tv_nsec));
+    }
+    ShedLevel shedding = overload.update(now);
 
     if (received < 0) {
-      if (errno == EWOULDBLOCK || errno == EAGAIN) {
+      if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
         // timeout without received data
         continue;
       }
@@ -85,13 +245,160 @@ void UDPServer::run() {
       break;
     }
 
-    DNS dnspacket;
-    dnspacket.parseDNS(buffer);
-    std::cout << dnspacket << std::endl;
+    pinQueryState();
+
+    int replies = 0;
+    for (int i = 0; i < received; ++i) {
+      QueryTrace *trace = nullptr;
+      if (traced) {
+        trace = &traces[replies];
+        trace->start(batchStart, std::max<int64_t>(0, wall - (stamps[i].tv_sec * 1000000000LL + stamps[i].tv_nsec)));
+        trace->mark(STAGE_BATCH);
+      }
 
-    auto response = dnspacket.buildDNSResponse();
-    sendto(sockfd, response.data(), response.size(), 0, (struct sockaddr *)&clientAddr, addr_len);
+      DNS dnspacket(arena);
+      if (!dnspacket.parseDNS((const uint8_t *)rxVecs[i].iov_base, rxMsgs[i].msg_len)) {
+        logger.debug("Dropping malformed packet");
+        continue;
+      }
+      if (!dnspacket.getQueries().empty())
+        hitters.add(dnspacket.getQueries().front().hash, dnspacket.getQueries().front().key, clientAddrs[i].sin_addr.s_addr);
+      /* one line per packet into stdio's buffer, flushed once per batch */
+      if (!dnstap.enabled() && shedding == SHED_NONE) {
+        char   line[DNS_SUMMARY_SIZE];
+        size_t length  = dnspacket.summarize(line, sizeof(line) - 1, clientAddrs[i].sin_addr.s_addr, clientAddrs[i].sin_port);
+        line[length++] = '\n';
+        std::fwrite(line, 1, length, stdout);
+      }
+      if (trace) {
+        trace->mark(STAGE_PARSE);
+        dnspacket.setTrace(trace);
+      }
+
+      bool     truncate       = shed(dnspacket, shedding);
+      uint64_t ticket         = 0;
+      requests[replies]       = i;
+      txVecs[replies].iov_len = answerDatagram(
+          dnspacket, (const uint8_t *)rxVecs[i].iov_base, rxMsgs[i].msg_len, clientAddrs[i].sin_addr.s_addr, (uint8_t *)txVecs[replies].iov_base, truncate,
+          notifyHandler, ticket
+      );
+      if (truncate)
+        overload.truncated();
+      if (trace)
+        trace->mark(STAGE_SERIALIZE);
+
+      /* a reply to an update waits for the journal on the acknowledger, the rest of the batch does not */
+      if (ticket > 0) {
+        const uint8_t  *query = (const uint8_t *)rxVecs[i].iov_base;
+        const uint8_t  *reply = (const uint8_t *)txVecs[replies].iov_base;
+        Acknowledgement ack   = {ticket, clientAddrs[i], stamps[i], {query, query + rxMsgs[i].msg_len}, {reply, reply + txVecs[replies].iov_len}};
+        {
+          std::lock_guard<std::mutex> lock(ackMutex);
+          acks.push_back(std::move(ack));
+        }
+        ackReady.notify_one();
+        continue;
+      }
+
+      std::memset(&txMsgs[replies], 0, sizeof(txMsgs[replies]));
+      txMsgs[replies].msg_hdr.msg_name    = &clientAddrs[i];
+      txMsgs[replies].msg_hdr.msg_namelen = rxMsgs[i].msg_hdr.msg_namelen;
+      txMsgs[replies].msg_hdr.msg_iov     = &txVecs[replies];
+      txMsgs[replies].msg_hdr.msg_iovlen  = 1;
+      replies++;
+    }
+
+    if (!dnstap.enabled() && shedding == SHED_NONE)
+      std::fflush(stdout);
+
+    uint64_t sendStart = traced ? traceTicks() : 0;
+    for (int sent = 0; sent < replies;) {
+      int n = sendmmsg(sockfd, txMsgs + sent, replies - sent, 0);
+      if (n < 0) {
+        logger.warn("Send failed: " + std::string(strerror(errno)));
+        break;
+      }
+      sent += n;
+    }
+
+    struct timespec done;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    overload.served(received, done.tv_sec * 1000000000LL + done.tv_nsec - now);
+
+    if (traced) {
+      uint64_t sendEnd = traceTicks();
+      for (int k = 0; k < replies; ++k) {
+        uint64_t unlogged;
+        traces[k].mark(STAGE_BATCH, sendStart);
+        traces[k].mark(STAGE_SEND, sendEnd);
+        if (!tracer.record(*traced, traces[k], arrival.tv_sec, unlogged))
+          continue;
+
+        /* slow queries are rare, parsing the request again for its summary keeps the common path lean */
+        int    i = requests[k];
+        char   line[DNS_SUMMARY_SIZE];
+        DNS    request(arena, (const uint8_t *)rxVecs[i].iov_base, rxMsgs[i].msg_len);
+        size_t length = request.summarize(line, sizeof(line), clientAddrs[i].sin_addr.s_addr, clientAddrs[i].sin_port);
+        logger.warn(
+            tracer.describe("Slow query " + std::string(line, length), traces[k]) +
+            (unlogged > 0 ? " (" + std::to_string(unlogged) + " slow queries not logged before it)" : "")
+        );
+      }
+    }
+
+    if (dnstap.enabled()) {
+      for (int k = 0; k < replies; ++k) {
+        int i = requests[k];
+        dnstap.log(
+            DNSTAP_UDP, clientAddrs[i].sin_addr.s_addr, clientAddrs[i].sin_port, stamps[i], (const uint8_t *)rxVecs[i].iov_base, rxMsgs[i].msg_len,
+            (const uint8_t *)txVecs[k].iov_base, txVecs[k].iov_len
+        );
+      }
+    }
+
+    arena.reset();
   }
+
+  for (int i = 0; i < BATCH_SIZE; ++i) {
+    pool.release((uint8_t *)rxVecs[i].iov_base);
+    pool.release((uint8_t *)txVecs[i].iov_base);
+  }
+
+  /* updates already taken are still acknowledged */
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    acknowledging = false;
+  }
+  ackReady.notify_one();
+  acknowledger.join();
+
+  listenfd = -1;
   close(sockfd);
   logger.info("UDP server is shutting down");
 }
+
+/* Send the replies to updates in the order they were taken, each once its change is durable */
+void UDPServer::runAcknowledger(int sockfd) {
+  Dnstap                      &dnstap = Dnstap::getInstance();
+  std::unique_lock<std::mutex> lock(ackMutex);
+
+  while (true) {
+    ackReady.wait(lock, [this] { return !acks.empty() || !acknowledging; });
+    if (acks.empty())
+      break;
+
+    Acknowledgement ack = std::move(acks.front());
+    acks.pop_front();
+    lock.unlock();
+
+    if (!DB::getInstance("").waitDurable(ack.ticket)) {
+      DNSHeader *header = (DNSHeader *)ack.reply.data();
+      header->flags     = htons((ntohs(header->flags) & ~F_RCODE) | RCODE_SERVFAIL);
+    }
+    sendto(sockfd, ack.reply.data(), ack.reply.size(), 0, (const struct sockaddr *)&ack.address, sizeof(ack.address));
+    if (dnstap.enabled())
+      dnstap.log(DNSTAP_UDP, ack.address.sin_addr.s_addr, ack.address.sin_port, ack.received, ack.query.data(), ack.query.size(), ack.reply.data(), ack.reply.size());
+
+    lock.lock();
+  }
+}
@@ -0,0 +1,283 @@
+#include "update.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sstream>
+
+#include "dnssec.hpp"
+#include "logger.hpp"
+#include "rdata.hpp"
+
+static std::vector<uint32_t> updateClients = {htonl(INADDR_LOOPBACK)};
+
+bool ZoneUpdate::setClients(const std::string &clients) {
+  std::stringstream ss(clients);
+  std::string       address;
+
+  updateClients.clear();
+  while (std::getline(ss, address, ',')) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+      return false;
+    updateClients.push_back(addr.s_addr);
+  }
+  return true;
+}
+
+bool ZoneUpdate::allowed(uint32_t client) {
+  return std::find(updateClients.begin(), updateClients.end(), client) != updateClients.end();
+}
+
+/* Types that only make sense in questions */
+static bool isMetaType(uint16_t type) {
+  switch (type) {
+    case T_OPT:
+    case T_TKEY:
+    case T_TSIG:
+    case T_IXFR:
+    case T_AXFR:
+    case T_MAILB:
+    case T_MAILA:
+    case T_ANY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Records the signer maintains itself in a signed zone (RFC 3007 4) */
+static bool isSignerType(uint16_t type) {
+  return Signer::getInstance().enabled() && (type == T_RRSIG || type == T_NSEC || type == T_DNSKEY);
+}
+
+ZoneUpdate::ZoneUpdate(): zclass(C_IN), durableTicket(0) {}
+
+uint16_t ZoneUpdate::process(const uint8_t *request, size_t size, const DNS &update) {
+  /* the zone section travels as the question */
+  const auto &zones = update.getQueries();
+  if (zones.size() != 1 || zones.front().type != T_SOA)
+    return RCODE_FORMERR;
+  zone   = std::string(zones.front().key);
+  zclass = zones.front().qclass;
+
+  size_t      offset = sizeof(DNSHeader);
+  std::string name;
+  if (!decodeName(request, size, offset, name) || offset + 4 > size)
+    return RCODE_FORMERR;
+  offset += 4;
+
+  const DNSHeader &header = update.getHeader();
+  for (int i = 0; i < header.ancount + header.nscount; ++i) {
+    ResourceRecord rr;
+    if (!decodeRecord(request, size, offset, rr.name, rr.record.type, rr.record.rclass, rr.record.ttl, rr.record.rdata))
+      return RCODE_FORMERR;
+    (i < header.ancount ? prerequisites : updates).push_back(std::move(rr));
+  }
+
+  uint16_t rcode = DB::getInstance("").update(
+      [this](const ZoneData &data, ZoneChange &change) { return build(data, change); }, durableTicket
+  );
+
+  Logger::getInstance().debug(
+      "UPDATE of " + zone + ": " + std::to_string(updates.size()) + " records, " + std::string(dns_rcode_vals.name(rcode))
+  );
+  return rcode;
+}
+
+uint64_t ZoneUpdate::ticket() const {
+  return durableTicket;
+}
+
+std::vector<DNSRecord> &ZoneUpdate::lookup(const ZoneData &data, const std::string &name) {
+  auto it = names.find(name);
+  if (it != names.end())
+    return it->second;
+
+  const auto *records = data.find(NameKey{name, hashName(name)});
+  return names[name] = records ? *records : std::vector<DNSRecord>();
+}
+
+/* RFC 2136 3.2, evaluated against the zone before any of the update is applied */
+uint16_t ZoneUpdate::checkPrerequisites(const ZoneData &data) {
+  RecordMap expected; /* RRsets that must exist exactly as given */
+
+  for (const auto &rr : prerequisites) {
+    const DNSRecord &prerequisite = rr.record;
+    if (prerequisite.ttl != 0)
+      return RCODE_FORMERR;
+    if (!isSubdomain(rr.name, zone))
+      return RCODE_NOTZONE;
+
+    const auto *records = data.find(NameKey{rr.name, hashName(rr.name)});
+    bool        present = hasType(records, prerequisite.type);
+
+    if (prerequisite.rclass == C_ANY) {
+      if (!prerequisite.rdata.empty())
+        return RCODE_FORMERR;
+      if (prerequisite.type == T_ANY ? records == nullptr : !present)
+        return prerequisite.type == T_ANY ? RCODE_NXDOMAIN : RCODE_NXRRSET;
+    } else if (prerequisite.rclass == C_NONE) {
+      if (!prerequisite.rdata.empty())
+        return RCODE_FORMERR;
+      if (prerequisite.type == T_ANY ? records != nullptr : present)
+        return prerequisite.type == T_ANY ? RCODE_YXDOMAIN : RCODE_YXRRSET;
+    } else if (prerequisite.rclass == zclass && !isMetaType(prerequisite.type)) {
+      expected[rr.name].push_back(prerequisite);
+    } else {
+      return RCODE_FORMERR;
+    }
+  }
+
+  /* value dependent: the RRsets must match as sets, TTLs aside */
+  for (const auto &[name, wanted] : expected) {
+    const auto *records = data.find(NameKey{name, hashName(name)});
+    if (records == nullptr)
+      return RCODE_NXRRSET;
+
+    auto sameData = [](const DNSRecord &lhs, const DNSRecord &rhs) {
+      return lhs.type == rhs.type && lhs.rdata == rhs.rdata;
+    };
+    for (const auto &record : wanted) {
+      if (std::none_of(records->begin(), records->end(), [&](const DNSRecord &other) { return sameData(record, other); }))
+        return RCODE_NXRRSET;
+    }
+    for (const auto &record : *records) {
+      bool typeWanted = std::any_of(wanted.begin(), wanted.end(), [&](const DNSRecord &other) { return other.type == record.type; });
+      if (typeWanted && std::none_of(wanted.begin(), wanted.end(), [&](const DNSRecord &other) { return sameData(record, other); }))
+        return RCODE_NXRRSET;
+    }
+  }
+  return RCODE_NOERROR;
+}
+
+/* RFC 2136 3.4.1, the whole update is rejected before anything is changed */
+uint16_t ZoneUpdate::prescan() const {
+  for (const auto &rr : updates) {
+    const DNSRecord &record = rr.record;
+    if (!isSubdomain(rr.name, zone))
+      return RCODE_NOTZONE;
+    if (isSignerType(record.type))
+      return RCODE_REFUSED;
+
+    if (record.rclass == zclass) {
+      if (isMetaType(record.type))
+        return RCODE_FORMERR;
+    } else if (record.rclass == C_ANY) {
+      if (record.ttl != 0 || !record.rdata.empty() || (isMetaType(record.type) && record.type != T_ANY))
+        return RCODE_FORMERR;
+    } else if (record.rclass == C_NONE) {
+      if (record.ttl != 0 || isMetaType(record.type))
+        return RCODE_FORMERR;
+    } else {
+      return RCODE_FORMERR;
+    }
+  }
+  return RCODE_NOERROR;
+}
+
+/* RFC 2136 3.4.2 */
+void ZoneUpdate::applyUpdate(const ZoneData &data, const ResourceRecord &rr) {
+  const DNSRecord &update  = rr.record;
+  auto            &records = lookup(data, rr.name);
+  bool             apex    = rr.name == zone;
+
+  auto ofType = [](uint16_t type) {
+    return [type](const DNSRecord &record) { return record.type == type; };
+  };
+
+  if (update.rclass == zclass) {
+    if (update.type == T_SOA) {
+      /* only a newer SOA replaces the current one */
+      auto soa = std::find_if(records.begin(), records.end(), ofType(T_SOA));
+      if (apex && soa != records.end() && (int32_t)(soaSerial(update.rdata) - soaSerial(soa->rdata)) > 0)
+        *soa = update;
+      return;
+    }
+
+    /* CNAME and other data cannot share a name */
+    bool hasCNAME = std::any_of(records.begin(), records.end(), ofType(T_CNAME));
+    bool hasOther = std::any_of(records.begin(), records.end(), [](const DNSRecord &record) { return record.type != T_CNAME; });
+    if (update.type == T_CNAME ? hasOther : hasCNAME)
+      return;
+    if (update.type == T_CNAME)
+      records.erase(std::remove_if(records.begin(), records.end(), ofType(T_CNAME)), records.end());
+
+    auto same = std::find_if(records.begin(), records.end(), [&](const DNSRecord &record) {
+      return record.type == update.type && record.rdata == update.rdata;
+    });
+    if (same != records.end()) {
+      same->ttl = update.ttl;
+    } else {
+      records.push_back(update);
+    }
+    return;
+  }
+
+  if (update.rclass == C_ANY) {
+    /* delete an RRset, or every RRset of the name; the apex keeps its SOA and NS */
+    records.erase(
+        std::remove_if(
+            records.begin(), records.end(),
+            [&](const DNSRecord &record) {
+              if ((apex && (record.type == T_SOA || record.type == T_NS)) || isSignerType(record.type))
+                return false;
+              return update.type == T_ANY || record.type == update.type;
+            }
+        ),
+        records.end()
+    );
+    return;
+  }
+
+  /* C_NONE: delete one record, never the SOA or the last NS of the apex */
+  if (update.type == T_SOA)
+    return;
+  if (apex && update.type == T_NS && std::count_if(records.begin(), records.end(), ofType(T_NS)) <= 1)
+    return;
+  records.erase(
+      std::remove_if(
+          records.begin(), records.end(),
+          [&](const DNSRecord &record) { return record.type == update.type && record.rdata == update.rdata; }
+      ),
+      records.end()
+  );
+}
+
+uint16_t ZoneUpdate::build(const ZoneData &data, ZoneChange &change) {
+  if (data.apex.empty() || data.apex != zone)
+    return RCODE_NOTAUTH;
+
+  uint16_t rcode = checkPrerequisites(data);
+  if (rcode == RCODE_NOERROR)
+    rcode = prescan();
+  if (rcode != RCODE_NOERROR)
+    return rcode;
+
+  for (const auto &rr : updates) {
+    applyUpdate(data, rr);
+  }
+
+  bool soaUpdated = false;
+  for (const auto &[name, after] : names) {
+    const auto *before = data.find(NameKey{name, hashName(name)});
+
+    if (before != nullptr) {
+      for (const auto &record : *before) {
+        if (std::find(after.begin(), after.end(), record) == after.end())
+          change.removed.push_back(ResourceRecord{name, record});
+      }
+    }
+    for (const auto &record : after) {
+      if (before == nullptr || std::find(before->begin(), before->end(), record) == before->end()) {
+        change.added.push_back(ResourceRecord{name, record});
+        soaUpdated |= record.type == T_SOA;
+      }
+    }
+  }
+
+  /* every change moves the serial forward (RFC 2136 3.6) */
+  if ((!change.removed.empty() || !change.added.empty()) && !soaUpdated)
+    data.bumpSerial(change);
+  return RCODE_NOERROR;
+}
@@ -0,0 +1,98 @@
+#include "view.hpp"
+
+#include "logger.hpp"
+#include "zoneloader.hpp"
+
+static thread_local std::shared_ptr<const std::vector<std::shared_ptr<const ZoneData>>> pinned;
+
+Views &Views::getInstance() {
+  static Views instance;
+  return instance;
+}
+
+Views::Views() {
+  current.store(std::make_shared<const ZoneSet>());
+}
+
+bool Views::configure(const std::string &spec) {
+  Logger &logger = Logger::getInstance();
+
+  size_t start = 0;
+  while (start <= spec.size()) {
+    size_t end = spec.find(',', start);
+    if (end == std::string::npos)
+      end = spec.size();
+    std::string item = spec.substr(start, end - start);
+    start            = end + 1;
+    if (item.empty())
+      continue;
+
+    size_t equals = item.find('=');
+    if (equals == std::string::npos || files.size() >= PREFIX_MAX_VALUE) {
+      logger.error("Invalid view " + item + ", expected file=prefix+prefix");
+      return false;
+    }
+    files.push_back(item.substr(0, equals));
+
+    std::string prefixes = item.substr(equals + 1);
+    for (size_t from = 0; from <= prefixes.size();) {
+      size_t      to     = std::min(prefixes.find('+', from), prefixes.size());
+      std::string prefix = prefixes.substr(from, to - from);
+      from               = to + 1;
+      if (!matcher.add(prefix, files.size())) {
+        logger.error("Invalid prefix " + prefix + " in view " + files.back());
+        return false;
+      }
+    }
+  }
+
+  if (!matcher.compile()) {
+    logger.error("Too many IPv4 view prefixes longer than /24");
+    return false;
+  }
+  logger.info("Compiled " + std::to_string(matcher.size()) + " prefixes of " + std::to_string(files.size()) + " views");
+
+  return reload();
+}
+
+bool Views::reload() {
+  Logger &logger = Logger::getInstance();
+
+  auto zones = std::make_shared<ZoneSet>();
+  for (const auto &file : files) {
+    auto zone = loadZoneFile(file);
+    if (!zone) {
+      logger.warn("Keeping the running views");
+      return false;
+    }
+    zones->push_back(std::move(zone));
+  }
+
+  current.store(std::move(zones));
+  return true;
+}
+
+bool Views::enabled() const {
+  return !files.empty();
+}
+
+void Views::pin() {
+  pinned = current.load(std::memory_order_acquire);
+}
+
+const ZoneData *Views::zoneOf(uint16_t view) {
+  if (view == 0)
+    return nullptr;
+  if (!pinned)
+    pinned = current.load(std::memory_order_acquire);
+
+  return view <= pinned->size() ? (*pinned)[view - 1].get() : nullptr;
+}
+
+const ZoneData *Views::select(uint32_t address) {
+  return zoneOf(matcher.lookup(address));
+}
+
+const ZoneData *Views::select(const struct in6_addr &address) {
+  return zoneOf(matcher.lookup(address));
+}
@@ -0,0 +1,420 @@
+#include "wal.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "name.hpp"
+#include "rdata.hpp"
+
+#define ENTRY_HEADER   8 // payload length and checksum
+#define SNAPSHOT_MAGIC "DNSDSNP1"
+
+static void putUint16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+static void putUint32(std::vector<uint8_t> &out, uint32_t value) {
+  putUint16(out, value >> 16);
+  putUint16(out, value);
+}
+
+static void putRecord(std::vector<uint8_t> &out, const std::string &name, const DNSRecord &record) {
+  out.push_back(name.size());
+  out.insert(out.end(), name.begin(), name.end());
+  putUint16(out, record.type);
+  putUint16(out, record.rclass);
+  putUint32(out, record.ttl);
+  putUint16(out, record.rdata.size());
+  out.insert(out.end(), record.rdata.begin(), record.rdata.end());
+}
+
+static uint32_t checksum(const uint8_t *data, size_t size) {
+  return hashName(std::string_view((const char *)data, size));
+}
+
+/* Bounds-checked reader over an encoded entry or snapshot */
+struct Reader {
+  const uint8_t *data;
+  size_t         size;
+  size_t         offset;
+
+  bool uint16(uint16_t &value) {
+    if (offset + 2 > size)
+      return false;
+    value = (data[offset] << 8) | data[offset + 1];
+    offset += 2;
+    return true;
+  }
+
+  bool uint32(uint32_t &value) {
+    uint16_t high, low;
+    if (!uint16(high) || !uint16(low))
+      return false;
+    value = ((uint32_t)high << 16) | low;
+    return true;
+  }
+
+  bool record(std::string &name, DNSRecord &record) {
+    if (offset >= size || offset + 1 + data[offset] > size)
+      return false;
+    name.assign((const char *)data + offset + 1, data[offset]);
+    offset += 1 + name.size();
+
+    uint16_t rdlength;
+    if (!uint16(record.type) || !uint16(record.rclass) || !uint32(record.ttl) || !uint16(rdlength) || offset + rdlength > size)
+      return false;
+    record.rdata.assign(data + offset, data + offset + rdlength);
+    offset += rdlength;
+    return true;
+  }
+};
+
+static bool decodeChange(const uint8_t *data, size_t size, ZoneChange &change) {
+  Reader   reader = {data, size, 0};
+  uint32_t removed, added;
+
+  if (!reader.uint32(change.fromSerial) || !reader.uint32(change.toSerial) || !reader.uint32(removed) || !reader.uint32(added))
+    return false;
+
+  for (uint32_t i = 0; i < removed + added; ++i) {
+    ResourceRecord rr;
+    if (!reader.record(rr.name, rr.record))
+      return false;
+    (i < removed ? change.removed : change.added).push_back(std::move(rr));
+  }
+  return reader.offset == size;
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool readAll(int fd, std::vector<uint8_t> &data) {
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return false;
+
+  data.resize(st.st_size);
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = pread(fd, data.data() + done, data.size() - done, done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/* Make a rename in the directory of `path` durable */
+static void syncDirectory(const std::string &path) {
+  size_t      slash     = path.rfind('/');
+  std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    ::close(fd);
+  }
+}
+
+/* Write `data` to a temporary file and move it over `path` */
+static bool replaceFile(const std::string &path, const uint8_t *data, size_t size) {
+  std::string temporary = path + ".tmp";
+
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  bool ok = writeAll(fd, data, size) && fsync(fd) == 0;
+  ::close(fd);
+  if (!ok || rename(temporary.c_str(), path.c_str()) < 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+
+  syncDirectory(path);
+  return true;
+}
+
+WriteAheadLog::WriteAheadLog()
+    : fd(-1), appended(0), durable(0), base(0), written(0), failed(false), running(false) {}
+
+WriteAheadLog::~WriteAheadLog() {
+  close();
+}
+
+bool WriteAheadLog::open(const std::string &path, const ReplayHandler &replay) {
+  Logger &logger = Logger::getInstance();
+
+  this->path = path;
+  fd         = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    logger.error("Cannot open journal " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  std::vector<uint8_t> data;
+  if (!readAll(fd, data)) {
+    logger.error("Cannot read journal " + path + ": " + std::string(strerror(errno)));
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  /* whatever follows the last intact entry is a write torn by a crash */
+  size_t end = 0;
+  while (end + ENTRY_HEADER <= data.size()) {
+    Reader   reader = {data.data(), data.size(), end};
+    uint32_t length, check;
+    if (!reader.uint32(length) || !reader.uint32(check) || reader.offset + length > data.size()
+        || checksum(data.data() + reader.offset, length) != check)
+      break;
+    end = reader.offset + length;
+  }
+  if (end < data.size()) {
+    logger.warn("Journal " + path + " has a damaged tail, dropping " + std::to_string(data.size() - end) + " bytes");
+    if (ftruncate(fd, end) < 0)
+      logger.warn("Cannot truncate journal " + path + ": " + std::string(strerror(errno)));
+    data.resize(end);
+  }
+
+  size_t entries = 0;
+  for (size_t offset = 0; offset < data.size();) {
+    uint32_t   length = ((uint32_t)data[offset] << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+    ZoneChange change;
+    if (!decodeChange(data.data() + offset + ENTRY_HEADER, length, change) || !replay(std::move(change)))
+      break;
+    offset += ENTRY_HEADER + length;
+    entries++;
+  }
+
+  if (entries > 0)
+    logger.info("Journal " + path + ": replayed " + std::to_string(entries) + " changes");
+
+  written = data.size();
+  running = true;
+  flusher = std::thread(&WriteAheadLog::run, this);
+  return true;
+}
+
+bool WriteAheadLog::isOpen() const {
+  return fd >= 0;
+}
+
+uint64_t WriteAheadLog::append(const ZoneChange &change) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  size_t start = pending.size();
+  pending.resize(start + ENTRY_HEADER);
+  putUint32(pending, change.fromSerial);
+  putUint32(pending, change.toSerial);
+  putUint32(pending, change.removed.size());
+  putUint32(pending, change.added.size());
+  for (const auto &rr : change.removed) {
+    putRecord(pending, rr.name, rr.record);
+  }
+  for (const auto &rr : change.added) {
+    putRecord(pending, rr.name, rr.record);
+  }
+
+  size_t               length = pending.size() - start - ENTRY_HEADER;
+  std::vector<uint8_t> header;
+  putUint32(header, length);
+  putUint32(header, checksum(pending.data() + start + ENTRY_HEADER, length));
+  std::memcpy(pending.data() + start, header.data(), ENTRY_HEADER);
+
+  pendingReady.notify_one();
+  return ++appended;
+}
+
+bool WriteAheadLog::waitDurable(uint64_t ticket) {
+  std::unique_lock<std::mutex> lock(mutex);
+  durableReady.wait(lock, [&] { return durable >= ticket || failed; });
+  return durable >= ticket;
+}
+
+bool WriteAheadLog::settled(uint64_t ticket) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return durable >= ticket || failed;
+}
+
+uint64_t WriteAheadLog::position() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return written + pending.size();
+}
+
+uint64_t WriteAheadLog::size() const {
+  return position() - base;
+}
+
+void WriteAheadLog::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      pendingReady.wait(lock, [&] { return !pending.empty() || !running; });
+      if (pending.empty())
+        break;
+    }
+    flush();
+  }
+}
+
+void WriteAheadLog::flush() {
+  std::lock_guard<std::mutex> fileLock(fileMutex);
+
+  /* everything queued while the previous batch was syncing goes out with one fsync */
+  std::vector<uint8_t> batch;
+  uint64_t             ticket;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batch.swap(pending);
+    ticket = appended;
+  }
+  if (batch.empty())
+    return;
+
+  bool ok = !failed && writeAll(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+  if (!ok)
+    Logger::getInstance().error("Journal write to " + path + " failed: " + std::string(strerror(errno)));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    written += batch.size();
+    if (ok) {
+      durable = ticket;
+    } else {
+      failed = true;
+    }
+  }
+  durableReady.notify_all();
+}
+
+bool WriteAheadLog::truncate(uint64_t position) {
+  Logger &logger = Logger::getInstance();
+
+  flush();
+  std::lock_guard<std::mutex> fileLock(fileMutex);
+
+  std::vector<uint8_t> data;
+  if (failed || position < base || !readAll(fd, data) || position - base > data.size())
+    return false;
+
+  /* only the changes made while the snapshot was written survive */
+  size_t keep = data.size() - (position - base);
+  if (!replaceFile(path, data.data() + (position - base), keep)) {
+    logger.error("Cannot rewrite journal " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  int next = ::open(path.c_str(), O_RDWR | O_APPEND);
+  if (next < 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    failed = true;
+    return false;
+  }
+
+  ::close(fd);
+  fd = next;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  base = position;
+  return true;
+}
+
+void WriteAheadLog::close() {
+  if (running) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    pendingReady.notify_all();
+    flusher.join();
+  }
+  if (fd >= 0) {
+    flush();
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool writeSnapshot(const std::string &path, const ZoneData &zone) {
+  std::vector<uint8_t> data(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8);
+
+  data.push_back(zone.apex.size());
+  data.insert(data.end(), zone.apex.begin(), zone.apex.end());
+  putUint32(data, zone.serial);
+  for (const auto &shard : zone.shards) {
+    for (const auto &[name, records] : *shard) {
+      for (const auto &record : records) {
+        putRecord(data, name, record);
+      }
+    }
+  }
+  putUint32(data, checksum(data.data(), data.size()));
+
+  return replaceFile(path, data.data(), data.size());
+}
+
+std::shared_ptr<ZoneData> readSnapshot(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  std::vector<uint8_t> data;
+  bool                 ok = readAll(fd, data);
+  ::close(fd);
+
+  if (!ok || data.size() < 13 || std::memcmp(data.data(), SNAPSHOT_MAGIC, 8) != 0) {
+    Logger::getInstance().warn("Ignoring unreadable snapshot " + path);
+    return nullptr;
+  }
+
+  Reader   trailer = {data.data(), data.size(), data.size() - 4};
+  uint32_t check;
+  if (!trailer.uint32(check) || check != checksum(data.data(), data.size() - 4)) {
+    Logger::getInstance().warn("Ignoring damaged snapshot " + path);
+    return nullptr;
+  }
+
+  Reader    reader = {data.data(), data.size() - 4, 8};
+  RecordMap records;
+  size_t    apexLength = data[reader.offset++];
+  if (reader.offset + apexLength > reader.size)
+    return nullptr;
+  std::string apex((const char *)data.data() + reader.offset, apexLength);
+  reader.offset += apexLength;
+
+  uint32_t serial;
+  if (!reader.uint32(serial))
+    return nullptr;
+
+  while (reader.offset < reader.size) {
+    std::string name;
+    DNSRecord   record;
+    if (!reader.record(name, record))
+      return nullptr;
+    records[name].push_back(std::move(record));
+  }
+
+  auto zone    = ZoneData::build(std::move(records));
+  zone->apex   = apex;
+  zone->serial = serial;
+  return zone;
+}
@@ -0,0 +1,546 @@
+#include "xdpserver.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "dnstap.hpp"
+#include "hitters.hpp"
+#include "logger.hpp"
+
+#define XSK_FRAME_SIZE 2048 // UMEM chunk per packet
+#define XSK_FRAMES     4096 // chunks in the UMEM, half of them wait in the fill ring
+#define XSK_RING_SIZE  2048 // descriptors in each of the four rings
+#define XSK_BATCH_SIZE 64   // frames taken from the RX ring per round
+#define XSK_MAP_SIZE   64   // receive queues the XDP program can steer to
+#define XSK_HEADERS    42   // Ethernet, IPv4 without options and UDP
+#define XSK_TTL        64
+
+/* One of the rings shared with the kernel, the descriptors are addresses or struct xdp_desc */
+struct XskRing {
+  uint32_t *producer = nullptr;
+  uint32_t *consumer = nullptr;
+  uint32_t *flags    = nullptr;
+  void     *descs    = nullptr;
+  void     *map      = MAP_FAILED;
+  size_t    length   = 0;
+
+  bool mapRing(int fd, const struct xdp_ring_offset &offsets, size_t descSize, off_t pgoff) {
+    length = offsets.desc + XSK_RING_SIZE * descSize;
+    map    = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED)
+      return false;
+    producer = (uint32_t *)((uint8_t *)map + offsets.producer);
+    consumer = (uint32_t *)((uint8_t *)map + offsets.consumer);
+    flags    = (uint32_t *)((uint8_t *)map + offsets.flags);
+    descs    = (uint8_t *)map + offsets.desc;
+    return true;
+  }
+
+  ~XskRing() {
+    if (map != MAP_FAILED)
+      munmap(map, length);
+  }
+
+  /* Entries the kernel produced that we have not consumed */
+  uint32_t available() const {
+    return __atomic_load_n(producer, __ATOMIC_ACQUIRE) - *consumer;
+  }
+
+  /* Entries we can produce before catching up with the kernel */
+  uint32_t space() const {
+    return XSK_RING_SIZE - (*producer - __atomic_load_n(consumer, __ATOMIC_ACQUIRE));
+  }
+
+  void consume(uint32_t count) {
+    __atomic_store_n(consumer, *consumer + count, __ATOMIC_RELEASE);
+  }
+
+  void produce(uint32_t count) {
+    __atomic_store_n(producer, *producer + count, __ATOMIC_RELEASE);
+  }
+
+  uint64_t &address(uint32_t index) {
+    return ((uint64_t *)descs)[index & (XSK_RING_SIZE - 1)];
+  }
+
+  struct xdp_desc &descriptor(uint32_t index) {
+    return ((struct xdp_desc *)descs)[index & (XSK_RING_SIZE - 1)];
+  }
+};
+
+/* The AF_XDP socket with its UMEM and rings, the socket map and the XDP program steering into it */
+struct XskSocket {
+  int      fd     = -1;
+  int      mapfd  = -1;
+  int      progfd = -1;
+  int      linkfd = -1;
+  uint8_t *umem   = (uint8_t *)MAP_FAILED;
+  XskRing  fill, completion, rx, tx;
+
+  ~XskSocket() {
+    /* the link goes first, so traffic flows to the kernel stack again before the socket is gone */
+    for (int descriptor : {linkfd, progfd, mapfd, fd}) {
+      if (descriptor >= 0)
+        close(descriptor);
+    }
+    if (umem != MAP_FAILED)
+      munmap(umem, (size_t)XSK_FRAMES * XSK_FRAME_SIZE);
+  }
+};
+
+static long bpf(int command, union bpf_attr &attr) {
+  return syscall(__NR_bpf, command, &attr, sizeof(attr));
+}
+
+static struct bpf_insn instruction(uint8_t code, uint8_t dst, uint8_t src, int16_t offset, int32_t imm) {
+  struct bpf_insn insn = {};
+  insn.code            = code;
+  insn.dst_reg         = dst;
+  insn.src_reg         = src;
+  insn.off             = offset;
+  insn.imm             = imm;
+  return insn;
+}
+
+/*
+  The XDP program, built by hand so no BPF toolchain is needed:
+
+    if the frame holds Ethernet, IPv4 without options and UDP headers,
+       is no fragment and goes to `port`:
+      return bpf_redirect_map(xsks, ctx->rx_queue_index, XDP_PASS)
+    return XDP_PASS
+
+  bpf_redirect_map() passes the frame on to the stack, too, when no socket
+  is bound to its queue.
+*/
+static std::vector<struct bpf_insn> steeringProgram(int mapfd, uint16_t port) {
+  enum { R0, R1, R2, R3, R4, R5 };
+  std::vector<struct bpf_insn> program;
+  std::vector<size_t>          passes;
+
+  auto load = [&](uint8_t size, uint8_t dst, uint8_t src, int16_t offset) {
+    program.push_back(instruction(BPF_LDX | BPF_MEM | size, dst, src, offset, 0));
+  };
+  auto pass = [&](uint8_t code, uint8_t dst, uint8_t src, int32_t imm) {
+    passes.push_back(program.size());
+    program.push_back(instruction(BPF_JMP | code, dst, src, 0, imm));
+  };
+
+  load(BPF_W, R2, R1, offsetof(struct xdp_md, data));
+  load(BPF_W, R3, R1, offsetof(struct xdp_md, data_end));
+  program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0));
+  program.push_back(instruction(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, XSK_HEADERS));
+  pass(BPF_JGT | BPF_X, R4, R3, 0);
+  /* the loads keep network byte order, so the constants are compared in it */
+  load(BPF_H, R5, R2, 12);
+  pass(BPF_JNE | BPF_K, R5, 0, htons(ETH_P_IP));
+  load(BPF_B, R5, R2, 14);
+  pass(BPF_JNE | BPF_K, R5, 0, 0x45);
+  load(BPF_B, R5, R2, 23);
+  pass(BPF_JNE | BPF_K, R5, 0, IPPROTO_UDP);
+  load(BPF_H, R5, R2, 20);
+  program.push_back(instruction(BPF_ALU64 | BPF_AND | BPF_K, R5, 0, 0, htons(0x3fff)));
+  pass(BPF_JNE | BPF_K, R5, 0, 0);
+  load(BPF_H, R5, R2, 36);
+  pass(BPF_JNE | BPF_K, R5, 0, htons(port));
+
+  load(BPF_W, R2, R1, offsetof(struct xdp_md, rx_queue_index));
+  program.push_back(instruction(BPF_LD | BPF_DW | BPF_IMM, R1, BPF_PSEUDO_MAP_FD, 0, mapfd));
+  program.push_back(instruction(0, 0, 0, 0, 0));
+  program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, R3, 0, 0, XDP_PASS));
+  program.push_back(instruction(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+  program.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+  for (size_t jump : passes) {
+    program[jump].off = program.size() - jump - 1;
+  }
+  program.push_back(instruction(BPF_ALU64 | BPF_MOV | BPF_K, R0, 0, 0, XDP_PASS));
+  program.push_back(instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  return program;
+}
+
+static bool fail(const std::string &what) {
+  Logger::getInstance().error("AF_XDP: " + what + ": " + std::string(strerror(errno)));
+  return false;
+}
+
+/* Socket, UMEM and rings bound to `queue` of `ifindex`, with half the frames handed to the fill ring */
+static bool openSocket(XskSocket &xsk, unsigned ifindex, uint32_t queue, std::vector<uint64_t> &spare) {
+  xsk.fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (xsk.fd < 0)
+    return fail("socket");
+
+  size_t length = (size_t)XSK_FRAMES * XSK_FRAME_SIZE;
+  xsk.umem      = (uint8_t *)mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (xsk.umem == MAP_FAILED)
+    return fail("UMEM");
+
+  struct xdp_umem_reg reg = {};
+  reg.addr                = (uint64_t)xsk.umem;
+  reg.len                 = length;
+  reg.chunk_size          = XSK_FRAME_SIZE;
+  if (setsockopt(xsk.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    return fail("UMEM registration");
+
+  int entries = XSK_RING_SIZE;
+  for (int ring : {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING}) {
+    if (setsockopt(xsk.fd, SOL_XDP, ring, &entries, sizeof(entries)) < 0)
+      return fail("ring setup");
+  }
+
+  struct xdp_mmap_offsets offsets;
+  socklen_t               size = sizeof(offsets);
+  if (getsockopt(xsk.fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &size) < 0)
+    return fail("ring offsets");
+  if (!xsk.fill.mapRing(xsk.fd, offsets.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+      !xsk.completion.mapRing(xsk.fd, offsets.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+      !xsk.rx.mapRing(xsk.fd, offsets.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+      !xsk.tx.mapRing(xsk.fd, offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+    return fail("ring mapping");
+
+  for (uint32_t frame = 0; frame < XSK_FRAMES; ++frame) {
+    spare.push_back((uint64_t)frame * XSK_FRAME_SIZE);
+  }
+  uint32_t start = *xsk.fill.producer;
+  for (uint32_t i = 0; i < XSK_RING_SIZE; ++i) {
+    xsk.fill.address(start + i) = spare.back();
+    spare.pop_back();
+  }
+  xsk.fill.produce(XSK_RING_SIZE);
+
+  /* zero copy when the driver can, copy mode otherwise */
+  struct sockaddr_xdp address = {};
+  address.sxdp_family         = AF_XDP;
+  address.sxdp_flags          = XDP_USE_NEED_WAKEUP;
+  address.sxdp_ifindex        = ifindex;
+  address.sxdp_queue_id       = queue;
+  if (bind(xsk.fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    return fail("bind");
+  return true;
+}
+
+/* Socket map holding the socket at `queue`, and the program steering into it attached to the interface */
+static bool attachProgram(XskSocket &xsk, unsigned ifindex, uint32_t queue, uint16_t port) {
+  union bpf_attr attr = {};
+  attr.map_type       = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size       = sizeof(uint32_t);
+  attr.value_size     = sizeof(uint32_t);
+  attr.max_entries    = XSK_MAP_SIZE;
+  xsk.mapfd           = bpf(BPF_MAP_CREATE, attr);
+  if (xsk.mapfd < 0)
+    return fail("socket map");
+
+  attr        = {};
+  attr.map_fd = xsk.mapfd;
+  attr.key    = (uint64_t)&queue;
+  attr.value  = (uint64_t)&xsk.fd;
+  attr.flags  = BPF_ANY;
+  if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+    return fail("socket map update");
+
+  std::vector<struct bpf_insn> program = steeringProgram(xsk.mapfd, port);
+  static char                  verifier[4096];
+  attr                      = {};
+  attr.prog_type            = BPF_PROG_TYPE_XDP;
+  attr.expected_attach_type = BPF_XDP;
+  attr.insns                = (uint64_t)program.data();
+  attr.insn_cnt             = program.size();
+  attr.license              = (uint64_t)"GPL";
+  xsk.progfd                = bpf(BPF_PROG_LOAD, attr);
+  if (xsk.progfd < 0) {
+    /* load again with the verifier log to tell why */
+    attr.log_buf   = (uint64_t)verifier;
+    attr.log_size  = sizeof(verifier);
+    attr.log_level = 1;
+    bpf(BPF_PROG_LOAD, attr);
+    Logger::getInstance().error("AF_XDP: the verifier rejected the program: " + std::string(verifier));
+    return false;
+  }
+
+  attr                            = {};
+  attr.link_create.prog_fd        = xsk.progfd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type    = BPF_XDP;
+  xsk.linkfd                      = bpf(BPF_LINK_CREATE, attr);
+  if (xsk.linkfd < 0)
+    return fail("attaching the program");
+  return true;
+}
+
+static uint32_t sum16(const uint8_t *data, size_t length, uint32_t sum) {
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += data[i] << 8 | data[i + 1];
+  }
+  if (length & 1)
+    sum += data[length - 1] << 8;
+  return sum;
+}
+
+static uint16_t fold(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+/*
+  Turn the query in `frame` into the reply whose `length` DNS bytes follow
+  its headers: addresses and ports swapped, lengths and checksums redone
+*/
+static void replyHeaders(uint8_t *frame, size_t length) {
+  uint8_t *ip  = frame + ETH_HLEN;
+  uint8_t *udp = ip + 20;
+  uint8_t  swap[6];
+
+  std::memcpy(swap, frame, ETH_ALEN);
+  std::memcpy(frame, frame + ETH_ALEN, ETH_ALEN);
+  std::memcpy(frame + ETH_ALEN, swap, ETH_ALEN);
+
+  uint16_t total = 20 + 8 + length;
+  std::memcpy(swap, ip + 12, 4);
+  std::memcpy(ip + 12, ip + 16, 4);
+  std::memcpy(ip + 16, swap, 4);
+  ip[2] = total >> 8;
+  ip[3] = total;
+  ip[4] = ip[5] = 0;
+  ip[6]         = 0x40; // don't fragment
+  ip[7]         = 0;
+  ip[8]         = XSK_TTL;
+  ip[10] = ip[11] = 0;
+  uint16_t check  = fold(sum16(ip, 20, 0));
+  ip[10]          = check >> 8;
+  ip[11]          = check;
+
+  std::memcpy(swap, udp, 2);
+  std::memcpy(udp, udp + 2, 2);
+  std::memcpy(udp + 2, swap, 2);
+  udp[4] = (8 + length) >> 8;
+  udp[5] = 8 + length;
+  udp[6] = udp[7] = 0;
+  /* pseudo header: addresses, protocol and UDP length */
+  check = fold(sum16(udp, 8 + length, sum16(ip + 12, 8, IPPROTO_UDP + 8 + length)));
+  if (check == 0)
+    check = 0xffff;
+  udp[6] = check >> 8;
+  udp[7] = check;
+}
+
+XDPServer::XDPServer(int port): port(port), ifindex(0), queue(0), running(false) {}
+
+XDPServer::~XDPServer() {
+  stop();
+}
+
+bool XDPServer::configure(const std::string &spec) {
+  size_t colon = spec.find(':');
+  interface    = spec.substr(0, colon);
+  ifindex      = if_nametoindex(interface.c_str());
+  if (ifindex == 0) {
+    Logger::getInstance().error("AF_XDP: no interface " + interface);
+    return false;
+  }
+
+  queue = 0;
+  if (colon != std::string::npos) {
+    char         *end;
+    unsigned long value = std::strtoul(spec.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || end == spec.c_str() + colon + 1 || value >= XSK_MAP_SIZE) {
+      Logger::getInstance().error("AF_XDP: invalid queue in " + spec + ", expected 0 to " + std::to_string(XSK_MAP_SIZE - 1));
+      return false;
+    }
+    queue = value;
+  }
+  return true;
+}
+
+bool XDPServer::enabled() const {
+  return ifindex != 0;
+}
+
+void XDPServer::start() {
+  running      = true;
+  serverThread = std::thread(&XDPServer::run, this);
+}
+
+void XDPServer::stop() {
+  if (running) {
+    running = false;
+    if (serverThread.joinable()) {
+      serverThread.join();
+    }
+  }
+}
+
+void XDPServer::setPort(int port) {
+  this->port = port;
+}
+
+void XDPServer::setNotifyHandler(NotifyHandler handler) {
+  notifyHandler = handler;
+}
+
+void XDPServer::run() {
+  Logger       &logger  = Logger::getInstance();
+  Dnstap       &dnstap  = Dnstap::getInstance();
+  HitterWorker &hitters = HeavyHitters::getInstance().worker();
+
+  XskSocket             xsk;
+  std::vector<uint64_t> spare; // frames owned by us, neither in a ring nor in flight
+  spare.reserve(XSK_FRAMES);
+  if (!openSocket(xsk, ifindex, queue, spare) || !attachProgram(xsk, ifindex, queue, port)) {
+    logger.warn("AF_XDP is off, " + interface + " is served by the UDP socket");
+    return;
+  }
+  logger.info("AF_XDP server is running on " + interface + " queue " + std::to_string(queue) + ", port " + std::to_string(port) + "...");
+
+  /* frames answered in this round: where, how long their DNS reply is and the journal position it waits for */
+  struct Reply {
+    uint64_t address;
+    size_t   length;
+    uint64_t ticket;
+  };
+
+  Arena             arena;
+  DB               &db = DB::getInstance("");
+  Reply             replies[XSK_BATCH_SIZE];
+  std::deque<Reply> held; // replies to updates waiting for the journal, their changes were taken in this order
+  uint8_t           reply[EDNS_PAYLOAD_SIZE];
+  struct pollfd     pfd = {xsk.fd, POLLIN, 0};
+
+  /* updates already taken are still acknowledged before stopping */
+  while (running || !held.empty()) {
+    /* sent frames come back through the completion ring, the fill ring takes them for new queries */
+    uint32_t done = xsk.completion.available();
+    for (uint32_t i = 0; i < done; ++i) {
+      spare.push_back(xsk.completion.address(*xsk.completion.consumer + i));
+    }
+    xsk.completion.consume(done);
+
+    uint32_t refill = std::min<uint32_t>(xsk.fill.space(), spare.size());
+    for (uint32_t i = 0; i < refill; ++i) {
+      xsk.fill.address(*xsk.fill.producer + i) = spare.back();
+      spare.pop_back();
+    }
+    xsk.fill.produce(refill);
+
+    uint32_t received = std::min<uint32_t>(xsk.rx.available(), XSK_BATCH_SIZE);
+    if (received == 0) {
+      /* also wakes the driver up when the fill ring was empty, the journal is looked at often while replies wait for it */
+      poll(&pfd, 1, held.empty() ? 100 : 1);
+      if (held.empty() || !db.settled(held.front().ticket))
+        continue;
+    }
+
+    struct timespec arrival;
+    clock_gettime(CLOCK_REALTIME, &arrival);
+    hitters.tick(arrival.tv_sec);
+    pinQueryState();
+
+    int answered = 0;
+    for (uint32_t k = 0; k < received; ++k) {
+      const struct xdp_desc &desc  = xsk.rx.descriptor(*xsk.rx.consumer + k);
+      uint8_t               *frame = xsk.umem + desc.addr;
+      uint8_t               *ip    = frame + ETH_HLEN;
+      uint8_t               *udp   = ip + 20;
+      size_t                 total = desc.len >= XSK_HEADERS ? ip[2] << 8 | ip[3] : 0;
+      size_t                 size  = total >= 28 ? udp[4] << 8 | udp[5] : 0;
+      /* the program checked the protocols, the lengths are up to us; a reply fills the rest of the chunk */
+      size_t room = XSK_FRAME_SIZE - desc.addr % XSK_FRAME_SIZE - XSK_HEADERS;
+
+      DNS dnspacket(arena);
+      if (total < 28 || ETH_HLEN + total > desc.len || size < 8 || 20 + size > total || !dnspacket.parseDNS(udp + 8, size - 8)) {
+        logger.debug("Dropping malformed packet");
+        spare.push_back(desc.addr);
+        continue;
+      }
+      const uint8_t *query  = udp + 8;
+      size_t         length = size - 8;
+      uint32_t       source;
+      uint16_t       sourcePort;
+      std::memcpy(&source, ip + 12, sizeof(source));
+      std::memcpy(&sourcePort, udp, sizeof(sourcePort));
+
+      if (!dnspacket.getQueries().empty())
+        hitters.add(dnspacket.getQueries().front().hash, dnspacket.getQueries().front().key, source);
+      if (!dnstap.enabled()) {
+        char   line[DNS_SUMMARY_SIZE];
+        size_t used  = dnspacket.summarize(line, sizeof(line) - 1, source, sourcePort);
+        line[used++] = '\n';
+        std::fwrite(line, 1, used, stdout);
+      }
+
+      bool   shed = false;
+      Reply &out  = replies[answered];
+      out.address = desc.addr;
+      out.length  = answerDatagram(dnspacket, query, length, source, reply, shed, notifyHandler, out.ticket);
+      if (out.length > room)
+        out.length = dnspacket.buildTruncated(reply, room);
+      if (dnstap.enabled())
+        dnstap.log(DNSTAP_UDP, source, sourcePort, arrival, query, length, reply, out.length);
+
+      /* the query is no longer needed, its frame takes the reply */
+      std::memcpy(frame + XSK_HEADERS, reply, out.length);
+      if (out.ticket > 0) {
+        held.push_back(out);
+        continue;
+      }
+      answered++;
+    }
+    xsk.rx.consume(received);
+
+    if (!dnstap.enabled())
+      std::fflush(stdout);
+
+    /* updates are acknowledged only once journaled, without making the queries of the batch wait for the disk */
+    while (!held.empty() && answered < XSK_BATCH_SIZE && db.settled(held.front().ticket)) {
+      Reply &out = replies[answered++];
+      out        = held.front();
+      held.pop_front();
+      if (!db.waitDurable(out.ticket)) {
+        DNSHeader *header = (DNSHeader *)(xsk.umem + out.address + XSK_HEADERS);
+        header->flags     = htons((ntohs(header->flags) & ~F_RCODE) | RCODE_SERVFAIL);
+      }
+    }
+
+    /* replies the TX ring has no room for are dropped, the client retries */
+    uint32_t sending = std::min<uint32_t>(xsk.tx.space(), answered);
+    for (uint32_t k = 0; k < (uint32_t)answered; ++k) {
+      if (k >= sending) {
+        spare.push_back(replies[k].address);
+        continue;
+      }
+      replyHeaders(xsk.umem + replies[k].address, replies[k].length);
+      struct xdp_desc &desc = xsk.tx.descriptor(*xsk.tx.producer + k);
+      desc.addr             = replies[k].address;
+      desc.len              = XSK_HEADERS + replies[k].length;
+      desc.options          = 0;
+    }
+    xsk.tx.produce(sending);
+    if (*xsk.tx.flags & XDP_RING_NEED_WAKEUP)
+      sendto(xsk.fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+
+    arena.reset();
+  }
+
+  logger.info("AF_XDP server is shutting down");
+}
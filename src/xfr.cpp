@@ -0,0 +1,226 @@
+#include "xfr.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+#include "logger.hpp"
+#include "rdata.hpp"
+#include "synth.hpp"
+
+ZoneTransfer::ZoneTransfer(MessageSink sink)
+    : sink(sink), buffer(XFR_MESSAGE_SIZE), writer(), transactionId(0), question(nullptr), ancount(0), failed(false) {}
+
+bool ZoneTransfer::serve(const uint8_t *request, size_t size, const DNS &query) {
+  transactionId = query.getHeader().transactionId;
+  question      = &query.getQueries().front();
+
+  auto             zone  = DB::getInstance("").snapshot();
+  const ZoneEntry *entry = zone->zones->find(NameKey{question->key, question->hash});
+  if (entry == nullptr || entry->apex != question->key)
+    return sendError(RCODE_NOTAUTH);
+
+  const auto *apexRecords = zone->find(entry->apex);
+  auto        soa = std::find_if(apexRecords->begin(), apexRecords->end(), [](const DNSRecord &record) { return record.type == T_SOA; });
+
+  /* only the primary zone has a journal, the others are always sent in full */
+  if (question->type == T_IXFR && entry->apex == zone->apex) {
+    uint32_t serial;
+    if (!requestedSerial(request, size, serial))
+      return sendError(RCODE_FORMERR);
+
+    /* client is up to date, the answer is just the current SOA */
+    if ((int32_t)(zone->serial - serial) <= 0) {
+      beginMessage(true);
+      addRecord(zone->apex, *soa);
+      return flush();
+    }
+
+    std::vector<std::shared_ptr<const ZoneChange>> changes;
+    if (DB::getInstance("").changesSince(serial, changes) && changes.back()->toSerial == zone->serial)
+      return sendIncremental(*zone, *soa, changes);
+  }
+
+  return sendFull(*zone, *entry, *soa);
+}
+
+bool ZoneTransfer::sendError(uint16_t rcode) {
+  beginMessage(true);
+  uint16_t flags = htons(F_RESPONSE | F_AUTHORITATIVE | rcode);
+  std::memcpy(buffer.data() + 2, &flags, 2);
+  return flush();
+}
+
+void ZoneTransfer::beginMessage(bool withQuestion) {
+  writer = PacketWriter{buffer.data(), buffer.size(), 0, false};
+  compressor.clear();
+  /* a record moved on to this message may still be using the last one */
+  if (owners.size() > 1)
+    owners.erase(owners.begin(), owners.end() - 1);
+  ancount = 0;
+
+  DNSHeader header     = {};
+  header.transactionId = htons(transactionId);
+  header.flags         = htons(F_RESPONSE | F_AUTHORITATIVE | (OPCODE_QUERY << OPCODE_SHIFT) | RCODE_NOERROR);
+  header.qdcount       = htons(withQuestion ? 1 : 0);
+  writer.append(&header, sizeof(DNSHeader));
+
+  if (withQuestion) {
+    writer.appendName(question->name);
+    writer.appendUint16(question->type);
+    writer.appendUint16(question->qclass);
+  }
+}
+
+bool ZoneTransfer::flush() {
+  uint16_t count = htons(ancount);
+  std::memcpy(buffer.data() + offsetof(DNSHeader, ancount), &count, 2);
+
+  if (!failed && !sink(buffer.data(), writer.size))
+    failed = true;
+  return !failed;
+}
+
+/* Append one record, starting a new message when the current one is full */
+bool ZoneTransfer::addRecord(std::string_view name, const DNSRecord &record) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    size_t mark = writer.size;
+
+    compressor.appendName(writer, name);
+    writer.appendUint16(record.type);
+    writer.appendUint16(record.rclass);
+    writer.appendUint32(record.ttl);
+    writer.appendUint16(record.rdata.size());
+    writer.append(record.rdata.data(), record.rdata.size());
+
+    if (!writer.overflow) {
+      ancount++;
+      return true;
+    }
+
+    /* ship what fits and retry the record in a fresh message */
+    writer.size     = mark;
+    writer.overflow = false;
+    if (ancount == 0 || !flush())
+      return false;
+    beginMessage(false);
+  }
+  return false;
+}
+
+/* Synthesized owners are not in the store, a copy is kept for the compressor to point at */
+bool ZoneTransfer::addSynthesized(std::string_view name, const DNSRecord &record) {
+  owners.emplace_back(name);
+  return addRecord(owners.back(), record);
+}
+
+bool ZoneTransfer::sendFull(const ZoneData &zone, const ZoneEntry &entry, const DNSRecord &soa) {
+  const std::string &apex = entry.apex;
+
+  if (zone.ranges && zone.ranges->expandedSize(apex) > XFR_MAX_SYNTHESIZED) {
+    Logger::getInstance().warn(
+        "Refusing to transfer " + apex + ", its $GENERATE and $SYNTHESIZE lines hold more than " + std::to_string(XFR_MAX_SYNTHESIZED)
+        + " records"
+    );
+    return sendError(RCODE_REFUSED);
+  }
+
+  beginMessage(true);
+  if (!addRecord(apex, soa))
+    return false;
+
+  /* the names of the zone follow its apex in the index, those of zones below it are theirs */
+  std::string prefix = orderKey(apex);
+  for (const std::string *key = &prefix; key != nullptr; key = zone.index->after(*key)) {
+    if (!prefix.empty() && (key->compare(0, prefix.size(), prefix) != 0 || (key->size() > prefix.size() && (*key)[prefix.size()] != '\0')))
+      break;
+
+    std::string name  = orderKeyName(*key);
+    const auto &shard = *zone.shards[zone.shardIndex(hashName(name))];
+    auto        owner = shard.find(name);
+    if (owner == shard.end() || zone.zones->find(NameKey{owner->first, hashName(name)}) != &entry)
+      continue;
+
+    /* owners are taken from the store, the compressor points back at them */
+    for (const auto &record : owner->second) {
+      if (record.type == T_SOA && name == apex)
+        continue;
+      if (!addRecord(owner->first, record))
+        return false;
+    }
+  }
+
+  /* records in the file win over synthesized ones with the same name, as in answers */
+  auto synthesized = [&](std::string_view name, const DNSRecord &record) {
+    NameKey key = {name, hashName(name)};
+    return zone.zones->find(key) != &entry || zone.find(key) != nullptr || addSynthesized(name, record);
+  };
+  if (zone.ranges && !zone.ranges->expand(apex, synthesized))
+    return false;
+
+  return addRecord(apex, soa) && flush();
+}
+
+bool ZoneTransfer::sendIncremental(
+    const ZoneData &zone, const DNSRecord &soa, const std::vector<std::shared_ptr<const ZoneChange>> &changes
+) {
+  beginMessage(true);
+  if (!addRecord(zone.apex, soa))
+    return false;
+
+  /* each step is: old SOA, deletions, new SOA, additions */
+  for (const auto &change : changes) {
+    for (const auto *side : {&change->removed, &change->added}) {
+      for (const auto &rr : *side) {
+        if (rr.record.type == T_SOA && rr.name == zone.apex && !addRecord(rr.name, rr.record))
+          return false;
+      }
+      for (const auto &rr : *side) {
+        if (!(rr.record.type == T_SOA && rr.name == zone.apex) && !addRecord(rr.name, rr.record))
+          return false;
+      }
+    }
+  }
+
+  return addRecord(zone.apex, soa) && flush();
+}
+
+bool requestedSerial(const uint8_t *request, size_t size, uint32_t &serial) {
+  if (size < sizeof(DNSHeader))
+    return false;
+
+  const DNSHeader *header = (const DNSHeader *)request;
+  size_t           offset = sizeof(DNSHeader);
+  std::string      name;
+
+  for (int i = 0; i < ntohs(header->qdcount); ++i) {
+    if (!decodeName(request, size, offset, name) || offset + 4 > size)
+      return false;
+    offset += 4;
+  }
+
+  for (int i = 0; i < ntohs(header->ancount) + ntohs(header->nscount); ++i) {
+    if (!decodeName(request, size, offset, name) || offset + 10 > size)
+      return false;
+
+    uint16_t type, rdlength;
+    std::memcpy(&type, request + offset, 2);
+    std::memcpy(&rdlength, request + offset + 8, 2);
+    offset += 10;
+
+    size_t end = offset + ntohs(rdlength);
+    if (end > size)
+      return false;
+
+    if (ntohs(type) == T_SOA) {
+      if (!decodeName(request, end, offset, name) || !decodeName(request, end, offset, name) || offset + 4 > end)
+        return false;
+      uint32_t value;
+      std::memcpy(&value, request + offset, 4);
+      serial = ntohl(value);
+      return true;
+    }
+    offset = end;
+  }
+  return false;
+}
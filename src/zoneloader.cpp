@@ -0,0 +1,900 @@
+#include "zoneloader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include <unistd.h>
+#include <vector>
+
+#include "dns.hpp"
+#include "logger.hpp"
+#include "prefix.hpp"
+#include "rdata.hpp"
+#include "synth.hpp"
+#include "threadpool.hpp"
+
+static std::atomic<bool> strictLoading(false);
+
+/* A parsed record, its owner and RDATA lie back to back in the arena of its chunk */
+struct ParsedRecord {
+  uint64_t hash;
+  uint32_t offset;
+  uint32_t ttl;
+  uint16_t type;
+  uint16_t rclass;
+  uint16_t rdlength;
+  uint8_t  nameLength;
+};
+
+struct LoadError {
+  const std::string *file;
+  size_t             line;
+  std::string        message;
+};
+
+struct SOASeen {
+  std::string name;
+  uint32_t    serial;
+};
+
+/* Directives in effect at some point of a master file */
+struct ParseState {
+  std::string origin; /* without the trailing dot, empty for the root */
+  uint32_t    ttl;    /* from $TTL */
+  bool        hasTtl;
+};
+
+/* One piece of a master file and what came out of it */
+struct ParsedChunk {
+  const std::string        *file;
+  const char               *begin;
+  const char               *end;
+  size_t                    firstLine;
+  ParseState                state; /* at `begin` */
+  std::vector<uint8_t>      arena;
+  std::vector<ParsedRecord> records;
+  std::vector<LoadError>    errors;
+  std::vector<SOASeen>      soas;
+
+  std::vector<GeneratedRange>     generated; /* $GENERATE and $SYNTHESIZE, kept as descriptors for the RangeIndex */
+  std::vector<SynthesizedNetwork> networks;
+
+  /* TTL and class left out before any are known take those of the record before the chunk */
+  size_t   inheritTtl, inheritClass;
+  uint32_t lastTtl;
+  uint16_t lastClass;
+  bool     hasLastTtl, hasLastClass;
+};
+
+/* Every file of the zone mapped into memory, cut into chunks in file order */
+struct LoadPlan {
+  std::deque<std::string>                files;
+  std::vector<std::pair<void *, size_t>> maps;
+  std::vector<ParsedChunk>               chunks;
+  std::vector<LoadError>                 errors;
+  size_t                                 chunkSize;
+  size_t                                 bytes;
+};
+
+static inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDelimiter(char c) {
+  return isBlank(c) || c == '\n' || c == ';' || c == '(' || c == ')' || c == '"';
+}
+
+static void splitFields(std::string_view line, std::vector<std::string_view> &fields) {
+  fields.clear();
+
+  size_t i = 0;
+  while (true) {
+    while (i < line.size() && isBlank(line[i])) {
+      ++i;
+    }
+    if (i == line.size())
+      break;
+
+    size_t start = i;
+    while (i < line.size() && !isBlank(line[i])) {
+      ++i;
+    }
+    fields.push_back(line.substr(start, i - start));
+  }
+}
+
+/* Seconds, optionally as BIND style units: 3600, 1h, 1w2d, 90M */
+static bool parseTtl(std::string_view field, uint32_t &ttl) {
+  if (field.empty() || field[0] < '0' || field[0] > '9')
+    return false;
+
+  const char *cursor = field.data();
+  const char *end    = field.data() + field.size();
+  uint64_t    total  = 0;
+  while (cursor < end) {
+    uint32_t value;
+    auto     result = std::from_chars(cursor, end, value);
+    if (result.ec != std::errc())
+      return false;
+    cursor = result.ptr;
+
+    uint64_t unit = 1;
+    if (cursor < end) {
+      switch (*cursor++ | 0x20) {
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case 'd': unit = 86400; break;
+        case 'w': unit = 604800; break;
+        default: return false;
+      }
+    }
+
+    total += value * unit;
+    if (total > UINT32_MAX)
+      return false;
+  }
+
+  ttl = total;
+  return true;
+}
+
+/* `name` relative to `origin` unless it ends with a dot, `@` is the origin itself */
+static bool qualifyName(std::string_view name, const std::string &origin, std::string &out) {
+  size_t escapes = 0;
+  while (escapes + 1 < name.size() && name[name.size() - 2 - escapes] == '\\') {
+    ++escapes;
+  }
+
+  if (name == "@") {
+    out = origin;
+  } else if (!name.empty() && name.back() == '.' && escapes % 2 == 0) {
+    out.assign(name.data(), name.size() - 1);
+  } else {
+    out.assign(name);
+    if (!origin.empty()) {
+      out.push_back('.');
+      out.append(origin);
+    }
+  }
+  return out.size() <= MAX_NAME_LENGTH;
+}
+
+static bool isDirective(std::string_view field, const char *directive) {
+  return field.size() == strlen(directive) && strncasecmp(field.data(), directive, field.size()) == 0;
+}
+
+/* Apply $ORIGIN or $TTL, anything else is an error */
+static bool applyDirective(const std::vector<std::string_view> &fields, ParseState &state, std::string &error) {
+  std::string name;
+
+  if (isDirective(fields[0], "$ORIGIN")) {
+    if (fields.size() != 2 || !qualifyName(fields[1], state.origin, name)) {
+      error = "expected a name after $ORIGIN";
+      return false;
+    }
+    state.origin = std::move(name);
+    return true;
+  }
+
+  if (isDirective(fields[0], "$TTL")) {
+    if (fields.size() != 2 || !parseTtl(fields[1], state.ttl)) {
+      error = "expected a TTL after $TTL";
+      return false;
+    }
+    state.hasTtl = true;
+    return true;
+  }
+
+  error = "unknown directive " + std::string(fields[0]);
+  return false;
+}
+
+/*
+  Split the next entry of the master file at `cursor` into `fields`: one
+  line, or several joined by parentheses, without comments. A quoted string
+  is one field, quotes included. `omitted` tells if the entry starts with a
+  blank, so repeats the previous owner. `line` is advanced past every
+  newline and `error` set if the entry is not closed.
+*/
+static bool nextEntry(
+    const char *&cursor, const char *end, std::vector<std::string_view> &fields, bool &omitted, size_t &line, const char *&error
+) {
+  fields.clear();
+  error = nullptr;
+
+  int depth = 0;
+  while (cursor < end) {
+    omitted = isBlank(*cursor);
+
+    const char *p = cursor;
+    while (p < end) {
+      char c = *p;
+      if (isBlank(c)) {
+        p++;
+      } else if (c == '\n') {
+        p++;
+        line++;
+        if (depth == 0)
+          break;
+      } else if (c == ';') {
+        p = (const char *)std::memchr(p, '\n', end - p);
+        if (p == nullptr)
+          p = end;
+      } else if (c == '(') {
+        depth++;
+        p++;
+      } else if (c == ')') {
+        if (depth-- == 0)
+          error = "unbalanced parentheses";
+        p++;
+      } else {
+        const char *start = p;
+        if (c == '"') {
+          for (p++; p < end && *p != '"'; p++) {
+            if (*p == '\\' && p + 1 < end)
+              p++;
+            if (*p == '\n')
+              line++;
+          }
+          if (p == end)
+            error = "unterminated string";
+          else
+            p++;
+        } else {
+          for (; p < end && !isDelimiter(*p); p++) {
+            if (*p == '\\' && p + 1 < end)
+              p++;
+          }
+        }
+        fields.emplace_back(start, p - start);
+      }
+    }
+    cursor = p;
+
+    if (depth > 0)
+      error = "unbalanced parentheses";
+    if (!fields.empty() || error != nullptr)
+      return true;
+    depth = 0;
+  }
+  return false;
+}
+
+/* Positions of the domain names among the RDATA fields of `type` */
+static size_t rdataNames(uint16_t type, size_t positions[2]) {
+  switch (type) {
+    case T_NS:
+    case T_CNAME:
+    case T_PTR:
+    case T_DNAME:
+      positions[0] = 0;
+      return 1;
+    case T_MX:
+      positions[0] = 1;
+      return 1;
+    case T_SRV:
+      positions[0] = 3;
+      return 1;
+    case T_SOA:
+      positions[0] = 0;
+      positions[1] = 1;
+      return 2;
+    case T_NAPTR:
+      positions[0] = 5;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Owner template of a $GENERATE or $SYNTHESIZE line, relative to the origin unless it ends with a dot */
+static bool parseRangeOwner(
+    std::string_view field, const ParseState &state, RangeOwner &owner, RangeNumber &number, std::string &error
+) {
+  std::string   name;
+  RangeTemplate parsed;
+  if (!qualifyName(field, state.origin, name)) {
+    error = "name too long";
+    return false;
+  }
+  if (!RangeTemplate::parse(name, parsed, error))
+    return false;
+  if (!RangeOwner::parse(parsed, owner, number)) {
+    error = "expected a single $ in the first label of " + name;
+    return false;
+  }
+  return true;
+}
+
+/*
+  $GENERATE start-stop[/step] owner [ttl] [class] type rdata, as in BIND, or
+  $SYNTHESIZE network/length owner [ttl]. Either is kept as one descriptor
+  and answered from at query time, see RangeIndex. Without a TTL of their
+  own they take the $TTL in effect.
+*/
+static bool parseRange(const std::vector<std::string_view> &fields, const ParseState &state, ParsedChunk &chunk, std::string &error) {
+  bool     generate = isDirective(fields[0], "$GENERATE");
+  uint32_t ttl      = state.ttl;
+  bool     hasTtl   = state.hasTtl;
+
+  if (!generate) {
+    SynthesizedNetwork network = {};
+    RangeNumber        number;
+    uint8_t            address[16], length;
+    if (fields.size() < 3 || fields.size() > 4 || !parsePrefix(std::string(fields[1]), address, length, network.v4)) {
+      error = "expected a network, an owner and an optional TTL after $SYNTHESIZE";
+      return false;
+    }
+    if (!parseRangeOwner(fields[2], state, network.owner, number, error))
+      return false;
+    if (number != RangeNumber{0, 0, 'd'}) {
+      error = "$SYNTHESIZE takes a plain $ in its owner";
+      return false;
+    }
+    if (fields.size() == 4 && !(hasTtl = parseTtl(fields[3], ttl))) {
+      error = "expected a TTL after the owner of $SYNTHESIZE";
+      return false;
+    }
+    if (!hasTtl) {
+      error = "expected a TTL or $TTL before $SYNTHESIZE";
+      return false;
+    }
+
+    /* IPv4 mapped into IPv6, host bits all clear in `first` and all set in `last` */
+    int offset = network.v4 ? 12 : 0;
+    if (network.v4) {
+      network.first[10] = network.first[11] = 0xff;
+      length += 96;
+    }
+    std::memcpy(network.first + offset, address, 16 - offset);
+    std::memcpy(network.last, network.first, 16);
+    for (int bit = length; bit < 128; ++bit) {
+      network.last[bit / 8] |= 0x80 >> (bit % 8);
+    }
+    network.ttl = ttl;
+    chunk.networks.push_back(std::move(network));
+    return true;
+  }
+
+  GeneratedRange range = {};
+  if (fields.size() < 5) {
+    error = "expected a range, an owner, a type and RDATA after $GENERATE";
+    return false;
+  }
+
+  const char *end    = fields[1].data() + fields[1].size();
+  auto        result = std::from_chars(fields[1].data(), end, range.first);
+  bool        valid  = result.ec == std::errc() && result.ptr < end && *result.ptr == '-';
+  if (valid)
+    result = std::from_chars(result.ptr + 1, end, range.last);
+  valid      = valid && result.ec == std::errc();
+  range.step = 1;
+  if (valid && result.ptr < end && *result.ptr == '/')
+    result = std::from_chars(result.ptr + 1, end, range.step);
+  if (!valid || result.ec != std::errc() || result.ptr != end || range.first > range.last || range.step == 0) {
+    error = "expected start-stop[/step] after $GENERATE";
+    return false;
+  }
+  if (!parseRangeOwner(fields[2], state, range.owner, range.number, error))
+    return false;
+
+  size_t next     = 3;
+  int    rclass   = -1;
+  bool   givenTtl = false;
+  for (int i = 0; i < 2 && next < fields.size(); ++i) {
+    if (!givenTtl && parseTtl(fields[next], ttl)) {
+      givenTtl = hasTtl = true;
+      next++;
+    } else if (rclass < 0 && (rclass = classValue(fields[next])) >= 0) {
+      next++;
+    }
+  }
+  int rtype = next < fields.size() ? typeValue(fields[next]) : -1;
+  if (rtype < 0 || rtype == T_SOA || next + 1 >= fields.size()) {
+    error = "expected a type other than SOA and RDATA after the owner of $GENERATE";
+    return false;
+  }
+  if (!hasTtl) {
+    error = "expected a TTL or $TTL before $GENERATE";
+    return false;
+  }
+  range.type   = rtype;
+  range.rclass = rclass < 0 ? C_IN : rclass;
+  range.ttl    = ttl;
+
+  std::vector<std::string_view> rdata(fields.begin() + next + 1, fields.end());
+  size_t                        positions[2];
+  size_t                        names = rdataNames(rtype, positions);
+  std::string                   qualified[2];
+  for (size_t i = 0; i < names && positions[i] < rdata.size(); ++i) {
+    if (!qualifyName(rdata[positions[i]], state.origin, qualified[i])) {
+      error = "name too long";
+      return false;
+    }
+    rdata[positions[i]] = qualified[i];
+  }
+  range.rdata.resize(rdata.size());
+  for (size_t i = 0; i < rdata.size(); ++i) {
+    if (!RangeTemplate::parse(rdata[i], range.rdata[i], error))
+      return false;
+  }
+
+  /* what the first owner gets has to encode, the others only differ in their numbers */
+  std::vector<std::string>      rendered(range.rdata.size());
+  std::vector<std::string_view> check;
+  std::vector<uint8_t>          wire;
+  for (size_t i = 0; i < range.rdata.size(); ++i) {
+    range.rdata[i].render(range.first, rendered[i]);
+    check.push_back(rendered[i]);
+  }
+  if (!encodeRdata(rtype, check, wire)) {
+    error = "$GENERATE makes malformed " + std::string(dns_type_vals.name(rtype)) + " records";
+    return false;
+  }
+  chunk.generated.push_back(std::move(range));
+  return true;
+}
+
+/* Compile the entries of `chunk` straight into its arena */
+static void parseChunk(ParsedChunk &chunk) {
+  std::vector<std::string_view> fields;
+  std::vector<uint8_t>          rdata;
+  ParseState                    state = chunk.state;
+  std::string                   owner, qualified[2], error;
+  bool                          hasOwner = false;
+  char                          name[NAME_BUFFER_SIZE];
+  char                          timers[4][16];
+
+  auto fail = [&chunk](size_t line, std::string message) {
+    chunk.errors.push_back(LoadError{chunk.file, line, std::move(message)});
+  };
+
+  size_t      line = chunk.firstLine;
+  bool        omitted;
+  const char *problem;
+  for (const char *cursor = chunk.begin; true;) {
+    size_t entryLine = line;
+    if (!nextEntry(cursor, chunk.end, fields, omitted, line, problem))
+      break;
+    if (problem != nullptr) {
+      fail(entryLine, problem);
+      continue;
+    }
+
+    if (!omitted && (isDirective(fields[0], "$GENERATE") || isDirective(fields[0], "$SYNTHESIZE"))) {
+      if (!parseRange(fields, state, chunk, error))
+        fail(entryLine, error);
+      continue;
+    }
+    if (!omitted && fields[0][0] == '$') {
+      if (!applyDirective(fields, state, error))
+        fail(entryLine, error);
+      continue;
+    }
+
+    size_t next = 0;
+    if (!omitted) {
+      if (!qualifyName(fields[0], state.origin, owner)) {
+        fail(entryLine, "name too long");
+        continue;
+      }
+      hasOwner = true;
+      next     = 1;
+    } else if (!hasOwner) {
+      fail(entryLine, "no owner to repeat");
+      continue;
+    }
+
+    /* TTL and class come in either order, both optional */
+    uint32_t ttl    = 0;
+    int      rclass = -1;
+    bool     hasTtl = false;
+    for (int i = 0; i < 2 && next < fields.size(); ++i) {
+      if (!hasTtl && parseTtl(fields[next], ttl)) {
+        hasTtl = true;
+        next++;
+      } else if (rclass < 0 && (rclass = classValue(fields[next])) >= 0) {
+        next++;
+      }
+    }
+
+    if (next >= fields.size()) {
+      fail(entryLine, "expected a type");
+      continue;
+    }
+    int rtype = typeValue(fields[next]);
+    if (rtype < 0) {
+      fail(entryLine, "unknown type " + std::string(fields[next]));
+      continue;
+    }
+    fields.erase(fields.begin(), fields.begin() + next + 1);
+
+    size_t positions[2];
+    size_t names = rdataNames(rtype, positions);
+    bool   valid = true;
+    for (size_t i = 0; i < names && positions[i] < fields.size(); ++i) {
+      valid                = valid && qualifyName(fields[positions[i]], state.origin, qualified[i]);
+      fields[positions[i]] = qualified[i];
+    }
+    if (rtype == T_SOA && fields.size() == 7) {
+      for (size_t i = 0; i < 4; ++i) {
+        uint32_t seconds;
+        if (!parseTtl(fields[3 + i], seconds))
+          continue;
+        auto result   = std::to_chars(timers[i], timers[i] + sizeof(timers[i]), seconds);
+        fields[3 + i] = std::string_view(timers[i], result.ptr - timers[i]);
+      }
+    }
+    if (!valid || !encodeRdata(rtype, fields, rdata) || rdata.size() > UINT16_MAX) {
+      fail(entryLine, "skipping unsupported or malformed " + std::string(dns_type_vals.name(rtype)) + " record");
+      continue;
+    }
+
+    if (hasTtl) {
+      chunk.lastTtl    = ttl;
+      chunk.hasLastTtl = true;
+    } else if (state.hasTtl) {
+      ttl = state.ttl;
+    } else if (chunk.hasLastTtl) {
+      ttl = chunk.lastTtl;
+    } else {
+      chunk.inheritTtl = chunk.records.size() + 1;
+    }
+
+    if (rclass >= 0) {
+      chunk.lastClass    = rclass;
+      chunk.hasLastClass = true;
+    } else if (chunk.hasLastClass) {
+      rclass = chunk.lastClass;
+    } else {
+      rclass             = C_IN;
+      chunk.inheritClass = chunk.records.size() + 1;
+    }
+
+    ParsedRecord record;
+    record.hash       = lowerAndHash(owner.data(), owner.size(), name);
+    record.offset     = chunk.arena.size();
+    record.ttl        = ttl;
+    record.type       = rtype;
+    record.rclass     = rclass;
+    record.rdlength   = rdata.size();
+    record.nameLength = owner.size();
+
+    chunk.arena.insert(chunk.arena.end(), name, name + owner.size());
+    chunk.arena.insert(chunk.arena.end(), rdata.begin(), rdata.end());
+    chunk.records.push_back(record);
+
+    if (rtype == T_SOA)
+      chunk.soas.push_back(SOASeen{std::string(name, owner.size()), soaSerial(rdata)});
+  }
+}
+
+static void *mapFile(const std::string &filename, size_t &size) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return MAP_FAILED;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return MAP_FAILED;
+  }
+
+  size      = info.st_size;
+  void *map = nullptr;
+  if (size > 0) {
+    map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+      madvise(map, size, MADV_WILLNEED);
+  }
+  close(fd);
+  return map;
+}
+
+/*
+  Map `filename` and cut it into chunks for parseChunk(). Chunks start at
+  an entry with its own owner, outside parentheses and quotes, and carry
+  the $ORIGIN and $TTL in effect there. $INCLUDE files are scanned in
+  place. The scan only looks for newlines, parentheses, quotes and
+  directives, so it is much cheaper than parsing.
+*/
+static bool scanFile(LoadPlan &plan, const std::string &filename, ParseState state, int depth) {
+  size_t size;
+  void  *map = mapFile(filename, size);
+  if (map == MAP_FAILED)
+    return false;
+  plan.maps.emplace_back(map, size);
+  plan.files.push_back(filename);
+  plan.bytes += size;
+
+  const std::string *file = &plan.files.back();
+  const char        *data = (const char *)map;
+  const char        *end  = data + size;
+
+  const char *chunkStart = data;
+  size_t      chunkLine  = 1;
+  ParseState  chunkState = state;
+  auto        cut        = [&](const char *at) {
+    if (at == chunkStart)
+      return;
+    ParsedChunk chunk = {};
+    chunk.file        = file;
+    chunk.begin       = chunkStart;
+    chunk.end         = at;
+    chunk.firstLine   = chunkLine;
+    chunk.state       = chunkState;
+    plan.chunks.push_back(std::move(chunk));
+  };
+
+  std::vector<std::string_view> fields;
+  std::string                   error;
+  size_t                        line = 1;
+  for (const char *p = data; p < end;) {
+    /* at the start of an entry */
+    if (*p == '$') {
+      const char *eol = (const char *)std::memchr(p, '\n', end - p);
+      if (eol == nullptr)
+        eol = end;
+      std::string_view text(p, eol - p);
+      text = text.substr(0, text.find(';'));
+      splitFields(text, fields);
+
+      if (isDirective(fields[0], "$INCLUDE")) {
+        ParseState  included = state;
+        std::string path     = fields.size() > 1 ? std::string(fields[1]) : std::string();
+        if (!path.empty() && path[0] != '/' && filename.find('/') != std::string::npos)
+          path = filename.substr(0, filename.rfind('/') + 1) + path;
+
+        cut(p);
+        if (fields.size() < 2 || fields.size() > 3 || (fields.size() == 3 && !qualifyName(fields[2], state.origin, included.origin))) {
+          plan.errors.push_back(LoadError{file, line, "expected a file and an optional origin after $INCLUDE"});
+        } else if (depth >= LOADER_MAX_INCLUDE_DEPTH) {
+          plan.errors.push_back(LoadError{file, line, "$INCLUDE nested too deep"});
+        } else if (!scanFile(plan, path, included, depth + 1)) {
+          plan.errors.push_back(LoadError{file, line, "cannot read " + path + ": " + std::string(strerror(errno))});
+        }
+        chunkStart = eol == end ? end : eol + 1;
+        chunkLine  = line + 1;
+        chunkState = state;
+      } else {
+        /* errors are reported by parseChunk() */
+        applyDirective(fields, state, error);
+      }
+
+      p = eol == end ? end : eol + 1;
+      line++;
+      continue;
+    }
+
+    if (p - chunkStart >= (ptrdiff_t)plan.chunkSize && !isBlank(*p) && *p != '\n' && *p != ';') {
+      cut(p);
+      chunkStart = p;
+      chunkLine  = line;
+      chunkState = state;
+    }
+
+    int parens = 0;
+    while (p < end) {
+      char c = *p++;
+      if (c == '\n') {
+        line++;
+        if (parens == 0)
+          break;
+      } else if (c == '(') {
+        parens++;
+      } else if (c == ')') {
+        parens = std::max(parens - 1, 0);
+      } else if (c == ';') {
+        p = (const char *)std::memchr(p, '\n', end - p);
+        if (p == nullptr)
+          p = end;
+      } else if (c == '"') {
+        for (; p < end && *p != '"'; p++) {
+          if (*p == '\\' && p + 1 < end)
+            p++;
+          if (*p == '\n')
+            line++;
+        }
+        if (p < end)
+          p++;
+      } else if (c == '\\' && p < end) {
+        if (*p++ == '\n')
+          line++;
+      }
+    }
+  }
+  cut(end);
+  return true;
+}
+
+/* Records at the start of each chunk may take their TTL and class from the chunks before */
+static void inheritDefaults(std::vector<ParsedChunk> &chunks) {
+  uint32_t ttl    = 0;
+  uint16_t rclass = C_IN;
+  for (auto &chunk : chunks) {
+    for (size_t i = 0; i < chunk.inheritTtl; ++i) {
+      chunk.records[i].ttl = ttl;
+    }
+    for (size_t i = 0; i < chunk.inheritClass; ++i) {
+      chunk.records[i].rclass = rclass;
+    }
+
+    if (chunk.hasLastTtl)
+      ttl = chunk.lastTtl;
+    if (chunk.hasLastClass)
+      rclass = chunk.lastClass;
+  }
+}
+
+void setStrictLoading(bool strict) {
+  strictLoading = strict;
+}
+
+std::shared_ptr<ZoneData> loadZoneFile(const std::string &filename, size_t threads) {
+  Logger &logger = Logger::getInstance();
+  auto    start  = std::chrono::steady_clock::now();
+
+  ThreadPool pool(threads);
+
+  struct stat info;
+  LoadPlan    plan = {};
+  plan.chunkSize   = std::max<size_t>(LOADER_CHUNK_SIZE, stat(filename.c_str(), &info) == 0 ? info.st_size / (pool.size() * 8) : 0);
+  if (!scanFile(plan, filename, ParseState{}, 0)) {
+    logger.error("Cannot read zone file " + filename + ": " + std::string(strerror(errno)));
+    return nullptr;
+  }
+
+  auto &chunks = plan.chunks;
+  pool.parallelFor(chunks.size(), [&chunks](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      parseChunk(chunks[i]);
+    }
+  });
+  for (const auto &[map, size] : plan.maps) {
+    if (map != nullptr)
+      munmap(map, size);
+  }
+  inheritDefaults(chunks);
+
+  /* errors and the zones in file order, the first SOA is the zone transfers and updates work on */
+  std::string                     apex;
+  std::vector<std::string>        apexes;
+  std::vector<GeneratedRange>     generated;
+  std::vector<SynthesizedNetwork> networks;
+  uint32_t                        serial  = 0;
+  size_t                          records = 0, errors = 0;
+  auto                            report  = [&](const LoadError &error) {
+    if (errors++ < LOADER_MAX_ERRORS)
+      logger.warn(*error.file + ":" + std::to_string(error.line) + ": " + error.message);
+  };
+  for (const auto &error : plan.errors) {
+    report(error);
+  }
+  for (const auto &chunk : chunks) {
+    for (const auto &error : chunk.errors) {
+      report(error);
+    }
+    for (const auto &soa : chunk.soas) {
+      if (apexes.empty()) {
+        apex   = soa.name;
+        serial = soa.serial;
+      }
+      apexes.push_back(soa.name);
+    }
+    records += chunk.records.size();
+    std::move(chunk.generated.begin(), chunk.generated.end(), std::back_inserter(generated));
+    std::move(chunk.networks.begin(), chunk.networks.end(), std::back_inserter(networks));
+  }
+  if (errors > LOADER_MAX_ERRORS)
+    logger.warn(filename + ": " + std::to_string(errors - LOADER_MAX_ERRORS) + " more entries skipped");
+  if (errors > 0 && strictLoading) {
+    logger.error("Refusing " + filename + " in strict mode after " + std::to_string(errors) + " errors");
+    return nullptr;
+  }
+
+  /* names are at most as many as records, which is good enough to size the shards */
+  size_t shardCount = MIN_ZONE_SHARDS;
+  while (shardCount * NAMES_PER_SHARD < records) {
+    shardCount *= 2;
+  }
+  auto shardOf = [shardCount](uint64_t hash) { return hash >> 32 & (shardCount - 1); };
+
+  /* group each chunk by shard, file order is kept within a shard */
+  pool.parallelFor(chunks.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      std::stable_sort(chunks[i].records.begin(), chunks[i].records.end(), [&](const ParsedRecord &lhs, const ParsedRecord &rhs) {
+        return shardOf(lhs.hash) < shardOf(rhs.hash);
+      });
+    }
+  });
+
+  std::vector<std::shared_ptr<const RecordMap>> shards(shardCount);
+  std::vector<std::vector<std::string>>         keys(shardCount);
+  pool.parallelFor(shardCount, [&](size_t begin, size_t end) {
+    for (size_t s = begin; s < end; ++s) {
+      auto shard = std::make_shared<RecordMap>();
+
+      for (const auto &chunk : chunks) {
+        auto first = std::partition_point(chunk.records.begin(), chunk.records.end(), [&](const ParsedRecord &record) {
+          return shardOf(record.hash) < s;
+        });
+        auto last  = std::partition_point(first, chunk.records.end(), [&](const ParsedRecord &record) {
+          return shardOf(record.hash) == s;
+        });
+
+        for (auto it = first; it != last; ++it) {
+          const uint8_t   *bytes = chunk.arena.data() + it->offset;
+          std::string_view owner((const char *)bytes, it->nameLength);
+
+          auto entry = shard->find(NameKey{owner, it->hash});
+          if (entry == shard->end()) {
+            entry = shard->emplace(std::string(owner), std::vector<DNSRecord>()).first;
+            keys[s].push_back(orderKey(owner));
+          }
+
+          const uint8_t *rdata = bytes + it->nameLength;
+          entry->second.push_back(DNSRecord{it->type, it->rclass, it->ttl, std::vector<uint8_t>(rdata, rdata + it->rdlength)});
+        }
+      }
+
+      std::sort(keys[s].begin(), keys[s].end());
+      shards[s] = std::move(shard);
+    }
+  });
+  chunks.clear();
+
+  /* merge the sorted keys of the shards pairwise, a round at a time */
+  while (keys.size() > 1) {
+    std::vector<std::vector<std::string>> merged((keys.size() + 1) / 2);
+    pool.parallelFor(merged.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        if (2 * i + 1 == keys.size()) {
+          merged[i] = std::move(keys[2 * i]);
+          continue;
+        }
+
+        auto &lhs = keys[2 * i];
+        auto &rhs = keys[2 * i + 1];
+        merged[i].reserve(lhs.size() + rhs.size());
+        std::merge(
+            std::make_move_iterator(lhs.begin()), std::make_move_iterator(lhs.end()), std::make_move_iterator(rhs.begin()),
+            std::make_move_iterator(rhs.end()), std::back_inserter(merged[i])
+        );
+      }
+    });
+    keys = std::move(merged);
+  }
+
+  auto zone    = std::make_shared<ZoneData>();
+  zone->shards = std::move(shards);
+  zone->index  = NameIndex::build(std::move(keys.front()));
+  zone->apex   = apex;
+  zone->serial = serial;
+  zone->zones  = ZoneRegistry::build(*zone, apexes);
+  zone->ranges = RangeIndex::build(std::move(generated), std::move(networks));
+
+  std::string ranges;
+  if (zone->ranges)
+    ranges = ", " + std::to_string(zone->ranges->generatedSize()) + " $GENERATE and " + std::to_string(zone->ranges->networkSize())
+             + " $SYNTHESIZE lines";
+
+  auto   elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double rate    = elapsed > 0 ? plan.bytes / elapsed / (1 << 20) : 0;
+  logger.info(
+      "Loaded " + filename + ": " + std::to_string(records) + " records, " + std::to_string(zone->index->size()) + " names, "
+      + std::to_string(zone->zones->size()) + " zones" + ranges + " in "
+      + std::to_string((int)(elapsed * 1000)) + " ms (" + std::to_string((int)rate) + " MB/s, " + std::to_string(pool.size())
+      + " threads)"
+  );
+  return zone;
+}
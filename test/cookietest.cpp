@@ -0,0 +1,137 @@
+/*
+  DNS cookie test. A client cookie sent to the UDP server comes back with
+  a server cookie for it, and the pair is answered when sent again; a query
+  with only the cookie and no question is answered too, a malformed cookie
+  is a format error. Under load shedding, driven through answerDatagram()
+  with `shed` set, a client cookie alone gets BADCOOKIE and a fresh server
+  cookie, the valid pair is answered in full and a query without cookies
+  is sent to TCP.
+
+    make test, or ./bin/test/cookietest
+*/
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+
+#define TEST_NAME "www.example.com"
+
+static const uint8_t clientCookie[COOKIE_CLIENT_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+/* COOKIE option carrying `cookie` */
+static std::vector<uint8_t> cookieOption(const std::vector<uint8_t> &cookie) {
+  std::vector<uint8_t> option = {O_COOKIE >> 8, O_COOKIE & 0xff, (uint8_t)(cookie.size() >> 8), (uint8_t)cookie.size()};
+  option.insert(option.end(), cookie.begin(), cookie.end());
+  return option;
+}
+
+/* Query for TEST_NAME with `cookie` in its OPT record, no OPT record if it is empty; no question if not `question` */
+static size_t buildQuery(uint8_t *buffer, size_t size, const std::vector<uint8_t> &cookie, bool question = true) {
+  PacketWriter out = {buffer, size, 0, false};
+  if (question) {
+    beginMessage(out, OPCODE_QUERY << OPCODE_SHIFT, TEST_NAME, T_A, 0, cookie.empty() ? 0 : 1);
+  } else {
+    DNSHeader header     = {};
+    header.transactionId = htons(0x7e57);
+    header.arcount       = htons(1);
+    out.append(&header, sizeof(header));
+  }
+  if (!cookie.empty())
+    appendOPT(out, false, cookieOption(cookie));
+  return out.size;
+}
+
+/* The COOKIE option of the reply, empty if it has none */
+static std::vector<uint8_t> replyCookie(const TestReply &reply) {
+  for (const auto &record : ofType(reply.additional, T_OPT)) {
+    size_t offset = 0;
+    while (offset + 4 <= record.rdata.size()) {
+      uint16_t code   = record.rdata[offset] << 8 | record.rdata[offset + 1];
+      uint16_t length = record.rdata[offset + 2] << 8 | record.rdata[offset + 3];
+      offset += 4;
+      if (offset + length > record.rdata.size())
+        break;
+      if (code == O_COOKIE)
+        return std::vector<uint8_t>(record.rdata.begin() + offset, record.rdata.begin() + offset + length);
+      offset += length;
+    }
+  }
+  return {};
+}
+
+static bool startsWithClientCookie(const std::vector<uint8_t> &cookie) {
+  return cookie.size() == COOKIE_CLIENT_SIZE + COOKIE_SERVER_SIZE && std::memcmp(cookie.data(), clientCookie, COOKIE_CLIENT_SIZE) == 0;
+}
+
+/* Answer the query through answerDatagram() as from loopback with `shed` set */
+static bool answerShed(const uint8_t *query, size_t length, TestReply &reply, bool &shed) {
+  Arena    arena;
+  DNS      packet(arena, query, length);
+  uint8_t  buffer[EDNS_PAYLOAD_SIZE];
+  uint64_t ticket;
+  shed = true;
+  size_t size = answerDatagram(packet, query, length, htonl(INADDR_LOOPBACK), buffer, shed, nullptr, ticket);
+  return size > 0 && parseReply(buffer, size, reply);
+}
+
+int main() {
+  std::string path = temporaryFile("cookietest", TEST_NAME " 300 IN A 192.0.2.1\n");
+  if (path.empty()) {
+    std::printf("FAIL: cannot write the zone file\n");
+    return EXIT_FAILURE;
+  }
+  DB::getInstance(path);
+
+  UDPServer server(0);
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+
+  uint8_t              query[EDNS_PAYLOAD_SIZE];
+  std::vector<uint8_t> client(clientCookie, clientCookie + COOKIE_CLIENT_SIZE);
+  TestReply            reply;
+  size_t               length = buildQuery(query, sizeof(query), client);
+  check(exchange(port, query, length, reply) && addresses(reply.answers) == "192.0.2.1", "a query with a client cookie is answered");
+  std::vector<uint8_t> cookie = replyCookie(reply);
+  check(startsWithClientCookie(cookie), "the reply carries a server cookie after the client cookie");
+
+  length = buildQuery(query, sizeof(query), cookie);
+  check(exchange(port, query, length, reply) && addresses(reply.answers) == "192.0.2.1", "the server cookie sent back is answered");
+
+  length = buildQuery(query, sizeof(query), client, false);
+  check(exchange(port, query, length, reply) && reply.rcode == RCODE_NOERROR && startsWithClientCookie(replyCookie(reply)),
+        "a cookie without a question gets a server cookie");
+
+  length = buildQuery(query, sizeof(query), std::vector<uint8_t>(client.begin(), client.begin() + 5));
+  check(exchange(port, query, length, reply) && reply.rcode == RCODE_FORMERR, "a malformed cookie is a format error");
+
+  bool shed;
+  length = buildQuery(query, sizeof(query), client);
+  check(answerShed(query, length, reply, shed) && reply.rcode == RCODE_BADCOOKIE && startsWithClientCookie(replyCookie(reply)),
+        "under load a client cookie alone gets BADCOOKIE and a server cookie");
+  length = buildQuery(query, sizeof(query), replyCookie(reply));
+  check(answerShed(query, length, reply, shed) && !shed && addresses(reply.answers) == "192.0.2.1",
+        "under load a valid server cookie is answered in full");
+  length = buildQuery(query, sizeof(query), {});
+  check(answerShed(query, length, reply, shed) && (reply.flags & F_TRUNCATED) && reply.answers.empty(),
+        "under load a query without cookies is truncated");
+
+  server.stop();
+  removeZone(path);
+  std::printf("%s\n", failures ? "cookietest FAILED" : "cookietest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
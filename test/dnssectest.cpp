@@ -0,0 +1,112 @@
+/*
+  DNSSEC denial test. A zone is loaded with a fresh key and queried over
+  UDP with the DO bit: a name that does not exist is answered NXDOMAIN
+  with the NSEC covering it and the one covering the wildcard, a type the
+  name does not have is answered NODATA with the name's own NSEC, which
+  lists the types it does have, and every NSEC comes with its RRSIG.
+  Without the DO bit no signatures are sent.
+
+    make test, or ./bin/test/dnssectest
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "dnssec.hpp"
+#include "handoff.hpp"
+#include "rdata.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+
+#define TEST_ZONE "example.com"
+
+/* Whether the type bitmap of the NSEC `rdata` lists `type` */
+static bool listsType(const std::vector<uint8_t> &rdata, uint16_t type) {
+  std::string next;
+  size_t      offset = 0;
+  if (!decodeName(rdata.data(), rdata.size(), offset, next))
+    return false;
+  while (offset + 2 <= rdata.size()) {
+    uint8_t window = rdata[offset], length = rdata[offset + 1];
+    offset += 2;
+    if (window == type >> 8 && (type & 0xff) / 8 < length && offset + length <= rdata.size())
+      return rdata[offset + (type & 0xff) / 8] & (0x80 >> (type & 7));
+    offset += length;
+  }
+  return false;
+}
+
+/* The NSEC in `section` owned by `owner` pointing at `next`, nullptr if there is none */
+static const TestRecord *findNSEC(const std::vector<TestRecord> &section, const std::string &owner, const std::string &next) {
+  for (const auto &record : section) {
+    if (record.type == T_NSEC && record.name == owner && rdataName(record.rdata) == next)
+      return &record;
+  }
+  return nullptr;
+}
+
+/* Whether `section` holds an RRSIG by `owner` over `covered` */
+static bool signs(const std::vector<TestRecord> &section, const std::string &owner, uint16_t covered) {
+  for (const auto &record : section) {
+    if (record.type == T_RRSIG && record.name == owner && record.rdata.size() >= 2 && (record.rdata[0] << 8 | record.rdata[1]) == covered)
+      return true;
+  }
+  return false;
+}
+
+int main() {
+  std::string key = "/tmp/dnssectest-" + std::to_string(getpid()) + ".key";
+  if (!Signer::getInstance().loadKey(key)) {
+    std::printf("FAIL: cannot create the key\n");
+    return EXIT_FAILURE;
+  }
+  std::string path = temporaryFile(
+      "dnssectest", "$ORIGIN " TEST_ZONE ".\n"
+                    "$TTL 300\n"
+                    "@ IN SOA ns1 host 1 3600 600 86400 300\n"
+                    "@ IN NS ns1\n"
+                    "alpha IN A 192.0.2.1\n"
+                    "gamma IN A 192.0.2.3\n"
+                    "ns1 IN A 192.0.2.53\n"
+  );
+  if (path.empty()) {
+    unlink(key.c_str());
+    std::printf("FAIL: cannot write the zone file\n");
+    return EXIT_FAILURE;
+  }
+  DB::getInstance(path);
+
+  UDPServer server(0);
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+
+  TestReply reply;
+  check(ask(port, "beta." TEST_ZONE, T_A, reply, true) && reply.rcode == RCODE_NXDOMAIN, "a missing name is answered NXDOMAIN");
+  check(findNSEC(reply.authority, "alpha." TEST_ZONE, "gamma." TEST_ZONE), "the NSEC from alpha to gamma covers the name");
+  check(findNSEC(reply.authority, TEST_ZONE, "alpha." TEST_ZONE), "the NSEC of the apex covers the wildcard");
+  check(signs(reply.authority, "alpha." TEST_ZONE, T_NSEC) && signs(reply.authority, TEST_ZONE, T_NSEC), "both NSEC records are signed");
+
+  check(ask(port, "alpha." TEST_ZONE, T_AAAA, reply, true) && reply.rcode == RCODE_NOERROR && reply.answers.empty(),
+        "a missing type is answered NODATA");
+  const TestRecord *nsec = findNSEC(reply.authority, "alpha." TEST_ZONE, "gamma." TEST_ZONE);
+  check(nsec && listsType(nsec->rdata, T_A) && !listsType(nsec->rdata, T_AAAA), "the NSEC of the name lists A but not AAAA");
+  check(signs(reply.authority, "alpha." TEST_ZONE, T_NSEC), "that NSEC is signed");
+
+  check(ask(port, "alpha." TEST_ZONE, T_A, reply, true) && signs(reply.answers, "alpha." TEST_ZONE, T_A), "the answer is signed with DO");
+  check(ask(port, "alpha." TEST_ZONE, T_A, reply) && ofType(reply.answers, T_RRSIG).empty(), "no signatures are sent without DO");
+
+  server.stop();
+  removeZone(path);
+  unlink(key.c_str());
+  std::printf("%s\n", failures ? "dnssectest FAILED" : "dnssectest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*
+  Response policy test. Three blocklists are configured next to a zone:
+  names on the first are answered NXDOMAIN, along with the names below
+  them, and a `*.name` entry blocks only what is below `name`; names on
+  the second get an empty answer and those on the third the sinkhole
+  addresses of their type. None of these answers claim authority, and
+  names on no list are answered from the zone as before.
+
+    make test, or ./bin/test/policytest
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "policy.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+
+#define TEST_ZONE "example.com"
+
+int main() {
+  std::string zone     = temporaryFile(
+      "policytest", "$ORIGIN " TEST_ZONE ".\n"
+                    "$TTL 300\n"
+                    "@ IN SOA ns1 host 1 3600 600 86400 300\n"
+                    "@ IN NS ns1\n"
+                    "ns1 IN A 192.0.2.53\n"
+                    "www IN A 192.0.2.1\n"
+                    "ads IN A 192.0.2.2\n"
+  );
+  std::string blocked  = temporaryFile("policytest", "ads." TEST_ZONE "\n*.tracker.example.net\n");
+  std::string empty    = temporaryFile("policytest", "0.0.0.0 quiet.example.org\n");
+  std::string sinkhole = temporaryFile("policytest", "malware.example.org\n");
+  if (zone.empty() || blocked.empty() || empty.empty() || sinkhole.empty()) {
+    std::printf("FAIL: cannot write the zone and the lists\n");
+    return EXIT_FAILURE;
+  }
+  DB::getInstance(zone);
+  check(Policy::getInstance().configure(blocked + "," + empty + "=nodata," + sinkhole + "=192.0.2.53+2001:db8::53"), "the lists load");
+
+  UDPServer server(0);
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+
+  TestReply reply;
+  check(ask(port, "ads." TEST_ZONE, T_A, reply) && reply.rcode == RCODE_NXDOMAIN && reply.answers.empty(),
+        "a listed name is answered NXDOMAIN over the zone");
+  check(!(reply.flags & F_AUTHORITATIVE), "the policy answer does not claim authority");
+  check(ask(port, "sub.ads." TEST_ZONE, T_A, reply) && reply.rcode == RCODE_NXDOMAIN, "a name below a listed name is blocked too");
+  check(ask(port, "x.tracker.example.net", T_A, reply) && reply.rcode == RCODE_NXDOMAIN, "a name below a wildcard entry is blocked");
+  check(ask(port, "tracker.example.net", T_A, reply) && reply.rcode == RCODE_REFUSED, "the wildcard entry does not block its own name");
+
+  check(ask(port, "quiet.example.org", T_A, reply) && reply.rcode == RCODE_NOERROR && reply.answers.empty(),
+        "a name of a nodata list gets an empty answer");
+  check(ask(port, "malware.example.org", T_A, reply) && addresses(reply.answers) == "192.0.2.53", "the sinkhole answers its IPv4 address");
+  check(ask(port, "malware.example.org", T_AAAA, reply) && addresses(reply.answers) == "2001:db8::53",
+        "the sinkhole answers its IPv6 address");
+
+  check(ask(port, "www." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "192.0.2.1" && (reply.flags & F_AUTHORITATIVE),
+        "a name on no list is answered from the zone");
+
+  server.stop();
+  removeZone(zone);
+  for (const std::string &path : {blocked, empty, sinkhole}) {
+    unlink(path.c_str());
+    unlink((path + ".set").c_str());
+  }
+  std::printf("%s\n", failures ? "policytest FAILED" : "policytest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
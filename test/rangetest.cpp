@@ -0,0 +1,118 @@
+/*
+  Address range test. A zone with $GENERATE and $SYNTHESIZE lines is
+  queried over UDP: generated names answer their addresses and the names
+  a CNAME range points to, numbers outside the range do not exist, a
+  record in the file wins over a generated one, and the PTR records of
+  the reverse zones lead back to the generated and synthesized names. An
+  AXFR writes the computed records out, each name once.
+
+    make test, or ./bin/test/rangetest
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+#include "xfr.hpp"
+
+#define TEST_ZONE "example.net"
+
+/* Records of `type` owned by `name` in `records` */
+static size_t count(const std::vector<TestRecord> &records, const std::string &name, uint16_t type) {
+  size_t found = 0;
+  for (const auto &record : records) {
+    if (record.name == name && record.type == type)
+      found++;
+  }
+  return found;
+}
+
+/* The answers of every message of an AXFR of TEST_ZONE, false if a message is malformed or not NOERROR */
+static bool transfer(std::vector<TestRecord> &records) {
+  uint8_t      request[EDNS_PAYLOAD_SIZE];
+  PacketWriter out = {request, sizeof(request), 0, false};
+  beginMessage(out, OPCODE_QUERY << OPCODE_SHIFT, TEST_ZONE, T_AXFR);
+
+  Arena        arena;
+  DNS          query(arena, request, out.size);
+  bool         ok = true;
+  ZoneTransfer axfr([&](const uint8_t *message, size_t length) {
+    TestReply reply;
+    ok = ok && parseReply(message, length, reply) && reply.rcode == RCODE_NOERROR;
+    records.insert(records.end(), reply.answers.begin(), reply.answers.end());
+    return ok;
+  });
+  return axfr.serve(request, out.size, query) && ok;
+}
+
+int main() {
+  std::string path = temporaryFile(
+      "rangetest", "$ORIGIN " TEST_ZONE ".\n"
+                   "$TTL 300\n"
+                   "@ IN SOA ns1 host 1 3600 600 86400 300\n"
+                   "@ IN NS ns1\n"
+                   "ns1 IN A 192.0.2.53\n"
+                   "dyn-9 IN A 192.0.2.9\n"
+                   "$GENERATE 1-254 dyn-$ A 198.51.100.$\n"
+                   "$GENERATE 0-15 ${0,2,x}.pool CNAME dyn-$\n"
+                   "$SYNTHESIZE 10.0.0.0/24 host-$\n"
+                   "$ORIGIN 100.51.198.in-addr.arpa.\n"
+                   "@ IN SOA ns1." TEST_ZONE ". host." TEST_ZONE ". 1 3600 600 86400 300\n"
+                   "@ IN NS ns1." TEST_ZONE ".\n"
+                   "$GENERATE 1-254 $ PTR dyn-$." TEST_ZONE ".\n"
+                   "$ORIGIN 0.0.10.in-addr.arpa.\n"
+                   "@ IN SOA ns1." TEST_ZONE ". host." TEST_ZONE ". 1 3600 600 86400 300\n"
+                   "@ IN NS ns1." TEST_ZONE ".\n"
+  );
+  if (path.empty()) {
+    std::printf("FAIL: cannot write the zone file\n");
+    return EXIT_FAILURE;
+  }
+  DB::getInstance(path);
+
+  UDPServer server(0);
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+
+  TestReply reply;
+  check(ask(port, "dyn-7." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "198.51.100.7", "a generated name answers its address");
+  check(ask(port, "dyn-9." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "192.0.2.9", "the record in the file wins");
+  check(ask(port, "dyn-255." TEST_ZONE, T_A, reply) && reply.rcode == RCODE_NXDOMAIN, "a number outside the range does not exist");
+
+  check(ask(port, "0f.pool." TEST_ZONE, T_A, reply) && count(reply.answers, "0f.pool." TEST_ZONE, T_CNAME) == 1 &&
+            addresses(reply.answers) == "198.51.100.15",
+        "a generated CNAME is followed to the generated address");
+  check(ask(port, "7.100.51.198.in-addr.arpa", T_PTR, reply) && reply.answers.size() == 1 &&
+            rdataName(reply.answers[0].rdata) == "dyn-7." TEST_ZONE,
+        "a generated PTR names the generated host");
+
+  check(ask(port, "host-10-0-0-5." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "10.0.0.5",
+        "a synthesized name answers its address");
+  check(ask(port, "5.0.0.10.in-addr.arpa", T_PTR, reply) && reply.answers.size() == 1 &&
+            rdataName(reply.answers[0].rdata) == "host-10-0-0-5." TEST_ZONE,
+        "a synthesized PTR names the synthesized host");
+
+  std::vector<TestRecord> records;
+  check(transfer(records), "the zone is transferred");
+  check(count(records, TEST_ZONE, T_SOA) == 2, "the transfer starts and ends with the SOA");
+  check(count(records, "dyn-7." TEST_ZONE, T_A) == 1 && count(records, "host-10-0-0-5." TEST_ZONE, T_A) == 1,
+        "the transfer holds the generated and synthesized records");
+  check(count(records, "dyn-9." TEST_ZONE, T_A) == 1, "a name of the file is transferred once");
+
+  server.stop();
+  removeZone(path);
+  std::printf("%s\n", failures ? "rangetest FAILED" : "rangetest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+/*
+  Secondary zone test. A stand-in primary serves three versions of a zone
+  over TCP, the secondary pulls the first one with AXFR, and each later
+  version is announced with a NOTIFY sent to the UDP server: the second is
+  pulled with IXFR and applied change by change, the third with AXFR after
+  the primary refuses IXFR. The served answers are checked after each step.
+
+    make test, or ./bin/test/secondarytest
+*/
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "arena.hpp"
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "rdata.hpp"
+#include "secondary.hpp"
+#include "stream.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+#include "xfr.hpp"
+
+#define TEST_ZONE "example.com"
+
+static ResourceRecord record(const std::string &name, uint16_t type, const std::vector<std::string_view> &fields) {
+  ResourceRecord rr = {name, DNSRecord{type, C_IN, 300, {}}};
+  encodeRdata(type, fields, rr.record.rdata);
+  return rr;
+}
+
+static std::vector<ResourceRecord> version(uint32_t serial, const std::vector<ResourceRecord> &records) {
+  std::string                 number = std::to_string(serial);
+  std::vector<ResourceRecord> out    = {record(TEST_ZONE, T_SOA, {"ns1.example.com.", "host.example.com.", number, "3600", "600", "86400", "300"})};
+  out.insert(out.end(), records.begin(), records.end());
+  return out;
+}
+
+static bool sameRecord(const ResourceRecord &a, const ResourceRecord &b) {
+  return a.name == b.name && a.record == b.record;
+}
+
+/* Records of `from` missing in `to` */
+static std::vector<ResourceRecord> missing(const std::vector<ResourceRecord> &from, const std::vector<ResourceRecord> &to) {
+  std::vector<ResourceRecord> out;
+  for (const auto &rr : from) {
+    if (std::none_of(to.begin(), to.end(), [&](const ResourceRecord &other) { return sameRecord(rr, other); }))
+      out.push_back(rr);
+  }
+  return out;
+}
+
+/*
+  Answers SOA, AXFR and IXFR queries for the versions published so far,
+  serial n being versions[n - 1]. IXFR is answered with the difference to
+  the latest version, or REFUSED when `incremental` is off.
+*/
+class Primary {
+public:
+  std::atomic<int>  axfrs{0};
+  std::atomic<int>  ixfrs{0};
+  std::atomic<bool> incremental{true};
+
+  Primary() {
+    struct sockaddr_in address = {};
+    address.sin_family         = AF_INET;
+    address.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(listenfd, (struct sockaddr *)&address, sizeof(address));
+    listen(listenfd, 8);
+    port = boundPort(listenfd);
+
+    struct timeval timeout = {0, 100000};
+    setsockopt(listenfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    thread = std::thread(&Primary::run, this);
+  }
+
+  ~Primary() {
+    running = false;
+    thread.join();
+    close(listenfd);
+  }
+
+  int getPort() const {
+    return port;
+  }
+
+  void publish(const std::vector<ResourceRecord> &records) {
+    std::lock_guard<std::mutex> lock(mutex);
+    versions.push_back(version(versions.size() + 1, records));
+  }
+
+private:
+  int                                      listenfd;
+  int                                      port;
+  std::atomic<bool>                        running{true};
+  std::thread                              thread;
+  std::mutex                               mutex;
+  std::vector<std::vector<ResourceRecord>> versions;
+  std::vector<uint8_t>                     response = std::vector<uint8_t>(MAX_STREAM_MESSAGE);
+
+  void run() {
+    while (running) {
+      int fd = accept(listenfd, nullptr, nullptr);
+      if (fd < 0)
+        continue;
+
+      struct timeval timeout = {0, 100000};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      std::vector<uint8_t> request(MAX_STREAM_MESSAGE);
+      size_t               length;
+      while (readMessage(fd, request.data(), request.size(), length, running, TEST_TIMEOUT) && serve(fd, request.data(), length)) {}
+      close(fd);
+    }
+  }
+
+  bool serve(int fd, const uint8_t *request, size_t length) {
+    Arena arena;
+    DNS   query(arena);
+    if (!query.parseDNS(request, length) || query.getQueries().empty())
+      return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto                 &latest = versions.back();
+    uint16_t                    type   = query.getQueries().front().type;
+    uint16_t                    id     = query.getHeader().transactionId;
+
+    std::vector<ResourceRecord> answers;
+    uint16_t                    rcode = RCODE_NOERROR;
+    uint32_t                    serial;
+    if (type == T_SOA) {
+      answers = {latest.front()};
+    } else if (type == T_AXFR) {
+      axfrs++;
+      answers = latest;
+      answers.push_back(latest.front());
+    } else if (type == T_IXFR && incremental && requestedSerial(request, length, serial) && serial >= 1 && serial <= versions.size()) {
+      /* the whole history in one step, the newest SOA around the removals and additions */
+      ixfrs++;
+      const auto &from    = versions[serial - 1];
+      auto        removed = missing(from, latest);
+      auto        added   = missing(latest, from);
+      answers             = {latest.front()};
+      answers.insert(answers.end(), removed.begin(), removed.end());
+      answers.insert(answers.end(), added.begin(), added.end());
+      answers.push_back(latest.front());
+    } else {
+      rcode = RCODE_REFUSED;
+    }
+    return writeMessage(fd, response.data(), build(id, type, rcode, answers), TEST_TIMEOUT);
+  }
+
+  size_t build(uint16_t id, uint16_t type, uint16_t rcode, const std::vector<ResourceRecord> &answers) {
+    PacketWriter out = {response.data(), response.size(), 0, false};
+
+    DNSHeader header     = {};
+    header.transactionId = htons(id);
+    header.flags         = htons(F_RESPONSE | F_AUTHORITATIVE | rcode);
+    header.qdcount       = htons(1);
+    header.ancount       = htons(answers.size());
+    out.append(&header, sizeof(header));
+    out.appendName(TEST_ZONE);
+    out.appendUint16(type);
+    out.appendUint16(C_IN);
+
+    for (const auto &rr : answers) {
+      out.appendName(rr.name);
+      out.appendUint16(rr.record.type);
+      out.appendUint16(rr.record.rclass);
+      out.appendUint32(rr.record.ttl);
+      out.appendUint16(rr.record.rdata.size());
+      out.append(rr.record.rdata.data(), rr.record.rdata.size());
+    }
+    return out.size;
+  }
+};
+
+/* Send `opcode` for `name` and `type` to the UDP server, the RCODE and the A records of the answer */
+static bool ask(int port, uint16_t opcode, const std::string &name, uint16_t type, uint16_t &rcode, std::vector<std::string> &addresses) {
+  uint8_t      buffer[EDNS_PAYLOAD_SIZE];
+  PacketWriter out = {buffer, sizeof(buffer), 0, false};
+
+  DNSHeader header     = {};
+  header.transactionId = htons(0x5ec0);
+  header.flags         = htons(opcode << OPCODE_SHIFT);
+  header.qdcount       = htons(1);
+  out.append(&header, sizeof(header));
+  out.appendName(name);
+  out.appendUint16(type);
+  out.appendUint16(C_IN);
+
+  struct sockaddr_in server = {};
+  server.sin_family         = AF_INET;
+  server.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+  server.sin_port           = htons(port);
+
+  int            fd      = socket(AF_INET, SOCK_DGRAM, 0);
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sendto(fd, buffer, out.size, 0, (struct sockaddr *)&server, sizeof(server));
+  ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+  close(fd);
+  if (length < (ssize_t)sizeof(DNSHeader))
+    return false;
+
+  const DNSHeader *reply  = (const DNSHeader *)buffer;
+  size_t           offset = sizeof(DNSHeader);
+  std::string      owner;
+  rcode = ntohs(reply->flags) & F_RCODE;
+  addresses.clear();
+  if (ntohs(reply->qdcount) == 1 && (!decodeName(buffer, length, offset, owner) || (offset += 4) > (size_t)length))
+    return false;
+  for (int i = 0; i < ntohs(reply->ancount); ++i) {
+    uint16_t             rtype, rclass;
+    uint32_t             ttl;
+    std::vector<uint8_t> rdata;
+    if (!decodeRecord(buffer, length, offset, owner, rtype, rclass, ttl, rdata))
+      return false;
+    char text[INET_ADDRSTRLEN];
+    if (rtype == T_A && rdata.size() == 4)
+      addresses.push_back(inet_ntop(AF_INET, rdata.data(), text, sizeof(text)));
+  }
+  return true;
+}
+
+/* The A records served for `name`, empty for none or no answer */
+static std::string served(int port, const std::string &name) {
+  uint16_t                 rcode;
+  std::vector<std::string> addresses;
+  if (!ask(port, OPCODE_QUERY, name, T_A, rcode, addresses))
+    return "";
+  std::sort(addresses.begin(), addresses.end());
+  std::string out;
+  for (const auto &address : addresses) {
+    out += (out.empty() ? "" : " ") + address;
+  }
+  return out;
+}
+
+static bool notifyServer(int port) {
+  uint16_t                 rcode;
+  std::vector<std::string> addresses;
+  return ask(port, OPCODE_NOTIFY, TEST_ZONE, T_SOA, rcode, addresses) && rcode == RCODE_NOERROR;
+}
+
+int main() {
+  Primary primary;
+  primary.publish({record("www.example.com", T_A, {"192.0.2.1"}), record("old.example.com", T_A, {"192.0.2.9"})});
+
+  Secondary secondary;
+  UDPServer server(0);
+  secondary.configure(TEST_ZONE, "127.0.0.1:" + std::to_string(primary.getPort()), 53);
+  server.setNotifyHandler([&secondary](uint32_t source) { return secondary.notify(source); });
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+  secondary.start();
+
+  check(eventually([&] { return served(port, "www.example.com") == "192.0.2.1"; }), "serial 1 is served after the first transfer");
+  check(primary.axfrs == 1 && primary.ixfrs == 0, "serial 1 came with AXFR");
+
+  /* serial 2 moves www, removes old and adds new */
+  primary.publish({record("www.example.com", T_A, {"192.0.2.2"}), record("new.example.com", T_A, {"192.0.2.3"})});
+  check(notifyServer(port), "NOTIFY for serial 2 is acknowledged");
+  check(eventually([&] { return served(port, "new.example.com") == "192.0.2.3"; }), "serial 2 is served after the NOTIFY");
+  check(served(port, "www.example.com") == "192.0.2.2", "www moved in serial 2");
+  check(served(port, "old.example.com").empty(), "old is gone in serial 2");
+  check(primary.ixfrs == 1 && primary.axfrs == 1, "serial 2 came with IXFR");
+
+  std::vector<std::shared_ptr<const ZoneChange>> changes;
+  bool journaled = DB::getInstance("").changesSince(1, changes) && changes.size() == 1;
+  check(journaled && changes[0]->toSerial == 2 && changes[0]->added.size() == 3 && changes[0]->removed.size() == 3,
+        "serial 2 was applied as one change");
+
+  /* serial 3 with IXFR refused, the secondary falls back to AXFR */
+  primary.incremental = false;
+  primary.publish({record("www.example.com", T_A, {"192.0.2.4"}), record("www.example.com", T_A, {"192.0.2.5"})});
+  check(notifyServer(port), "NOTIFY for serial 3 is acknowledged");
+  check(eventually([&] { return served(port, "www.example.com") == "192.0.2.4 192.0.2.5"; }), "serial 3 is served after the NOTIFY");
+  check(served(port, "new.example.com").empty(), "new is gone in serial 3");
+  check(primary.axfrs == 2, "serial 3 came with AXFR after IXFR was refused");
+  check(DB::getInstance("").snapshot()->serial == 3, "the store is at serial 3");
+
+  secondary.stop();
+  server.stop();
+  std::printf("%s\n", failures ? "secondarytest FAILED" : "secondarytest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/*
+  Steering health check test. Two endpoints of www.example.com are checked
+  by TCP connect to a listener on each, and answers are shared between them
+  while both are up. The listener of the first is closed: once the check
+  sees that, the first drops out of the selection and every answer is the
+  second, until the listener comes back.
+
+    make test, or ./bin/test/steeringtest
+*/
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "rdata.hpp"
+#include "steering.hpp"
+#include "test.hpp"
+
+#define TEST_NAME    "www.example.com"
+#define TEST_ANSWERS 20 // selections looked at per step
+
+/* TCP listener on `address`, on `port` or any free one for 0, -1 if that fails */
+static int listenOn(const char *address, int port) {
+  struct sockaddr_in in = {};
+  in.sin_family         = AF_INET;
+  in.sin_port           = htons(port);
+  inet_pton(AF_INET, address, &in.sin_addr);
+
+  int fd  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, (struct sockaddr *)&in, sizeof(in)) != 0 || listen(fd, 8) != 0) {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Addresses answered over TEST_ANSWERS selections */
+static std::set<std::string> selected(Steering &steering, const std::vector<DNSRecord> &records) {
+  std::string           name(TEST_NAME);
+  uint8_t               client[16] = {};
+  std::set<std::string> addresses;
+  steering.pin();
+  for (int i = 0; i < TEST_ANSWERS; ++i) {
+    bool             located = false;
+    const DNSRecord *record  = steering.select(NameKey{name, hashName(name)}, records, T_A, client, located);
+    char             text[INET_ADDRSTRLEN];
+    if (record != nullptr && record->rdata.size() == 4 && inet_ntop(AF_INET, record->rdata.data(), text, sizeof(text)))
+      addresses.insert(text);
+  }
+  return addresses;
+}
+
+int main() {
+  int first  = listenOn("127.0.0.1", 0);
+  int second = listenOn("127.0.0.2", 0);
+  if (first < 0 || second < 0) {
+    std::printf("FAIL: cannot listen on loopback\n");
+    return EXIT_FAILURE;
+  }
+  int firstPort = boundPort(first);
+
+  char        path[] = "/tmp/steeringtest-XXXXXX";
+  int         file   = mkstemp(path);
+  std::string config = TEST_NAME " 127.0.0.1 check " + std::to_string(firstPort) + "\n" +
+                       TEST_NAME " 127.0.0.2 check " + std::to_string(boundPort(second)) + "\n";
+  if (file < 0 || write(file, config.data(), config.size()) != (ssize_t)config.size()) {
+    std::printf("FAIL: cannot write the steering file\n");
+    return EXIT_FAILURE;
+  }
+  close(file);
+
+  std::vector<DNSRecord> records(2, DNSRecord{T_A, C_IN, 300, {}});
+  encodeRdata(T_A, {"127.0.0.1"}, records[0].rdata);
+  encodeRdata(T_A, {"127.0.0.2"}, records[1].rdata);
+
+  Steering &steering = Steering::getInstance();
+  check(steering.configure(path), "the steering file loads");
+  steering.start();
+
+  std::set<std::string> both = {"127.0.0.1", "127.0.0.2"};
+  std::set<std::string> rest = {"127.0.0.2"};
+  check(selected(steering, records) == both, "both endpoints are answered while up");
+
+  /* the reload wakes the prober, so the next check runs right away instead of after the interval */
+  close(first);
+  steering.reload();
+  check(eventually([&] { return selected(steering, records) == rest; }), "the endpoint drops out once its listener is gone");
+
+  first = listenOn("127.0.0.1", firstPort);
+  check(first >= 0, "the listener is back on its port");
+  steering.reload();
+  check(eventually([&] { return selected(steering, records) == both; }), "the endpoint returns once its listener is back");
+
+  steering.stop();
+  close(first);
+  close(second);
+  unlink(path);
+  std::printf("%s\n", failures ? "steeringtest FAILED" : "steeringtest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
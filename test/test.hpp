@@ -0,0 +1,198 @@
+#ifndef __TEST_HPP__
+#define __TEST_HPP__
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "dns.hpp"
+#include "rdata.hpp"
+
+#define TEST_TIMEOUT 5 // seconds a step may take
+
+/*
+  Shared by the end to end tests in test/: checks that print ok or FAIL and
+  count the failures, which the test reports at the end and exits with,
+  polling for what servers do on their own threads, and queries to a UDP
+  server over loopback with their replies taken apart.
+*/
+inline int failures = 0;
+
+inline void check(bool ok, const std::string &what) {
+  std::printf("%s: %s\n", ok ? "ok" : "FAIL", what.c_str());
+  if (!ok)
+    failures++;
+}
+
+/* Poll `done` until it holds or the timeout runs out */
+inline bool eventually(const std::function<bool()> &done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(TEST_TIMEOUT);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  return true;
+}
+
+/* A file under /tmp named after `prefix` holding `text`, empty if it cannot be written */
+inline std::string temporaryFile(const std::string &prefix, const std::string &text) {
+  std::string path = "/tmp/" + prefix + "-XXXXXX";
+  int         fd   = mkstemp(path.data());
+  if (fd < 0)
+    return "";
+  bool written = write(fd, text.data(), text.size()) == (ssize_t)text.size();
+  close(fd);
+  if (!written)
+    unlink(path.c_str());
+  return written ? path : "";
+}
+
+/* Remove the zone file at `path` with the journal and snapshot the store keeps next to it */
+inline void removeZone(const std::string &path) {
+  unlink(path.c_str());
+  unlink((path + ".jnl").c_str());
+  unlink((path + ".snap").c_str());
+}
+
+/* One record of a reply, the OPT record included */
+struct TestRecord {
+  std::string          name;
+  uint16_t             type;
+  uint32_t             ttl;
+  std::vector<uint8_t> rdata;
+};
+
+/* A reply taken apart, `rcode` with the upper bits an OPT record carries */
+struct TestReply {
+  uint16_t                flags;
+  uint16_t                rcode;
+  std::vector<TestRecord> answers;
+  std::vector<TestRecord> authority;
+  std::vector<TestRecord> additional;
+};
+
+/* Header and question of a message, the counts of the sections that follow as given */
+inline void beginMessage(
+    PacketWriter &out, uint16_t flags, const std::string &name, uint16_t type, uint16_t nscount = 0, uint16_t arcount = 0
+) {
+  DNSHeader header     = {};
+  header.transactionId = htons(0x7e57);
+  header.flags         = htons(flags);
+  header.qdcount       = htons(1);
+  header.nscount       = htons(nscount);
+  header.arcount       = htons(arcount);
+  out.append(&header, sizeof(header));
+  out.appendName(name);
+  out.appendUint16(type);
+  out.appendUint16(C_IN);
+}
+
+/* OPT record with the DO bit if `dnssec`, followed by `options` in wire form */
+inline void appendOPT(PacketWriter &out, bool dnssec, const std::vector<uint8_t> &options = {}) {
+  out.appendName("");
+  out.appendUint16(T_OPT);
+  out.appendUint16(EDNS_PAYLOAD_SIZE);
+  out.appendUint32(dnssec ? EDNS_DO : 0);
+  out.appendUint16(options.size());
+  out.append(options.data(), options.size());
+}
+
+/* Take the `length` byte reply at `data` apart, false if it is malformed */
+inline bool parseReply(const uint8_t *data, size_t length, TestReply &reply) {
+  if (length < sizeof(DNSHeader))
+    return false;
+
+  const DNSHeader *header = (const DNSHeader *)data;
+  size_t           offset = sizeof(DNSHeader);
+  std::string      name;
+  reply.flags = ntohs(header->flags);
+  reply.rcode = reply.flags & F_RCODE;
+  for (int i = 0; i < ntohs(header->qdcount); ++i) {
+    if (!decodeName(data, length, offset, name) || (offset += 4) > length)
+      return false;
+  }
+
+  std::vector<TestRecord> *sections[] = {&reply.answers, &reply.authority, &reply.additional};
+  uint16_t                 counts[]   = {ntohs(header->ancount), ntohs(header->nscount), ntohs(header->arcount)};
+  for (int s = 0; s < 3; ++s) {
+    sections[s]->clear();
+    for (int i = 0; i < counts[s]; ++i) {
+      TestRecord record;
+      uint16_t   rclass;
+      if (!decodeRecord(data, length, offset, record.name, record.type, rclass, record.ttl, record.rdata))
+        return false;
+      if (record.type == T_OPT)
+        reply.rcode |= (record.ttl >> 24) << 4;
+      sections[s]->push_back(std::move(record));
+    }
+  }
+  return true;
+}
+
+/* Send the `length` byte `query` to the UDP server on loopback `port` and take the reply apart, false without one */
+inline bool exchange(int port, const uint8_t *query, size_t length, TestReply &reply) {
+  struct sockaddr_in server = {};
+  server.sin_family         = AF_INET;
+  server.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+  server.sin_port           = htons(port);
+
+  uint8_t        buffer[EDNS_PAYLOAD_SIZE];
+  int            fd      = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sendto(fd, query, length, 0, (struct sockaddr *)&server, sizeof(server));
+  ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+  close(fd);
+  return received > 0 && parseReply(buffer, received, reply);
+}
+
+/* Query the UDP server on loopback `port` for `name` and `type`, with EDNS and the DO bit if `dnssec` */
+inline bool ask(int port, const std::string &name, uint16_t type, TestReply &reply, bool dnssec = false) {
+  uint8_t      buffer[EDNS_PAYLOAD_SIZE];
+  PacketWriter out = {buffer, sizeof(buffer), 0, false};
+  beginMessage(out, OPCODE_QUERY << OPCODE_SHIFT, name, type, 0, dnssec ? 1 : 0);
+  if (dnssec)
+    appendOPT(out, true);
+  return exchange(port, buffer, out.size, reply);
+}
+
+/* The records of `type` in `section` */
+inline std::vector<TestRecord> ofType(const std::vector<TestRecord> &section, uint16_t type) {
+  std::vector<TestRecord> records;
+  for (const auto &record : section) {
+    if (record.type == type)
+      records.push_back(record);
+  }
+  return records;
+}
+
+/* The A and AAAA addresses of `section` as text, in the order they came */
+inline std::string addresses(const std::vector<TestRecord> &section) {
+  std::string out;
+  for (const auto &record : section) {
+    char text[INET6_ADDRSTRLEN];
+    if ((record.type == T_A && record.rdata.size() == 4 && inet_ntop(AF_INET, record.rdata.data(), text, sizeof(text)))
+        || (record.type == T_AAAA && record.rdata.size() == 16 && inet_ntop(AF_INET6, record.rdata.data(), text, sizeof(text))))
+      out += (out.empty() ? "" : " ") + std::string(text);
+  }
+  return out;
+}
+
+/* The name at the start of `rdata`, as in CNAME, PTR and NSEC records */
+inline std::string rdataName(const std::vector<uint8_t> &rdata) {
+  std::string name;
+  size_t      offset = 0;
+  return decodeName(rdata.data(), rdata.size(), offset, name) ? name : "";
+}
+
+#endif /* __TEST_HPP__ */
@@ -0,0 +1,119 @@
+/*
+  Dynamic update test. RFC 2136 UPDATE messages are sent to the UDP server
+  of a zone loaded from a temporary file: an added record is served and
+  was written to the journal before the reply, the serial went up, a
+  failed prerequisite and a zone we do not serve are refused with their
+  RCODEs and leave the zone alone, and a deleted RRset is gone.
+
+    make test, or ./bin/test/updatetest
+*/
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "handoff.hpp"
+#include "rdata.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+
+#define TEST_ZONE "example.com"
+
+/* One record of a prerequisite or update section, `rdata` empty for the RRset forms of class ANY */
+struct UpdateRecord {
+  std::string          name;
+  uint16_t             type;
+  uint16_t             rclass;
+  uint32_t             ttl;
+  std::vector<uint8_t> rdata;
+};
+
+static std::vector<uint8_t> address(const char *text) {
+  std::vector<uint8_t> rdata;
+  encodeRdata(T_A, {text}, rdata);
+  return rdata;
+}
+
+/* Send an UPDATE of `zone` with `prerequisites` and `updates`, the RCODE of the reply or -1 without one */
+static int update(
+    int port, const std::string &zone, const std::vector<UpdateRecord> &prerequisites, const std::vector<UpdateRecord> &updates
+) {
+  uint8_t      buffer[EDNS_PAYLOAD_SIZE];
+  PacketWriter out = {buffer, sizeof(buffer), 0, false};
+  beginMessage(out, OPCODE_UPDATE << OPCODE_SHIFT, zone, T_SOA, updates.size());
+  ((DNSHeader *)buffer)->ancount = htons(prerequisites.size());
+  for (const auto *section : {&prerequisites, &updates}) {
+    for (const auto &record : *section) {
+      out.appendName(record.name);
+      out.appendUint16(record.type);
+      out.appendUint16(record.rclass);
+      out.appendUint32(record.ttl);
+      out.appendUint16(record.rdata.size());
+      out.append(record.rdata.data(), record.rdata.size());
+    }
+  }
+
+  TestReply reply;
+  return exchange(port, buffer, out.size, reply) ? reply.rcode : -1;
+}
+
+static uint32_t serial() {
+  return DB::getInstance("").snapshot()->serial;
+}
+
+int main() {
+  std::string path = temporaryFile(
+      "updatetest", "$ORIGIN " TEST_ZONE ".\n"
+                    "$TTL 300\n"
+                    "@ IN SOA ns1 host 1 3600 600 86400 300\n"
+                    "@ IN NS ns1\n"
+                    "ns1 IN A 192.0.2.53\n"
+                    "www IN A 192.0.2.1\n"
+  );
+  if (path.empty()) {
+    std::printf("FAIL: cannot write the zone file\n");
+    return EXIT_FAILURE;
+  }
+  DB::getInstance(path);
+
+  UDPServer server(0);
+  server.start();
+  if (!eventually([&server] { return server.getSocket() >= 0; })) {
+    std::printf("FAIL: the UDP server did not start\n");
+    return EXIT_FAILURE;
+  }
+  int port = boundPort(server.getSocket());
+
+  TestReply reply;
+  check(update(port, TEST_ZONE, {}, {{"new." TEST_ZONE, T_A, C_IN, 300, address("192.0.2.10")}}) == RCODE_NOERROR,
+        "adding a record is accepted");
+  check(ask(port, "new." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "192.0.2.10", "the added record is served");
+  check(serial() == 2, "the update raised the serial");
+
+  struct stat journal;
+  check(stat((path + ".jnl").c_str(), &journal) == 0 && journal.st_size > 0, "the update was journaled before the reply");
+
+  /* the name must exist, it does not, so nothing is applied */
+  UpdateRecord missing = {"missing." TEST_ZONE, T_ANY, C_ANY, 0, {}};
+  check(update(port, TEST_ZONE, {missing}, {{"www." TEST_ZONE, T_A, C_IN, 300, address("192.0.2.2")}}) == RCODE_NXDOMAIN,
+        "a failed prerequisite is answered NXDOMAIN");
+  check(ask(port, "www." TEST_ZONE, T_A, reply) && addresses(reply.answers) == "192.0.2.1", "a failed update changes nothing");
+
+  check(update(port, "example.org", {}, {{"www.example.org", T_A, C_IN, 300, address("192.0.2.3")}}) == RCODE_NOTAUTH,
+        "an update of a zone we do not serve is answered NOTAUTH");
+
+  check(update(port, TEST_ZONE, {}, {{"new." TEST_ZONE, T_A, C_ANY, 0, {}}}) == RCODE_NOERROR, "deleting the RRset is accepted");
+  check(ask(port, "new." TEST_ZONE, T_A, reply) && reply.rcode == RCODE_NXDOMAIN, "the deleted name is gone");
+  check(serial() == 3, "the deletion raised the serial again");
+
+  server.stop();
+  removeZone(path);
+  std::printf("%s\n", failures ? "updatetest FAILED" : "updatetest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+/*
+  AF_XDP test. Two network namespaces are joined by a veth pair: the
+  servers run in one with the XDP program on its end of the pair, the
+  client sockets are opened in the other. A UDP query is answered through
+  the AF_XDP socket without reaching the kernel's UDP stack, while a
+  datagram for another port and a query over TCP pass the program and are
+  served by sockets. Needs root to set up the namespaces, skipped otherwise.
+
+    make test, or ./bin/test/xdptest
+*/
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "db.hpp"
+#include "dns.hpp"
+#include "rdata.hpp"
+#include "stream.hpp"
+#include "tcpserver.hpp"
+#include "test.hpp"
+#include "udpserver.hpp"
+#include "xdpserver.hpp"
+
+#define TEST_PORT      5353
+#define TEST_SERVER    "10.99.0.1"
+#define TEST_CLIENT    "10.99.0.2"
+#define TEST_NAMESPACE "xdptest" // prefix of the two namespaces
+
+static bool run(const std::string &command) {
+  return std::system(command.c_str()) == 0;
+}
+
+static void removeNamespaces() {
+  run("ip netns del " TEST_NAMESPACE "-server 2>/dev/null");
+  run("ip netns del " TEST_NAMESPACE "-client 2>/dev/null");
+}
+
+/* Server and client namespaces joined by veth0 and veth1; commands run from here end up in the server one */
+static bool createNamespaces(int &client) {
+  removeNamespaces();
+  if (!run("ip netns add " TEST_NAMESPACE "-server") || !run("ip netns add " TEST_NAMESPACE "-client"))
+    return false;
+
+  int server = open("/var/run/netns/" TEST_NAMESPACE "-server", O_RDONLY | O_CLOEXEC);
+  client     = open("/var/run/netns/" TEST_NAMESPACE "-client", O_RDONLY | O_CLOEXEC);
+  bool moved = server >= 0 && client >= 0 && setns(server, CLONE_NEWNET) == 0;
+  if (server >= 0)
+    close(server);
+  return moved && run("ip link set lo up") && run("ip link add veth0 type veth peer name veth1 netns " TEST_NAMESPACE "-client") &&
+         run("ip addr add " TEST_SERVER "/24 dev veth0") && run("ip link set veth0 up") &&
+         run("ip netns exec " TEST_NAMESPACE "-client ip addr add " TEST_CLIENT "/24 dev veth1") &&
+         run("ip netns exec " TEST_NAMESPACE "-client ip link set veth1 up");
+}
+
+/* Socket of `type` in the namespace `netns`, sockets stay in the namespace they were made in */
+static int socketIn(int netns, int type) {
+  int fd = -1;
+  std::thread([&] {
+    if (setns(netns, CLONE_NEWNET) == 0)
+      fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  }).join();
+
+  struct timeval timeout = {1, 0};
+  if (fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+static struct sockaddr_in serverAddress(int port) {
+  struct sockaddr_in address = {};
+  address.sin_family         = AF_INET;
+  address.sin_port           = htons(port);
+  inet_pton(AF_INET, TEST_SERVER, &address.sin_addr);
+  return address;
+}
+
+/* Datagrams the kernel's UDP stack of this namespace has taken in */
+static long udpDatagrams() {
+  std::ifstream snmp("/proc/thread-self/net/snmp");
+  std::string   line;
+  while (std::getline(snmp, line)) {
+    if (line.rfind("Udp: ", 0) != 0 || line.find("InDatagrams") != std::string::npos)
+      continue;
+    std::istringstream fields(line.substr(5));
+    long               count = -1;
+    fields >> count;
+    return count;
+  }
+  return -1;
+}
+
+static size_t buildQuery(uint8_t *buffer, size_t size, const std::string &name) {
+  PacketWriter out = {buffer, size, 0, false};
+
+  DNSHeader header     = {};
+  header.transactionId = htons(0x0cd9);
+  header.qdcount       = htons(1);
+  out.append(&header, sizeof(header));
+  out.appendName(name);
+  out.appendUint16(T_A);
+  out.appendUint16(C_IN);
+  return out.size;
+}
+
+/* The first A record of an answer, empty if there is none */
+static std::string firstAddress(const uint8_t *buffer, size_t length) {
+  if (length < sizeof(DNSHeader))
+    return "";
+
+  const DNSHeader *reply  = (const DNSHeader *)buffer;
+  size_t           offset = sizeof(DNSHeader);
+  std::string      owner;
+  if (ntohs(reply->qdcount) == 1 && (!decodeName(buffer, length, offset, owner) || (offset += 4) > length))
+    return "";
+  for (int i = 0; i < ntohs(reply->ancount); ++i) {
+    uint16_t             rtype, rclass;
+    uint32_t             ttl;
+    std::vector<uint8_t> rdata;
+    if (!decodeRecord(buffer, length, offset, owner, rtype, rclass, ttl, rdata))
+      return "";
+    char text[INET_ADDRSTRLEN];
+    if (rtype == T_A && rdata.size() == 4)
+      return inet_ntop(AF_INET, rdata.data(), text, sizeof(text));
+  }
+  return "";
+}
+
+static std::string askUDP(int client, const std::string &name) {
+  uint8_t            buffer[EDNS_PAYLOAD_SIZE];
+  size_t             length  = buildQuery(buffer, sizeof(buffer), name);
+  struct sockaddr_in address = serverAddress(TEST_PORT);
+  int                fd      = socketIn(client, SOCK_DGRAM);
+  sendto(fd, buffer, length, 0, (struct sockaddr *)&address, sizeof(address));
+  ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+  close(fd);
+  return received > 0 ? firstAddress(buffer, received) : "";
+}
+
+static std::string askTCP(int client, const std::string &name) {
+  uint8_t            buffer[EDNS_PAYLOAD_SIZE];
+  size_t             length  = buildQuery(buffer, sizeof(buffer), name);
+  struct sockaddr_in address = serverAddress(TEST_PORT);
+  int                fd      = socketIn(client, SOCK_STREAM);
+  std::atomic<bool>  running = true;
+
+  bool asked = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 && writeMessage(fd, buffer, length, 1000) &&
+               readMessage(fd, buffer, sizeof(buffer), length, running, 1000);
+  close(fd);
+  return asked ? firstAddress(buffer, length) : "";
+}
+
+int main() {
+  if (geteuid() != 0) {
+    std::printf("xdptest skipped: needs root\n");
+    return EXIT_SUCCESS;
+  }
+
+  int client = -1;
+  if (!createNamespaces(client)) {
+    removeNamespaces();
+    std::printf("xdptest skipped: cannot create network namespaces\n");
+    return EXIT_SUCCESS;
+  }
+
+  char path[] = "/tmp/xdptest-XXXXXX";
+  int  file   = mkstemp(path);
+  if (file < 0) {
+    removeNamespaces();
+    std::printf("FAIL: cannot write the zone file\n");
+    return EXIT_FAILURE;
+  }
+  dprintf(file, "www.example.com 300 IN A 192.0.2.1\n");
+  close(file);
+  DB::getInstance(path);
+
+  UDPServer server(TEST_PORT);
+  TCPServer tcpServer(TEST_PORT);
+  XDPServer xdpServer(TEST_PORT);
+  check(xdpServer.configure("veth0"), "veth0 is found");
+  server.start();
+  tcpServer.start();
+  xdpServer.start();
+
+  /* until the program is attached the UDP socket answers, which the kernel counts */
+  long before = -1;
+  check(eventually([&] {
+          before = udpDatagrams();
+          return askUDP(client, "www.example.com") == "192.0.2.1" && udpDatagrams() == before;
+        }),
+        "a UDP query is answered without reaching the kernel's UDP stack");
+
+  /* a datagram for another port is left to the kernel */
+  struct sockaddr_in other = serverAddress(TEST_PORT + 1);
+  int                sink  = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  int                probe = socketIn(client, SOCK_DGRAM);
+  struct timeval     wait  = {1, 0};
+  char               data[16];
+  setsockopt(sink, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+  bind(sink, (struct sockaddr *)&other, sizeof(other));
+  sendto(probe, "not dns", 7, 0, (struct sockaddr *)&other, sizeof(other));
+  check(recv(sink, data, sizeof(data), 0) == 7 && std::memcmp(data, "not dns", 7) == 0, "a datagram for another port reaches its socket");
+  check(udpDatagrams() > before, "that datagram went through the kernel's UDP stack");
+  close(sink);
+  close(probe);
+
+  check(askTCP(client, "www.example.com") == "192.0.2.1", "the TCP query is answered by the TCP server");
+
+  xdpServer.stop();
+  tcpServer.stop();
+  server.stop();
+  close(client);
+  removeNamespaces();
+  removeZone(path);
+  std::printf("%s\n", failures ? "xdptest FAILED" : "xdptest passed");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}